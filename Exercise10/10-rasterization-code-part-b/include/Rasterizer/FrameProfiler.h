@@ -0,0 +1,221 @@
+#ifndef RASTERIZER_FRAMEPROFILER_H
+#define RASTERIZER_FRAMEPROFILER_H
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <Rasterizer/SimpleRasterizer.h>
+
+namespace Rasterizer
+{
+  /**
+   * Collects the time spent on each stage of the frames of a render loop. The times of all
+   * frames are kept for a CSV file, and percentiles are computed over the most recent ones,
+   * which can also be drawn into the image as an overlay. The stages of a frame may be
+   * recorded by different threads, like the render thread and the one presenting the frames.
+   */
+  class FrameProfiler
+  {
+  public:
+    /**
+     * The stages of a frame
+     */
+    enum Stage
+    {
+      /**
+       * Updating the lights and selecting the levels of detail, see
+       * SimpleRasterizer::StageTimes
+       */
+      Stage_Scene,
+
+      /**
+       * Rendering the shadow maps
+       */
+      Stage_Shadows,
+
+      /**
+       * Transforming and lighting the vertices
+       */
+      Stage_Vertex,
+
+      /**
+       * Assembling, clipping, culling and binning the triangles
+       */
+      Stage_Setup,
+
+      /**
+       * Sorting the triangles by depth for the painter's algorithm
+       */
+      Stage_Sort,
+
+      /**
+       * Drawing the tiles
+       */
+      Stage_Raster,
+
+      /**
+       * Presenting the frame in a window or writing it to a stream
+       */
+      Stage_Present,
+
+      /**
+       * The time from the start of the frame to the start of the next one
+       */
+      Stage_Frame,
+
+      /**
+       * The number of stages
+       */
+      StageCount
+    };
+
+    /**
+     * The number of recent frames the percentiles are computed over by default
+     */
+    static const int DefaultWindowSize = 256;
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * The times of the stages of a frame in milliseconds, negative if they were not recorded
+     */
+    struct FrameTimes
+    {
+      double times[StageCount];
+    };
+
+    /**
+     * The times of all frames, by frame number
+     */
+    std::vector<FrameTimes> frames;
+
+    /**
+     * The most recent times of each stage, a ring of windowSize entries
+     */
+    std::vector<double> recentTimes[StageCount];
+
+    /**
+     * The number of times recorded for each stage, which selects the next entry of its ring
+     */
+    size_t recordedTimes[StageCount];
+
+    /**
+     * The number of recent frames the percentiles are computed over
+     */
+    int windowSize;
+
+    /**
+     * Whether a frame was begun, and its number and start
+     */
+    bool frameBegun;
+    unsigned int currentFrame;
+    Clock::time_point frameStart;
+
+    /**
+     * Guards all of the above
+     */
+    mutable std::mutex timesMutex;
+
+    /**
+     * Computes a percentile of the recent times of a stage. timesMutex must be locked.
+     */
+    double ComputePercentile(Stage stage, double percentile) const;
+
+    /**
+     * Records the time of a stage. timesMutex must be locked.
+     */
+    void RecordLocked(unsigned int frame, Stage stage, double milliseconds);
+
+    FrameProfiler(const FrameProfiler &);
+    FrameProfiler &operator=(const FrameProfiler &);
+
+  public:
+    /**
+     * Constructs a new FrameProfiler object without any frames.
+     */
+    FrameProfiler();
+
+    /**
+     * Marks the start of a frame, which ends the frame begun before and records its
+     * Stage_Frame time.
+     *
+     * @param frame The number of the frame
+     */
+    void BeginFrame(unsigned int frame);
+
+    /**
+     * Forgets all frames.
+     */
+    void Clear();
+
+    /**
+     * Draws the 50th and 99th percentiles of the recent times of all stages into the top
+     * left corner of an image, as numbers in milliseconds and as bars relative to 1/60
+     * second. The overlay is opaque, so it can be drawn into every frame of an image that is
+     * rendered into again.
+     *
+     * @param image The image
+     */
+    void DrawOverlay(Raytracer::Image &image) const;
+
+    /**
+     * @return The number of frames with at least one recorded stage, counting up to the
+     *   highest frame number
+     */
+    size_t GetFrameCount() const;
+
+    /**
+     * Computes a percentile of the recent times of a stage.
+     *
+     * @param stage The stage
+     * @param percentile The percentile, from 0 to 100
+     * @return The smallest recent time that is at least as long as the given percentage of
+     *   the recent times, in milliseconds, or 0 if none was recorded
+     */
+    double GetPercentile(Stage stage, double percentile) const;
+
+    /**
+     * @param stage The stage
+     * @return The name of the stage in capitals
+     */
+    static const char *GetStageName(Stage stage);
+
+    /**
+     * Records the time of a stage of a frame.
+     *
+     * @param frame The number of the frame
+     * @param stage The stage
+     * @param milliseconds The time
+     */
+    void Record(unsigned int frame, Stage stage, double milliseconds);
+
+    /**
+     * Records the times of the stages of the rasterizer for a frame.
+     *
+     * @param frame The number of the frame
+     * @param times The times, from SimpleRasterizer::GetStageTimes()
+     */
+    void Record(unsigned int frame, const SimpleRasterizer::StageTimes &times);
+
+    /**
+     * Writes the times of all frames to a CSV file, one line per frame with a column per
+     * stage in milliseconds. Stages that were not recorded are left empty.
+     *
+     * @param fileName The file name
+     * @return true if the file was written, false otherwise
+     */
+    bool SaveCSV(const char *fileName) const;
+
+    /**
+     * Sets the number of recent frames the percentiles are computed over. This forgets the
+     * recent times, but not the ones kept for the CSV file.
+     *
+     * @param frames The number of frames, at least 1
+     */
+    void SetWindowSize(int frames);
+  };
+}
+
+#endif // RASTERIZER_FRAMEPROFILER_H
@@ -1,7 +1,11 @@
 #ifndef RASTERIZER_SIMPLERASTERIZER_H
 #define RASTERIZER_SIMPLERASTERIZER_H
 
+#include <atomic>
+#include <unordered_map>
+
 #include <Raytracer/Raytracer.h>
+#include <Raytracer/Internal/Simd.h>
 
 namespace Rasterizer
 {
@@ -10,7 +14,573 @@ namespace Rasterizer
    */
   class SimpleRasterizer
   {
+  public:
+    /**
+     * The ways the color of a pixel can be computed
+     */
+    enum Shading
+    {
+      /**
+       * Lights the vertices and interpolates their colors across the triangles
+       */
+      Shading_Gouraud,
+
+      /**
+       * Interpolates the normals and positions of the vertices and lights every pixel
+       */
+      Shading_Phong,
+
+      /**
+       * Draws the diffuse colors, normals and positions of the visible surfaces into a
+       * G-buffer first and lights every visible pixel afterwards, only with the lights that
+       * reach its tile. Light contributions below the light threshold are dropped.
+       */
+      Shading_Deferred
+    };
+
+    /**
+     * The ways the visible surface of each pixel is determined
+     */
+    enum Visibility
+    {
+      /**
+       * Tests every fragment against the z buffer
+       */
+      Visibility_DepthBuffer,
+
+      /**
+       * Sorts the triangles by depth every frame and draws the opaque ones from back to front
+       * without testing the z buffer, so that nearer triangles paint over farther ones. The
+       * triangles are sorted by the mean depth of their vertices, so intersecting triangles
+       * and triangles of very different sizes may be drawn in the wrong order.
+       */
+      Visibility_Painter,
+
+      /**
+       * Draws the depths of the opaque triangles of a tile into the z buffer first, without
+       * computing any varyings, and shades only the first fragment at the nearest depth of
+       * each pixel afterwards, so that every covered pixel is shaded once and keeps the same
+       * triangle as with Visibility_DepthBuffer. Multisampled frames are drawn like with
+       * Visibility_DepthBuffer.
+       */
+      Visibility_DepthPrepass
+    };
+
+    /**
+     * Counts the work done while rendering a frame
+     */
+    struct Statistics
+    {
+      /**
+       * The number of meshes that were skipped because their bounding box lies outside the
+       * view frustum
+       */
+      size_t culledMeshes;
+
+      /**
+       * The number of triangles that were skipped because they lie outside the view frustum
+       */
+      size_t culledOutsideTriangles;
+
+      /**
+       * The number of triangles that were clipped against the near or far plane or the guard
+       * band
+       */
+      size_t clippedTriangles;
+
+      /**
+       * The number of triangles that were skipped because they face away from the camera
+       */
+      size_t culledBackfaces;
+
+      /**
+       * The number of triangles that were skipped because their area is zero
+       */
+      size_t culledZeroArea;
+
+      /**
+       * The number of triangles that were skipped because they cover no pixel center, or
+       * no sample with multisampling
+       */
+      size_t culledSmallTriangles;
+
+      /**
+       * The number of triangles that were set up for rasterization
+       */
+      size_t triangles;
+
+      /**
+       * The number of pixel blocks that were not rejected as a whole
+       */
+      size_t blocks;
+
+      /**
+       * The number of pixels covered by triangles
+       */
+      size_t fragments;
+
+      /**
+       * The number of covered pixels that passed the depth test
+       */
+      size_t fragmentsWritten;
+
+      /**
+       * The number of covered pixels that were known to pass the depth test without reading
+       * the z buffer
+       */
+      size_t fragmentsAccepted;
+
+      /**
+       * The number of covered pixels whose depth was written by the depth pre-pass
+       */
+      size_t prepassFragments;
+
+      /**
+       * The number of pixels covered by opaque triangles at the end of the frame, with
+       * multisampling only those covered at all samples. Dividing fragmentsWritten by it
+       * yields the number of times each of them was shaded. This is only counted if enabled
+       * with SetOverdrawStatistics().
+       */
+      size_t coveredPixels;
+
+      /**
+       * The number of times a triangle was skipped in a tile because it lies behind
+       * everything drawn there
+       */
+      size_t culledTriangles;
+
+      /**
+       * The number of pixel blocks that were skipped because the triangle lies behind
+       * everything drawn there
+       */
+      size_t culledBlocks;
+
+      /**
+       * The number of pixels within the bounding boxes of the skipped triangles and blocks,
+       * which were never tested against the triangle
+       */
+      size_t culledPixels;
+
+      /**
+       * The number of pixels lit by deferred shading
+       */
+      size_t shadedPixels;
+
+      /**
+       * The number of lights in the light lists of all tiles for deferred shading
+       */
+      size_t tileLights;
+
+      /**
+       * The number of fragments of translucent triangles stored for blending
+       */
+      size_t translucentFragments;
+
+      /**
+       * The number of fragments of translucent triangles that were dropped because the
+       * fragment arena was full or the pixel had MaxFragmentLayers nearer layers
+       */
+      size_t droppedFragments;
+
+      /**
+       * The number of pixels whose samples were stored separately with multisampling,
+       * because triangles covered only some of them
+       */
+      size_t splitPixels;
+
+      /**
+       * The number of cube shadow maps rendered, the others were kept from earlier frames
+       */
+      size_t renderedShadowMaps;
+
+      /**
+       * The number of triangles sorted by depth for the painter's algorithm
+       */
+      size_t sortedTriangles;
+
+      /**
+       * The number of sorted triangles that went through the radix sort, because the order
+       * of the previous frame was not close enough to sorted
+       */
+      size_t radixSortedTriangles;
+    };
+
+    /**
+     * The time spent on each stage of rendering a frame, in milliseconds
+     */
+    struct StageTimes
+    {
+      /**
+       * Updating the lights and selecting the levels of detail of the meshes
+       */
+      double sceneTime;
+
+      /**
+       * Rendering the shadow maps that are out of date
+       */
+      double shadowTime;
+
+      /**
+       * Transforming and lighting the vertices of the visible meshes
+       */
+      double vertexTime;
+
+      /**
+       * Assembling, clipping and culling the triangles and sorting them into the tiles
+       */
+      double setupTime;
+
+      /**
+       * Sorting the triangles by depth for the painter's algorithm
+       */
+      double sortTime;
+
+      /**
+       * Drawing the tiles, including resolving the samples, deferred shading and blending
+       * the translucent layers
+       */
+      double rasterTime;
+    };
+
+    /**
+     * The width and height of the pixel blocks that are accepted or rejected as a whole
+     */
+    static const int BlockSize = 8;
+
+    /**
+     * The width and height of the screen tiles the triangles are sorted into. Each tile is
+     * drawn by a single thread.
+     */
+    static const int TileSize = 64;
+
+    /**
+     * The number of vertices or triangles each thread processes at a time in the vertex stage
+     */
+    static const int VertexBatchSize = 4096;
+
+    /**
+     * The maximum number of values per vertex that are interpolated across the triangles
+     */
+    static const int MaxVaryings = 16;
+
+    /**
+     * The maximum number of translucent layers blended per pixel. Farther layers are
+     * dropped.
+     */
+    static const int MaxFragmentLayers = 16;
+
+    /**
+     * The number of fragments a tile takes from the fragment arena at a time
+     */
+    static const int FragmentChunkSize = 1024;
+
+    /**
+     * The largest number of samples per pixel
+     */
+    static const int MaxSamples = 8;
+
+    /**
+     * The largest width and height of the faces of the shadow maps
+     */
+    static const int MaxShadowMapSize = 4096;
+
   private:
+    /**
+     * A triangle that has been transformed to screen space, given by the indices of its
+     * vertices in the post-transform buffer
+     */
+    struct ScreenTriangle
+    {
+      unsigned int vertex[3];
+
+      /**
+       * The opacity of the triangle. Triangles with an opacity below 1 are blended in depth
+       * order with the fragment lists.
+       */
+      float opacity;
+
+      /**
+       * The texture that modulates the color of the triangle, or NULL
+       */
+      const Raytracer::Scenes::Texture *texture;
+    };
+
+    /**
+     * Marks the end of a fragment list
+     */
+    static const unsigned int NoFragment = 0xffffffffu;
+
+    /**
+     * Marks pixels whose samples all have the color stored in the image
+     */
+    static const unsigned int NoSamples = 0xffffffffu;
+
+    /**
+     * A fragment of a translucent triangle in the list of its pixel
+     */
+    struct Fragment
+    {
+      glm::vec3 color;
+      float depth;
+      float opacity;
+
+      /**
+       * The index of the next fragment of the pixel in the fragment arena, or NoFragment
+       */
+      unsigned int next;
+    };
+
+    /**
+     * The depth range of a block of pixels
+     */
+    struct HiZBlock
+    {
+      /**
+       * A lower bound of the z buffer values in the block
+       */
+      float minZ;
+
+      /**
+       * An upper bound of the z buffer values in the block
+       */
+      float maxZ;
+
+      /**
+       * Whether pixels have been drawn since maxZ was determined, so that the z buffer
+       * values may be lower now
+       */
+      bool stale;
+    };
+
+#ifdef RAYTRACER_SSE2
+    /**
+     * The values of an edge function at four neighboring pixels
+     */
+    typedef __m128i EdgeQuad;
+#else
+    /**
+     * The value of an edge function at the first of four neighboring pixels
+     */
+    typedef int EdgeQuad;
+#endif
+
+    /**
+     * The values of a multisampled triangle within a block that DrawSampleQuad() needs,
+     * see DrawTriangle()
+     */
+    struct SampleBlock
+    {
+      /**
+       * The texture of the triangle, or NULL
+       */
+      const Raytracer::Scenes::Texture *texture;
+
+      /**
+       * Whether the pixels are lit, instead of taking the interpolated color
+       */
+      bool lightPixels;
+
+      /**
+       * Whether the samples have to be tested against the z buffer
+       */
+      bool depthTest;
+
+      /**
+       * Whether no edge crosses the block, so that every sample inside it is covered
+       */
+      bool inner;
+
+      /**
+       * The number of planes, 1 / w and the varyings divided by w
+       */
+      int planeCount;
+
+      /**
+       * The depth at the center of the first pixel of the block and its changes from one
+       * pixel to the next
+       */
+      float blockZ, dzdx, dzdy;
+
+      /**
+       * The planes at the center of the first pixel of the block and their changes from one
+       * pixel to the next
+       */
+      const float *blockPlanes, *planeDx, *planeDy;
+
+      /**
+       * The offsets of the depth from the pixel center to each sample
+       */
+      const float *sampleZs;
+
+      /**
+       * The offsets of the edge functions from the pixel centers to each sample, and the
+       * largest of them for each edge
+       */
+      EdgeQuad sampleEdges[3][MaxSamples], reachEdges[3];
+
+#ifndef RAYTRACER_SSE2
+      /**
+       * The changes of the edge functions from one pixel to the next
+       */
+      int edgeStepsX[3];
+#endif
+    };
+
+    /**
+     * A rectangle of the image that is drawn by a single thread
+     */
+    struct Tile
+    {
+      /**
+       * The first and last pixel column and row of the tile
+       */
+      int minX, minY, maxX, maxY;
+
+      /**
+       * A lower bound of the z buffer values in the tile
+       */
+      float minZ;
+
+      /**
+       * An upper bound of the z buffer values in the tile
+       */
+      float maxZ;
+
+      /**
+       * Whether the maxZ of a block within the tile has decreased since maxZ was determined
+       */
+      bool staleMaxZ;
+
+      /**
+       * Whether the z buffer and the hierarchical z buffer of the tile hold their clear
+       * values, i.e. no depth has been drawn into the tile since it was last cleared. The
+       * pixels are tracked per image, see clearedPixels.
+       */
+      bool cleared;
+
+      /**
+       * The work done for this tile in the current frame
+       */
+      Statistics statistics;
+
+      /**
+       * The indices of the lights reaching the visible pixels of the tile, for deferred
+       * shading
+       */
+      std::vector<unsigned int> lights;
+
+      /**
+       * The lights of the tile that reach the block being shaded
+       */
+      std::vector<unsigned int> blockLights;
+
+      /**
+       * Whether fragments of translucent triangles have been stored for the tile in the
+       * current frame, i.e. the fragment lists of its pixels are in use
+       */
+      bool translucent;
+
+      /**
+       * The range of the fragment arena the tile stores its next fragments in
+       */
+      size_t fragmentNext, fragmentEnd;
+
+      /**
+       * The colors of the samples of the split pixels of the tile, samples per pixel
+       */
+      std::vector<glm::vec3> sampleColors;
+
+      /**
+       * The index of each split pixel, in the order their samples are stored in
+       * sampleColors. A pixel may appear more than once if it was covered completely in
+       * between, and only its last entry is used.
+       */
+      std::vector<unsigned int> splitPixels;
+    };
+
+    /**
+     * A light source as used by the vertex lighting
+     */
+    struct VertexLight
+    {
+      glm::vec3 position;
+      glm::vec3 intensity;
+    };
+
+    /**
+     * The part of the screen a light reaches with deferred shading
+     */
+    struct LightBounds
+    {
+      /**
+       * The first and last pixel column and row the light may reach. The rectangle is empty
+       * if the light reaches no pixel.
+       */
+      int minX, minY, maxX, maxY;
+
+      /**
+       * The range of screen space depths the light may reach
+       */
+      float minZ, maxZ;
+
+      /**
+       * The square of the radius of the sphere around the light that it reaches
+       */
+      float squaredRadius;
+
+      /**
+       * The value subtracted from the attenuation of the light, which makes its
+       * contribution fall to zero at the border of its bounds
+       */
+      float cutoff;
+    };
+
+    /**
+     * A mesh casting shadows into a shadow map, with everything that determines how it
+     * looks from the light
+     */
+    struct ShadowCaster
+    {
+      const Raytracer::Objects::Mesh *mesh;
+      glm::mat4 transform;
+      int level;
+      unsigned int generation;
+    };
+
+    /**
+     * The cube shadow map of a light. Face 2 * axis looks along the positive x, y or z
+     * axis, face 2 * axis + 1 along the negative one, and both see the next axis as x and
+     * the axis after it as y.
+     */
+    struct ShadowMap
+    {
+      /**
+       * The reciprocal distance along the axis of the face to the nearest occluder seen
+       * through each texel, or 0 where there is none, face by face and row by row
+       */
+      std::vector<float> depths;
+
+      /**
+       * The position of the light the map was rendered from
+       */
+      glm::vec3 position;
+
+      /**
+       * The square of the radius within which the casters were gathered
+       */
+      float squaredRadius;
+
+      /**
+       * The distance from the light to the far plane of the faces
+       */
+      float farClip;
+
+      /**
+       * The casters the map was rendered with
+       */
+      std::vector<ShadowCaster> casters;
+    };
+
     /**
      * The image to render into
      */
@@ -22,19 +592,308 @@ namespace Rasterizer
     glm::vec3 ambientLight;
 
     /**
-     * A list of all lights in the scene
+     * The lights of the scene
+     */
+    std::vector<VertexLight> lights;
+
+    /**
+     * The bounds of each light in the frame being rendered with deferred shading
+     */
+    std::vector<LightBounds> lightBounds;
+
+    /**
+     * The light contribution below which deferred shading drops a light
+     */
+    float lightThreshold;
+
+    /**
+     * The scene the light list was built for
+     */
+    const Raytracer::Scenes::Scene *lightScene;
+
+    /**
+     * The light registry generation of lightScene the light list was built for
+     */
+    unsigned int lightGeneration;
+
+    /**
+     * The cube shadow maps of the first lights, which are kept across frames
+     */
+    std::vector<ShadowMap> shadowMaps;
+
+    /**
+     * The width and height of each face of the shadow maps, or 0 without shadows
+     */
+    int shadowMapSize;
+
+    /**
+     * The maximum number of lights that cast shadows
+     */
+    int shadowLightLimit;
+
+    /**
+     * The casters gathered for the shadow map being checked
+     */
+    std::vector<ShadowCaster> shadowCasters;
+
+    /**
+     * The level of detail selected for each mesh in the previous frame
+     */
+    std::unordered_map<const Raytracer::Objects::Mesh *, int> lodLevels;
+
+    /**
+     * The scene the levels of detail were selected for
+     */
+    const Raytracer::Scenes::Scene *lodScene;
+
+    /**
+     * The mesh registry generation of lodScene the levels of detail were selected for
+     */
+    unsigned int lodGeneration;
+
+    /**
+     * The number of triangles per covered pixel used to select the levels of detail
+     */
+    float lodTriangleDensity;
+
+    /**
+     * The post-transform buffer: the screen space positions of all vertices of the frame,
+     * with the reciprocal of the clip space w as fourth component
+     */
+    std::vector<glm::vec4> transformedPositions;
+
+    /**
+     * The values interpolated across the triangles, varyingCount per vertex in the
+     * post-transform buffer
+     */
+    std::vector<float> varyings;
+
+    /**
+     * The number of varyings per vertex. Gouraud shading interpolates the lit color, Phong
+     * shading the diffuse color, the normal and the position in world space. Textured frames
+     * add the texture coordinates.
+     */
+    int varyingCount;
+
+    /**
+     * The index of the u texture coordinate among the varyings, followed by v, or -1 if no
+     * mesh of the frame is textured. Meshes without a texture pass on zeros.
+     */
+    int textureVarying;
+
+    /**
+     * The way the pixel colors are computed
+     */
+    Shading shading;
+
+    /**
+     * The clip space positions of the vertices of the mesh being rendered
+     */
+    std::vector<glm::vec4> clipPositions;
+
+    /**
+     * The planes of the view frustum and the guard band each vertex of the mesh being
+     * rendered lies outside of, as a combination of the Clip* flags
+     */
+    std::vector<unsigned short> clipCodes;
+
+    /**
+     * The number of triangles assembled from each batch of triangles of the mesh being
+     * rendered
+     */
+    std::vector<size_t> assembledTriangles;
+
+    /**
+     * The number of vertices created by clipping the triangles of each batch
+     */
+    std::vector<size_t> assembledVertices;
+
+    /**
+     * The vertices of the triangles of the non-indexed mesh being rendered, three per
+     * triangle
+     */
+    std::vector<glm::vec3> vertexPositions, vertexNormals, vertexColors;
+
+    /**
+     * The triangles of the frame being rendered, in the order they were submitted
+     */
+    std::vector<ScreenTriangle> screenTriangles;
+
+    /**
+     * The tiles of the image, row by row
+     */
+    std::vector<Tile> tiles;
+
+    /**
+     * The number of tiles per row
+     */
+    int tileColumns;
+
+    /**
+     * The indices of the triangles overlapping each tile. The triangles are binned in
+     * consecutive ranges of binRangeSize triangles, and each range has its own bin for every
+     * tile, starting at index range * tiles.size().
+     */
+    std::vector<std::vector<unsigned int> > bins;
+
+    /**
+     * The number of triangles binned together
+     */
+    int binRangeSize;
+
+    /**
+     * The work done for each range or batch of triangles processed by a single thread
+     */
+    std::vector<Statistics> rangeStatistics;
+
+    /**
+     * Whether triangles facing away from the camera are skipped
+     */
+    bool backfaceCulling;
+
+    /**
+     * Whether the covered pixels are counted after drawing each tile
+     */
+    bool overdrawStatistics;
+
+    /**
+     * How the visible surface of each pixel is determined
+     */
+    Visibility visibility;
+
+    /**
+     * The depth keys of the triangles of the frame for the painter's algorithm, by triangle
+     */
+    std::vector<unsigned int> sortKeys;
+
+    /**
+     * The triangles in back to front order, by their index before sorting. They are kept for
+     * the next frame, whose sort starts from this order.
+     */
+    std::vector<unsigned int> sortOrder;
+
+    /**
+     * The keys and triangle indices being sorted, and the buffers the radix sort moves them
+     * into with every pass
+     */
+    std::vector<unsigned int> radixKeys, radixKeyBuffer, radixOrderBuffer;
+
+    /**
+     * The sorted triangles, swapped with screenTriangles
+     */
+    std::vector<ScreenTriangle> sortedTriangles;
+
+    /**
+     * The z buffer, one value per pixel in the same order as the image pixels. It is kept
+     * across frames and only cleared tile by tile as the tiles are drawn into.
      */
-    std::vector<const Raytracer::Scenes::Light *> lights;
+    std::vector<float> zBuffer;
 
     /**
-     * A list of all meshes in the scene
+     * Marks the pixels that were shaded after the depth pre-pass, one value per pixel like
+     * zBuffer. Only the first of several fragments at the nearest depth is shaded, as with
+     * Visibility_DepthBuffer. It is cleared tile by tile before the shading pass.
      */
-    std::vector<const Raytracer::Objects::Mesh *> meshes;
+    std::vector<unsigned char> shadedPixels;
 
     /**
-     * The z buffer
+     * The G-buffer for deferred shading: the interpolated normal and position in world space
+     * of every pixel. The diffuse colors are stored in the image until the pixels are lit.
      */
-    float *zBuffer;
+    std::vector<glm::vec3> gBufferNormals, gBufferPositions;
+
+    /**
+     * The index of the first fragment in the list of every pixel, or NoFragment. Only the
+     * entries of translucent tiles are valid.
+     */
+    std::vector<unsigned int> fragmentHeads;
+
+    /**
+     * The fragment arena. The tiles take chunks of FragmentChunkSize fragments from it, and
+     * further fragments are dropped when it is exhausted.
+     */
+    std::vector<Fragment> fragments;
+
+    /**
+     * The number of fragments of the arena handed out to tiles in the current frame
+     */
+    std::atomic<size_t> fragmentCount;
+
+    /**
+     * The size of the fragment arena
+     */
+    size_t fragmentBudget;
+
+    /**
+     * Whether the frame being rendered contains translucent triangles
+     */
+    bool translucent;
+
+    /**
+     * The number of samples per pixel, 1 without multisampling
+     */
+    int samples;
+
+    /**
+     * The positions of the samples relative to the pixel center, in subpixel units
+     */
+    const int (*samplePositions)[2];
+
+    /**
+     * The largest distance of a sample from the pixel center along either axis, in subpixel
+     * units
+     */
+    int sampleExtent;
+
+    /**
+     * The depths of the samples with multisampling. The rows are split into groups of four
+     * pixels, which store the depths of their first sample, then of their second sample and
+     * so on, so that a sample can be tested for four pixels at once. The z buffer holds the
+     * depth of the farthest sample of each pixel then, so that the hierarchical z buffer
+     * stays conservative.
+     */
+    std::vector<float> sampleDepths;
+
+    /**
+     * The index of the samples of each pixel in the sampleColors of its tile, or NoSamples
+     * if all samples of the pixel have the same color, which is stored in the image. Since
+     * every triangle is shaded once per pixel, this holds for all pixels that are covered
+     * completely by their nearest triangle.
+     */
+    std::vector<unsigned int> sampleSlots;
+
+    /**
+     * The hierarchical z buffer, one entry per block of BlockSize x BlockSize pixels, row by
+     * row
+     */
+    std::vector<HiZBlock> hiZ;
+
+    /**
+     * For every image rendered into with the current tile layout, whether the pixels of each
+     * tile hold the background color. Frame loops cycle through several images, which keep
+     * their pixels from one frame they are rendered into to the next.
+     */
+    std::unordered_map<const Raytracer::Image *, std::vector<unsigned char> > clearedPixels;
+
+    /**
+     * The flags of the current image in clearedPixels, one per tile
+     */
+    std::vector<unsigned char> *imageClearedPixels;
+
+    /**
+     * The number of blocks per row
+     */
+    int blockColumns;
+
+    /**
+     * The statistics of the frame being rendered
+     */
+    Statistics statistics;
+
+    /**
+     * The stage times of the frame being rendered
+     */
+    StageTimes stageTimes;
     
     /**
      * The view projection matrix
@@ -43,43 +902,96 @@ namespace Rasterizer
 
 
     /**
-     * Compares two triangles by their mean z values
+     * Sorts the triangles of the frame into the bins of the tiles they overlap.
+     */
+    void BinTriangles();
+
+    /**
+     * Draws a single triangle. The triangle is rasterized with edge functions in fixed point
+     * coordinates, in blocks of BlockSize x BlockSize pixels. Pixels are covered if their
+     * center lies inside the triangle, or on a top or left edge, so triangles sharing an edge
+     * never leave gaps or draw a pixel twice. With multisampling, the same holds for the
+     * samples of opaque triangles.
      *
-     * @param t1 The first triangle
-     * @param t2 The second triangle
-     * @return true if the mean z value of t1 is greater than that of z2, false otherwise
+     * For the depth pre-pass, depthOnly only draws the depth of an opaque triangle into the z
+     * buffer, without multisampling. The pixels are covered and their depths interpolated
+     * exactly like when shading them, so that the shading pass finds equal depths.
+     *
+     * @param t The triangle
+     * @param tile The tile to draw the triangle into. Pixels outside the tile are left
+     *   untouched.
      */
-    static bool CompareTriangle(const Raytracer::Objects::Triangle &t1,
-                                const Raytracer::Objects::Triangle &t2);
+    template <bool depthOnly>
+    void DrawTriangle(const ScreenTriangle &t, Tile &tile);
 
     /**
-     * Fills a horizontal span of pixels.
+     * Draws four neighboring pixels of a multisampled triangle for DrawTriangle(). The samples
+     * are tested for coverage and depth, and each pixel that any of them passes is shaded
+     * once. Pixels covered at only some of their samples keep separate sample colors.
      *
-     * @param x1 The first x coordinate
-     * @param x2 The second x coordinate
-     * @param y The y coordinate
-     * @param z1 The z buffer value at x1
-     * @param z2 The z buffer value at x2
-     * @param color1 The color at x1
-     * @param color2 The color at x2
-     * @remarks DrawSpan sets the pixels between (x1, y) and (x2, y), including the pixel on
-     *   the left side (x1 or x2, whichever is less) and excluding the pixel on the right
-     *   side (x2 or x1, whichever is greater).
+     * @param block The values of the triangle within the block
+     * @param edges The edge functions at the first pixel, with the steps of partial edges
+     * @param x The first pixel column, a multiple of four
+     * @param y The pixel row
+     * @param column The first pixel column relative to the block
+     * @param row The pixel row relative to the block
+     * @param lanes The number of pixels within the bounding box, up to 4
+     * @param tile The tile containing the pixels
+     * @return Whether any sample passed the depth test
      */
-    void DrawSpan(int x1, int x2, int y, float z1, float z2, glm::vec3 &color1,
-                  glm::vec3 &color2, glm::vec3 &color3, const Raytracer::Objects::Triangle &t, int indices[]);
+    bool DrawSampleQuad(const SampleBlock &block, const EdgeQuad edges[3], int x, int y,
+                        int column, int row, int lanes, Tile &tile);
 
-    std::vector<glm::vec2> DrawLine(glm::vec3 pos0, glm::vec3 pos1);
+    /**
+     * Retrieves an upper bound of the z buffer values within a block. If pixels of the
+     * block have been drawn since the bound was determined, the z buffer is searched again.
+     *
+     * @param block The index of the block in hiZ
+     * @param x The first pixel column of the block
+     * @param y The first pixel row of the block
+     * @return The upper bound
+     */
+    float GetBlockMaxZ(int block, int x, int y);
 
-    void Barycentric(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c, float &u, float &v, float &w);
+    /**
+     * Retrieves the texture of a mesh, if it has texture coordinates to sample it with.
+     *
+     * @param mesh The mesh
+     * @return The texture or NULL
+     */
+    static const Raytracer::Scenes::Texture *GetMeshTexture(const Raytracer::Objects::Mesh *mesh);
 
-    
     /**
-     * Draws a single triangle.
+     * Computes the level of detail of a texture for a quad from the changes of the texture
+     * coordinates at its first pixel. All pixels of the quad share it.
      *
-     * @param t The triangle that has already been transformed to screen space and lit
+     * @param texture The texture
+     * @param blockPlanes The planes at the first pixel of the block
+     * @param planeDx The changes of the planes from one pixel to the next along x
+     * @param planeDy The changes of the planes from one pixel to the next along y
+     * @param column The column of the quad within the block
+     * @param row The row of the quad within the block
+     * @return The level of detail, see Texture::GetLod()
      */
-    void DrawTriangle(const Raytracer::Objects::Triangle &t);
+    float GetTextureLod(const Raytracer::Scenes::Texture &texture, const float *blockPlanes,
+                        const float *planeDx, const float *planeDy, int column, int row) const;
+
+    /**
+     * Retrieves an upper bound of the z buffer values within a tile.
+     *
+     * @param tile The tile
+     * @return The upper bound
+     */
+    float GetTileMaxZ(Tile &tile);
+
+    /**
+     * Resets the pixels of a tile to the background color and its z buffer and hierarchical
+     * z buffer values to the far plane, unless they are clear already.
+     *
+     * @param tile The tile
+     * @param pixelsCleared The flag of the tile in imageClearedPixels
+     */
+    void ClearTile(Tile &tile, unsigned char &pixelsCleared);
 
     /**
      * Calculates the lighting for a single vertex.
@@ -92,40 +1004,243 @@ namespace Rasterizer
     glm::vec3 LightVertex(glm::vec4 position, glm::vec3 normal, glm::vec3 color);
 
     /**
-     * Sorts a list of triangles according to their mean z values.
+     * Looks up how much of a point a light reaches according to its shadow map. The four
+     * texels around the point are compared and their results interpolated bilinearly.
      *
-     * @param triangles A list of triangles. Upon return, this list will be sorted by ascending
-     *   mean z value.
+     * @param light The index of the light, which must have a shadow map
+     * @param position The position of the point, in world space
+     * @param normal The normalized surface normal at the point, in world space
+     * @return The visibility, from 0 in shadow to 1 fully lit
      */
-    void SortTriangles(std::vector<Raytracer::Objects::Triangle> &triangles);
-    
+    float GetShadow(size_t light, const glm::vec3 &position, const glm::vec3 &normal) const;
+
+#ifdef RAYTRACER_SSE2
+    /**
+     * Looks up the visibility of four points from a light with GetShadow().
+     *
+     * @param light The index of the light, which must have a shadow map
+     * @param position The x, y and z coordinates of the points, in world space
+     * @param normal The x, y and z coordinates of the normalized surface normals
+     * @param lanes The lanes to look up, the others get a visibility of 0
+     * @return The visibilities
+     */
+    __m128 GetShadowQuad(size_t light, const __m128 position[3], const __m128 normal[3],
+                         int lanes) const;
+#endif
 
+#ifdef RAYTRACER_SSE2
     /**
-     * Transforms a triangle from model space into screen space and computes the lighting for
-     * its vertices.
+     * Calculates the lighting for four points at once, giving the same results as
+     * LightVertex().
      *
-     * @param t The triangle. Precondition: t in model space, Postcondition: t in screen space.
+     * @param position The x, y and z coordinates of the points, in world space
+     * @param normal The x, y and z coordinates of the normalized surface normals, in world
+     *   space
+     * @param color The red, green and blue diffuse material colors
+     * @param result Receives the red, green and blue lit colors
+     */
+    void LightQuad(const __m128 position[3], const __m128 normal[3], const __m128 color[3],
+                   __m128 result[3]);
+#endif
+
+    /**
+     * Calculates the lighting for a pixel with deferred shading. Lights only reach the
+     * pixel if it lies within their radius, and their attenuation is reduced by their
+     * cutoff. With SSE2, ShadeTile() lights four pixels at
+     * once, giving the same results.
+     *
+     * @param position The position in world space
+     * @param normal The normalized surface normal in world space
+     * @param color The diffuse material color
+     * @param lightIndices The indices of the lights to consider
+     * @param lightCount The number of lights
+     * @return The lit color
+     */
+    glm::vec3 LightPixel(const glm::vec3 &position, const glm::vec3 &normal,
+                         const glm::vec3 &color, const unsigned int *lightIndices,
+                         size_t lightCount);
+
+    /**
+     * Adds a fragment of a translucent triangle to the list of its pixel.
+     *
+     * @param tile The tile containing the pixel
+     * @param pixel The index of the pixel
+     * @param color The color of the fragment
+     * @param depth The depth of the fragment
+     * @param opacity The opacity of the fragment
+     */
+    void AddFragment(Tile &tile, int pixel, const glm::vec3 &color, float depth,
+                     float opacity);
+
+    /**
+     * Blends the fragment lists of the pixels of a tile over the opaque pixels, from back to
+     * front. Fragments behind the opaque surface are skipped.
+     *
+     * @param tile The tile
+     */
+    void ResolveTile(Tile &tile);
+
+    /**
+     * Averages the samples of the split pixels of a tile into the image, and stores the
+     * depth of their nearest sample in the z buffer, so that deferred shading and the
+     * translucent layers treat them as covered. The pixels are not split afterwards.
+     *
+     * @param tile The tile
+     */
+    void ResolveSamples(Tile &tile);
+
+    /**
+     * Lights the visible pixels of a tile from the G-buffer. The lights are culled against
+     * the range of depths within the tile first.
+     *
+     * @param tile The tile
+     */
+    void ShadeTile(Tile &tile);
+
+    /**
+     * Sorts the triangles of the frame from back to front by the sums of the depths of their
+     * vertices, which are turned into 32 bit keys. Triangles with equal keys keep their
+     * order. If the number of triangles did not change, the order of the previous frame is
+     * checked first, and repaired with an insertion sort if only a few triangles are out of
+     * place. Otherwise, the keys and the triangle indices are sorted with a parallel radix
+     * sort. The sorted triangles replace the ones in screenTriangles.
+     */
+    void SortTriangles();
+
+    /**
+     * Repairs the order of the previous frame with an insertion sort, giving up after a
+     * limited number of moves.
+     *
+     * @return true if sortOrder is sorted now, false if the order was too far from sorted
+     */
+    bool RepairSortOrder();
+
+    /**
+     * Transforms a vertex from model space into screen space and computes its varyings. With
+     * Gouraud shading, this includes the lighting.
+     *
+     * @param position The vertex position in model space
+     * @param normal The vertex normal in model space
+     * @param color The diffuse vertex color
+     * @param modelTransform the model transform matrix for vertices
+     * @param modelTransformNormals the model transform matrix for normals
+     * @param clipPosition Receives the vertex position in clip space
+     * @param screenPosition Receives the vertex position in screen space and the reciprocal
+     *   of its clip space w
+     * @param varyings Receives the varyingCount varyings of the vertex
+     */
+    void TransformAndLightVertex(const glm::vec3 &position, const glm::vec3 &normal,
+                                 const glm::vec3 &color, const glm::mat4 &modelTransform,
+                                 const glm::mat4 &modelTransformNormals,
+                                 glm::vec4 &clipPosition, glm::vec4 &screenPosition,
+                                 float *varyings);
+
+    /**
+     * Transforms an array of vertices from model space into screen space and computes their
+     * varyings. With SSE2, four vertices are processed at once, giving the same results as
+     * TransformAndLightVertex().
+     *
+     * @param positions The vertex positions in model space
+     * @param normals The vertex normals in model space
+     * @param colors The diffuse vertex colors
+     * @param textureCoords The texture coordinates, or NULL to pass on zeros if the frame
+     *   has texture coordinates
+     * @param count The number of vertices
      * @param modelTransform the model transform matrix for vertices
      * @param modelTransformNormals the model transform matrix for normals
+     * @param clipPositions Receives the vertex positions in clip space
+     * @param clipCodes Receives the planes each vertex lies outside of
+     * @param screenPositions Receives the vertex positions in screen space and the
+     *   reciprocals of their clip space w
+     * @param varyings Receives varyingCount varyings per vertex
      */
-    void TransformAndLightTriangle(Raytracer::Objects::Triangle &t, 
+    void TransformAndLightVertices(const glm::vec3 *positions, const glm::vec3 *normals,
+                                   const glm::vec3 *colors, const glm::vec2 *textureCoords,
+                                   int count,
                                    const glm::mat4 &modelTransform,
-                                   const glm::mat4 &modelTransformNormals);
+                                   const glm::mat4 &modelTransformNormals,
+                                   glm::vec4 *clipPositions, unsigned short *clipCodes,
+                                   glm::vec4 *screenPositions, float *varyings);
+
+    /**
+     * Clips a triangle of the mesh being rendered that crosses the near or far plane or the
+     * guard band in clip space. The vertices of the clipped polygon are added to the
+     * post-transform buffer and the polygon is split into a fan of triangles.
+     *
+     * @param index The indices of the vertices within the mesh
+     * @param firstVertex The index of the first vertex of the mesh in the post-transform
+     *   buffer
+     * @param planes The planes to clip against, as a combination of ClipPlane flags
+     * @param newVertex The index in the post-transform buffer to store the vertices of the
+     *   clipped polygon at
+     * @param triangles Receives the triangles, or NULL to only count the vertices
+     * @return The number of vertices of the clipped polygon, which is 0 if nothing is left
+     *   or at least 3
+     */
+    int ClipTriangle(const unsigned int index[3], unsigned int firstVertex, int planes,
+                     size_t newVertex, ScreenTriangle *triangles);
 
     /**
-     * Renders a single mesh.
+     * Transforms and lights a single mesh and adds its triangles to the triangles of the
+     * frame. Indexed meshes have each unique vertex transformed and lit once.
      *
      * @param mesh The mesh
+     * @param level The level of detail to render
      */
-    void RenderMesh(const Raytracer::Objects::Mesh *mesh);
+    void RenderMesh(const Raytracer::Objects::Mesh *mesh, int level);
 
     /**
-     * Scans a scene object and all its children and adds any lights and meshes found to the
-     * appropriate lists.
+     * Draws the binned triangles into the tiles, in parallel. Tiles are cleared right before
+     * the first triangle is drawn into them, and tiles that stay empty are only cleared if
+     * they still hold pixels of an earlier frame. With Visibility_DepthPrepass, the opaque
+     * triangles of each tile are drawn twice, first only their depths.
+     */
+    void RenderTiles();
+
+    /**
+     * Updates the list of lights from the scene's light registry. The list is rebuilt only if
+     * lights were added or removed, otherwise just the light positions are refreshed.
      *
-     * @param object The scene object
+     * @param scene The scene
      */
-    void ScanObject(const Raytracer::Scenes::SceneObject *object);
+    void UpdateLights(const Raytracer::Scenes::Scene &scene);
+
+    /**
+     * Determines the part of the screen each light reaches for deferred shading. A light
+     * reaches the sphere within which its contribution stays above the light threshold.
+     *
+     * @param viewTransform The view matrix
+     * @param projectionTransform The projection matrix
+     * @param nearClip The distance of the near plane
+     */
+    void UpdateLightBounds(const glm::mat4 &viewTransform, const glm::mat4 &projectionTransform,
+                           float nearClip);
+
+    /**
+     * Divides the image into tiles and allocates the z buffers, unless the ones of the
+     * previous frame still fit. Newly created tiles are marked as not cleared.
+     */
+    void UpdateTiles();
+
+    /**
+     * Gathers the casters of every light with a shadow map and renders the maps whose light
+     * moved or whose casters changed since they were rendered. The casters are the opaque
+     * meshes whose bounding spheres reach into the radius of the light, drawn at the level
+     * of detail selected for the frame.
+     *
+     * @param scene The scene
+     */
+    void UpdateShadowMaps(const Raytracer::Scenes::Scene &scene);
+
+    /**
+     * Renders the depths of the casters of a shadow map into one of its faces. The triangles
+     * are clipped like the ones of the frame and rasterized span by span, keeping the
+     * nearest depth of every texel.
+     *
+     * @param map The shadow map
+     * @param face The face
+     */
+    void RenderShadowFace(ShadowMap &map, int face);
 
   public:
     /**
@@ -134,7 +1249,10 @@ namespace Rasterizer
     SimpleRasterizer();
 
     /**
-     * Rasterizes a scene into an image.
+     * Rasterizes a scene into an image. When rendering into an image that was rendered into
+     * before, the parts of the image that stay empty are not cleared again, so the image must
+     * not be changed by others in between. Several images can be used in turn. The global
+     * transformations of the scene are brought up to date first.
      *
      * @param image The image
      * @param scene The scene
@@ -142,7 +1260,108 @@ namespace Rasterizer
      *   invalid
      *
      */
-    bool Render(Raytracer::Image &image, const Raytracer::Scenes::Scene &scene); 
+    bool Render(Raytracer::Image &image, Raytracer::Scenes::Scene &scene); 
+
+    /**
+     * @return The statistics of the last rendered frame
+     */
+    const Statistics &GetStatistics() const;
+
+    /**
+     * @return The time spent on each stage of the last rendered frame
+     */
+    const StageTimes &GetStageTimes() const;
+
+    /**
+     * Sets how the meshes' levels of detail are selected.
+     *
+     * @param trianglesPerPixel The desired number of triangles per pixel covered by a mesh,
+     *   or 0 to always render the full meshes
+     */
+    void SetLodTriangleDensity(float trianglesPerPixel);
+
+    /**
+     * Enables or disables skipping triangles that face away from the camera. Front faces are
+     * the ones whose vertices appear in counterclockwise order. This is disabled by default,
+     * since open meshes show their back faces.
+     *
+     * @param enable true to skip back faces
+     */
+    void SetBackfaceCulling(bool enable);
+
+    /**
+     * Enables or disables counting the pixels covered at the end of the frame, see
+     * Statistics::coveredPixels. This searches the z buffer of every drawn tile, so it is
+     * disabled by default.
+     *
+     * @param enable true to count the covered pixels
+     */
+    void SetOverdrawStatistics(bool enable);
+
+    /**
+     * Selects how the visible surface of each pixel is determined. The default is the z
+     * buffer.
+     *
+     * @param visibility The method
+     */
+    void SetVisibility(Visibility visibility);
+
+    /**
+     * Selects how the pixel colors are computed. The default is Gouraud shading.
+     *
+     * @param shading The shading
+     */
+    void SetShading(Shading shading);
+
+    /**
+     * Sets the light contribution below which deferred shading drops a light. Larger values
+     * let each light reach fewer pixels, which makes rendering many lights faster. The
+     * default is 1/256.
+     *
+     * @param threshold The threshold, or 0 to let all lights reach every pixel
+     */
+    void SetLightThreshold(float threshold);
+
+    /**
+     * Sets the number of fragments of translucent triangles that may be stored per frame.
+     * Meshes whose material has an opacity below 1 are translucent. The arena holding the
+     * fragments is allocated in the first frame with translucent triangles. The default is
+     * 4M fragments, which take 96 MB.
+     *
+     * @param fragments The number of fragments
+     */
+    void SetFragmentBudget(size_t fragments);
+
+    /**
+     * Sets the number of samples per pixel. With multisampling, opaque triangles are tested
+     * for coverage and depth at every sample but shaded once per pixel, and the pixels are
+     * averaged after all triangles of a tile have been drawn. Translucent triangles are
+     * still only drawn at the pixel centers. The default is 1.
+     *
+     * @param samples 1, 4 or 8. Other values are rounded down to one of these.
+     */
+    void SetMultisampling(int samples);
+
+    /**
+     * Enables shadows of point lights. Each of the first lights gets a cube shadow map,
+     * which is rendered from the light once and only rendered again when the light moves or
+     * the meshes within its radius change, see SetLightThreshold(). Shadows are disabled by
+     * default.
+     *
+     * @param mapSize The width and height of each of the six faces of a map in texels, up
+     *   to MaxShadowMapSize, or 0 to disable shadows
+     * @param lightLimit The number of lights that cast shadows. Each map takes
+     *   24 * mapSize * mapSize bytes.
+     */
+    void SetShadows(int mapSize, int lightLimit);
+
+    /**
+     * Determines the memory used by the render targets besides the image: the z buffers, the
+     * samples, the G-buffer, the fragment lists and the shadow maps.
+     *
+     * @return The size in bytes
+     */
+    size_t GetRenderTargetSize() const;
   };
 }
 
@@ -0,0 +1,211 @@
+#ifndef RAYTRACER_COLORENCODER_H
+#define RAYTRACER_COLORENCODER_H
+
+#include <memory>
+
+#include <glm.hpp>
+
+namespace Raytracer
+{
+	class Image;
+
+	/**
+	 * Encodes linear colors with a transfer curve and quantizes them to eight bits per channel
+	 * for image files, windows and video streams. Quantization truncates, so a value is
+	 * encoded as 255 only if it reaches 1.
+	 *
+	 * There are two methods. The table method looks up the result in a table built from the
+	 * exact curve and gives exactly the same results as evaluating the curve with pow(). The
+	 * polynomial method approximates the curve with polynomials in SIMD registers and is
+	 * within one step of the exact result. Ordered dithering spreads the quantization error
+	 * over a 4 x 4 pattern of pixels. It needs the unquantized value, so it always uses the
+	 * polynomial method.
+	 *
+	 * Negative values and NaN are encoded as 0, values above 1 as 255. An encoder can be
+	 * used by several threads at once.
+	 */
+	class ColorEncoder
+	{
+	public:
+		/**
+		 * The transfer curve
+		 */
+		enum Curve
+		{
+			/**
+			 * A power curve, value^(1 / gamma)
+			 */
+			Curve_Gamma,
+
+			/**
+			 * The sRGB curve, which is linear near black and a power curve with a gamma of 2.4
+			 * above. It is close to a gamma of 2.2.
+			 */
+			Curve_sRGB
+		};
+
+		/**
+		 * How the curve is evaluated
+		 */
+		enum Method
+		{
+			Method_Table,
+			Method_Polynomial
+		};
+
+		/**
+		 * The order of the channels in the encoded pixels
+		 */
+		enum Layout
+		{
+			/**
+			 * Three bytes per pixel: red, green, blue
+			 */
+			Layout_RGB,
+
+			/**
+			 * Three bytes per pixel: blue, green, red, as in BMP files
+			 */
+			Layout_BGR,
+
+			/**
+			 * Four bytes per pixel: blue, green, red and 255, as in 32 bit X11 and Windows
+			 * bitmaps
+			 */
+			Layout_BGRA
+		};
+
+		/**
+		 * The smallest gamma of Curve_Gamma
+		 */
+		static const float MinGamma;
+
+	private:
+		struct Table;
+
+		Curve curve;
+		float gamma;
+		Method method;
+		bool dithering;
+
+		/**
+		 * The table of the curve, shared by all encoders with the same curve. It is freed
+		 * with the last of them.
+		 */
+		std::shared_ptr<const Table> table;
+
+		/**
+		 * Finds the table of a curve that is in use by another encoder, or builds it.
+		 */
+		static std::shared_ptr<const Table> GetTable(Curve curve, float gamma);
+
+		/**
+		 * @return The exponent of the power curve
+		 */
+		float GetExponent() const;
+
+	public:
+		/**
+		 * Constructs a new ColorEncoder object for a gamma of 2.2 with the table method and
+		 * without dithering.
+		 */
+		ColorEncoder();
+
+		/**
+		 * Constructs a new ColorEncoder object with the table method and without dithering.
+		 *
+		 * @param curve The transfer curve
+		 * @param gamma The gamma of Curve_Gamma, see SetCurve()
+		 */
+		ColorEncoder(Curve curve, float gamma);
+
+		/**
+		 * Encodes a value without dithering.
+		 *
+		 * @param value The linear value
+		 * @return The encoded value, from 0 to 255
+		 */
+		unsigned char Encode(float value) const;
+
+		/**
+		 * Encodes the pixels of an image, spread across the worker threads by rows.
+		 *
+		 * @param image The image
+		 * @param layout The order of the channels of the encoded pixels
+		 * @param target Receives the encoded pixels of the top row. Padding at the end of the
+		 *   rows is left as it is.
+		 * @param stride The number of bytes from one row to the next. It is negative to
+		 *   store the rows from the bottom up.
+		 */
+		void EncodeImage(const Image &image, Layout layout, unsigned char *target,
+			int stride) const;
+
+		/**
+		 * Encodes a row of pixels.
+		 *
+		 * @param pixels The linear colors
+		 * @param count The number of pixels
+		 * @param y The row in the image, which selects the row of the dithering pattern
+		 * @param layout The order of the channels of the encoded pixels
+		 * @param target Receives the encoded pixels
+		 */
+		void EncodeRow(const glm::vec3 *pixels, int count, int y, Layout layout,
+			unsigned char *target) const;
+
+		/**
+		 * Evaluates the curve with pow() and quantizes the result, the way Image::SaveBMP()
+		 * used to. The table method gives exactly these results.
+		 *
+		 * @param curve The transfer curve
+		 * @param gamma The gamma of Curve_Gamma
+		 * @param value The linear value
+		 * @return The encoded value, from 0 to 255
+		 */
+		static unsigned char EncodeExactly(Curve curve, float gamma, float value);
+
+		/**
+		 * @return The transfer curve
+		 */
+		Curve GetCurve() const;
+
+		/**
+		 * @return The gamma of Curve_Gamma
+		 */
+		float GetGamma() const;
+
+		/**
+		 * @return How the curve is evaluated without dithering
+		 */
+		Method GetMethod() const;
+
+		/**
+		 * @return Whether ordered dithering is used
+		 */
+		bool IsDithering() const;
+
+		/**
+		 * Sets the transfer curve.
+		 *
+		 * @param curve The transfer curve
+		 * @param gamma The gamma of Curve_Gamma, at least MinGamma. Lower values are raised
+		 *   to it. Gammas below 1 need larger tables.
+		 */
+		void SetCurve(Curve curve, float gamma);
+
+		/**
+		 * Sets whether ordered dithering is used by EncodeRow() and EncodeImage().
+		 *
+		 * @param enable true to dither, false to quantize every pixel on its own
+		 */
+		void SetDithering(bool enable);
+
+		/**
+		 * Sets how the curve is evaluated without dithering.
+		 *
+		 * @param method The method
+		 */
+		void SetMethod(Method method);
+	};
+}
+
+#endif // RAYTRACER_COLORENCODER_H
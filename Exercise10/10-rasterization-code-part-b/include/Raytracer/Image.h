@@ -37,6 +37,7 @@ namespace Raytracer
 
     const glm::vec3 & GetPixel(int i, int j) const;
     const glm::vec3 *GetPixels() const;
+    glm::vec3 *GetPixels();
 
     void SaveBMP(const char *fileName, float gamma) const;
     void SetPixel(int x, int y, const glm::vec3 &pixel);
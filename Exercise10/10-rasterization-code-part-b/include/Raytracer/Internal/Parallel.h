@@ -0,0 +1,43 @@
+#ifndef RAYTRACER_INTERNAL_PARALLEL_H
+#define RAYTRACER_INTERNAL_PARALLEL_H
+
+#include <functional>
+
+namespace Raytracer
+{
+	namespace Internal
+	{
+		/**
+		 * Retrieves the number of threads ParallelFor() distributes work across, including the
+		 * calling thread.
+		 *
+		 * @return The number of threads
+		 */
+		int GetThreadCount();
+
+		/**
+		 * Sets the number of threads ParallelFor() distributes work across, including the
+		 * calling thread. This must not be called while a ParallelFor() is running.
+		 *
+		 * @param count The number of threads or 0 to use one thread per hardware core
+		 */
+		void SetThreadCount(int count);
+
+		/**
+		 * Splits the range [begin, end) into chunks of at most grainSize elements and calls
+		 * body(chunkBegin, chunkEnd) for each chunk on the worker threads. The calling thread
+		 * takes part in the work and ParallelFor() returns when all chunks are done.
+		 *
+		 * @param begin The first index of the range
+		 * @param end The index one past the last index of the range
+		 * @param grainSize The maximum number of elements passed to a single call of body
+		 * @param body The function to be called for each chunk
+		 * @remarks Calls from inside a body are executed serially on the calling thread. Calls
+		 *   from several threads at once share the worker threads.
+		 */
+		void ParallelFor(int begin, int end, int grainSize,
+			const std::function<void(int, int)> &body);
+	}
+}
+
+#endif // RAYTRACER_INTERNAL_PARALLEL_H
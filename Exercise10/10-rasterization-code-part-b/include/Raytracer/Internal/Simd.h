@@ -0,0 +1,60 @@
+#ifndef RAYTRACER_INTERNAL_SIMD_H
+#define RAYTRACER_INTERNAL_SIMD_H
+
+/**
+ * RAYTRACER_SSE2 is defined if SSE2 intrinsics may be used. SSE2 is part of every x86-64 CPU,
+ * so this covers all 64 bit builds on x86. Code using the intrinsics must provide a scalar
+ * fallback for other platforms.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACER_SSE2
+#include <emmintrin.h>
+
+#include <glm.hpp>
+
+namespace Raytracer
+{
+	namespace Internal
+	{
+		/**
+		 * Loads twelve consecutive floats as four vectors and returns them as separate x, y and
+		 * z registers.
+		 */
+		inline void LoadVec3x4(const glm::vec3 *in, __m128 &x, __m128 &y, __m128 &z)
+		{
+			const float *f = &in->x;
+			__m128 a = _mm_loadu_ps(f);     // x0 y0 z0 x1
+			__m128 b = _mm_loadu_ps(f + 4); // y1 z1 x2 y2
+			__m128 c = _mm_loadu_ps(f + 8); // z2 x3 y3 z3
+
+			x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 0, 0)),
+				_mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+			y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+				_mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+				_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+		}
+
+		/**
+		 * Stores four vectors given as separate x, y and z registers as twelve consecutive floats.
+		 */
+		inline void StoreVec3x4(glm::vec3 *out, __m128 x, __m128 y, __m128 z)
+		{
+			__m128 xy01 = _mm_unpacklo_ps(x, y);
+			__m128 xy23 = _mm_unpackhi_ps(x, y);
+
+			__m128 z0x1 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+			__m128 y1z1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+			__m128 z2x3 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+			__m128 y3z3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+
+			float *f = &out->x;
+			_mm_storeu_ps(f, _mm_shuffle_ps(xy01, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+			_mm_storeu_ps(f + 4, _mm_shuffle_ps(y1z1, xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+			_mm_storeu_ps(f + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+		}
+	}
+}
+#endif
+
+#endif // RAYTRACER_INTERNAL_SIMD_H
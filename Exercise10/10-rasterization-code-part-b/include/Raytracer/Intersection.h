@@ -35,6 +35,11 @@ namespace Raytracer
 		 */
 		Scenes::Material *material;
 
+		/**
+		 * The color the diffuse material color is modulated with, e.g. a vertex color
+		 */
+		glm::vec3 color;
+
 		Intersection Transform(glm::mat4x4 transformation) const;
 	};
 }
@@ -1,30 +1,406 @@
 #ifndef RAYTRACER_OBJECTS_MESH_H
 #define RAYTRACER_OBJECTS_MESH_H
 
+#include <stddef.h>
+
 #include <vector>
 
 #include <Raytracer/Objects/Triangle.h>
-#include <Raytracer/Scenes/SceneObject.h>
+#include <Raytracer/Scenes/PhysicalObject.h>
 
 namespace Raytracer
 {
+	namespace Scenes
+	{
+		class Camera;
+		class Material;
+	}
+
 	namespace Objects
 	{
-		class Mesh  : public Scenes::SceneObject
+		/**
+		 * A triangle mesh. A mesh stores its triangles either as a list of independent
+		 * triangles or, in indexed mode, as arrays of unique vertices plus an index buffer
+		 * with three indices per triangle.
+		 *
+		 * Indexed meshes can have a chain of simplified versions (levels of detail) that share
+		 * the vertex arrays of the full mesh. The vertices are ordered such that every level
+		 * only uses a prefix of the vertex arrays.
+		 */
+		class Mesh  : public Scenes::PhysicalObject
 		{
+			friend class MeshCodec;
+
 		private:
+			/**
+			 * The triangles of a mesh that is not indexed
+			 */
 			std::vector<Triangle> triangles;
 
+			/**
+			 * The unique vertex positions of an indexed mesh
+			 */
+			std::vector<glm::vec3> positions;
+
+			/**
+			 * The unique vertex normals of an indexed mesh
+			 */
+			std::vector<glm::vec3> normals;
+
+			/**
+			 * The unique vertex colors of an indexed mesh
+			 */
+			std::vector<glm::vec3> colors;
+
+			/**
+			 * The unique vertex texture coordinates of an indexed mesh, or empty if the mesh
+			 * has none
+			 */
+			std::vector<glm::vec2> textureCoords;
+
+			/**
+			 * The vertex indices of an indexed mesh, three per triangle
+			 */
+			std::vector<unsigned int> indices;
+
+			/**
+			 * The vertex indices of the simplified levels of detail, starting with level 1
+			 */
+			std::vector<std::vector<unsigned int> > lodIndices;
+
+			/**
+			 * The number of vertices used by each level of detail, starting with level 1
+			 */
+			std::vector<size_t> lodVertexCounts;
+
+			/**
+			 * The level of detail used for ray tracing
+			 */
+			int activeLod;
+
+			/**
+			 * The corners of the bounding box in model space
+			 */
+			glm::vec3 boundsMin;
+			glm::vec3 boundsMax;
+
+			/**
+			 * The surface material or NULL to use a default material
+			 */
+			Scenes::Material *material;
+
+			/**
+			 * Whether the mesh is in indexed mode
+			 */
+			bool indexed;
+
+			/**
+			 * Counts the changes of the vertices and triangles
+			 */
+			unsigned int generation;
+
+			/**
+			 * Removes all levels of detail except for the full mesh and makes the full mesh the
+			 * active level.
+			 */
+			void ClearLods();
+
+			/**
+			 * Finds the closest triangle of the active level of detail hit by a ray.
+			 *
+			 * @param ray The ray in model space
+			 * @param anyHit true to stop at the first triangle found
+			 * @param triangle Receives the index of the triangle
+			 * @param distance Receives the distance along the ray
+			 * @param u Receives the barycentric weight of the second vertex
+			 * @param v Receives the barycentric weight of the third vertex
+			 * @return true if the ray hits a triangle
+			 */
+			bool Intersect(const Ray &ray, bool anyHit, size_t &triangle, float &distance,
+				float &u, float &v) const;
+
+			/**
+			 * Recomputes the bounding box from the vertices.
+			 */
+			void UpdateBounds();
+
 		public:
+			/**
+			 * The default number of triangles per covered pixel used to select a level of
+			 * detail
+			 */
+			static const float DefaultLodTriangleDensity;
+
 			Mesh();
 
+			/**
+			 * Appends a triangle. An indexed mesh appends the three vertices of the triangle to
+			 * its vertex arrays without merging them; call MakeIndexed() again to merge them.
+			 *
+			 * @param t The triangle
+			 */
 			void AddTriangle(Triangle &t);
 
+			/**
+			 * Appends a number of triangles in one go.
+			 *
+			 * @param t A pointer to the first triangle
+			 * @param count The number of triangles
+			 */
+			void AddTriangles(const Triangle *t, size_t count);
+
+			/**
+			 * Generates a chain of simplified versions of the mesh by quadric error
+			 * simplification. Each level has about a constant fraction of the triangles of the
+			 * level before. The mesh is converted into indexed mode if necessary, and its
+			 * vertices are reordered so that every level uses a prefix of the vertex arrays.
+			 *
+			 * @param maxLevels The maximum number of levels, including the full mesh
+			 * @param reduction The fraction of triangles to keep from one level to the next
+			 * @param minTriangleCount No level with fewer triangles than this is generated
+			 */
+			void GenerateLods(int maxLevels = 6, float reduction = 0.5f,
+				size_t minTriangleCount = 256);
+
+			/**
+			 * Retrieves the level of detail used for ray tracing.
+			 *
+			 * @return The level of detail
+			 */
+			int GetActiveLod() const;
+
+			/**
+			 * Retrieves the axis-aligned bounding box of the mesh.
+			 *
+			 * @param min Receives the minimum corner in model space
+			 * @param max Receives the maximum corner in model space
+			 * @return false if the mesh is empty
+			 */
+			bool GetBoundingBox(glm::vec3 &min, glm::vec3 &max) const;
+
+			/**
+			 * Retrieves a sphere enclosing the mesh.
+			 *
+			 * @param center Receives the center in model space
+			 * @param radius Receives the radius in model space, or a negative value if the mesh
+			 *   is empty
+			 */
+			void GetBoundingSphere(glm::vec3 &center, float &radius) const;
+
+			/**
+			 * Retrieves the vertex colors of an indexed mesh.
+			 *
+			 * @return The color of each unique vertex
+			 */
+			const std::vector<glm::vec3> &GetColors() const;
+
+			/**
+			 * Retrieves a counter that changes whenever the vertices or triangles of the mesh
+			 * change, including their order. Renderers can compare it to detect that data
+			 * derived from the geometry is out of date.
+			 *
+			 * @return The generation of the geometry
+			 */
+			unsigned int GetGeneration() const;
+
+			/**
+			 * Retrieves the index buffer of an indexed mesh.
+			 *
+			 * @return Three vertex indices per triangle
+			 */
+			const std::vector<unsigned int> &GetIndices() const;
+
+			void GetIntersection(const RayHit &hit, Intersection &intersection) const;
+
+			/**
+			 * Retrieves the number of levels of detail.
+			 *
+			 * @return The number of levels, 1 if there are no simplified levels
+			 */
+			int GetLodCount() const;
+
+			/**
+			 * Retrieves the index buffer of a level of detail of an indexed mesh.
+			 *
+			 * @param level The level, 0 for the full mesh
+			 * @return Three vertex indices per triangle
+			 */
+			const std::vector<unsigned int> &GetLodIndices(int level) const;
+
+			/**
+			 * Retrieves the number of triangles of a level of detail.
+			 *
+			 * @param level The level, 0 for the full mesh
+			 * @return The number of triangles
+			 */
+			size_t GetLodTriangleCount(int level) const;
+
+			/**
+			 * Retrieves the number of vertices used by a level of detail of an indexed mesh.
+			 *
+			 * @param level The level, 0 for the full mesh
+			 * @return The number of vertices; the level only uses vertices below this index
+			 */
+			size_t GetLodVertexCount(int level) const;
+
+			/**
+			 * Retrieves the surface material.
+			 *
+			 * @return The material or NULL if the mesh uses a default material
+			 */
+			Scenes::Material *GetMaterial() const;
+
+			/**
+			 * Retrieves the vertex normals of an indexed mesh.
+			 *
+			 * @return The normal of each unique vertex
+			 */
+			const std::vector<glm::vec3> &GetNormals() const;
+
+			/**
+			 * Retrieves the vertex positions of an indexed mesh.
+			 *
+			 * @return The position of each unique vertex
+			 */
+			const std::vector<glm::vec3> &GetPositions() const;
+
+			/**
+			 * Retrieves the vertex texture coordinates of an indexed mesh.
+			 *
+			 * @return The texture coordinates of each unique vertex, or an empty list if the
+			 *   mesh has none
+			 */
+			const std::vector<glm::vec2> &GetTextureCoords() const;
+
+			/**
+			 * Retrieves a single triangle in either mode.
+			 *
+			 * @param i The index of the triangle
+			 * @return The triangle
+			 */
+			Triangle GetTriangle(size_t i) const;
+
+			/**
+			 * Retrieves the number of triangles in either mode.
+			 *
+			 * @return The number of triangles
+			 */
+			size_t GetTriangleCount() const;
+
+			/**
+			 * Retrieves the triangles of a mesh that is not indexed.
+			 *
+			 * @return The list of triangles. This list is empty for indexed meshes.
+			 */
 			const std::vector<Triangle> &GetTriangles() const;
 
+			/**
+			 * Retrieves the number of unique vertices of an indexed mesh.
+			 *
+			 * @return The number of vertices
+			 */
+			size_t GetVertexCount() const;
+
+			bool HitTest(const Ray &ray, RayHit *hit) const;
+
 			virtual bool IsInstanceOf(Scenes::SceneObjectType type) const;
 
-			bool Load(const char *fileName);
+			/**
+			 * Checks whether the mesh is in indexed mode.
+			 *
+			 * @return true if the mesh stores unique vertices and an index buffer
+			 */
+			bool IsIndexed() const;
+
+			/**
+			 * Replaces the triangles of this mesh with the contents of a .raw file or of a file
+			 * written by Save(). The file is memory mapped and copied or decoded in a single
+			 * pass.
+			 *
+			 * @param fileName The file name
+			 * @param indexed true to build an indexed mesh, merging identical vertices, or false
+			 *   to store independent triangles. Compressed files are always loaded as indexed
+			 *   meshes, including their levels of detail.
+			 * @return true if the file was loaded, false if it could not be opened or is invalid
+			 */
+			bool Load(const char *fileName, bool indexed = false);
+
+			/**
+			 * Converts the mesh into indexed mode, merging vertices that have identical
+			 * positions, normals and colors.
+			 */
+			void MakeIndexed();
+
+			/**
+			 * Reserves memory for a number of triangles so that subsequent calls to
+			 * AddTriangle() and AddTriangles() do not reallocate.
+			 *
+			 * @param count The total number of triangles to reserve memory for
+			 */
+			void Reserve(size_t count);
+
+			/**
+			 * Writes an indexed mesh and its levels of detail to a file in the compressed
+			 * format of MeshCodec.
+			 *
+			 * @param fileName The file name
+			 * @return true if the file was written, false if the mesh is not indexed or the
+			 *   file could not be written
+			 */
+			bool Save(const char *fileName) const;
+
+			/**
+			 * Selects the level of detail for the projected size of the mesh. The number of
+			 * triangles drawn follows the number of pixels the mesh covers. To avoid switching
+			 * back and forth, a different level is only selected if the triangle count of the
+			 * previous level is off by a margin.
+			 *
+			 * @param camera The camera
+			 * @param imageHeight The height of the image in pixels
+			 * @param trianglesPerPixel The desired number of triangles per covered pixel
+			 * @param previousLevel The level selected for the previous frame
+			 * @return The level of detail, 0 for the full mesh
+			 */
+			int SelectLod(const Scenes::Camera &camera, float imageHeight,
+				float trianglesPerPixel, int previousLevel) const;
+
+			/**
+			 * Sets the level of detail used for ray tracing. Renderer::Render() selects it every
+			 * frame, while the rasterizer keeps its own level for each mesh and leaves it alone.
+			 * Levels beyond the ones the mesh has are clamped, and changing the levels resets
+			 * it to 0.
+			 *
+			 * @param level The level of detail, 0 for the full mesh
+			 */
+			void SetActiveLod(int level);
+
+			/**
+			 * Sets the surface material.
+			 *
+			 * @param material The material or NULL to use a default material. The mesh does not
+			 *   take ownership of the material.
+			 */
+			void SetMaterial(Scenes::Material *material);
+
+			/**
+			 * Sets the texture coordinates of an indexed mesh by taking over the contents of a
+			 * vector. Converting the mesh into indexed mode again, loading it and replacing its
+			 * triangles remove the texture coordinates.
+			 *
+			 * @param coords One pair of texture coordinates per unique vertex, or an empty
+			 *   vector to remove them. The vector is left empty.
+			 * @return true if the coordinates were set, false if the mesh is not indexed or the
+			 *   number of coordinates does not match the number of vertices
+			 */
+			bool SetTextureCoords(std::vector<glm::vec2> &&coords);
+
+			/**
+			 * Replaces the triangles of this mesh by taking over the contents of a vector. The
+			 * mesh is no longer indexed afterwards.
+			 *
+			 * @param triangles The new triangles. The vector is left empty.
+			 */
+			void SetTriangles(std::vector<Triangle> &&triangles);
 		};
 	}
 }
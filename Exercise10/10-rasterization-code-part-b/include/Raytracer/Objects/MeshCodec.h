@@ -0,0 +1,66 @@
+#ifndef RAYTRACER_OBJECTS_MESHCODEC_H
+#define RAYTRACER_OBJECTS_MESHCODEC_H
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace Raytracer
+{
+	namespace Objects
+	{
+		class Mesh;
+
+		/**
+		 * Converts indexed meshes to and from a compact binary encoding. Vertex positions are
+		 * quantized to 16 bits per coordinate relative to the bounding box of the mesh,
+		 * normals are octahedral-encoded with 16 bits per component, and colors are stored
+		 * as RGB8. Each attribute is stored as a separate array per component so that the
+		 * decoder can expand four vertices at a time with SIMD instructions. The index
+		 * buffers of the mesh and all its levels of detail are delta-coded with a variable
+		 * number of bytes per index. Texture coordinates are not stored.
+		 *
+		 * The encoding starts with a header:
+		 *   - The characters "QMSH" and the format version (32 bit)
+		 *   - The number of vertices and the number of levels of detail (32 bit each)
+		 *   - The minimum corner of the bounding box and the position quantization step
+		 *     (three floats each)
+		 *   - For each level of detail, the number of triangles, the number of vertices used
+		 *     and the size of the encoded index buffer in bytes (32 bit each)
+		 */
+		class MeshCodec
+		{
+		public:
+			/**
+			 * Checks whether a block of memory starts with a compressed mesh.
+			 *
+			 * @param data The data
+			 * @param size The size of the data in bytes
+			 * @return true if the data has the header of a compressed mesh
+			 */
+			static bool IsCompressed(const unsigned char *data, size_t size);
+
+			/**
+			 * Decodes a compressed mesh. The mesh is replaced with the decoded mesh, which is
+			 * in indexed mode and has the levels of detail that were encoded.
+			 *
+			 * @param data The encoded mesh
+			 * @param size The size of the data in bytes
+			 * @param mesh The mesh to decode into
+			 * @return true if the mesh was decoded, false if the data is invalid
+			 */
+			static bool Decode(const unsigned char *data, size_t size, Mesh &mesh);
+
+			/**
+			 * Encodes an indexed mesh including its levels of detail.
+			 *
+			 * @param mesh The mesh
+			 * @param data Receives the encoded mesh
+			 * @return true if the mesh was encoded, false if it is not in indexed mode
+			 */
+			static bool Encode(const Mesh &mesh, std::vector<unsigned char> &data);
+		};
+	}
+}
+
+#endif // RAYTRACER_OBJECTS_MESHCODEC_H
@@ -0,0 +1,136 @@
+#ifndef RAYTRACER_OBJECTS_MESHFILE_H
+#define RAYTRACER_OBJECTS_MESHFILE_H
+
+#include <stddef.h>
+
+#include <glm.hpp>
+
+namespace Raytracer
+{
+	namespace Objects
+	{
+		/**
+		 * A vertex as stored in a .raw file
+		 */
+		struct RawVertex
+		{
+			glm::vec3 position;
+
+			glm::vec3 normal;
+
+			glm::vec3 color;
+		};
+
+		/**
+		 * A triangle as stored in a .raw file
+		 */
+		struct RawTriangle
+		{
+			RawVertex vertex[3];
+		};
+
+		/**
+		 * A read-only view of a .raw triangle mesh file. The file is mapped into memory and its
+		 * header is validated once, after which the triangles can be accessed in place without
+		 * copying them.
+		 *
+		 * The .raw format consists of a 32 bit triangle count followed by the triangles, each
+		 * stored as three vertices of position, normal and color (see RawTriangle). Files in
+		 * the compressed format of MeshCodec are recognized by their header.
+		 */
+		class MeshFile
+		{
+		private:
+			/**
+			 * The start of the mapped file or NULL if no file is open
+			 */
+			const unsigned char *data;
+
+			/**
+			 * The size of the mapped file in bytes
+			 */
+			size_t size;
+
+			/**
+			 * The number of triangles in the file
+			 */
+			size_t triangleCount;
+
+			/**
+			 * Whether the file contains a compressed mesh instead of raw triangles
+			 */
+			bool compressed;
+
+#ifdef _WIN32
+			void *fileHandle;
+			void *mappingHandle;
+#endif
+
+			MeshFile(const MeshFile &);
+			MeshFile &operator=(const MeshFile &);
+
+		public:
+			/**
+			 * Constructs a new MeshFile object without opening a file.
+			 */
+			MeshFile();
+
+			/**
+			 * Destructs a MeshFile object and unmaps the file.
+			 */
+			~MeshFile();
+
+			/**
+			 * Unmaps the file. Pointers returned by GetTriangles() become invalid.
+			 */
+			void Close();
+
+			/**
+			 * Retrieves the contents of the file.
+			 *
+			 * @return A pointer to the start of the mapped file or NULL if no file is open
+			 */
+			const unsigned char *GetData() const;
+
+			/**
+			 * Retrieves the size of the file.
+			 *
+			 * @return The size of the file in bytes
+			 */
+			size_t GetSize() const;
+
+			/**
+			 * Retrieves the number of triangles in a .raw file.
+			 *
+			 * @return The number of triangles or 0 if no file is open or the file is compressed
+			 */
+			size_t GetTriangleCount() const;
+
+			/**
+			 * Retrieves the triangles stored in the file.
+			 *
+			 * @return A pointer to the first triangle in the mapped file or NULL if no file is
+			 *   open or the file is compressed. The pointer is valid until the file is closed.
+			 */
+			const RawTriangle *GetTriangles() const;
+
+			/**
+			 * Checks whether the file contains a compressed mesh.
+			 *
+			 * @return true if the file is in the format of MeshCodec
+			 */
+			bool IsCompressed() const;
+
+			/**
+			 * Maps a .raw or a compressed mesh file into memory and validates its header.
+			 *
+			 * @param fileName The file name
+			 * @return true if the file was opened and has a valid size, false otherwise. The
+			 *   contents of compressed files are only validated by MeshCodec::Decode().
+			 */
+			bool Open(const char *fileName);
+		};
+	}
+}
+
+#endif // RAYTRACER_OBJECTS_MESHFILE_H
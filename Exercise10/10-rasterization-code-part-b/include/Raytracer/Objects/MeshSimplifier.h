@@ -0,0 +1,156 @@
+#ifndef RAYTRACER_OBJECTS_MESHSIMPLIFIER_H
+#define RAYTRACER_OBJECTS_MESHSIMPLIFIER_H
+
+#include <stddef.h>
+
+#include <queue>
+#include <vector>
+
+#include <glm.hpp>
+
+namespace Raytracer
+{
+	namespace Objects
+	{
+		/**
+		 * Reduces the number of triangles of an indexed mesh by quadric error simplification.
+		 * Edges are collapsed by moving one of their vertices onto the other (half-edge
+		 * collapses), cheapest first, so the simplified meshes only use the existing vertices
+		 * and can share the vertex arrays of the original mesh.
+		 *
+		 * Vertices on open borders are never moved. Since vertices with the same position but
+		 * different normals or colors are separate vertices, this also keeps attribute seams
+		 * closed.
+		 */
+		class MeshSimplifier
+		{
+		private:
+			/**
+			 * A symmetric 4x4 matrix measuring the squared distance to a set of planes
+			 */
+			struct Quadric
+			{
+				double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+				Quadric();
+				Quadric(const glm::vec3 &normal, float d, float weight);
+
+				void Add(const Quadric &q);
+				double Evaluate(const glm::vec3 &p) const;
+			};
+
+			/**
+			 * A possible collapse of the edge from one vertex to another
+			 */
+			struct Collapse
+			{
+				float cost;
+				unsigned int from;
+				unsigned int to;
+				unsigned int fromVersion;
+				unsigned int toVersion;
+
+				bool operator<(const Collapse &c) const;
+			};
+
+			const std::vector<glm::vec3> &positions;
+
+			/**
+			 * The current vertex indices, three per triangle
+			 */
+			std::vector<unsigned int> triangles;
+
+			/**
+			 * Whether each triangle is still part of the mesh
+			 */
+			std::vector<unsigned char> triangleAlive;
+
+			/**
+			 * The triangles using each vertex. May contain triangles that have been removed.
+			 */
+			std::vector<std::vector<unsigned int> > vertexTriangles;
+
+			std::vector<Quadric> quadrics;
+
+			/**
+			 * Whether each vertex is locked in place, i.e. lies on an open border
+			 */
+			std::vector<unsigned char> locked;
+
+			/**
+			 * Whether each vertex has been collapsed into another one
+			 */
+			std::vector<unsigned char> removed;
+
+			/**
+			 * Counts the changes to each vertex to recognize outdated collapses
+			 */
+			std::vector<unsigned int> versions;
+
+			/**
+			 * Scratch marks used while testing collapses
+			 */
+			std::vector<unsigned int> marks;
+			unsigned int mark;
+
+			std::priority_queue<Collapse> collapses;
+
+			/**
+			 * The removed vertices in the order they were removed
+			 */
+			std::vector<unsigned int> collapseOrder;
+
+			size_t triangleCount;
+
+			bool CanCollapse(unsigned int from, unsigned int to);
+			void Push(unsigned int from, unsigned int to);
+			void Remove(unsigned int from, unsigned int to);
+
+			MeshSimplifier(const MeshSimplifier &);
+			MeshSimplifier &operator=(const MeshSimplifier &);
+
+		public:
+			/**
+			 * Prepares an indexed mesh for simplification.
+			 *
+			 * @param positions The vertex positions. The vector must stay alive and unchanged
+			 *   while the simplifier is used.
+			 * @param indices The vertex indices, three per triangle
+			 */
+			MeshSimplifier(const std::vector<glm::vec3> &positions,
+				const std::vector<unsigned int> &indices);
+
+			/**
+			 * Retrieves the vertices removed so far.
+			 *
+			 * @return The indices of the removed vertices in the order they were removed
+			 */
+			const std::vector<unsigned int> &GetCollapseOrder() const;
+
+			/**
+			 * Retrieves the triangles of the simplified mesh.
+			 *
+			 * @param indices Receives three vertex indices for every remaining triangle, in the
+			 *   original triangle order
+			 */
+			void GetIndices(std::vector<unsigned int> &indices) const;
+
+			/**
+			 * @return The number of remaining triangles
+			 */
+			size_t GetTriangleCount() const;
+
+			/**
+			 * Collapses edges until at most a given number of triangles is left. Calling this
+			 * again with a smaller count continues from the current state.
+			 *
+			 * @param targetTriangleCount The number of triangles to reduce the mesh to
+			 * @return true if the target was reached, false if no more edges could be
+			 *   collapsed without changing the topology or folding triangles over
+			 */
+			bool Simplify(size_t targetTriangleCount);
+		};
+	}
+}
+
+#endif // RAYTRACER_OBJECTS_MESHSIMPLIFIER_H
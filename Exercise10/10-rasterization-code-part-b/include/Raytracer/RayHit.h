@@ -32,6 +32,13 @@ namespace Raytracer
 		 * The object that was hit or NULL if no object was hit
 		 */
 		const Scenes::PhysicalObject *object;
+
+		/**
+		 * The part of the object that was hit, like a triangle of a mesh, and the barycentric
+		 * coordinates of the intersection point within it
+		 */
+		size_t primitive;
+		float u, v;
 		
 	public:
 		/**
@@ -77,6 +84,15 @@ namespace Raytracer
 		 */
 		const Scenes::PhysicalObject *GetObject() const;
 
+		/**
+		 * Gets the part of the object that was hit, as set by the object.
+		 *
+		 * @param primitive Receives the index of the part, like a triangle of a mesh
+		 * @param u Receives the barycentric coordinate of the second vertex
+		 * @param v Receives the barycentric coordinate of the third vertex
+		 */
+		void GetPrimitive(size_t &primitive, float &u, float &v) const;
+
 		/**
 		 * Gets the position of the intersection point.
 		 *
@@ -93,7 +109,7 @@ namespace Raytracer
 		const Ray &GetRay() const;
 
 		/**
-		 * Sets the distance and the object that was hit.
+		 * Sets the distance and the object that was hit. The part of the object is reset.
 		 *
 		 * @param distance The distance from the ray origin to the intersection point
 		 * @param object The object that was hit or NULL if no object was hit
@@ -109,6 +125,16 @@ namespace Raytracer
 		 */
 		void Set(const Ray &ray, float distance, const Scenes::PhysicalObject *object);
 
+		/**
+		 * Sets the part of the object that was hit, so that the object does not have to
+		 * search it again in GetIntersection().
+		 *
+		 * @param primitive The index of the part, like a triangle of a mesh
+		 * @param u The barycentric coordinate of the second vertex
+		 * @param v The barycentric coordinate of the third vertex
+		 */
+		void SetPrimitive(size_t primitive, float u, float v);
+
 		/**
 		 * Sets the ray.
 		 *
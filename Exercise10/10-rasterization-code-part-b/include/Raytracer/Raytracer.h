@@ -2,6 +2,7 @@
 #define RAYTRACER_H
 
 #include <Raytracer/Accelerator.h>
+#include <Raytracer/ColorEncoder.h>
 #include <Raytracer/IIntegrator.h>
 #include <Raytracer/Image.h>
 #include <Raytracer/Ray.h>
@@ -16,10 +17,15 @@
 #include <Raytracer/Scenes/Material.h>
 #include <Raytracer/Scenes/PointLight.h>
 #include <Raytracer/Scenes/Scene.h>
+#include <Raytracer/Scenes/SceneGraph.h>
 #include <Raytracer/Scenes/SceneObject.h>
 #include <Raytracer/Scenes/SceneObjectType.h>
+#include <Raytracer/Scenes/Texture.h>
 
 #include <Raytracer/Objects/Mesh.h>
+#include <Raytracer/Objects/MeshCodec.h>
+#include <Raytracer/Objects/MeshFile.h>
+#include <Raytracer/Objects/MeshSimplifier.h>
 #include <Raytracer/Objects/Sphere.h>
 #include <Raytracer/Objects/Triangle.h>
 
@@ -18,6 +18,12 @@ namespace Raytracer
 		Accelerator *accelerator;
 		IIntegrator *integrator;
 
+		/**
+		 * The number of triangles per covered pixel used to select the meshes' levels of
+		 * detail, or 0 to always use the full meshes
+		 */
+		float lodTriangleDensity;
+
 	protected:
 		/**
 		 * Renders a single pixel.
@@ -82,7 +88,17 @@ namespace Raytracer
 		void SetAccelerator(Accelerator *accelerator);
 
 		/**
-		 * Renders an image of a scene.
+		 * Sets how the meshes' levels of detail are selected.
+		 *
+		 * @param trianglesPerPixel The desired number of triangles per pixel covered by a mesh,
+		 *   or 0 to always use the full meshes
+		 */
+		void SetLodTriangleDensity(float trianglesPerPixel);
+
+		/**
+		 * Renders an image of a scene. The global transformations of the scene are brought up
+		 * to date and the level of detail of every mesh is selected first, so the scene is
+		 * changed.
 		 *
 		 * @param scene The scene
 		 * @param width The image width in pixels
@@ -91,7 +107,7 @@ namespace Raytracer
 		 * @remarks You cannot use the same Renderer object to render different scenes
 		 *   simultaneously.
 		 */
-		Image *Render(const Scenes::Scene &scene, int width, int height); 
+		Image *Render(Scenes::Scene &scene, int width, int height); 
 	};
 }
 
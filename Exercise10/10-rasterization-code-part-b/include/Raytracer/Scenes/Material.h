@@ -7,6 +7,8 @@ namespace Raytracer
 {
 	namespace Scenes
 	{
+		class Texture;
+
 		/**
 		 * A Material that determines the visual properties of an object
 		 */
@@ -38,6 +40,16 @@ namespace Raytracer
 			 */
 			float shininess;
 
+			/**
+			 * The opacity, from 0 for invisible to 1 for opaque
+			 */
+			float opacity;
+
+			/**
+			 * The texture that modulates the diffuse color, or NULL
+			 */
+			Texture *texture;
+
 		public:
 			/**
 			 * Constructs a new default material.
@@ -58,6 +70,11 @@ namespace Raytracer
 			 * Gets the emissive color
 			 */
 			glm::vec3 GetEmissive();
+
+			/**
+			 * Gets the opacity. Only the rasterizer draws translucent surfaces.
+			 */
+			float GetOpacity();
 			
 			/**
 			 * Gets the shininess, which determines the shape of the highlight
@@ -69,6 +86,12 @@ namespace Raytracer
 			 */
 			glm::vec3 GetSpecular();
 
+			/**
+			 * Gets the texture that modulates the diffuse color, or NULL. Only the rasterizer
+			 * samples textures, using the texture coordinates of indexed meshes.
+			 */
+			Texture *GetTexture();
+
 			/**
 			 * Sets the ambient color
 			 */
@@ -84,6 +107,11 @@ namespace Raytracer
 			 */
 			void SetEmissive(glm::vec3 &color);
 
+			/**
+			 * Sets the opacity, from 0 for invisible to 1 for opaque
+			 */
+			void SetOpacity(float opacity);
+
 			/**
 			 * Sets the shininess, which determines the shape of the highlight
 			 */
@@ -93,6 +121,12 @@ namespace Raytracer
 			 * Sets the specular color
 			 */
 			void SetSpecular(glm::vec3 &color);
+
+			/**
+			 * Sets the texture that modulates the diffuse color, or NULL for none. The material
+			 * does not take ownership of the texture.
+			 */
+			void SetTexture(Texture *texture);
 		};
 	}
 }
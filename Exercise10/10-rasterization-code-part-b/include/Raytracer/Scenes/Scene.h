@@ -1,16 +1,30 @@
 #ifndef RAYTRACER_SCENES_SCENE_H
 #define RAYTRACER_SCENES_SCENE_H
 
+#include <vector>
+
 #include <Raytracer/Scenes/SceneObject.h>
 
 namespace Raytracer
 {
 	class Ray;
 
+	namespace Objects
+	{
+		class Mesh;
+	}
+
 	namespace Scenes
 	{
 		class Camera;
+		class Light;
+		class PhysicalObject;
 
+		/**
+		 * The root of a scene. Besides the hierarchy, a scene keeps typed lists of all lights,
+		 * meshes, physical objects and cameras it contains. The lists are updated whenever an
+		 * object enters or leaves the scene, so renderers never have to traverse the hierarchy.
+		 */
 		class Scene : public SceneObject
 		{
 		private:
@@ -19,12 +33,58 @@ namespace Raytracer
 			 */
 			Camera *activeCamera;
 
+			/**
+			 * All lights in the scene
+			 */
+			std::vector<Light *> lights;
+
+			/**
+			 * All meshes in the scene
+			 */
+			std::vector<Objects::Mesh *> meshes;
+
+			/**
+			 * All physical objects in the scene
+			 */
+			std::vector<PhysicalObject *> physicalObjects;
+
+			/**
+			 * All cameras in the scene
+			 */
+			std::vector<Camera *> cameras;
+
+			/**
+			 * Counts the changes of each registry
+			 */
+			unsigned int generations[SceneRegistry_Count];
+
+			/**
+			 * Adds an object that just entered the scene to the matching registries.
+			 *
+			 * @param object The object
+			 */
+			void Register(SceneObject *object);
+
+			/**
+			 * Removes an object that is leaving the scene from all registries.
+			 *
+			 * @param object The object
+			 */
+			void Unregister(SceneObject *object);
+
+			friend class SceneObject;
+
 		public:
 			/**
 			 * Constructs a new Scene object.
 			 */
 			Scene();
 
+			/**
+			 * Destructs a Scene and deletes all objects in it.
+			 */
+			virtual ~Scene();
+
 			/**
 			 * Retrieves the active camera, i.e. the camera object to be used for rendering the
 			 * scene.
@@ -33,6 +93,44 @@ namespace Raytracer
 			 */
 			Camera *GetActiveCamera() const;
 
+			/**
+			 * Retrieves a list of all cameras in the scene.
+			 *
+			 * @return A list of all cameras in the scene
+			 */
+			const std::vector<Camera *> &GetCameras() const;
+
+			/**
+			 * Retrieves the change counter of a registry. The counter is incremented whenever
+			 * an object is added to or removed from the registry, so renderers can keep data
+			 * derived from it until the counter changes.
+			 *
+			 * @param registry The registry
+			 * @return The change counter
+			 */
+			unsigned int GetGeneration(SceneRegistry registry) const;
+
+			/**
+			 * Retrieves a list of all lights in the scene.
+			 *
+			 * @return A list of all lights in the scene
+			 */
+			const std::vector<Light *> &GetLights() const;
+
+			/**
+			 * Retrieves a list of all meshes in the scene.
+			 *
+			 * @return A list of all meshes in the scene
+			 */
+			const std::vector<Objects::Mesh *> &GetMeshes() const;
+
+			/**
+			 * Retrieves a list of all physical objects in the scene.
+			 *
+			 * @return A list of all physical objects in the scene
+			 */
+			const std::vector<PhysicalObject *> &GetPhysicalObjects() const;
+
 			virtual bool IsInstanceOf(SceneObjectType type) const;
 
 			/**
@@ -0,0 +1,271 @@
+#ifndef RAYTRACER_SCENES_SCENEGRAPH_H
+#define RAYTRACER_SCENES_SCENEGRAPH_H
+
+#include <vector>
+
+#include <glm.hpp>
+
+namespace Raytracer
+{
+	namespace Scenes
+	{
+		class SceneObject;
+
+		/**
+		 * Stores the hierarchy and the transformations of scene objects in flat arrays. Nodes
+		 * are grouped by their depth in the hierarchy, so every level only refers to nodes of
+		 * the level above it and the global transformations can be updated one level at a
+		 * time, with all nodes of a level in parallel.
+		 *
+		 * Nodes are identified by stable handles. Adding and removing a node takes constant
+		 * time; removal moves the last node of the level into the freed slot.
+		 *
+		 * Changed transformations take effect in the global transformations when Update() is
+		 * called, which the renderers do before every frame. Reading the global
+		 * transformations does not change the graph, so several threads may read them at
+		 * once.
+		 */
+		class SceneGraph
+		{
+		public:
+			/**
+			 * A handle to a node
+			 */
+			typedef int Node;
+
+			/**
+			 * The handle that does not refer to any node
+			 */
+			static const Node InvalidNode = -1;
+
+		private:
+			/**
+			 * Flags stored for each node
+			 */
+			enum NodeFlags
+			{
+				NodeFlags_Dirty = 1
+			};
+
+			/**
+			 * All nodes with the same depth in the hierarchy, stored as parallel arrays.
+			 */
+			struct Level
+			{
+				std::vector<Node> nodes;
+				std::vector<Node> parents;
+				std::vector<unsigned int> types;
+				std::vector<SceneObject *> objects;
+				std::vector<glm::mat4x4> transformations;
+				std::vector<glm::mat4x4> globalTransformations;
+				std::vector<glm::mat4x4> globalToLocals;
+				std::vector<unsigned int> updateStamps;
+				std::vector<unsigned char> flags;
+			};
+
+			/**
+			 * The levels of the hierarchy, from the top-level nodes downwards
+			 */
+			std::vector<Level> levels;
+
+			/**
+			 * The level of each node, indexed by handle, or -1 for unused handles
+			 */
+			std::vector<int> nodeLevels;
+
+			/**
+			 * The position of each node within its level, indexed by handle
+			 */
+			std::vector<int> nodeSlots;
+
+			/**
+			 * Unused handles that can be given out again
+			 */
+			std::vector<Node> freeNodes;
+
+			/**
+			 * The object the graph belongs to or NULL
+			 */
+			SceneObject *owner;
+
+			/**
+			 * The topmost level containing a node whose transformation was changed since the
+			 * last update or -1 if all global transformations are up to date
+			 */
+			int firstDirtyLevel;
+
+			/**
+			 * Counts the update passes
+			 */
+			unsigned int updateStamp;
+
+			/**
+			 * Appends a node to a level and returns its slot.
+			 */
+			int Insert(int level, Node node, Node parent, unsigned int type, SceneObject *object,
+				const glm::mat4x4 &transformation);
+
+			/**
+			 * Removes a node from its level by moving the last node of the level into its slot.
+			 */
+			void Erase(Node node);
+
+			/**
+			 * Marks a node as changed.
+			 */
+			void Invalidate(Node node);
+
+			SceneGraph(const SceneGraph &);
+			SceneGraph &operator=(const SceneGraph &);
+
+		public:
+			/**
+			 * Constructs a new, empty SceneGraph.
+			 *
+			 * @param owner The object the graph belongs to or NULL
+			 */
+			SceneGraph(SceneObject *owner);
+
+			/**
+			 * Retrieves the graph holding all scene objects that have not been added to a
+			 * scene.
+			 *
+			 * @return The default graph
+			 */
+			static SceneGraph *GetDefault();
+
+			/**
+			 * Adds a new top-level node with an identity transformation.
+			 *
+			 * @param object The object represented by the node
+			 * @return The handle of the new node
+			 */
+			Node Create(SceneObject *object);
+
+			/**
+			 * Removes a node. The node must not have any children left.
+			 *
+			 * @param node The node
+			 */
+			void Destroy(Node node);
+
+			/**
+			 * Retrieves the level of a node, i.e. its depth in the hierarchy.
+			 *
+			 * @param node The node
+			 * @return The level of the node, 0 for top-level nodes
+			 */
+			int GetDepth(Node node) const;
+
+			/**
+			 * Retrieves the global transformation of a node as of the last Update().
+			 *
+			 * @param node The node
+			 * @return The transformation from the node's local coordinates to world coordinates
+			 */
+			const glm::mat4x4 &GetGlobalTransformation(Node node) const;
+
+			/**
+			 * Retrieves the inverse of the global transformation of a node as of the last
+			 * Update().
+			 *
+			 * @param node The node
+			 * @return The transformation from world coordinates to the node's local coordinates
+			 */
+			const glm::mat4x4 &GetGlobalToLocal(Node node) const;
+
+			/**
+			 * Retrieves the object the graph belongs to.
+			 *
+			 * @return The owner object or NULL for the default graph
+			 */
+			SceneObject *GetOwner() const;
+
+			/**
+			 * Retrieves the parent of a node.
+			 *
+			 * @param node The node
+			 * @return The parent node or InvalidNode for top-level nodes
+			 */
+			Node GetParent(Node node) const;
+
+			/**
+			 * Retrieves the local transformation of a node.
+			 *
+			 * @param node The node
+			 * @return The transformation from the node's coordinates to its parent's coordinates
+			 */
+			const glm::mat4x4 &GetTransformation(Node node) const;
+
+			/**
+			 * Retrieves the type tag of a node.
+			 *
+			 * @param node The node
+			 * @return A bit mask with bit n set if the object is an instance of SceneObjectType n
+			 */
+			unsigned int GetTypeMask(Node node) const;
+
+			/**
+			 * Moves a node below another node or to the top level. The children of the node
+			 * must be moved afterwards to keep the levels consistent.
+			 *
+			 * @param node The node
+			 * @param parent The new parent or InvalidNode to make node a top-level node
+			 */
+			void SetParent(Node node, Node parent);
+
+			/**
+			 * Sets the local transformation of a node. The global transformations are updated
+			 * on the next call to Update().
+			 *
+			 * @param node The node
+			 * @param transformation The transformation from the node's coordinates to its
+			 *   parent's coordinates
+			 */
+			void SetTransformation(Node node, const glm::mat4x4 &transformation);
+
+			/**
+			 * Sets the type tag of a node.
+			 *
+			 * @param node The node
+			 * @param typeMask A bit mask with bit n set if the object is an instance of
+			 *   SceneObjectType n
+			 */
+			void SetTypeMask(Node node, unsigned int typeMask);
+
+			/**
+			 * Recomputes the global transformation and its inverse of all nodes whose
+			 * transformation or whose ancestors' transformations changed, one level at a time.
+			 * It must not be called while other threads read the graph.
+			 */
+			void Update();
+
+			/**
+			 * @return The number of levels in the hierarchy
+			 */
+			int GetLevelCount() const;
+
+			/**
+			 * @return The number of nodes in a level
+			 */
+			int GetLevelSize(int level) const;
+
+			/**
+			 * @return The objects of all nodes in a level
+			 */
+			SceneObject *const *GetLevelObjects(int level) const;
+
+			/**
+			 * @return The type tags of all nodes in a level
+			 */
+			const unsigned int *GetLevelTypeMasks(int level) const;
+
+			/**
+			 * @return The global transformations of all nodes in a level. Call Update() first.
+			 */
+			const glm::mat4x4 *GetLevelGlobalTransformations(int level) const;
+		};
+	}
+}
+
+#endif // RAYTRACER_SCENES_SCENEGRAPH_H
@@ -1,6 +1,7 @@
 #ifndef RAYTRACER_SCENES_SCENEOBJECT_H
 #define RAYTRACER_SCENES_SCENEOBJECT_H
 
+#include <Raytracer/Scenes/SceneGraph.h>
 #include <Raytracer/Scenes/SceneObjectType.h>
 
 #include <vector>
@@ -9,9 +10,30 @@ namespace Raytracer
 {
 	namespace Scenes
 	{
+		/**
+		 * An object in a scene. A SceneObject is a handle to a node of a SceneGraph, which
+		 * stores the hierarchy and transformations of all objects in flat arrays. Objects that
+		 * are not part of a scene live in the default graph and move to the scene's graph when
+		 * they are added to it.
+		 */
 		class SceneObject
 		{
 		private:
+			/**
+			 * The graph holding the node of this object
+			 */
+			SceneGraph *graph;
+
+			/**
+			 * The node of this object in graph
+			 */
+			SceneGraph::Node node;
+
+			/**
+			 * The graph this object is the root of or NULL. Only scenes own a graph.
+			 */
+			SceneGraph *ownedGraph;
+
 			/**
 			 * The parent of this object or NULL if this is a top-level object
 			 */
@@ -23,26 +45,44 @@ namespace Raytracer
 			std::vector<SceneObject *> children;
 
 			/**
-			 * The transformation matrix to transform a point from the coordinate system of the
-			 * parent of this object to its local coordinate system. If this object does not have
-			 * a parent, this is the transformation from world coordinates into the local
-			 * coordinate system.
+			 * The position of this object in the children list of its parent
 			 */
-			glm::mat4x4 transformation;
+			int childIndex;
 
 			/**
-			 * The transformation matrix to transform a point from world coordinates to local
-			 * coordinates.
+			 * The position of this object in each typed registry of its scene or -1
 			 */
-			glm::mat4x4 globalTransformation;
+			int registryIndices[SceneRegistry_Count];
 
-			glm::mat4x4 globalToLocal;
+			/**
+			 * Moves this object and all its children into a graph, below a given node.
+			 *
+			 * @param target The graph to move into
+			 * @param parentNode The new parent node or SceneGraph::InvalidNode
+			 */
+			void Attach(SceneGraph *target, SceneGraph::Node parentNode);
+
+			/**
+			 * Removes a child from the list of children in constant time.
+			 */
+			void UnlinkChild(SceneObject *child);
+
+			SceneObject(const SceneObject &);
+			SceneObject &operator=(const SceneObject &);
 
+			friend class Scene;
+
+		protected:
 			/**
-			 * Updates the global transformation based on the current transformation. This
-			 * includes child objects.
+			 * Makes this object the root of a new scene graph that it owns, moving it and all
+			 * its children there.
 			 */
-			void UpdateTransformations();
+			void CreateGraph();
+
+			/**
+			 * Deletes all child objects.
+			 */
+			void DeleteChildren();
 
 		public:
 			/**
@@ -73,7 +113,7 @@ namespace Raytracer
 
 			/**
 			* Retrieves the position of this object in world space, i.e. the translation component
-			* of the global transformation matrix.
+			* of the global transformation matrix as of the last SceneGraph::Update().
 			*
 			* @return The global position of this object
 			*/
@@ -81,7 +121,8 @@ namespace Raytracer
 
 			/**
 			* Retrieves a matrix that can be used to transform coordinates from world space to
-			* object space. This is the inverse of the global transformation matrix.
+			* object space. This is the inverse of the global transformation matrix as of the last
+			* SceneGraph::Update().
 			*
 			* @return The inverse of the global transformation matrix
 			*/
@@ -89,12 +130,21 @@ namespace Raytracer
 
 			/**
 			 * Retrieves the global transformation matrix. The global transformation matrix is used
-			 * to transform coordinates from object space to world space.
+			 * to transform coordinates from object space to world space. Changed transformations
+			 * take effect on the next SceneGraph::Update() of the object's graph, which the
+			 * renderers call before every frame.
 			 *
 			 * @return The global transformation matrix
 			 */
 			const glm::mat4x4 &GetGlobalTransformation() const;
 
+			/**
+			 * Retrieves the node of this object in its scene graph.
+			 *
+			 * @return The node handle
+			 */
+			SceneGraph::Node GetNode() const;
+
 			/**
 			 * Retrieves the parent object of this object.
 			 *
@@ -102,6 +152,28 @@ namespace Raytracer
 			 */
 			SceneObject *GetParent() const;
 
+			/**
+			 * Retrieves the scene graph holding this object.
+			 *
+			 * @return The scene graph
+			 */
+			SceneGraph *GetSceneGraph();
+
+			/**
+			 * Retrieves the scene graph holding this object for reading.
+			 *
+			 * @return The scene graph
+			 */
+			const SceneGraph *GetSceneGraph() const;
+
+			/**
+			 * Computes the type tag stored for this object in the scene graph.
+			 *
+			 * @return A bit mask with bit n set if IsInstanceOf() returns true for
+			 *   SceneObjectType n
+			 */
+			unsigned int GetTypeMask() const;
+
 			/**
 			 * Retrieves the position of this object, i.e. the translation component of the
 			 * transformation matrix.
@@ -119,6 +191,15 @@ namespace Raytracer
 			 */
 			const glm::mat4x4 &GetTransformation() const;
 
+			/**
+			 * Checks whether this instance is of the given type using the type tag stored in the
+			 * scene graph. Unlike IsInstanceOf(), this does not need a virtual call.
+			 *
+			 * @param type The type to check against
+			 * @return true if this object is of type type, false otherwise
+			 */
+			bool HasType(SceneObjectType type) const;
+
 			/**
 			 * Checks whether this instance is of the given type.
 			 *
@@ -129,7 +210,7 @@ namespace Raytracer
 			
 			/**
 			 * Removes an object from the list of children. After removal, the object has no
-			 * parent.
+			 * parent. The order of the remaining children may change.
 			 *
 			 * @param child The child to be removed
 			 */
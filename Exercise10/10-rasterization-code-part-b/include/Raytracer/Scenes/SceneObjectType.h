@@ -16,7 +16,28 @@ namespace Raytracer
 			SceneObjectType_PhysicalObject,
 			SceneObjectType_PointLight,
 			SceneObjectType_Mesh,
-			SceneObjectType_Sphere
+			SceneObjectType_Sphere,
+
+			/**
+			 * The number of scene object types
+			 */
+			SceneObjectType_Count
+		};
+
+		/**
+		 * An enumeration of the typed object lists a Scene maintains for its renderers.
+		 */
+		enum SceneRegistry
+		{
+			SceneRegistry_Lights,
+			SceneRegistry_Meshes,
+			SceneRegistry_PhysicalObjects,
+			SceneRegistry_Cameras,
+
+			/**
+			 * The number of registries
+			 */
+			SceneRegistry_Count
 		};
 	}
 }
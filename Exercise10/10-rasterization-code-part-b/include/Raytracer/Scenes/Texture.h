@@ -0,0 +1,185 @@
+#ifndef RAYTRACER_SCENES_TEXTURE_H
+#define RAYTRACER_SCENES_TEXTURE_H
+
+#include <vector>
+
+#include <glm.hpp>
+
+#include <Raytracer/Internal/Simd.h>
+
+namespace Raytracer
+{
+	class Image;
+
+	namespace Scenes
+	{
+		/**
+		 * A color texture with a chain of mipmaps, sampled with repeating texture coordinates.
+		 * Each level stores its texels as RGB8 in tiles of TileSize x TileSize texels, which
+		 * are ordered along a Z curve (Morton order) within the tile. A tile fills one cache
+		 * line, so the four texels of a bilinear lookup usually come from the same line no
+		 * matter in which direction the texture is traversed. The channels are encoded with a
+		 * gamma, which keeps dark colors from banding, and every fetched texel is decoded
+		 * with a table before it is filtered.
+		 *
+		 * Sampling is bilinear within a level and linear between the two levels around the
+		 * level of detail (trilinear). The scalar and the SIMD sampling functions give exactly
+		 * the same results.
+		 */
+		class Texture
+		{
+		public:
+			/**
+			 * The number of texels along each side of a tile
+			 */
+			static const int TileSize = 4;
+
+		private:
+			/**
+			 * A level of the mipmap chain
+			 */
+			struct Level
+			{
+				int width;
+				int height;
+
+				/**
+				 * The number of tiles per row
+				 */
+				int tileColumns;
+
+				/**
+				 * The texels, tile by tile, with red in the lowest byte
+				 */
+				std::vector<unsigned int> texels;
+			};
+
+			std::vector<Level> levels;
+
+			/**
+			 * The linear value of each encoded channel value
+			 */
+			float decode[256];
+
+			/**
+			 * Stores the texels of one level, encoded with a gamma and quantized to eight bits
+			 * per channel.
+			 */
+			void AddLevel(int width, int height, const std::vector<glm::vec3> &pixels,
+				float gamma);
+
+			/**
+			 * Finds the four texels and the weights of a bilinear lookup in a level.
+			 *
+			 * @param level The level
+			 * @param s The horizontal texture coordinate, from 0 to 1
+			 * @param t The vertical texture coordinate, from 0 to 1
+			 * @param texels Receives the top left, top right, bottom left and bottom right texels
+			 * @param weightX Receives the weight of the right texels
+			 * @param weightY Receives the weight of the bottom texels
+			 */
+			void GetFootprint(const Level &level, float s, float t, unsigned int texels[4],
+				float &weightX, float &weightY) const;
+
+#ifdef RAYTRACER_SSE2
+			/**
+			 * Finds the texels and weights of the bilinear lookups of four positions in a level
+			 * the same way as the scalar GetFootprint().
+			 */
+			void GetFootprint(const Level &level, __m128 s, __m128 t, __m128i texels[4],
+				__m128 &weightX, __m128 &weightY) const;
+#endif
+
+			/**
+			 * Selects the levels to sample for a level of detail.
+			 *
+			 * @param lod The level of detail
+			 * @param blend Receives the weight of the second level
+			 * @return The first level. The second level is only sampled if blend is not 0.
+			 */
+			int SelectLevels(float lod, float &blend) const;
+
+			Texture(const Texture &);
+			Texture &operator=(const Texture &);
+
+		public:
+			Texture();
+
+			/**
+			 * Creates the texture from an image and builds its mipmaps. Every level halves
+			 * the size of the one before, down to 1 x 1 texels, and averages 2 x 2 texels of
+			 * it.
+			 *
+			 * @param image The image with the colors of the texture in linear space
+			 * @param gamma The gamma the texels are encoded with. 1 stores them linearly, larger
+			 *   values keep more precision in dark colors.
+			 * @return true if the texture was created, false if the image is empty or the gamma
+			 *   is not positive
+			 */
+			bool Create(const Image &image, float gamma);
+
+			/**
+			 * @return The width of the first level in texels
+			 */
+			int GetWidth() const;
+
+			/**
+			 * @return The height of the first level in texels
+			 */
+			int GetHeight() const;
+
+			/**
+			 * @return The number of mipmap levels, 0 for an empty texture
+			 */
+			int GetLevelCount() const;
+
+			/**
+			 * Computes the level of detail for a pixel from the changes of the texture
+			 * coordinates from one pixel to the next.
+			 *
+			 * @param dudx The change of u along x
+			 * @param dvdx The change of v along x
+			 * @param dudy The change of u along y
+			 * @param dvdy The change of v along y
+			 * @return The binary logarithm of the larger of the two steps in texels of the
+			 *   first level. Values up to 0 select the first level.
+			 */
+			float GetLod(float dudx, float dvdx, float dudy, float dvdy) const;
+
+			/**
+			 * Loads an uncompressed 24 bit BMP file, as written by Image::SaveBMP().
+			 *
+			 * @param fileName The file name
+			 * @param gamma The gamma the colors in the file are encoded with. The texels keep
+			 *   this encoding and are converted to linear space when they are sampled.
+			 * @return true if the file was loaded, false otherwise
+			 */
+			bool LoadBMP(const char *fileName, float gamma);
+
+			/**
+			 * Samples the texture at one position.
+			 *
+			 * @param u The horizontal texture coordinate, repeating every unit
+			 * @param v The vertical texture coordinate, repeating every unit
+			 * @param lod The level of detail, see GetLod()
+			 * @return The color, black for an empty texture
+			 */
+			glm::vec3 Sample(float u, float v, float lod) const;
+
+#ifdef RAYTRACER_SSE2
+			/**
+			 * Samples the texture at four positions with the same level of detail, giving the
+			 * same results as Sample().
+			 *
+			 * @param u The horizontal texture coordinates
+			 * @param v The vertical texture coordinates
+			 * @param lod The level of detail of all four positions
+			 * @param color Receives the red, green and blue values of the four colors
+			 */
+			void SampleQuad(__m128 u, __m128 v, float lod, __m128 color[3]) const;
+#endif
+		};
+	}
+}
+
+#endif // RAYTRACER_SCENES_TEXTURE_H
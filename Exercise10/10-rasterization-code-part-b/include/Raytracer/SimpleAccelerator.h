@@ -21,25 +21,14 @@ namespace Raytracer
 
 	/**
 	 * A simple accelerator that uses brute force testing of all objects to find intersections.
+	 * The objects and lights are taken directly from the scene's registries.
 	 */
 	class SimpleAccelerator : public Accelerator
 	{
-	private:
-		/**
-		 * A list of all physical objects in the scene
-		 */
-		std::vector<Scenes::PhysicalObject *> physicalObjects;
-
-		std::vector<Scenes::Light *> lights;
-
-		void AddObject(const Scenes::SceneObject *object);
-
 	public:
 		virtual const std::vector<Scenes::Light *> &GetLights() const;
 
 		virtual bool HitTest(const Ray &ray, RayHit *hit) const;
-
-		virtual void SetScene(const Scenes::Scene *scene);
 	};
 }
 
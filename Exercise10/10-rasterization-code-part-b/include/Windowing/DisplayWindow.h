@@ -6,19 +6,18 @@
 #include <tchar.h>
 #else
 #include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
 #endif
 
-namespace Raytracer
-{
-	class Image;
-}
+#include <Raytracer/ColorEncoder.h>
+#include <Windowing/IPresenter.h>
 
 namespace Windowing
 {
 	/**
 	 * Opens a window that can be used to display an image.
 	 */
-	class DisplayWindow
+	class DisplayWindow : public IPresenter
 	{
 	private:
 #ifdef _WIN32
@@ -29,12 +28,73 @@ namespace Windowing
 #else
 		Display *display;
 		Window window;
-		
+
+		/**
+		 * The image the pixels are converted into for presentation. It is kept until the size
+		 * of the image changes.
+		 */
+		XImage *frame;
+
+		/**
+		 * The shared memory segment holding the pixels of the frame if the X server supports
+		 * the MIT-SHM extension and runs on the same machine. Otherwise, the pixels are sent
+		 * to the server with every update.
+		 */
+		XShmSegmentInfo sharedSegment;
+
+		/**
+		 * Whether the frame is held in shared memory
+		 */
+		bool frameShared;
+
+		/**
+		 * Whether the server may still be reading the shared memory of the frame
+		 */
+		bool framePending;
+
+		/**
+		 * Whether the image changed since it was last converted into the frame
+		 */
+		bool frameOutdated;
+
+		/**
+		 * Whether shared memory may be used for the frame
+		 */
+		bool sharedMemory;
+
+		/**
+		 * Creates the frame, in shared memory if possible.
+		 *
+		 * @param width The width of the frame
+		 * @param height The height of the frame
+		 * @return true if the frame was created, false otherwise
+		 */
+		bool CreateFrame(int width, int height);
+
+		/**
+		 * Destroys the frame and detaches its shared memory.
+		 */
+		void DestroyFrame();
+
+		/**
+		 * Converts the image into the frame if it changed and puts the frame into the window.
+		 */
+		void DrawFrame();
+
 		void HandleEvent(XEvent &event);
 #endif
 
 		Raytracer::Image *image;
 
+		/**
+		 * Encodes the colors of the image for display, with a gamma of 2.2 unless it is
+		 * changed
+		 */
+		Raytracer::ColorEncoder encoder;
+
+		DisplayWindow(const DisplayWindow &);
+		DisplayWindow &operator=(const DisplayWindow &);
+
 	public:
 		/**
 		 * Constructs a new DisplayWindow object and opens the window on the screen.
@@ -47,10 +107,17 @@ namespace Windowing
 		/**
 		 * Destructs a DisplayWindow.
 		 */
-		~DisplayWindow();
+		virtual ~DisplayWindow();
 
 		/**
-		 * Retrieves current execution time.
+		 * @return The encoder of the colors of the image, which may be changed between
+		 *   updates
+		 */
+		Raytracer::ColorEncoder &GetEncoder();
+
+		/**
+		 * Retrieves current execution time from a monotonic clock with at least microsecond
+		 * resolution.
 		 *
 		 * @return The time, in seconds, since the first call to GetTime().
 		 */
@@ -61,19 +128,39 @@ namespace Windowing
 		 *
 		 * @return true if the window is still open, false if it has been closed
 		 */
-		bool ProcessMessages();
+		virtual bool ProcessMessages();
+
+		/**
+		 * Retrieves whether the window presents its image through shared memory, which avoids
+		 * sending the pixels to the X server. This is only known after the first image was
+		 * drawn.
+		 *
+		 * @return true if the MIT-SHM extension is used, false otherwise
+		 */
+		bool IsSharedMemoryUsed() const;
 
 		/**
 		 * Specifies the image to be drawn in the window.
 		 *
 		 * @param image The image to be drawn
 		 */
-		void SetImage(Raytracer::Image *image);
+		virtual void SetImage(Raytracer::Image *image);
+
+		/**
+		 * Specifies whether the image may be presented through shared memory (MIT-SHM) on X11.
+		 * This is the default. Shared memory is not used if the X server does not support it
+		 * or runs on another machine.
+		 *
+		 * @param enable true to use shared memory where possible, false to always send the
+		 *   pixels to the X server
+		 */
+		void SetSharedMemory(bool enable);
 
 		/**
-		 * Refreshes the window by redrawing the associated image.
+		 * Refreshes the window by redrawing the associated image. On X11, the image is
+		 * converted and sent to the server right away.
 		 */
-		void Update();
+		virtual void Update();
 	};
 }
 
@@ -0,0 +1,271 @@
+#ifndef WINDOWING_FRAMEPIPELINE_H
+#define WINDOWING_FRAMEPIPELINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace Raytracer
+{
+	class Image;
+}
+
+namespace Windowing
+{
+	class IPresenter;
+
+	/**
+	 * Runs a render loop that overlaps rendering and presentation. A render thread renders the
+	 * frames into a ring of images, while the calling thread shows the newest finished frame
+	 * with a presenter, like a window, and handles its messages. An image is never rendered
+	 * into while the presenter may still read it.
+	 */
+	class FramePipeline
+	{
+	public:
+		/**
+		 * Renders a frame. This is called on the render thread.
+		 *
+		 * @param image The image to render into. It still holds the frame rendered into it
+		 *   before.
+		 * @param frame The number of the frame, counting from 0
+		 * @param time The time of the frame in seconds since Run() was called. With frame
+		 *   pacing, this is the time the frame was scheduled for, and with a fixed time step,
+		 *   the frame number times the step.
+		 * @return true to go on, false to stop after this frame
+		 */
+		typedef std::function<bool(Raytracer::Image &image, unsigned int frame, double time)>
+			RenderFunction;
+
+		/**
+		 * The time spent on a frame in each stage of the pipeline, in milliseconds
+		 */
+		struct FrameTiming
+		{
+			/**
+			 * The time spent in the render function
+			 */
+			double renderTime;
+
+			/**
+			 * The time the finished frame waited until the window thread took it
+			 */
+			double queueTime;
+
+			/**
+			 * The time the window thread spent drawing the frame and handling messages while
+			 * it was shown
+			 */
+			double presentTime;
+
+			/**
+			 * Whether the frame was skipped because a newer frame finished before it could be
+			 * shown
+			 */
+			bool dropped;
+		};
+
+		/**
+		 * Receives the timing of a frame once it is final, which is when the next frame is
+		 * shown, the frame is skipped or the run ends. This is called on the thread that
+		 * called Run().
+		 *
+		 * @param frame The number of the frame
+		 * @param timing The timing of the frame
+		 */
+		typedef std::function<void(unsigned int frame, const FrameTiming &timing)>
+			TimingFunction;
+
+		/**
+		 * The largest number of finished frames that may wait for presentation
+		 */
+		static const int MaxLatency = 4;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * What an image of the ring is used for
+		 */
+		enum SlotState
+		{
+			Slot_Free,
+			Slot_Rendering,
+			Slot_Ready,
+			Slot_Presented
+		};
+
+		/**
+		 * An image of the ring
+		 */
+		struct Slot
+		{
+			Raytracer::Image *image;
+			SlotState state;
+
+			/**
+			 * The frame the image holds
+			 */
+			unsigned int frame;
+
+			/**
+			 * When the frame was finished
+			 */
+			Clock::time_point finished;
+		};
+
+		int width;
+		int height;
+
+		/**
+		 * The number of finished frames that may wait for presentation
+		 */
+		int latency;
+
+		/**
+		 * The time between the starts of two frames in seconds, or 0 to render as fast as
+		 * possible
+		 */
+		double frameInterval;
+
+		/**
+		 * The time from one frame to the next passed to the render function, or 0 to pass
+		 * the actual time
+		 */
+		double timeStep;
+
+		/**
+		 * The images, latency + 2 of them: one shown by the window, one being rendered and the
+		 * ones waiting for presentation
+		 */
+		std::vector<Slot> slots;
+
+		/**
+		 * The timings of the frames of the last run, by frame number
+		 */
+		std::vector<FrameTiming> timings;
+
+		/**
+		 * Receives the final timings of the frames, or empty
+		 */
+		TimingFunction timingFunction;
+
+		/**
+		 * Guards the slots, the timings and the flags below while the render thread runs
+		 */
+		std::mutex slotMutex;
+
+		/**
+		 * Signals the window thread that a frame was finished or the render thread stopped
+		 */
+		std::condition_variable readyCondition;
+
+		/**
+		 * Signals the render thread that a slot was freed or that it has to stop
+		 */
+		std::condition_variable freeCondition;
+
+		/**
+		 * Whether the presenter was closed and the render thread has to stop
+		 */
+		bool stopping;
+
+		/**
+		 * Whether the render thread has finished its last frame
+		 */
+		bool finished;
+
+		/**
+		 * Renders frames until the render function returns false or stopping is set.
+		 *
+		 * @param render The render function
+		 * @param start The time Run() was called
+		 */
+		void RenderLoop(const RenderFunction &render, Clock::time_point start);
+
+		/**
+		 * Allocates the ring of images if the latency changed.
+		 */
+		void UpdateSlots();
+
+		FramePipeline(const FramePipeline &);
+		FramePipeline &operator=(const FramePipeline &);
+
+	public:
+		/**
+		 * Constructs a new FramePipeline object with a latency of one frame and no frame
+		 * pacing.
+		 *
+		 * @param width The width of the images
+		 * @param height The height of the images
+		 */
+		FramePipeline(int width, int height);
+
+		/**
+		 * Destructs a FramePipeline and its images.
+		 */
+		~FramePipeline();
+
+		/**
+		 * Retrieves the timings of the frames of the last run. Frames that were not finished
+		 * when the presenter was closed are not included.
+		 *
+		 * @return The timings, by frame number
+		 */
+		const std::vector<FrameTiming> &GetTimings() const;
+
+		/**
+		 * Renders and presents frames until the presenter is closed or the render function
+		 * returns false. The presenter must only be used by the calling thread. Afterwards,
+		 * it may still show the last frame, whose image belongs to the pipeline.
+		 *
+		 * @param presenter The presenter, for example a DisplayWindow
+		 * @param render The render function, which is called on a separate thread
+		 * @return true if the render function stopped the loop, false if the presenter was
+		 *   closed
+		 */
+		bool Run(IPresenter &presenter, const RenderFunction &render);
+
+		/**
+		 * Sets the rate at which frames are started. The frames are scheduled at fixed
+		 * intervals, and a frame that starts late does not make the following ones start
+		 * early.
+		 *
+		 * @param framesPerSecond The frame rate, or 0 to render as fast as possible
+		 */
+		void SetFrameRate(double framesPerSecond);
+
+		/**
+		 * Sets the number of finished frames that may wait for presentation, which is the
+		 * number of frames the window lags behind the render thread at most. With 1, the
+		 * default, the render thread renders the next frame while the window shows the last
+		 * one, and every frame is shown. With more, the render thread is held up less by a
+		 * slow window, which shows the newest frame and skips the others. The ring holds
+		 * latency + 2 images.
+		 *
+		 * @param frames The latency, from 1 to MaxLatency
+		 */
+		void SetLatency(int frames);
+
+		/**
+		 * Sets a fixed time step, so that the render function gets the same times no matter
+		 * how long the frames take. Together with a latency of 1, which shows every frame,
+		 * this makes the presented frames reproducible.
+		 *
+		 * @param seconds The time from one frame to the next, or 0 to pass the actual time
+		 */
+		void SetTimeStep(double seconds);
+
+		/**
+		 * Sets a function that receives the timing of every frame once it is final, for
+		 * example to profile the frames while they are rendered.
+		 *
+		 * @param function The function, or an empty function to receive none
+		 */
+		void SetTimingFunction(const TimingFunction &function);
+	};
+}
+
+#endif // WINDOWING_FRAMEPIPELINE_H
@@ -0,0 +1,42 @@
+#ifndef WINDOWING_IPRESENTER_H
+#define WINDOWING_IPRESENTER_H
+
+namespace Raytracer
+{
+	class Image;
+}
+
+namespace Windowing
+{
+	/**
+	 * Implemented by classes that can present rendered images, like a window on the screen or
+	 * a video stream.
+	 */
+	class IPresenter
+	{
+	public:
+		virtual ~IPresenter() {}
+
+		/**
+		 * Handles any pending messages.
+		 *
+		 * @return true if further images can be presented, false if the presenter has been
+		 *   closed
+		 */
+		virtual bool ProcessMessages() = 0;
+
+		/**
+		 * Specifies the image to be presented.
+		 *
+		 * @param image The image to be presented
+		 */
+		virtual void SetImage(Raytracer::Image *image) = 0;
+
+		/**
+		 * Presents the current contents of the image.
+		 */
+		virtual void Update() = 0;
+	};
+}
+
+#endif // WINDOWING_IPRESENTER_H
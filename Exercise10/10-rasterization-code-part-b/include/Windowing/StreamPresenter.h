@@ -0,0 +1,229 @@
+#ifndef WINDOWING_STREAMPRESENTER_H
+#define WINDOWING_STREAMPRESENTER_H
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Raytracer/ColorEncoder.h>
+#include <Windowing/IPresenter.h>
+
+namespace Windowing
+{
+	/**
+	 * Presents images without a window system by writing them as an uncompressed video
+	 * stream to a file or pipe. Update() converts the image to eight bits per channel and
+	 * queues it, and a writer thread writes the queued frames. If the queue is full, Update()
+	 * waits, so no frame is ever skipped.
+	 */
+	class StreamPresenter : public IPresenter
+	{
+	public:
+		/**
+		 * The format of the stream
+		 */
+		enum Format
+		{
+			/**
+			 * YUV4MPEG2 with full resolution chroma (C444), which video tools like ffmpeg and
+			 * mpv read without being told the size and frame rate
+			 */
+			Format_Y4M,
+
+			/**
+			 * The RGB pixels of each frame, three bytes each and row by row from the top,
+			 * without any header
+			 */
+			Format_RGB
+		};
+
+		/**
+		 * The number of frames that may wait for the writer thread by default
+		 */
+		static const int DefaultQueueLength = 4;
+
+	private:
+		int width;
+		int height;
+		Format format;
+
+		/**
+		 * The stream, or NULL if it is not open
+		 */
+		FILE *file;
+
+		/**
+		 * Whether the stream is the standard output, which is not closed
+		 */
+		bool standardOutput;
+
+		Raytracer::Image *image;
+
+		/**
+		 * Encodes the colors of the image, with a gamma of 2.2 unless it is changed
+		 */
+		Raytracer::ColorEncoder encoder;
+
+		/**
+		 * The number of frames after which the presenter closes, or 0 for no limit
+		 */
+		unsigned int frameCount;
+
+		/**
+		 * The number of frames queued so far
+		 */
+		unsigned int framesQueued;
+
+		/**
+		 * The number of frames written so far
+		 */
+		unsigned int framesWritten;
+
+		/**
+		 * The number of frames that may wait for the writer thread
+		 */
+		int queueLength;
+
+		/**
+		 * The RGB pixels of the frames waiting for the writer thread, oldest first
+		 */
+		std::deque<std::vector<unsigned char> > queue;
+
+		/**
+		 * Buffers of written frames, kept to be filled again
+		 */
+		std::vector<std::vector<unsigned char> > spareBuffers;
+
+		/**
+		 * Guards the queue, the spare buffers, the number of written frames and the flags
+		 * below while the writer thread runs
+		 */
+		std::mutex queueMutex;
+
+		/**
+		 * Signals the writer thread that a frame was queued or that it has to stop
+		 */
+		std::condition_variable queuedCondition;
+
+		/**
+		 * Signals Update() that the writer thread took a frame
+		 */
+		std::condition_variable writtenCondition;
+
+		/**
+		 * Whether the writer thread has to stop after writing the queued frames
+		 */
+		bool closing;
+
+		/**
+		 * Whether writing failed, which closes the presenter
+		 */
+		bool failed;
+
+		std::thread writer;
+
+		/**
+		 * Converts the RGB pixels of a frame to planar YUV with the BT.601 coefficients in
+		 * the limited range, as Y4M players expect by default.
+		 *
+		 * @param pixels The RGB pixels
+		 * @param planes Receives the Y, U and V planes, one after the other
+		 */
+		void ConvertToYuv(const std::vector<unsigned char> &pixels,
+			std::vector<unsigned char> &planes) const;
+
+		/**
+		 * Writes queued frames until closing is set and the queue is empty, or until writing
+		 * fails.
+		 */
+		void WriteLoop();
+
+		StreamPresenter(const StreamPresenter &);
+		StreamPresenter &operator=(const StreamPresenter &);
+
+	public:
+		/**
+		 * Constructs a new StreamPresenter object without opening a stream.
+		 *
+		 * @param width The width of the frames
+		 * @param height The height of the frames
+		 */
+		StreamPresenter(int width, int height);
+
+		/**
+		 * Destructs a StreamPresenter and closes its stream.
+		 */
+		virtual ~StreamPresenter();
+
+		/**
+		 * Writes the queued frames and closes the stream.
+		 *
+		 * @return true if all frames were written, false if writing failed
+		 */
+		bool Close();
+
+		/**
+		 * @return The encoder of the colors of the frames, which may be changed between
+		 *   frames
+		 */
+		Raytracer::ColorEncoder &GetEncoder();
+
+		/**
+		 * @return The number of frames written to the stream so far
+		 */
+		unsigned int GetFramesWritten();
+
+		/**
+		 * Opens the stream and writes its header.
+		 *
+		 * @param fileName The file or named pipe to write to, or "-" for the standard output
+		 * @param format The format of the stream
+		 * @param framesPerSecond The frame rate stored in the header of a Y4M stream
+		 * @return true if the stream was opened, false otherwise
+		 */
+		bool Open(const char *fileName, Format format, double framesPerSecond);
+
+		/**
+		 * Retrieves whether more frames can be presented.
+		 *
+		 * @return true if the stream is open, writing has not failed and the frame count has
+		 *   not been reached, false otherwise
+		 */
+		virtual bool ProcessMessages();
+
+		/**
+		 * Sets the number of frames after which the presenter closes, which stops a
+		 * FramePipeline running with it.
+		 *
+		 * @param frames The number of frames, or 0 for no limit
+		 */
+		void SetFrameCount(unsigned int frames);
+
+		/**
+		 * Specifies the image to be presented.
+		 *
+		 * @param image The image to be presented. It must have the size of the frames.
+		 */
+		virtual void SetImage(Raytracer::Image *image);
+
+		/**
+		 * Sets the number of frames that may wait for the writer thread. This must be called
+		 * before the stream is opened.
+		 *
+		 * @param frames The queue length, at least 1
+		 */
+		void SetQueueLength(int frames);
+
+		/**
+		 * Encodes the image with the encoder and queues it as the next frame. If the
+		 * queue is full, this waits until the writer thread took a frame.
+		 */
+		virtual void Update();
+	};
+}
+
+#endif // WINDOWING_STREAMPRESENTER_H
@@ -0,0 +1,308 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <glm.hpp>
+
+#include <Raytracer/Raytracer.h>
+#include <Rasterizer/FrameProfiler.h>
+
+using namespace std;
+using namespace glm;
+using namespace Rasterizer;
+using namespace Raytracer;
+
+namespace
+{
+  const char *const StageNames[FrameProfiler::StageCount] = {
+    "SCENE", "SHADOWS", "VERTEX", "SETUP", "SORT", "RASTER", "PRESENT", "FRAME"
+  };
+
+  /**
+   * The characters of the overlay font and their glyphs, 3 x 5 pixels each. Every byte is a
+   * row from the top, with the left pixel in bit 2. Other characters are drawn blank.
+   */
+  const char GlyphCharacters[] = "0123456789.-ACDEFHMNOPRSTUVWX";
+  const unsigned char Glyphs[][5] = {
+    {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7}, {5, 5, 7, 1, 1},
+    {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1}, {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7},
+    {0, 0, 0, 0, 2}, {0, 0, 7, 0, 0}, {2, 5, 7, 5, 5}, {7, 4, 4, 4, 7}, {6, 5, 5, 5, 6},
+    {7, 4, 6, 4, 7}, {7, 4, 6, 4, 4}, {5, 5, 7, 5, 5}, {5, 7, 7, 5, 5}, {6, 5, 5, 5, 5},
+    {2, 5, 5, 5, 2}, {7, 5, 7, 4, 4}, {6, 5, 6, 5, 5}, {3, 4, 2, 1, 6}, {7, 2, 2, 2, 2},
+    {5, 5, 5, 5, 7}, {5, 5, 5, 5, 2}, {5, 5, 7, 7, 5}, {5, 5, 2, 5, 5}
+  };
+
+  /**
+   * The size of the pixels of the glyphs in image pixels, and the distances between the
+   * characters and the lines of the overlay
+   */
+  const int GlyphScale = 2;
+  const int CharacterAdvance = 4 * GlyphScale;
+  const int LineAdvance = 6 * GlyphScale;
+
+  /**
+   * The width of the margin around the overlay and of its bars, in pixels
+   */
+  const int OverlayMargin = 4;
+  const int BarWidth = 64;
+
+  /**
+   * The time that fills a bar, one frame at 60 frames per second
+   */
+  const double BarTime = 1000.0 / 60.0;
+
+  /**
+   * Fills a rectangle of an image, clipped to the image.
+   */
+  void FillRectangle(Image &image, int x0, int y0, int x1, int y1, const vec3 &color)
+  {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, image.GetWidth());
+    y1 = std::min(y1, image.GetHeight());
+
+    vec3 *pixels = image.GetPixels();
+    for (int y = y0; y < y1; y++)
+    {
+      for (int x = x0; x < x1; x++)
+        pixels[y * image.GetWidth() + x] = color;
+    }
+  }
+
+  /**
+   * Draws a line of text with the overlay font, clipped to the image.
+   */
+  void DrawText(Image &image, int x, int y, const char *text, const vec3 &color)
+  {
+    for (; *text != '\0'; text++, x += CharacterAdvance)
+    {
+      const char *glyph = strchr(GlyphCharacters, toupper(*text));
+      if (*text == ' ' || glyph == NULL)
+        continue;
+
+      const unsigned char *rows = Glyphs[glyph - GlyphCharacters];
+      for (int row = 0; row < 5; row++)
+      {
+        for (int column = 0; column < 3; column++)
+        {
+          if (rows[row] & (4 >> column))
+          {
+            FillRectangle(image, x + column * GlyphScale, y + row * GlyphScale,
+                          x + (column + 1) * GlyphScale, y + (row + 1) * GlyphScale, color);
+          }
+        }
+      }
+    }
+  }
+}
+
+FrameProfiler::FrameProfiler()
+{
+  windowSize = DefaultWindowSize;
+  Clear();
+}
+
+void FrameProfiler::BeginFrame(unsigned int frame)
+{
+  lock_guard<mutex> lock(timesMutex);
+
+  Clock::time_point now = Clock::now();
+  if (frameBegun)
+  {
+    RecordLocked(currentFrame, Stage_Frame,
+                 chrono::duration<double, milli>(now - frameStart).count());
+  }
+
+  frameBegun = true;
+  currentFrame = frame;
+  frameStart = now;
+}
+
+void FrameProfiler::Clear()
+{
+  lock_guard<mutex> lock(timesMutex);
+
+  frames.clear();
+  for (int i = 0; i < StageCount; i++)
+  {
+    recentTimes[i].assign(windowSize, 0.0);
+    recordedTimes[i] = 0;
+  }
+
+  frameBegun = false;
+  currentFrame = 0;
+}
+
+double FrameProfiler::ComputePercentile(Stage stage, double percentile) const
+{
+  size_t count = std::min(recordedTimes[stage], recentTimes[stage].size());
+  if (count == 0)
+    return 0.0;
+
+  // The nearest rank: the smallest time that at least the given percentage of the times
+  // do not exceed.
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  size_t rank = (size_t)ceil(percentile / 100.0 * count);
+  rank = (rank > 0 ? rank - 1 : 0);
+
+  vector<double> times(recentTimes[stage].begin(), recentTimes[stage].begin() + count);
+  nth_element(times.begin(), times.begin() + rank, times.end());
+  return times[rank];
+}
+
+void FrameProfiler::DrawOverlay(Image &image) const
+{
+  lock_guard<mutex> lock(timesMutex);
+
+  const vec3 background(0.0f);
+  const vec3 textColor(1.0f);
+  const vec3 medianColor(0.1f, 0.6f, 0.1f);
+  const vec3 tailColor(0.8f, 0.05f, 0.05f);
+
+  // A column for the names, two for the numbers and the bars.
+  const int textColumns = 7 + 7 + 7;
+  const int barX = OverlayMargin * 2 + textColumns * CharacterAdvance;
+  FillRectangle(image, 0, 0, barX + BarWidth + OverlayMargin,
+                OverlayMargin * 2 + (StageCount + 1) * LineAdvance, background);
+
+  DrawText(image, OverlayMargin, OverlayMargin, "MS         P50    P99", textColor);
+
+  for (int i = 0; i < StageCount; i++)
+  {
+    double median = ComputePercentile((Stage)i, 50.0);
+    double tail = ComputePercentile((Stage)i, 99.0);
+
+    char line[64];
+    if (recordedTimes[i] == 0)
+      snprintf(line, sizeof(line), "%-7s%7s%7s", StageNames[i], "-", "-");
+    else
+      snprintf(line, sizeof(line), "%-7s%7.2f%7.2f", StageNames[i], median, tail);
+
+    int y = OverlayMargin + (i + 1) * LineAdvance;
+    DrawText(image, OverlayMargin, y, line, textColor);
+
+    // The bar shows the median, and a mark the 99th percentile.
+    int medianWidth = (int)std::min(median / BarTime * BarWidth, (double)BarWidth);
+    int tailX = barX + (int)std::min(tail / BarTime * BarWidth, (double)BarWidth - 1);
+    FillRectangle(image, barX, y, barX + medianWidth, y + 5 * GlyphScale, medianColor);
+    if (recordedTimes[i] > 0)
+      FillRectangle(image, tailX, y, tailX + 1, y + 5 * GlyphScale, tailColor);
+  }
+}
+
+size_t FrameProfiler::GetFrameCount() const
+{
+  lock_guard<mutex> lock(timesMutex);
+  return frames.size();
+}
+
+double FrameProfiler::GetPercentile(Stage stage, double percentile) const
+{
+  if (stage < 0 || stage >= StageCount)
+    return 0.0;
+
+  lock_guard<mutex> lock(timesMutex);
+  return ComputePercentile(stage, percentile);
+}
+
+const char *FrameProfiler::GetStageName(Stage stage)
+{
+  return (stage >= 0 && stage < StageCount ? StageNames[stage] : "");
+}
+
+void FrameProfiler::Record(unsigned int frame, Stage stage, double milliseconds)
+{
+  if (stage < 0 || stage >= StageCount)
+    return;
+
+  lock_guard<mutex> lock(timesMutex);
+  RecordLocked(frame, stage, milliseconds);
+}
+
+void FrameProfiler::Record(unsigned int frame, const SimpleRasterizer::StageTimes &times)
+{
+  lock_guard<mutex> lock(timesMutex);
+  RecordLocked(frame, Stage_Scene, times.sceneTime);
+  RecordLocked(frame, Stage_Shadows, times.shadowTime);
+  RecordLocked(frame, Stage_Vertex, times.vertexTime);
+  RecordLocked(frame, Stage_Setup, times.setupTime);
+  RecordLocked(frame, Stage_Sort, times.sortTime);
+  RecordLocked(frame, Stage_Raster, times.rasterTime);
+}
+
+void FrameProfiler::RecordLocked(unsigned int frame, Stage stage, double milliseconds)
+{
+  if (frame >= frames.size())
+  {
+    FrameTimes empty;
+    for (int i = 0; i < StageCount; i++)
+      empty.times[i] = -1.0;
+    frames.resize((size_t)frame + 1, empty);
+  }
+
+  frames[frame].times[stage] = milliseconds;
+
+  recentTimes[stage][recordedTimes[stage] % recentTimes[stage].size()] = milliseconds;
+  recordedTimes[stage]++;
+}
+
+bool FrameProfiler::SaveCSV(const char *fileName) const
+{
+  if (fileName == NULL)
+    return false;
+
+  FILE *file = fopen(fileName, "w");
+  if (file == NULL)
+    return false;
+
+  lock_guard<mutex> lock(timesMutex);
+
+  // The column names are the stage names in lower case.
+  bool success = (fputs("frame", file) >= 0);
+  for (int i = 0; i < StageCount && success; i++)
+  {
+    char name[16];
+    size_t length = 0;
+    for (; StageNames[i][length] != '\0' && length + 1 < sizeof(name); length++)
+      name[length] = (char)tolower(StageNames[i][length]);
+    name[length] = '\0';
+
+    success = (fprintf(file, ",%s_ms", name) > 0);
+  }
+
+  success = success && (fputc('\n', file) != EOF);
+
+  for (size_t frame = 0; frame < frames.size() && success; frame++)
+  {
+    success = (fprintf(file, "%u", (unsigned int)frame) > 0);
+    for (int i = 0; i < StageCount && success; i++)
+    {
+      if (frames[frame].times[i] >= 0.0)
+        success = (fprintf(file, ",%.4f", frames[frame].times[i]) > 0);
+      else
+        success = (fputc(',', file) != EOF);
+    }
+
+    success = success && (fputc('\n', file) != EOF);
+  }
+
+  if (fclose(file) != 0)
+    success = false;
+
+  return success;
+}
+
+void FrameProfiler::SetWindowSize(int frames)
+{
+  lock_guard<mutex> lock(timesMutex);
+
+  windowSize = std::max(frames, 1);
+  for (int i = 0; i < StageCount; i++)
+  {
+    recentTimes[i].assign(windowSize, 0.0);
+    recordedTimes[i] = 0;
+  }
+}
@@ -1,4 +1,8 @@
 #include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <string.h>
 #include <vector>
 #include <iostream>
 #include <glm.hpp>
@@ -7,6 +11,8 @@
 
 #define RAYTRACER_USE_FOREACH
 #include <Raytracer/Raytracer.h>
+#include <Raytracer/Internal/Parallel.h>
+#include <Raytracer/Internal/Simd.h>
 
 #include <Rasterizer/SimpleRasterizer.h>
 
@@ -14,369 +20,3313 @@ using namespace std;
 using namespace glm;
 using namespace Rasterizer;
 using namespace Raytracer;
+using namespace Raytracer::Internal;
 using namespace Raytracer::Objects;
 using namespace Raytracer::Scenes;
 
 SimpleRasterizer::SimpleRasterizer()
 {
   ambientLight = vec3(0.01f);
+  lightScene = NULL;
+  lightGeneration = 0;
+  lodScene = NULL;
+  lodGeneration = 0;
+  lodTriangleDensity = Mesh::DefaultLodTriangleDensity;
+  statistics = Statistics();
+  stageTimes = StageTimes();
+  tileColumns = 0;
+  binRangeSize = 1;
+  blockColumns = 0;
+  image = NULL;
+  imageClearedPixels = NULL;
+  backfaceCulling = false;
+  overdrawStatistics = false;
+  visibility = Visibility_DepthBuffer;
+  shading = Shading_Gouraud;
+  varyingCount = 3;
+  textureVarying = -1;
+  lightThreshold = 1.0f / 256.0f;
+  fragmentBudget = (size_t)1 << 22;
+  translucent = false;
+  samples = 1;
+  samplePositions = NULL;
+  sampleExtent = 0;
+  shadowMapSize = 0;
+  shadowLightLimit = 0;
 }
 
-bool SimpleRasterizer::CompareTriangle(const Triangle &t1, const Triangle &t2)
+namespace
 {
-  // These aren't actually the mean values, but since both are off by a constant factor (3),
-  // this inequation is equivalent.
-  return (t1.position[0].z + t1.position[1].z + t1.position[2].z >
-          t2.position[0].z + t2.position[1].z + t2.position[2].z);
+  typedef chrono::steady_clock Clock;
+
+  /**
+   * The number of images whose cleared tiles are tracked. Frame loops cycle through a few
+   * images, the flags of all images are dropped when another one comes along.
+   */
+  const size_t MaxTrackedImages = 8;
+
+  /**
+   * Measures the time since a point in time and moves that point to now.
+   *
+   * @param start The point in time, which is set to now
+   * @return The time since start, in milliseconds
+   */
+  double TakeMilliseconds(Clock::time_point &start)
+  {
+    Clock::time_point now = Clock::now();
+    double time = chrono::duration<double, milli>(now - start).count();
+    start = now;
+    return time;
+  }
+
+  /**
+   * The number of fractional bits of the fixed point screen coordinates
+   */
+  const int SubpixelBits = 4;
+  const int SubpixelScale = 1 << SubpixelBits;
+
+  /**
+   * Triangles with a vertex farther than this many pixels from the origin are not drawn.
+   * This bounds the edge function values of partially covered blocks to 32 bits. Triangles
+   * are clipped to a guard band of half this size around the center of the image.
+   */
+  const float GuardBand = 16384.0f;
+
+  /**
+   * The planes a clip space position may lie outside of. The near and far planes and the
+   * guard band are clipped against, while the sides of the view frustum are only used to
+   * skip triangles that are not visible.
+   */
+  enum ClipPlane
+  {
+    ClipNear = 1 << 0,
+    ClipFar = 1 << 1,
+    ClipGuardLeft = 1 << 2,
+    ClipGuardRight = 1 << 3,
+    ClipGuardBottom = 1 << 4,
+    ClipGuardTop = 1 << 5,
+    ClipLeft = 1 << 6,
+    ClipRight = 1 << 7,
+    ClipBottom = 1 << 8,
+    ClipTop = 1 << 9,
+
+    ClipPlanes = ClipNear | ClipFar | ClipGuardLeft | ClipGuardRight | ClipGuardBottom |
+                 ClipGuardTop,
+    FrustumPlanes = ClipNear | ClipFar | ClipLeft | ClipRight | ClipBottom | ClipTop
+  };
+
+  /**
+   * Finds the planes a clip space position lies outside of.
+   *
+   * @param p The position in clip space
+   * @param guardX The x coordinate of the right guard band plane in normalized device
+   *   coordinates
+   * @param guardY The y coordinate of the top guard band plane in normalized device
+   *   coordinates
+   * @return A combination of ClipPlane flags
+   */
+  int GetClipCode(const vec4 &p, float guardX, float guardY)
+  {
+    int code = 0;
+    float gx = guardX * p.w;
+    float gy = guardY * p.w;
+
+    if (p.z < -p.w) code |= ClipNear;
+    if (p.z > p.w) code |= ClipFar;
+    if (p.x < -gx) code |= ClipGuardLeft;
+    if (p.x > gx) code |= ClipGuardRight;
+    if (p.y < -gy) code |= ClipGuardBottom;
+    if (p.y > gy) code |= ClipGuardTop;
+    if (p.x < -p.w) code |= ClipLeft;
+    if (p.x > p.w) code |= ClipRight;
+    if (p.y < -p.w) code |= ClipBottom;
+    if (p.y > p.w) code |= ClipTop;
+
+    return code;
+  }
+
+  /**
+   * Calculates the signed distance of a clip space position to one of the clip planes, up
+   * to a positive factor. The distance is negative exactly if GetClipCode() reports the
+   * position outside of the plane.
+   */
+  float GetPlaneDistance(const vec4 &p, int plane, float guardX, float guardY)
+  {
+    switch (plane)
+    {
+    case ClipNear: return p.z + p.w;
+    case ClipFar: return p.w - p.z;
+    case ClipGuardLeft: return p.x + guardX * p.w;
+    case ClipGuardRight: return guardX * p.w - p.x;
+    case ClipGuardBottom: return p.y + guardY * p.w;
+    default: return guardY * p.w - p.y;
+    }
+  }
+
+  /**
+   * A vertex of a polygon being clipped
+   */
+  struct ClipVertex
+  {
+    vec4 position;
+    float varyings[SimpleRasterizer::MaxVaryings];
+  };
+
+  /**
+   * The maximum number of vertices of a clipped triangle. Every plane adds at most one.
+   */
+  const int MaxClipVertices = 3 + 6;
+
+  /**
+   * Clips a convex polygon against a plane.
+   *
+   * @param in The vertices of the polygon
+   * @param count The number of vertices
+   * @param varyingCount The number of varyings per vertex
+   * @param plane The ClipPlane to clip against
+   * @param guardX The guard band in x direction, as for GetClipCode()
+   * @param guardY The guard band in y direction, as for GetClipCode()
+   * @param out Receives the vertices of the clipped polygon
+   * @return The number of vertices of the clipped polygon
+   */
+  int ClipPolygon(const ClipVertex *in, int count, int varyingCount, int plane, float guardX,
+                  float guardY, ClipVertex *out)
+  {
+    int outCount = 0;
+    float distance = GetPlaneDistance(in[count - 1].position, plane, guardX, guardY);
+
+    for (int i = 0, j = count - 1; i < count; j = i++)
+    {
+      float previousDistance = distance;
+      distance = GetPlaneDistance(in[i].position, plane, guardX, guardY);
+
+      // Always interpolate from the inner to the outer vertex, so that triangles sharing an
+      // edge split it at exactly the same point.
+      if ((previousDistance >= 0.0f) != (distance >= 0.0f))
+      {
+        const ClipVertex &inner = (distance >= 0.0f ? in[i] : in[j]);
+        const ClipVertex &outer = (distance >= 0.0f ? in[j] : in[i]);
+        float innerDistance = (distance >= 0.0f ? distance : previousDistance);
+        float outerDistance = (distance >= 0.0f ? previousDistance : distance);
+        float t = innerDistance / (innerDistance - outerDistance);
+
+        out[outCount].position = inner.position + (outer.position - inner.position) * t;
+        for (int k = 0; k < varyingCount; k++)
+          out[outCount].varyings[k] = inner.varyings[k] + (outer.varyings[k] - inner.varyings[k]) * t;
+        outCount++;
+      }
+
+      if (distance >= 0.0f)
+        out[outCount++] = in[i];
+    }
+
+    return outCount;
+  }
+
+  /**
+   * The number of set bits in each 4 bit lane mask
+   */
+  const int LaneCounts[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+  /**
+   * Each 4 bit lane mask expanded to all bits set in the selected lanes
+   */
+  const int LaneMasks[16][4] = {
+    {0, 0, 0, 0}, {-1, 0, 0, 0}, {0, -1, 0, 0}, {-1, -1, 0, 0},
+    {0, 0, -1, 0}, {-1, 0, -1, 0}, {0, -1, -1, 0}, {-1, -1, -1, 0},
+    {0, 0, 0, -1}, {-1, 0, 0, -1}, {0, -1, 0, -1}, {-1, -1, 0, -1},
+    {0, 0, -1, -1}, {-1, 0, -1, -1}, {0, -1, -1, -1}, {-1, -1, -1, -1}};
+
+  /**
+   * Widens the conservative depth ranges of triangles and blocks to cover the rounding errors
+   * of the interpolated depth values.
+   */
+  const float DepthMargin = 1.0e-5f;
+
+  /**
+   * The positions of the samples within a pixel with 4x and 8x multisampling, relative to
+   * the pixel center in subpixel units. No two samples share a row or a column, so nearly
+   * horizontal and vertical edges get as many shades as there are samples.
+   */
+  const int SamplePositions4[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+  const int SamplePositions8[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5},
+                                      {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+
+  /**
+   * Snaps the vertices of a screen space triangle to the subpixel grid and finds the pixels
+   * whose centers lie within its bounding box.
+   *
+   * @param position The vertex positions in screen space. The w components are ignored.
+   * @param width The width of the image
+   * @param height The height of the image
+   * @param vx Receives the snapped x coordinates
+   * @param vy Receives the snapped y coordinates
+   * @param area Receives twice the signed area of the snapped triangle, in subpixel units
+   * @param bounds Receives the first and last pixel column and row of the bounding box,
+   *   clipped to the image. The box is empty if no pixel center lies within it.
+   * @param sampleExtent The largest distance of a sample from the pixel center, in subpixel
+   *   units. Pixels are included in the bounding box if any of their samples may lie
+   *   within it.
+   * @return false if a vertex lies outside the guard band or is not a number
+   */
+  bool SnapTriangle(const vec4 position[3], int width, int height, int vx[3], int vy[3],
+                    long long &area, int bounds[4], int sampleExtent)
+  {
+    // The comparisons also reject NaNs.
+    for (int i = 0; i < 3; i++)
+    {
+      if (!(fabsf(position[i].x) <= GuardBand && fabsf(position[i].y) <= GuardBand))
+        return false;
+
+      vx[i] = (int)floorf(position[i].x * SubpixelScale + 0.5f);
+      vy[i] = (int)floorf(position[i].y * SubpixelScale + 0.5f);
+    }
+
+    area = (long long)(vx[1] - vx[0]) * (vy[2] - vy[0]) -
+           (long long)(vy[1] - vy[0]) * (vx[2] - vx[0]);
+
+    const int half = SubpixelScale / 2;
+    int left = std::min(std::min(vx[0], vx[1]), vx[2]);
+    int top = std::min(std::min(vy[0], vy[1]), vy[2]);
+    int right = std::max(std::max(vx[0], vx[1]), vx[2]);
+    int bottom = std::max(std::max(vy[0], vy[1]), vy[2]);
+
+    bounds[0] = std::max((left - half - sampleExtent + SubpixelScale - 1) >> SubpixelBits, 0);
+    bounds[1] = std::max((top - half - sampleExtent + SubpixelScale - 1) >> SubpixelBits, 0);
+    bounds[2] = std::min((right - half + sampleExtent) >> SubpixelBits, width - 1);
+    bounds[3] = std::min((bottom - half + sampleExtent) >> SubpixelBits, height - 1);
+
+    return true;
+  }
+  /**
+   * The distance from a point light within which meshes cast no shadows. The shadow maps
+   * store reciprocal distances, so this only has to keep them finite.
+   */
+  const float ShadowNearClip = 0.01f;
+
+  /**
+   * The distance an occluder must lie in front of a point to shadow it, in texels of the
+   * shadow map at the distance of the point. This keeps surfaces whose texels cover a slope
+   * from shadowing themselves.
+   */
+  const float ShadowDepthBias = 1.5f;
+
+  /**
+   * The distance points are moved along their normals before they are looked up in a
+   * shadow map, in texels of the map at the distance of the point
+   */
+  const float ShadowNormalOffset = 1.0f;
+
+  /**
+   * Finds the face of a cube shadow map a direction from the light falls on.
+   *
+   * @param d The direction
+   * @param x Receives the coordinate along the x axis of the face
+   * @param y Receives the coordinate along the y axis of the face
+   * @param z Receives the distance along the axis the face looks along
+   * @return The face, see SimpleRasterizer::ShadowMap
+   */
+  int GetCubeFace(const vec3 &d, float &x, float &y, float &z)
+  {
+    int axis = 0;
+    if (fabsf(d.y) > fabsf(d[axis]))
+      axis = 1;
+    if (fabsf(d.z) > fabsf(d[axis]))
+      axis = 2;
+
+    x = d[(axis + 1) % 3];
+    y = d[(axis + 2) % 3];
+    z = fabsf(d[axis]);
+    return 2 * axis + (d[axis] < 0.0f ? 1 : 0);
+  }
+
+  /**
+   * Creates the matrix that takes world space positions into the clip space of a face of a
+   * cube shadow map. The w coordinate is the distance along the axis of the face, the same
+   * as the z coordinate of GetCubeFace().
+   *
+   * @param position The position of the light
+   * @param face The face
+   * @param farClip The distance of the far plane
+   * @return The matrix
+   */
+  mat4 GetShadowFaceTransform(const vec3 &position, int face, float farClip)
+  {
+    const int axis = face / 2;
+    const int xAxis = (axis + 1) % 3;
+    const int yAxis = (axis + 2) % 3;
+    const float sign = (face & 1) ? -1.0f : 1.0f;
+
+    // The z coordinate is mapped like with perspective(), from -w on the near plane to w
+    // on the far plane.
+    const float scale = (farClip + ShadowNearClip) / (farClip - ShadowNearClip);
+    const float offset = -2.0f * farClip * ShadowNearClip / (farClip - ShadowNearClip);
+
+    mat4 transform(0.0f);
+    transform[xAxis][0] = 1.0f;
+    transform[3][0] = -position[xAxis];
+    transform[yAxis][1] = 1.0f;
+    transform[3][1] = -position[yAxis];
+    transform[axis][2] = scale * sign;
+    transform[3][2] = -scale * sign * position[axis] + offset;
+    transform[axis][3] = sign;
+    transform[3][3] = -sign * position[axis];
+    return transform;
+  }
+
+  /**
+   * Draws a triangle into a face of a shadow map, keeping the largest reciprocal depth of
+   * every texel whose center it covers. Texels on the edges are covered, too, and both
+   * orientations are drawn. Every row is drawn as a span between the edges without
+   * testing the texels.
+   *
+   * @param position The vertex positions in texels, with the reciprocal of the clip space
+   *   w as fourth component
+   * @param depths The texels of the face
+   * @param size The width and height of the face
+   */
+  void DrawShadowTriangle(const vec4 position[3], float *depths, int size)
+  {
+    int vx[3], vy[3], bounds[4];
+    long long area;
+    if (!SnapTriangle(position, size, size, vx, vy, area, bounds, 0) || area == 0 ||
+        bounds[0] > bounds[2] || bounds[1] > bounds[3])
+      return;
+
+    // Edge i lies opposite of vertex i, and its edge function is positive inside.
+    const long long orientation = (area > 0 ? 1 : -1);
+    long long a[3], b[3], c[3];
+    double planeX = 0.0, planeY = 0.0, plane0 = 0.0;
+    for (int i = 0; i < 3; i++)
+    {
+      int j = (i + 1) % 3, k = (i + 2) % 3;
+      a[i] = (long long)(vy[j] - vy[k]) * orientation;
+      b[i] = (long long)(vx[k] - vx[j]) * orientation;
+      c[i] = -a[i] * vx[j] - b[i] * vy[j];
+
+      // The edge function of vertex i is the barycentric weight of its reciprocal depth,
+      // times the area.
+      double weight = position[i].w / (double)(area * orientation);
+      planeX += weight * a[i] * SubpixelScale;
+      planeY += weight * b[i] * SubpixelScale;
+      plane0 += weight * (c[i] + (a[i] + b[i]) * (SubpixelScale / 2));
+    }
+
+    const int x0 = bounds[0];
+    const int last = bounds[2] - x0;
+    const float stepX = (float)planeX;
+
+    for (int y = bounds[1]; y <= bounds[3]; y++)
+    {
+      // Find the texels of the row inside all three edges.
+      int first = 0, end = last;
+      for (int i = 0; i < 3 && first <= end; i++)
+      {
+        long long step = a[i] * SubpixelScale;
+        long long e = a[i] * (x0 * SubpixelScale + SubpixelScale / 2) +
+                      b[i] * (y * SubpixelScale + SubpixelScale / 2) + c[i];
+
+        if (step > 0)
+        {
+          if (e < 0)
+            first = (int)std::min(std::max((long long)first, (-e + step - 1) / step),
+                                  (long long)last + 1);
+        }
+        else if (e < 0)
+          end = -1;
+        else if (step < 0)
+          end = (int)std::min((long long)end, e / -step);
+      }
+
+      float rowDepth = (float)(plane0 + planeX * x0 + planeY * y);
+      float *row = depths + (size_t)y * size + x0;
+      for (int x = first; x <= end; x++)
+        row[x] = std::max(row[x], rowDepth + stepX * (float)x);
+    }
+  }
+  /**
+   * The number of bits of the keys sorted by each pass of the radix sort
+   */
+  const int RadixBits = 8;
+  const int RadixBuckets = 1 << RadixBits;
+
+  /**
+   * The smallest number of keys each thread handles in a pass of the radix sort
+   */
+  const int MinRadixChunkSize = 16384;
+
+  /**
+   * The order of the previous frame is only repaired if at most one in this many
+   * neighboring triangles are out of order in it
+   */
+  const int RepairDescentRatio = 64;
+
+  /**
+   * The insertion sort repairing the order of the previous frame gives up after moving the
+   * triangles by this many places per triangle in total
+   */
+  const int RepairMoveLimit = 4;
+
+  /**
+   * Maps a float to an unsigned integer with the same order, with negative values below
+   * positive ones.
+   */
+  unsigned int GetSortableBits(float value)
+  {
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+  }
+
+  /**
+   * Sorts values by their keys with a stable LSD radix sort. Each pass counts the digits
+   * of the keys in chunks on all threads, and then moves every chunk's keys to their place
+   * behind the ones of the chunks before with the same digit. Passes in which all keys have
+   * the same digit are skipped.
+   *
+   * @param keys The keys
+   * @param values The values, as many as keys
+   * @param keyBuffer The buffer the keys are moved into, which is swapped with keys after
+   *   every pass
+   * @param valueBuffer The buffer the values are moved into
+   */
+  void RadixSort(vector<unsigned int> &keys, vector<unsigned int> &values,
+                 vector<unsigned int> &keyBuffer, vector<unsigned int> &valueBuffer)
+  {
+    const int count = (int)keys.size();
+    if (count < 2)
+      return;
+
+    keyBuffer.resize(count);
+    valueBuffer.resize(count);
+
+    const int chunkSize = std::max((count + GetThreadCount() - 1) / GetThreadCount(),
+                                   MinRadixChunkSize);
+    const int chunkCount = (count + chunkSize - 1) / chunkSize;
+    vector<unsigned int> offsets((size_t)chunkCount * RadixBuckets);
+
+    for (int shift = 0; shift < 32; shift += RadixBits)
+    {
+      ParallelFor(0, count, chunkSize, [&](int begin, int end)
+      {
+        unsigned int *chunkOffsets = &offsets[(size_t)(begin / chunkSize) * RadixBuckets];
+        std::fill(chunkOffsets, chunkOffsets + RadixBuckets, 0u);
+        for (int i = begin; i < end; i++)
+          chunkOffsets[(keys[i] >> shift) & (RadixBuckets - 1)]++;
+      });
+
+      unsigned int firstDigit = (keys[0] >> shift) & (RadixBuckets - 1);
+      int sameDigit = 0;
+      for (int chunk = 0; chunk < chunkCount; chunk++)
+        sameDigit += offsets[(size_t)chunk * RadixBuckets + firstDigit];
+
+      if (sameDigit == count)
+        continue;
+
+      unsigned int position = 0;
+      for (int digit = 0; digit < RadixBuckets; digit++)
+      {
+        for (int chunk = 0; chunk < chunkCount; chunk++)
+        {
+          unsigned int &offset = offsets[(size_t)chunk * RadixBuckets + digit];
+          unsigned int digitCount = offset;
+          offset = position;
+          position += digitCount;
+        }
+      }
+
+      ParallelFor(0, count, chunkSize, [&](int begin, int end)
+      {
+        unsigned int *chunkOffsets = &offsets[(size_t)(begin / chunkSize) * RadixBuckets];
+        for (int i = begin; i < end; i++)
+        {
+          unsigned int target = chunkOffsets[(keys[i] >> shift) & (RadixBuckets - 1)]++;
+          keyBuffer[target] = keys[i];
+          valueBuffer[target] = values[i];
+        }
+      });
+
+      keys.swap(keyBuffer);
+      values.swap(valueBuffer);
+    }
+  }
 }
 
-// Compute barycentric coordinates (u, v, w) for
-// point p with respect to triangle (a, b, c)
-void SimpleRasterizer::Barycentric(vec3 p, vec3 a, vec3 b, vec3 c, float &u, float &v, float &w)
-{
-    vec3 v0 = b - a, v1 = c - a, v2 = p - a;
-    float d00 = dot(v0, v0);
-    float d01 = dot(v0, v1);
-    float d11 = dot(v1, v1);
-    float d20 = dot(v2, v0);
-    float d21 = dot(v2, v1);
-    float denom = d00 * d11 - d01 * d01;
-    v = (d11 * d20 - d01 * d21) / denom;
-    w = (d00 * d21 - d01 * d20) / denom;
-    u = 1.0f - v - w;
-}
+void SimpleRasterizer::BinTriangles()
+{
+  const int width = image->GetWidth();
+  const int height = image->GetHeight();
+  const int triangleCount = (int)screenTriangles.size();
+  const int tileCount = (int)tiles.size();
+
+  // Every thread bins a consecutive range of triangles into its own set of bins, so no
+  // locking is needed and the tiles can draw the ranges one after another in their original
+  // order.
+  binRangeSize = std::max((triangleCount + GetThreadCount() - 1) / GetThreadCount(), 1);
+  int rangeCount = (triangleCount + binRangeSize - 1) / binRangeSize;
+
+  bins.resize(std::max((size_t)rangeCount * tileCount, bins.size()));
+  rangeStatistics.assign(rangeCount, Statistics());
+
+  ParallelFor(0, triangleCount, binRangeSize, [&](int begin, int end)
+  {
+    int range = begin / binRangeSize;
+    vector<unsigned int> *rangeBins = &bins[(size_t)range * tileCount];
+    Statistics &rangeStatistics = this->rangeStatistics[range];
+
+    for (int i = 0; i < tileCount; i++)
+      rangeBins[i].clear();
+
+    for (int i = begin; i < end; i++)
+    {
+      vec4 position[3];
+      for (int v = 0; v < 3; v++)
+        position[v] = transformedPositions[screenTriangles[i].vertex[v]];
+
+      int vx[3], vy[3], bounds[4];
+      long long area;
+      if (!SnapTriangle(position, width, height, vx, vy, area, bounds, sampleExtent))
+        continue;
+
+      // Counterclockwise triangles have a negative area, since the y axis points down.
+      if (area == 0)
+      {
+        rangeStatistics.culledZeroArea++;
+        continue;
+      }
+      if (backfaceCulling && area > 0)
+      {
+        rangeStatistics.culledBackfaces++;
+        continue;
+      }
+      if (bounds[0] > bounds[2] || bounds[1] > bounds[3])
+      {
+        rangeStatistics.culledSmallTriangles++;
+        continue;
+      }
+
+      rangeStatistics.triangles++;
+
+      for (int y = bounds[1] / TileSize; y <= bounds[3] / TileSize; y++)
+      {
+        for (int x = bounds[0] / TileSize; x <= bounds[2] / TileSize; x++)
+          rangeBins[y * tileColumns + x].push_back(i);
+      }
+    }
+  });
+
+  for (int range = 0; range < rangeCount; range++)
+  {
+    statistics.culledZeroArea += rangeStatistics[range].culledZeroArea;
+    statistics.culledBackfaces += rangeStatistics[range].culledBackfaces;
+    statistics.culledSmallTriangles += rangeStatistics[range].culledSmallTriangles;
+    statistics.triangles += rangeStatistics[range].triangles;
+  }
+}
+
+float SimpleRasterizer::GetBlockMaxZ(int block, int x, int y)
+{
+  HiZBlock &hiZBlock = hiZ[block];
+  if (!hiZBlock.stale)
+    return hiZBlock.maxZ;
+
+  const int width = image->GetWidth();
+  int endX = std::min(x + BlockSize, width);
+  int endY = std::min(y + BlockSize, image->GetHeight());
+  float maxZ = -FLT_MAX;
+
+#ifdef RAYTRACER_SSE2
+  if (endX == x + BlockSize)
+  {
+    __m128 maxZs = _mm_set1_ps(maxZ);
+    for (int row = y; row < endY; row++)
+    {
+      const float *depth = &zBuffer[0] + row * width + x;
+      for (int column = 0; column < BlockSize; column += 4)
+        maxZs = _mm_max_ps(maxZs, _mm_loadu_ps(depth + column));
+    }
+
+    maxZs = _mm_max_ps(maxZs, _mm_shuffle_ps(maxZs, maxZs, _MM_SHUFFLE(1, 0, 3, 2)));
+    maxZs = _mm_max_ps(maxZs, _mm_shuffle_ps(maxZs, maxZs, _MM_SHUFFLE(2, 3, 0, 1)));
+    maxZ = _mm_cvtss_f32(maxZs);
+  }
+  else
+#endif
+  {
+    for (int row = y; row < endY; row++)
+    {
+      const float *depth = &zBuffer[0] + row * width;
+      for (int column = x; column < endX; column++)
+        maxZ = std::max(maxZ, depth[column]);
+    }
+  }
+
+  hiZBlock.stale = false;
+  if (maxZ < hiZBlock.maxZ)
+  {
+    hiZBlock.maxZ = maxZ;
+    tiles[(y / TileSize) * tileColumns + x / TileSize].staleMaxZ = true;
+  }
+
+  return hiZBlock.maxZ;
+}
+
+float SimpleRasterizer::GetTileMaxZ(Tile &tile)
+{
+  if (!tile.staleMaxZ)
+    return tile.maxZ;
+
+  // Blocks whose farthest pixel has not been searched yet still contribute their old,
+  // larger value, which keeps the result conservative.
+  float maxZ = -FLT_MAX;
+  for (int y = tile.minY; y <= tile.maxY; y += BlockSize)
+  {
+    const HiZBlock *row = &hiZ[(y / BlockSize) * blockColumns];
+    for (int x = tile.minX; x <= tile.maxX; x += BlockSize)
+      maxZ = std::max(maxZ, row[x / BlockSize].maxZ);
+  }
+
+  tile.maxZ = maxZ;
+  tile.staleMaxZ = false;
+
+  return maxZ;
+}
+
+const Texture *SimpleRasterizer::GetMeshTexture(const Mesh *mesh)
+{
+  Material *material = mesh->GetMaterial();
+  if (material == NULL || material->GetTexture() == NULL ||
+      material->GetTexture()->GetLevelCount() == 0 || mesh->GetTextureCoords().empty())
+  {
+    return NULL;
+  }
+
+  return material->GetTexture();
+}
+
+float SimpleRasterizer::GetTextureLod(const Texture &texture, const float *blockPlanes,
+                                      const float *planeDx, const float *planeDy, int column,
+                                      int row) const
+{
+  // The texture coordinates are the quotients of their planes and plane 0, so their
+  // derivatives follow from the quotient rule.
+  const int u = textureVarying + 1, v = textureVarying + 2;
+  float pw = blockPlanes[0] + planeDx[0] * (float)column + planeDy[0] * (float)row;
+  float pu = blockPlanes[u] + planeDx[u] * (float)column + planeDy[u] * (float)row;
+  float pv = blockPlanes[v] + planeDx[v] * (float)column + planeDy[v] * (float)row;
+  float inverseW2 = 1.0f / (pw * pw);
+
+  return texture.GetLod((planeDx[u] * pw - pu * planeDx[0]) * inverseW2,
+                        (planeDx[v] * pw - pv * planeDx[0]) * inverseW2,
+                        (planeDy[u] * pw - pu * planeDy[0]) * inverseW2,
+                        (planeDy[v] * pw - pv * planeDy[0]) * inverseW2);
+}
+
+template <bool depthOnly>
+void SimpleRasterizer::DrawTriangle(const ScreenTriangle &t, Tile &tile)
+{
+  vec4 position[3];
+  for (int i = 0; i < 3; i++)
+    position[i] = transformedPositions[t.vertex[i]];
+
+  int vx[3], vy[3], bounds[4];
+  long long area;
+  if (!SnapTriangle(position, image->GetWidth(), image->GetHeight(), vx, vy, area, bounds,
+                    sampleExtent) || area == 0)
+  {
+    return;
+  }
+
+  // Only draw the part of the triangle within the tile.
+  int minX = std::max(bounds[0], tile.minX);
+  int minY = std::max(bounds[1], tile.minY);
+  int maxX = std::min(bounds[2], tile.maxX);
+  int maxY = std::min(bounds[3], tile.maxY);
+
+  if (minX > maxX || minY > maxY)
+    return;
+
+  Statistics &statistics = tile.statistics;
+
+  // The painter's algorithm draws opaque triangles over everything drawn before them.
+  const bool painted = (!depthOnly && visibility == Visibility_Painter && !(t.opacity < 1.0f));
+
+  // Skip the triangle if it lies behind everything drawn into the tile so far. As with
+  // blocks, the bound is only updated if the triangle is not in front of the whole tile.
+  float minZ = std::min(std::min(position[0].z, position[1].z), position[2].z) - DepthMargin;
+  float maxZ = std::max(std::max(position[0].z, position[1].z), position[2].z) + DepthMargin;
+
+  if (!painted && !(minZ < tile.minZ) && !(minZ < GetTileMaxZ(tile)))
+  {
+    if (!depthOnly)
+    {
+      statistics.culledTriangles++;
+      statistics.culledPixels += (maxX - minX + 1) * (maxY - minY + 1);
+    }
+    return;
+  }
+
+  // Translucent triangles leave the z buffer alone and add their fragments to the fragment
+  // lists. Deferred shading cannot light them later, so they are lit like with Phong
+  // shading.
+  const bool translucent = (t.opacity < 1.0f);
+  const bool lightPixels = (shading == Shading_Phong ||
+                            (shading == Shading_Deferred && translucent));
+
+  // Textures modulate the interpolated color, which is the lit color with Gouraud shading and
+  // the diffuse color otherwise.
+  const Texture *texture = (textureVarying >= 0 ? t.texture : NULL);
+  const int tu = textureVarying, tv = textureVarying + 1;
+
+  // With multisampling, opaque triangles are tested at the samples instead of the pixel
+  // centers, which lie up to extent subpixels away.
+  const bool multisampled = (!depthOnly && samples > 1 && !translucent);
+  const int extent = (multisampled ? sampleExtent : 0);
+
+  // After the depth pre-pass, the z buffer holds the nearest depth of every pixel already,
+  // and only the first fragment at exactly that depth is shaded.
+  const bool equalDepth = (!depthOnly && visibility == Visibility_DepthPrepass &&
+                           samples == 1 && !translucent);
+
+  // Both sides of the triangles are drawn, so flip the winding of back faces to make the
+  // inside of all edges positive.
+  int order[3] = {0, 1, 2};
+  if (area < 0)
+  {
+    std::swap(order[1], order[2]);
+    area = -area;
+  }
+
+  // Edge i lies opposite vertex order[i]. Its edge function a * x + b * y + c is twice the
+  // area of the triangle formed by the edge and the point (x, y), in subpixel units, so
+  // dividing it by the area of the whole triangle yields the barycentric coordinate of vertex
+  // order[i]. Pixels on edges that are not top or left edges are excluded by the bias.
+  //
+  // The depth is interpolated linearly in screen space. The varyings are not, since the
+  // perspective divide bends them. Instead, 1 / w and every varying divided by w are
+  // interpolated, which are linear in screen space, and divided by each other per pixel.
+  // These values are the planes: plane 0 is 1 / w, plane k is varying k - 1 divided by w.
+  // Drawing only the depth needs none of them.
+  const int planeCount = (depthOnly ? 0 : 1 + varyingCount);
+  long long a[3], b[3], c[3];
+  int bias[3];
+  float z[3];
+  float planes[3][1 + MaxVaryings];
+
+  for (int i = 0; i < 3; i++)
+  {
+    int j = order[(i + 1) % 3];
+    int k = order[(i + 2) % 3];
+
+    a[i] = vy[j] - vy[k];
+    b[i] = vx[k] - vx[j];
+    c[i] = -(a[i] * vx[j] + b[i] * vy[j]);
+    bias[i] = (a[i] > 0 || (a[i] == 0 && b[i] > 0)) ? 0 : -1;
+
+    const vec4 &p = position[order[i]];
+    const float *vertexVaryings = &varyings[t.vertex[order[i]] * (size_t)varyingCount];
+
+    z[i] = p.z;
+    planes[i][0] = p.w;
+    for (int k = 1; k < planeCount; k++)
+      planes[i][k] = vertexVaryings[k - 1] * p.w;
+  }
+
+  // The changes of the interpolated values from one pixel to the next
+  const float inverseArea = 1.0f / (float)area;
+  float dzdx = 0.0f, dzdy = 0.0f;
+  float planeDx[1 + MaxVaryings], planeDy[1 + MaxVaryings];
+
+  for (int k = 0; k < planeCount; k++)
+    planeDx[k] = planeDy[k] = 0.0f;
+
+  for (int i = 0; i < 3; i++)
+  {
+    float dldx = (float)(a[i] * SubpixelScale) * inverseArea;
+    float dldy = (float)(b[i] * SubpixelScale) * inverseArea;
+
+    dzdx += z[i] * dldx;
+    dzdy += z[i] * dldy;
+    for (int k = 0; k < planeCount; k++)
+    {
+      planeDx[k] += planes[i][k] * dldx;
+      planeDy[k] += planes[i][k] * dldy;
+    }
+  }
+
+  const int width = image->GetWidth();
+  const int half = SubpixelScale / 2;
+  vec3 *pixels = image->GetPixels();
+
+  // The offsets of the edge functions and the depth from the pixel center to each sample
+  int sampleEdges[3][MaxSamples];
+  float sampleZs[MaxSamples];
+
+  if (multisampled)
+  {
+    for (int s = 0; s < samples; s++)
+    {
+      int sx = samplePositions[s][0];
+      int sy = samplePositions[s][1];
+
+      for (int i = 0; i < 3; i++)
+        sampleEdges[i][s] = (int)(a[i] * sx + b[i] * sy);
+      sampleZs[s] = dzdx * ((float)sx / SubpixelScale) + dzdy * ((float)sy / SubpixelScale);
+    }
+  }
+
+#ifdef RAYTRACER_SSE2
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  const __m128 zSteps = _mm_mul_ps(_mm_set1_ps(dzdx), laneOffsets);
+  __m128 planeSteps[1 + MaxVaryings];
+  for (int k = 0; k < planeCount; k++)
+    planeSteps[k] = _mm_mul_ps(_mm_set1_ps(planeDx[k]), laneOffsets);
+#endif
+
+  for (int by = minY & ~(BlockSize - 1); by <= maxY; by += BlockSize)
+  {
+    for (int bx = minX & ~(BlockSize - 1); bx <= maxX; bx += BlockSize)
+    {
+      // Evaluate the edge functions at the center of the first pixel of the block. Since
+      // they are linear, their extremes over the block are found at its corner pixels.
+      long long px = (long long)bx * SubpixelScale + half;
+      long long py = (long long)by * SubpixelScale + half;
+
+      long long e[3];
+      bool partial[3];
+      bool outside = false;
+
+      for (int i = 0; i < 3; i++)
+      {
+        e[i] = a[i] * px + b[i] * py + c[i];
+
+        long long spanX = a[i] * (SubpixelScale * (BlockSize - 1));
+        long long spanY = b[i] * (SubpixelScale * (BlockSize - 1));
+        long long reach = (std::abs(a[i]) + std::abs(b[i])) * extent;
+        long long low = e[i] + bias[i] + std::min(spanX, 0LL) + std::min(spanY, 0LL) - reach;
+        long long high = e[i] + bias[i] + std::max(spanX, 0LL) + std::max(spanY, 0LL) + reach;
+
+        if (high < 0)
+          outside = true;
+        partial[i] = (low < 0);
+      }
+
+      if (outside)
+        continue;
+
+      // Only visit the part of the block within the bounding box.
+      int startX = std::max(bx, minX);
+      int startY = std::max(by, minY);
+      int endX = std::min(bx + BlockSize - 1, maxX);
+      int endY = std::min(by + BlockSize - 1, maxY);
+
+      // The interpolated values at the first pixel of the block
+      float blockZ = 0.0f;
+      float blockPlanes[1 + MaxVaryings];
+      for (int k = 0; k < planeCount; k++)
+        blockPlanes[k] = 0.0f;
+
+      for (int i = 0; i < 3; i++)
+      {
+        float l = (float)e[i] * inverseArea;
+        blockZ += z[i] * l;
+        for (int k = 0; k < planeCount; k++)
+          blockPlanes[k] += planes[i][k] * l;
+      }
+
+      // The depth of the triangle within the block lies between its values at the corners of
+      // the block and between the depths of its vertices. Skip the block if all of its pixels
+      // are closer already, and skip the depth test if all of its pixels are farther away.
+      float cornerZX = dzdx * (BlockSize - 1);
+      float cornerZY = dzdy * (BlockSize - 1);
+      float blockMinZ = std::max(blockZ + std::min(cornerZX, 0.0f) + std::min(cornerZY, 0.0f) -
+                                 DepthMargin, minZ);
+      float blockMaxZ = std::min(blockZ + std::max(cornerZX, 0.0f) + std::max(cornerZY, 0.0f) +
+                                 DepthMargin, maxZ);
+
+      if (multisampled)
+      {
+        // The samples lie up to extent subpixels beyond the corner pixel centers.
+        float reachZ = (fabsf(dzdx) + fabsf(dzdy)) * ((float)extent / SubpixelScale);
+        blockMinZ = std::max(blockMinZ - reachZ, minZ);
+        blockMaxZ = std::min(blockMaxZ + reachZ, maxZ);
+      }
+
+      // Searching the z buffer for the farthest pixel is only worth it if the triangle is
+      // not in front of all pixels of the block anyway.
+      int block = (by / BlockSize) * blockColumns + bx / BlockSize;
+      if (!painted && !(blockMinZ < hiZ[block].minZ) &&
+          !(blockMinZ < GetBlockMaxZ(block, bx, by)))
+      {
+        if (!depthOnly)
+        {
+          statistics.culledBlocks++;
+          statistics.culledPixels += (endX - startX + 1) * (endY - startY + 1);
+        }
+        continue;
+      }
+
+      if (!depthOnly)
+        statistics.blocks++;
+
+      bool depthTest = equalDepth || (!painted && !(blockMaxZ < hiZ[block].minZ));
+      bool written = false;
+
+      // Multisampling keeps the sample depths of four pixels together, so its quads start at
+      // multiples of four. The pixels added in front lie outside the bounds of the triangle
+      // and fail the coverage test.
+      if (multisampled)
+        startX &= ~3;
+
+      // The values of partially covered edges stay within the range of the block's corners,
+      // which has a zero crossing, so they can be stepped from pixel to pixel in 32 bits.
+      // Edges that cover the whole block are replaced by a constant 0, which passes.
+#ifdef RAYTRACER_SSE2
+      __m128i rowEdges[3], edgeStepsX[3], edgeStepsY[3];
+#else
+      int rowEdges[3], edgeStepsX[3], edgeStepsY[3];
+#endif
+      for (int i = 0; i < 3; i++)
+      {
+        int value = 0, stepX = 0, stepY = 0;
+        if (partial[i])
+        {
+          value = (int)(e[i] + bias[i] + a[i] * (SubpixelScale * (startX - bx)) +
+                        b[i] * (SubpixelScale * (startY - by)));
+          stepX = (int)(a[i] * SubpixelScale);
+          stepY = (int)(b[i] * SubpixelScale);
+        }
+
+#ifdef RAYTRACER_SSE2
+        rowEdges[i] = _mm_setr_epi32(value, value + stepX, value + 2 * stepX, value + 3 * stepX);
+        edgeStepsX[i] = _mm_set1_epi32(4 * stepX);
+        edgeStepsY[i] = _mm_set1_epi32(stepY);
+#else
+        rowEdges[i] = value;
+        edgeStepsX[i] = stepX;
+        edgeStepsY[i] = stepY;
+#endif
+      }
+
+      if (multisampled)
+      {
+        // The samples are tested like the pixel centers, for four pixels at a time and one
+        // sample after the other. Every pixel is shaded once, at its center if all of its
+        // samples take the color and at its first covered sample otherwise, so that the
+        // varyings are never extrapolated beyond the triangle.
+        //
+        // The offsets of the edges from the pixel centers to the samples are constant. The
+        // largest offset of each edge rejects the quads no sample covers with one test per
+        // edge.
+        SampleBlock sampleBlock;
+        sampleBlock.texture = texture;
+        sampleBlock.lightPixels = lightPixels;
+        sampleBlock.depthTest = depthTest;
+        sampleBlock.inner = !partial[0] && !partial[1] && !partial[2];
+        sampleBlock.planeCount = planeCount;
+        sampleBlock.blockZ = blockZ;
+        sampleBlock.dzdx = dzdx;
+        sampleBlock.dzdy = dzdy;
+        sampleBlock.blockPlanes = blockPlanes;
+        sampleBlock.planeDx = planeDx;
+        sampleBlock.planeDy = planeDy;
+        sampleBlock.sampleZs = sampleZs;
+
+        for (int i = 0; i < 3; i++)
+        {
+          int reachEdge = 0;
+          for (int s = 0; s < samples; s++)
+          {
+            int offset = (partial[i] ? sampleEdges[i][s] : 0);
+            reachEdge = std::max(reachEdge, offset);
+#ifdef RAYTRACER_SSE2
+            sampleBlock.sampleEdges[i][s] = _mm_set1_epi32(offset);
+#else
+            sampleBlock.sampleEdges[i][s] = offset;
+#endif
+          }
+
+#ifdef RAYTRACER_SSE2
+          sampleBlock.reachEdges[i] = _mm_set1_epi32(reachEdge);
+#else
+          sampleBlock.reachEdges[i] = reachEdge;
+          sampleBlock.edgeStepsX[i] = edgeStepsX[i];
+#endif
+        }
+
+        for (int y = startY; y <= endY; y++)
+        {
+          EdgeQuad edges[3];
+          for (int i = 0; i < 3; i++)
+            edges[i] = rowEdges[i];
+
+          for (int x = startX; x <= endX; x += 4)
+          {
+            if (DrawSampleQuad(sampleBlock, edges, x, y, x - bx, y - by,
+                               std::min(4, endX - x + 1), tile))
+            {
+              written = true;
+            }
+
+            for (int i = 0; i < 3; i++)
+            {
+#ifdef RAYTRACER_SSE2
+              edges[i] = _mm_add_epi32(edges[i], edgeStepsX[i]);
+#else
+              edges[i] += 4 * edgeStepsX[i];
+#endif
+            }
+          }
+
+          for (int i = 0; i < 3; i++)
+          {
+#ifdef RAYTRACER_SSE2
+            rowEdges[i] = _mm_add_epi32(rowEdges[i], edgeStepsY[i]);
+#else
+            rowEdges[i] += edgeStepsY[i];
+#endif
+          }
+        }
+      }
+      else
+      {
+        for (int y = startY; y <= endY; y++)
+        {
+          int row = y - by;
+
+#ifdef RAYTRACER_SSE2
+          __m128i edges[3];
+#else
+          int edges[3];
+#endif
+          for (int i = 0; i < 3; i++)
+            edges[i] = rowEdges[i];
+
+          for (int x = startX; x <= endX; x += 4)
+          {
+            int column = x - bx;
+            int lanes = std::min(4, endX - x + 1);
+            int mask = (1 << lanes) - 1;
+            float *depth = &zBuffer[0] + y * width + x;
+            unsigned char *shaded = &shadedPixels[0] + y * width + x;
+            vec3 *target = pixels + y * width + x;
+
+#ifdef RAYTRACER_SSE2
+            __m128i inside = _mm_set1_epi32(-1);
+            for (int i = 0; i < 3; i++)
+            {
+              inside = _mm_andnot_si128(_mm_srai_epi32(edges[i], 31), inside);
+              edges[i] = _mm_add_epi32(edges[i], edgeStepsX[i]);
+            }
+
+            mask &= _mm_movemask_ps(_mm_castsi128_ps(inside));
+            if (mask == 0)
+              continue;
+
+            if (!depthOnly)
+              statistics.fragments += LaneCounts[mask];
+
+            __m128 quadZs = _mm_add_ps(_mm_set1_ps(blockZ + dzdx * column + dzdy * row), zSteps);
+            if (depthTest)
+            {
+              __m128 oldZs;
+              if (lanes == 4)
+                oldZs = _mm_loadu_ps(depth);
+              else
+              {
+                float values[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+                for (int lane = 0; lane < lanes; lane++)
+                  values[lane] = depth[lane];
+                oldZs = _mm_loadu_ps(values);
+              }
+
+              mask &= _mm_movemask_ps(equalDepth ? _mm_cmple_ps(quadZs, oldZs) :
+                                                   _mm_cmplt_ps(quadZs, oldZs));
+
+              // Later fragments at the same depth leave the shaded pixels alone, like the
+              // strict test of the z buffer mode.
+              if (equalDepth)
+              {
+                for (int lane = 0; lane < lanes; lane++)
+                {
+                  if (shaded[lane])
+                    mask &= ~(1 << lane);
+                  else if (mask & (1 << lane))
+                    shaded[lane] = 1;
+                }
+              }
+
+              if (mask == 0)
+                continue;
+            }
+            else if (!depthOnly)
+              statistics.fragmentsAccepted += LaneCounts[mask];
+
+            if (depthOnly)
+            {
+              statistics.prepassFragments += LaneCounts[mask];
+              written = true;
+
+              if (mask == 0xf)
+                _mm_storeu_ps(depth, quadZs);
+              else
+              {
+                float zs[4];
+                _mm_storeu_ps(zs, quadZs);
+                for (int lane = 0; lane < lanes; lane++)
+                {
+                  if (mask & (1 << lane))
+                    depth[lane] = zs[lane];
+                }
+              }
+              continue;
+            }
+
+            if (!translucent)
+            {
+              statistics.fragmentsWritten += LaneCounts[mask];
+              written = true;
+            }
+
+            // Recover the varyings from the planes.
+            __m128 values[MaxVaryings];
+            __m128 w = _mm_div_ps(one, _mm_add_ps(_mm_set1_ps(
+                blockPlanes[0] + planeDx[0] * (float)column + planeDy[0] * (float)row),
+                planeSteps[0]));
+            for (int k = 1; k < planeCount; k++)
+            {
+              __m128 plane = _mm_add_ps(_mm_set1_ps(blockPlanes[k] + planeDx[k] * (float)column +
+                                                    planeDy[k] * (float)row), planeSteps[k]);
+              values[k - 1] = _mm_mul_ps(plane, w);
+            }
+
+            if (texture != NULL)
+            {
+              __m128 texel[3];
+              texture->SampleQuad(values[tu], values[tv], GetTextureLod(*texture, blockPlanes,
+                                  planeDx, planeDy, column, row), texel);
+              for (int c = 0; c < 3; c++)
+                values[c] = _mm_mul_ps(values[c], texel[c]);
+            }
+
+            // Deferred shading stores the diffuse color in the image for now.
+            __m128 quadRs, quadGs, quadBs;
+            if (!lightPixels)
+            {
+              quadRs = values[0];
+              quadGs = values[1];
+              quadBs = values[2];
+            }
+            else
+            {
+              __m128 *normal = values + 3;
+              __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+                  _mm_mul_ps(normal[0], normal[0]), _mm_mul_ps(normal[1], normal[1])),
+                  _mm_mul_ps(normal[2], normal[2]))));
+              for (int c = 0; c < 3; c++)
+                normal[c] = _mm_mul_ps(normal[c], inverseLength);
+
+              __m128 result[3];
+              LightQuad(values + 6, normal, values, result);
+              quadRs = result[0];
+              quadGs = result[1];
+              quadBs = result[2];
+            }
+
+            if (translucent)
+            {
+              float zs[4], rs[4], gs[4], bs[4];
+              _mm_storeu_ps(zs, quadZs);
+              _mm_storeu_ps(rs, quadRs);
+              _mm_storeu_ps(gs, quadGs);
+              _mm_storeu_ps(bs, quadBs);
+
+              for (int lane = 0; lane < lanes; lane++)
+              {
+                if (mask & (1 << lane))
+                {
+                  AddFragment(tile, y * width + x + lane, vec3(rs[lane], gs[lane], bs[lane]),
+                              zs[lane], t.opacity);
+                }
+              }
+              continue;
+            }
+
+            if (mask == 0xf)
+            {
+              _mm_storeu_ps(depth, quadZs);
+              StoreVec3x4(target, quadRs, quadGs, quadBs);
+
+              if (shading == Shading_Deferred)
+              {
+                StoreVec3x4(&gBufferNormals[y * width + x], values[3], values[4], values[5]);
+                StoreVec3x4(&gBufferPositions[y * width + x], values[6], values[7], values[8]);
+              }
+              continue;
+            }
+
+            float zs[4], rs[4], gs[4], bs[4];
+            _mm_storeu_ps(zs, quadZs);
+            _mm_storeu_ps(rs, quadRs);
+            _mm_storeu_ps(gs, quadGs);
+            _mm_storeu_ps(bs, quadBs);
+
+            float laneValues[MaxVaryings][4];
+            if (shading == Shading_Deferred)
+            {
+              for (int k = 3; k < 9; k++)
+                _mm_storeu_ps(laneValues[k], values[k]);
+            }
+
+            for (int lane = 0; lane < lanes; lane++)
+            {
+              if (mask & (1 << lane))
+              {
+                depth[lane] = zs[lane];
+                target[lane] = vec3(rs[lane], gs[lane], bs[lane]);
+
+                if (shading == Shading_Deferred)
+                {
+                  gBufferNormals[y * width + x + lane] =
+                      vec3(laneValues[3][lane], laneValues[4][lane], laneValues[5][lane]);
+                  gBufferPositions[y * width + x + lane] =
+                      vec3(laneValues[6][lane], laneValues[7][lane], laneValues[8][lane]);
+                }
+              }
+            }
+#else
+            for (int lane = 0; lane < lanes; lane++)
+            {
+              for (int i = 0; i < 3; i++)
+              {
+                if (edges[i] + edgeStepsX[i] * lane < 0)
+                  mask &= ~(1 << lane);
+              }
+            }
+
+            for (int i = 0; i < 3; i++)
+              edges[i] += 4 * edgeStepsX[i];
+
+            if (mask == 0)
+              continue;
+
+            float quadZ = blockZ + dzdx * column + dzdy * row;
+            if (depthOnly)
+            {
+              for (int lane = 0; lane < lanes; lane++)
+              {
+                float pixelZ = quadZ + dzdx * (float)lane;
+                if (!(mask & (1 << lane)) || (depthTest && !(pixelZ < depth[lane])))
+                  continue;
+
+                statistics.prepassFragments++;
+                written = true;
+                depth[lane] = pixelZ;
+              }
+              continue;
+            }
+
+            statistics.fragments += LaneCounts[mask];
+
+            float quadPlanes[1 + MaxVaryings];
+            for (int k = 0; k < planeCount; k++)
+              quadPlanes[k] = blockPlanes[k] + planeDx[k] * (float)column + planeDy[k] * (float)row;
+
+            float lod = 0.0f;
+            if (texture != NULL)
+              lod = GetTextureLod(*texture, blockPlanes, planeDx, planeDy, column, row);
+
+            for (int lane = 0; lane < lanes; lane++)
+            {
+              float pixelZ = quadZ + dzdx * (float)lane;
+
+              if (!(mask & (1 << lane)) || (depthTest && !(pixelZ < depth[lane]) &&
+                                            !(equalDepth && pixelZ == depth[lane])))
+              {
+                continue;
+              }
+
+              if (equalDepth)
+              {
+                if (shaded[lane])
+                  continue;
+                shaded[lane] = 1;
+              }
+
+              if (!depthTest)
+                statistics.fragmentsAccepted++;
+
+              // Recover the varyings from the planes.
+              float values[MaxVaryings];
+              float w = 1.0f / (quadPlanes[0] + planeDx[0] * (float)lane);
+              for (int k = 1; k < planeCount; k++)
+                values[k - 1] = (quadPlanes[k] + planeDx[k] * (float)lane) * w;
+
+              if (texture != NULL)
+              {
+                vec3 texel = texture->Sample(values[tu], values[tv], lod);
+                for (int c = 0; c < 3; c++)
+                  values[c] *= texel[c];
+              }
+
+              vec3 color(values[0], values[1], values[2]);
+              if (lightPixels)
+              {
+                vec3 normal = normalize(vec3(values[3], values[4], values[5]));
+                color = LightVertex(vec4(values[6], values[7], values[8], 1.0f), normal, color);
+              }
+
+              if (translucent)
+              {
+                AddFragment(tile, y * width + x + lane, color, pixelZ, t.opacity);
+                continue;
+              }
+
+              statistics.fragmentsWritten++;
+              written = true;
+
+              depth[lane] = pixelZ;
+              target[lane] = color;
+
+              if (shading == Shading_Deferred)
+              {
+                // Only fill the G-buffer, ShadeTile() lights the pixel later.
+                gBufferNormals[y * width + x + lane] = vec3(values[3], values[4], values[5]);
+                gBufferPositions[y * width + x + lane] = vec3(values[6], values[7], values[8]);
+              }
+            }
+#endif
+          }
+
+          for (int i = 0; i < 3; i++)
+          {
+#ifdef RAYTRACER_SSE2
+            rowEdges[i] = _mm_add_epi32(rowEdges[i], edgeStepsY[i]);
+#else
+            rowEdges[i] += edgeStepsY[i];
+#endif
+          }
+        }
+      }
+
+      if (written)
+      {
+        // If the triangle covers the whole block, every pixel is at most as far away as the
+        // farthest point of the triangle within the block now. Otherwise, the farthest pixel
+        // has to be searched when the block is tested the next time.
+        bool covered = !partial[0] && !partial[1] && !partial[2] && startX == bx &&
+                       startY == by && endX == bx + BlockSize - 1 && endY == by + BlockSize - 1;
+
+        HiZBlock &hiZBlock = hiZ[block];
+        hiZBlock.minZ = std::min(hiZBlock.minZ, blockMinZ);
+        tile.minZ = std::min(tile.minZ, blockMinZ);
+
+        if (painted)
+        {
+          // The painted pixels may lie farther away than the ones they covered.
+          if (blockMaxZ > hiZBlock.maxZ)
+          {
+            hiZBlock.maxZ = blockMaxZ;
+            tile.maxZ = std::max(tile.maxZ, blockMaxZ);
+          }
+        }
+        else if (covered && blockMaxZ < hiZBlock.maxZ)
+        {
+          hiZBlock.maxZ = blockMaxZ;
+          hiZBlock.stale = false;
+          tile.staleMaxZ = true;
+        }
+        else if (!covered)
+          hiZBlock.stale = true;
+      }
+    }
+  }
+}
+
+bool SimpleRasterizer::DrawSampleQuad(const SampleBlock &block, const EdgeQuad edges[3], int x,
+                                      int y, int column, int row, int lanes, Tile &tile)
+{
+  // The values of the triangle, named like in DrawTriangle()
+  const Texture *texture = block.texture;
+  const int tu = textureVarying, tv = textureVarying + 1;
+  const int planeCount = block.planeCount;
+  const float *blockPlanes = block.blockPlanes;
+  const float *planeDx = block.planeDx;
+  const float *planeDy = block.planeDy;
+
+  const int width = image->GetWidth();
+  const int quadColumns = (width + 3) / 4;
+  const int pixel = y * width + x;
+  const int fullCoverage = (1 << samples) - 1;
+  vec3 *pixels = image->GetPixels();
+  float *quadDepths = &sampleDepths[((size_t)y * quadColumns + x / 4) * samples * 4];
+
+#ifdef RAYTRACER_SSE2
+  const __m128 one = _mm_set1_ps(1.0f);
+#endif
+
+  // Find the pixels each sample covers first, most quads in the bounding box of a
+  // small triangle are not covered at all.
+  int masks[MaxSamples];
+  int candidates = (1 << lanes) - 1;
+  int covered = 0;
+
+#ifdef RAYTRACER_SSE2
+  __m128i reached = _mm_set1_epi32(-1);
+  for (int i = 0; i < 3; i++)
+  {
+    reached = _mm_andnot_si128(
+        _mm_srai_epi32(_mm_add_epi32(edges[i], block.reachEdges[i]), 31), reached);
+  }
+
+  candidates &= _mm_movemask_ps(_mm_castsi128_ps(reached));
+  if (candidates == 0)
+    return false;
+
+  for (int s = 0; s < samples; s++)
+  {
+    masks[s] = candidates;
+    if (!block.inner)
+    {
+      __m128i inside = _mm_set1_epi32(-1);
+      for (int i = 0; i < 3; i++)
+      {
+        inside = _mm_andnot_si128(_mm_srai_epi32(
+            _mm_add_epi32(edges[i], block.sampleEdges[i][s]), 31), inside);
+      }
+      masks[s] &= _mm_movemask_ps(_mm_castsi128_ps(inside));
+    }
+    covered |= masks[s];
+  }
+#else
+  for (int lane = 0; lane < lanes; lane++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      if (edges[i] + block.edgeStepsX[i] * lane + block.reachEdges[i] < 0)
+        candidates &= ~(1 << lane);
+    }
+  }
+
+  if (candidates == 0)
+    return false;
+
+  for (int s = 0; s < samples; s++)
+  {
+    masks[s] = candidates;
+    for (int lane = 0; lane < lanes && !block.inner; lane++)
+    {
+      for (int i = 0; i < 3; i++)
+      {
+        if (edges[i] + block.edgeStepsX[i] * lane + block.sampleEdges[i][s] < 0)
+          masks[s] &= ~(1 << lane);
+      }
+    }
+    covered |= masks[s];
+  }
+#endif
+
+  if (covered == 0)
+    return false;
+
+  tile.statistics.fragments += LaneCounts[covered];
+
+  // Test and write the depths of the covered samples. The pixels each sample takes
+  // the color in are kept for the shading below.
+  int passed[MaxSamples];
+  int anyPassed = 0;
+  int allPassed = (1 << lanes) - 1;
+
+#ifdef RAYTRACER_SSE2
+  __m128 zSteps = _mm_mul_ps(_mm_set1_ps(block.dzdx), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+  __m128 quadZs = _mm_add_ps(_mm_set1_ps(block.blockZ + block.dzdx * column + block.dzdy * row),
+                             zSteps);
+#else
+  float quadZ = block.blockZ + block.dzdx * column + block.dzdy * row;
+#endif
+
+  for (int s = 0; s < samples; s++)
+  {
+    int mask = masks[s];
+    float *depth = quadDepths + 4 * s;
+
+#ifdef RAYTRACER_SSE2
+    if (mask != 0)
+    {
+      __m128 zs = _mm_add_ps(quadZs, _mm_set1_ps(block.sampleZs[s]));
+      __m128 oldZs = _mm_loadu_ps(depth);
+      if (block.depthTest)
+        mask &= _mm_movemask_ps(_mm_cmplt_ps(zs, oldZs));
+
+      __m128 pass = _mm_loadu_ps((const float *)LaneMasks[mask]);
+      _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(pass, zs), _mm_andnot_ps(pass, oldZs)));
+    }
+#else
+    for (int lane = 0; lane < lanes; lane++)
+    {
+      if (!(mask & (1 << lane)))
+        continue;
+
+      float sampleZ = quadZ + block.dzdx * (float)lane + block.sampleZs[s];
+      if (block.depthTest && !(sampleZ < depth[lane]))
+        mask &= ~(1 << lane);
+      else
+        depth[lane] = sampleZ;
+    }
+#endif
+
+    passed[s] = mask;
+    anyPassed |= mask;
+    allPassed &= mask;
+  }
+
+  if (anyPassed == 0)
+    return false;
+
+  if (!block.depthTest)
+    tile.statistics.fragmentsAccepted += LaneCounts[anyPassed];
+
+  tile.statistics.fragmentsWritten += LaneCounts[anyPassed];
+
+  // The z buffer keeps the farthest sample of each pixel.
+  float farthestZ[4];
+#ifdef RAYTRACER_SSE2
+  __m128 farthestZs = _mm_loadu_ps(quadDepths);
+  for (int s = 1; s < samples; s++)
+    farthestZs = _mm_max_ps(farthestZs, _mm_loadu_ps(quadDepths + 4 * s));
+  _mm_storeu_ps(farthestZ, farthestZs);
+#else
+  for (int lane = 0; lane < 4; lane++)
+  {
+    farthestZ[lane] = quadDepths[lane];
+    for (int s = 1; s < samples; s++)
+      farthestZ[lane] = std::max(farthestZ[lane], quadDepths[4 * s + lane]);
+  }
+#endif
+
+  // Find the samples of each pixel that take the color, and where to shade it.
+  int coverages[4];
+  float shadeXs[4], shadeYs[4];
+
+  for (int lane = 0; lane < 4; lane++)
+  {
+    coverages[lane] = ((allPassed & (1 << lane)) ? fullCoverage : 0);
+    shadeXs[lane] = (float)(column + lane);
+    shadeYs[lane] = (float)row;
+
+    if (!(anyPassed & (1 << lane)))
+      continue;
+
+    zBuffer[pixel + lane] = farthestZ[lane];
+
+    if (coverages[lane] == fullCoverage)
+      continue;
+
+    for (int s = 0; s < samples; s++)
+      coverages[lane] |= ((passed[s] >> lane) & 1) << s;
+
+    int first = 0;
+    while (!(coverages[lane] & (1 << first)))
+      first++;
+
+    shadeXs[lane] += (float)samplePositions[first][0] / SubpixelScale;
+    shadeYs[lane] += (float)samplePositions[first][1] / SubpixelScale;
+  }
+
+  // Recover the varyings from the planes at the shading positions.
+  vec3 colors[4];
+  float laneValues[MaxVaryings][4];
+
+#ifdef RAYTRACER_SSE2
+  __m128 shadeX = _mm_loadu_ps(shadeXs);
+  __m128 shadeY = _mm_loadu_ps(shadeYs);
+  __m128 values[MaxVaryings];
+  __m128 w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_set1_ps(blockPlanes[0]),
+      _mm_mul_ps(_mm_set1_ps(planeDx[0]), shadeX)),
+      _mm_mul_ps(_mm_set1_ps(planeDy[0]), shadeY)));
+  for (int k = 1; k < planeCount; k++)
+  {
+    __m128 plane = _mm_add_ps(_mm_add_ps(_mm_set1_ps(blockPlanes[k]),
+        _mm_mul_ps(_mm_set1_ps(planeDx[k]), shadeX)),
+        _mm_mul_ps(_mm_set1_ps(planeDy[k]), shadeY));
+    values[k - 1] = _mm_mul_ps(plane, w);
+  }
+
+  if (texture != NULL)
+  {
+    __m128 texel[3];
+    texture->SampleQuad(values[tu], values[tv], GetTextureLod(*texture, blockPlanes,
+                        planeDx, planeDy, column, row), texel);
+    for (int c = 0; c < 3; c++)
+      values[c] = _mm_mul_ps(values[c], texel[c]);
+  }
+
+  __m128 quadColor[3] = {values[0], values[1], values[2]};
+  if (block.lightPixels)
+  {
+    __m128 *normal = values + 3;
+    __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(normal[0], normal[0]), _mm_mul_ps(normal[1], normal[1])),
+        _mm_mul_ps(normal[2], normal[2]))));
+    for (int c = 0; c < 3; c++)
+      normal[c] = _mm_mul_ps(normal[c], inverseLength);
+
+    LightQuad(values + 6, normal, values, quadColor);
+  }
+
+  StoreVec3x4(colors, quadColor[0], quadColor[1], quadColor[2]);
+  if (shading == Shading_Deferred)
+  {
+    for (int k = 3; k < 9; k++)
+      _mm_storeu_ps(laneValues[k], values[k]);
+  }
+#else
+  float lod = 0.0f;
+  if (texture != NULL)
+    lod = GetTextureLod(*texture, blockPlanes, planeDx, planeDy, column, row);
+
+  for (int lane = 0; lane < lanes; lane++)
+  {
+    if (!(anyPassed & (1 << lane)))
+      continue;
+
+    float values[MaxVaryings];
+    float w = 1.0f / (blockPlanes[0] + planeDx[0] * shadeXs[lane] +
+                      planeDy[0] * shadeYs[lane]);
+    for (int k = 1; k < planeCount; k++)
+    {
+      values[k - 1] = (blockPlanes[k] + planeDx[k] * shadeXs[lane] +
+                       planeDy[k] * shadeYs[lane]) * w;
+      laneValues[k - 1][lane] = values[k - 1];
+    }
+
+    if (texture != NULL)
+    {
+      vec3 texel = texture->Sample(values[tu], values[tv], lod);
+      for (int c = 0; c < 3; c++)
+        values[c] *= texel[c];
+    }
+
+    colors[lane] = vec3(values[0], values[1], values[2]);
+    if (block.lightPixels)
+    {
+      vec3 normal = normalize(vec3(values[3], values[4], values[5]));
+      colors[lane] = LightVertex(vec4(values[6], values[7], values[8], 1.0f), normal,
+                                 colors[lane]);
+    }
+  }
+#endif
+
+  for (int lane = 0; lane < lanes; lane++)
+  {
+    if (!(anyPassed & (1 << lane)))
+      continue;
+
+    // Pixels only keep separate sample colors while they are partly covered.
+    if (coverages[lane] == fullCoverage)
+    {
+      pixels[pixel + lane] = colors[lane];
+      sampleSlots[pixel + lane] = NoSamples;
+    }
+    else
+    {
+      unsigned int &slot = sampleSlots[pixel + lane];
+      if (slot == NoSamples)
+      {
+        slot = (unsigned int)tile.splitPixels.size();
+        tile.splitPixels.push_back(pixel + lane);
+        tile.sampleColors.resize(tile.sampleColors.size() + samples,
+                                 pixels[pixel + lane]);
+      }
+
+      vec3 *sampleColors = &tile.sampleColors[(size_t)slot * samples];
+      for (int s = 0; s < samples; s++)
+      {
+        if (coverages[lane] & (1 << s))
+          sampleColors[s] = colors[lane];
+      }
+    }
+
+    if (shading == Shading_Deferred)
+    {
+      // The G-buffer holds the surface drawn last into the pixel.
+      gBufferNormals[pixel + lane] =
+          vec3(laneValues[3][lane], laneValues[4][lane], laneValues[5][lane]);
+      gBufferPositions[pixel + lane] =
+          vec3(laneValues[6][lane], laneValues[7][lane], laneValues[8][lane]);
+    }
+  }
+
+  return true;
+}
+
+vec3 SimpleRasterizer::LightVertex(vec4 position, vec3 normal, vec3 color)
+{
+  vec3 result = color * ambientLight;
+
+  foreach (VertexLight, light, lights)
+  {
+    vec3 intensity = light->intensity;
+
+    vec3 distance = light->position - vec3(position);
+    float attenuation = 1.0f / (0.001f + dot(distance, distance));
+    vec3 direction = normalize(distance);
+
+    float lambert = glm::max(0.0f, dot(normal, direction));
+
+    if (lambert > 0)
+    {
+      vec3 term = color * lambert * attenuation * intensity;
+
+      // Lights with a shadow map only reach the parts of the surface they see.
+      size_t index = light - lights.begin();
+      if (index < shadowMaps.size())
+        term *= GetShadow(index, vec3(position), normal);
+
+      result += term;
+    }
+  }
+
+  return result;
+}
+
+float SimpleRasterizer::GetShadow(size_t light, const vec3 &position, const vec3 &normal) const
+{
+  const ShadowMap &map = shadowMaps[light];
+  const int size = shadowMapSize;
+  const float texel = 2.0f / size;
+
+  // Move the point off the surface by about a texel at its distance, so that the texels
+  // covering the surface itself lie behind it.
+  vec3 d = position - map.position;
+  float distance = std::max(std::max(fabsf(d.x), fabsf(d.y)), fabsf(d.z));
+  d += normal * (distance * texel * ShadowNormalOffset);
+
+  float x, y, z;
+  int face = GetCubeFace(d, x, y, z);
+  if (!(z > 0.0f))
+    return 1.0f;
+
+  // Find the four texels whose centers surround the point. The coordinates lie within the
+  // face up to half a texel, so truncating them after the shift rounds down.
+  float u = (x / z + 1.0f) * (size * 0.5f) + 0.5f;
+  float v = (1.0f - y / z) * (size * 0.5f) + 0.5f;
+  int column = (int)u, row = (int)v;
+  float weightX = u - column, weightY = v - row;
+
+  int columns[2] = {std::max(column - 1, 0), std::min(column, size - 1)};
+  int rows[2] = {std::max(row - 1, 0), std::min(row, size - 1)};
+
+  // Occluders are reciprocal depths, so the ones nearer than the point minus the bias
+  // are larger than this.
+  const float *depths = &map.depths[(size_t)face * size * size];
+  float limit = 1.0f / (z - z * texel * ShadowDepthBias);
+
+  float lit[2][2];
+  for (int j = 0; j < 2; j++)
+  {
+    for (int i = 0; i < 2; i++)
+      lit[j][i] = (depths[rows[j] * size + columns[i]] > limit ? 0.0f : 1.0f);
+  }
+
+  return (lit[0][0] + (lit[0][1] - lit[0][0]) * weightX) * (1.0f - weightY) +
+         (lit[1][0] + (lit[1][1] - lit[1][0]) * weightX) * weightY;
+}
+
+#ifdef RAYTRACER_SSE2
+__m128 SimpleRasterizer::GetShadowQuad(size_t light, const __m128 position[3],
+                                       const __m128 normal[3], int lanes) const
+{
+  float p[3][4], n[3][4], visibility[4];
+  for (int c = 0; c < 3; c++)
+  {
+    _mm_storeu_ps(p[c], position[c]);
+    _mm_storeu_ps(n[c], normal[c]);
+  }
+
+  for (int lane = 0; lane < 4; lane++)
+  {
+    visibility[lane] = 0.0f;
+    if (lanes & (1 << lane))
+      visibility[lane] = GetShadow(light, vec3(p[0][lane], p[1][lane], p[2][lane]),
+                                   vec3(n[0][lane], n[1][lane], n[2][lane]));
+  }
+
+  return _mm_loadu_ps(visibility);
+}
+#endif
+
+#ifdef RAYTRACER_SSE2
+void SimpleRasterizer::LightQuad(const __m128 position[3], const __m128 normal[3],
+                                 const __m128 color[3], __m128 result[3])
+{
+  // Every operation is done in the same order as in LightVertex().
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  for (int c = 0; c < 3; c++)
+    result[c] = _mm_mul_ps(color[c], _mm_set1_ps(ambientLight[c]));
+
+  foreach (VertexLight, light, lights)
+  {
+    __m128 distance[3];
+    for (int c = 0; c < 3; c++)
+      distance[c] = _mm_sub_ps(_mm_set1_ps(light->position[c]), position[c]);
+
+    __m128 squaredDistance = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(distance[0], distance[0]), _mm_mul_ps(distance[1], distance[1])),
+        _mm_mul_ps(distance[2], distance[2]));
+    __m128 attenuation = _mm_div_ps(one, _mm_add_ps(_mm_set1_ps(0.001f), squaredDistance));
+    __m128 inverseDistance = _mm_div_ps(one, _mm_sqrt_ps(squaredDistance));
+
+    __m128 lambert = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(normal[0], _mm_mul_ps(distance[0], inverseDistance)),
+        _mm_mul_ps(normal[1], _mm_mul_ps(distance[1], inverseDistance))),
+        _mm_mul_ps(normal[2], _mm_mul_ps(distance[2], inverseDistance)));
+    lambert = _mm_max_ps(zero, lambert);
+
+    // Lanes facing away from the light keep their color unchanged.
+    __m128 lit = _mm_cmpgt_ps(lambert, zero);
+
+    size_t index = light - lights.begin();
+    bool shadowed = (index < shadowMaps.size());
+    __m128 visibility = one;
+    if (shadowed)
+      visibility = GetShadowQuad(index, position, normal, _mm_movemask_ps(lit));
+
+    for (int c = 0; c < 3; c++)
+    {
+      __m128 term = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(color[c], lambert), attenuation),
+                               _mm_set1_ps(light->intensity[c]));
+      if (shadowed)
+        term = _mm_mul_ps(term, visibility);
+      result[c] = _mm_add_ps(result[c], _mm_and_ps(term, lit));
+    }
+  }
+}
+#endif
+
+vec3 SimpleRasterizer::LightPixel(const vec3 &position, const vec3 &normal, const vec3 &color,
+                                  const unsigned int *lightIndices, size_t lightCount)
+{
+  vec3 result = color * ambientLight;
+
+  for (size_t i = 0; i < lightCount; i++)
+  {
+    const VertexLight &light = lights[lightIndices[i]];
+
+    const LightBounds &bounds = lightBounds[lightIndices[i]];
+
+    vec3 distance = light.position - position;
+    float squaredDistance = dot(distance, distance);
+    if (!(squaredDistance < bounds.squaredRadius))
+      continue;
+
+    float attenuation = std::max(1.0f / (0.001f + squaredDistance) - bounds.cutoff, 0.0f);
+    vec3 direction = distance * (1.0f / sqrtf(squaredDistance));
+
+    float lambert = glm::max(0.0f, dot(normal, direction));
+
+    if (lambert > 0)
+    {
+      vec3 term = color * lambert * attenuation * light.intensity;
+      if (lightIndices[i] < shadowMaps.size())
+        term *= GetShadow(lightIndices[i], position, normal);
+
+      result += term;
+    }
+  }
+
+  return result;
+}
+
+void SimpleRasterizer::SortTriangles()
+{
+  const int count = (int)screenTriangles.size();
+  statistics.sortedTriangles = count;
+  if (count == 0)
+    return;
+
+  // z grows with the distance, so the keys are inverted to put the farthest triangles first.
+  sortKeys.resize(count);
+  ParallelFor(0, count, VertexBatchSize, [&](int begin, int end)
+  {
+    for (int i = begin; i < end; i++)
+    {
+      const ScreenTriangle &t = screenTriangles[i];
+      float z = transformedPositions[t.vertex[0]].z + transformedPositions[t.vertex[1]].z +
+                transformedPositions[t.vertex[2]].z;
+      sortKeys[i] = ~GetSortableBits(z);
+    }
+  });
+
+  // The meshes submit their triangles in the same order every frame, so unless the number
+  // of triangles changed, the last order is still nearly sorted while the view changes
+  // gradually. The radix sort starts from the submitted order instead, which it keeps for
+  // equal keys, so both ways give the same order.
+  if (sortOrder.size() != (size_t)count || !RepairSortOrder())
+  {
+    statistics.radixSortedTriangles = count;
+
+    radixKeys.assign(sortKeys.begin(), sortKeys.end());
+    sortOrder.resize(count);
+    for (int i = 0; i < count; i++)
+      sortOrder[i] = i;
+
+    RadixSort(radixKeys, sortOrder, radixKeyBuffer, radixOrderBuffer);
+  }
+
+  sortedTriangles.resize(count);
+  ParallelFor(0, count, VertexBatchSize, [&](int begin, int end)
+  {
+    for (int i = begin; i < end; i++)
+      sortedTriangles[i] = screenTriangles[sortOrder[i]];
+  });
+
+  screenTriangles.swap(sortedTriangles);
+}
+
+bool SimpleRasterizer::RepairSortOrder()
+{
+  const int count = (int)sortOrder.size();
+  unsigned int *order = &sortOrder[0];
+  const unsigned int *keys = &sortKeys[0];
+
+  // Equal keys are ordered by the submitted order, like with the radix sort.
+  auto before = [keys](unsigned int a, unsigned int b)
+  {
+    return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+  };
+
+  // Count the neighbors that are out of order first, which is cheap and done on all
+  // threads. Most frames of a still view need no repair at all.
+  atomic<int> descents(0);
+  ParallelFor(1, count, VertexBatchSize, [&](int begin, int end)
+  {
+    int rangeDescents = 0;
+    for (int i = begin; i < end; i++)
+    {
+      if (before(order[i], order[i - 1]))
+        rangeDescents++;
+    }
+
+    descents += rangeDescents;
+  });
+
+  if (descents == 0)
+    return true;
+  if (descents > count / RepairDescentRatio)
+    return false;
+
+  // Move every triangle back past the ones that belong behind it.
+  size_t moves = 0;
+  const size_t moveLimit = (size_t)count * RepairMoveLimit;
+  for (int i = 1; i < count; i++)
+  {
+    unsigned int triangle = order[i];
+    int j = i;
+    for (; j > 0 && before(triangle, order[j - 1]); j--)
+      order[j] = order[j - 1];
+    order[j] = triangle;
+
+    moves += i - j;
+    if (moves > moveLimit)
+      return false;
+  }
+
+  return true;
+}
+
+void SimpleRasterizer::TransformAndLightVertex(const vec3 &position, const vec3 &normal,
+                                               const vec3 &color, const mat4 &modelTransform,
+                                               const mat4 &modelTransformNormals,
+                                               vec4 &clipPosition, vec4 &screenPosition,
+                                               float *varyings)
+{
+  // Apply model transform to go from model coordiantes to world coordinates
+  vec4 worldCoords = modelTransform * vec4(position, 1.0f);
+  vec3 worldNormal = normalize(vec3(modelTransformNormals * vec4(normal, 0.0f)));
+
+  if (shading == Shading_Gouraud)
+  {
+    // Light vertex in world coordinates
+    vec3 litColor = LightVertex(worldCoords, worldNormal, color);
+    for (int i = 0; i < 3; i++)
+      varyings[i] = litColor[i];
+  }
+  else
+  {
+    // The pixels are lit, so pass on everything the lighting needs.
+    for (int i = 0; i < 3; i++)
+    {
+      varyings[i] = color[i];
+      varyings[3 + i] = worldNormal[i];
+      varyings[6 + i] = worldCoords[i];
+    }
+  }
+
+  // Get clip coordinates by ViewProjectionTransformation
+  vec4 clipCoords = this->viewProjectionTransform * worldCoords;
+  clipPosition = clipCoords;
+
+  // Get normalized device coordinates (i.e. x,y in [-1,1])
+  clipCoords.x /= clipCoords.w;
+  clipCoords.y /= clipCoords.w;
+  clipCoords.z /= clipCoords.w;
+
+  // Apply viewport transform to get windows coordinates and set new positions. This is done
+  // in single precision, just like in TransformAndLightVertices().
+  screenPosition.x = (clipCoords.x + 1.0f) * (image->GetWidth() * 0.5f);
+  screenPosition.y = (1.0f - clipCoords.y) * (image->GetHeight() * 0.5f);
+  screenPosition.z = clipCoords.z;
+  screenPosition.w = 1.0f / clipCoords.w;
+}
+
+void SimpleRasterizer::TransformAndLightVertices(const vec3 *positions, const vec3 *normals,
+                                                 const vec3 *colors, const vec2 *textureCoords,
+                                                 int count,
+                                                 const mat4 &modelTransform,
+                                                 const mat4 &modelTransformNormals,
+                                                 vec4 *clipPositions, unsigned short *clipCodes,
+                                                 vec4 *screenPositions, float *varyings)
+{
+  const float guardX = GuardBand / image->GetWidth();
+  const float guardY = GuardBand / image->GetHeight();
+  int i = 0;
+
+#ifdef RAYTRACER_SSE2
+  // Four vertices at a time, one per lane. Every operation is done in the same order as in
+  // TransformAndLightVertex(), so both give exactly the same results.
+  const mat4 &m = modelTransform;
+  const mat4 &n = modelTransformNormals;
+  const mat4 &vp = viewProjectionTransform;
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 halfWidth = _mm_set1_ps(image->GetWidth() * 0.5f);
+  const __m128 halfHeight = _mm_set1_ps(image->GetHeight() * 0.5f);
+
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128 px, py, pz, nx, ny, nz, cx, cy, cz;
+    LoadVec3x4(positions + i, px, py, pz);
+    LoadVec3x4(normals + i, nx, ny, nz);
+    LoadVec3x4(colors + i, cx, cy, cz);
+
+    // World space position and normal
+    __m128 world[4];
+    for (int r = 0; r < 4; r++)
+    {
+      world[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(m[0][r]), px), _mm_mul_ps(_mm_set1_ps(m[1][r]), py)),
+          _mm_mul_ps(_mm_set1_ps(m[2][r]), pz)), _mm_set1_ps(m[3][r]));
+    }
+
+    __m128 normal[3];
+    for (int r = 0; r < 3; r++)
+    {
+      normal[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(n[0][r]), nx), _mm_mul_ps(_mm_set1_ps(n[1][r]), ny)),
+          _mm_mul_ps(_mm_set1_ps(n[2][r]), nz)), _mm_set1_ps(n[3][r] * 0.0f));
+    }
+
+    __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(normal[0], normal[0]), _mm_mul_ps(normal[1], normal[1])),
+        _mm_mul_ps(normal[2], normal[2]))));
+    for (int r = 0; r < 3; r++)
+      normal[r] = _mm_mul_ps(normal[r], inverseLength);
+
+    // The varyings for the shading
+    __m128 color[3] = {cx, cy, cz};
+    __m128 values[MaxVaryings];
+
+    if (shading == Shading_Gouraud)
+      LightQuad(world, normal, color, values);
+    else
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        values[c] = color[c];
+        values[3 + c] = normal[c];
+        values[6 + c] = world[c];
+      }
+    }
+
+    float lanes[MaxVaryings][4];
+    for (int k = 0; k < varyingCount; k++)
+      _mm_storeu_ps(lanes[k], values[k]);
+
+    for (int lane = 0; lane < 4; lane++)
+    {
+      for (int k = 0; k < varyingCount; k++)
+        varyings[(i + lane) * varyingCount + k] = lanes[k][lane];
+    }
+
+    // Clip space, perspective divide and viewport transform
+    __m128 clip[4];
+    for (int r = 0; r < 4; r++)
+    {
+      clip[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(vp[0][r]), world[0]), _mm_mul_ps(_mm_set1_ps(vp[1][r]), world[1])),
+          _mm_mul_ps(_mm_set1_ps(vp[2][r]), world[2])), _mm_mul_ps(_mm_set1_ps(vp[3][r]), world[3]));
+    }
+
+    // The same comparisons as in GetClipCode()
+    __m128 negativeW = _mm_sub_ps(zero, clip[3]);
+    __m128 gx = _mm_mul_ps(_mm_set1_ps(guardX), clip[3]);
+    __m128 gy = _mm_mul_ps(_mm_set1_ps(guardY), clip[3]);
+    __m128 outside[10] =
+    {
+      _mm_cmplt_ps(clip[2], negativeW), _mm_cmpgt_ps(clip[2], clip[3]),
+      _mm_cmplt_ps(clip[0], _mm_sub_ps(zero, gx)), _mm_cmpgt_ps(clip[0], gx),
+      _mm_cmplt_ps(clip[1], _mm_sub_ps(zero, gy)), _mm_cmpgt_ps(clip[1], gy),
+      _mm_cmplt_ps(clip[0], negativeW), _mm_cmpgt_ps(clip[0], clip[3]),
+      _mm_cmplt_ps(clip[1], negativeW), _mm_cmpgt_ps(clip[1], clip[3])
+    };
+
+    __m128i code = _mm_setzero_si128();
+    for (int plane = 0; plane < 10; plane++)
+      code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(outside[plane]),
+                                              _mm_set1_epi32(1 << plane)));
+    _mm_storel_epi64((__m128i *)(clipCodes + i), _mm_packs_epi32(code, code));
+
+    __m128 c0 = clip[0], c1 = clip[1], c2 = clip[2], c3 = clip[3];
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_ps(&clipPositions[i].x, c0);
+    _mm_storeu_ps(&clipPositions[i + 1].x, c1);
+    _mm_storeu_ps(&clipPositions[i + 2].x, c2);
+    _mm_storeu_ps(&clipPositions[i + 3].x, c3);
+
+    __m128 sx = _mm_mul_ps(_mm_add_ps(_mm_div_ps(clip[0], clip[3]), one), halfWidth);
+    __m128 sy = _mm_mul_ps(_mm_sub_ps(one, _mm_div_ps(clip[1], clip[3])), halfHeight);
+    __m128 sz = _mm_div_ps(clip[2], clip[3]);
+    __m128 sw = _mm_div_ps(one, clip[3]);
+    _MM_TRANSPOSE4_PS(sx, sy, sz, sw);
+    _mm_storeu_ps(&screenPositions[i].x, sx);
+    _mm_storeu_ps(&screenPositions[i + 1].x, sy);
+    _mm_storeu_ps(&screenPositions[i + 2].x, sz);
+    _mm_storeu_ps(&screenPositions[i + 3].x, sw);
+  }
+#endif
+
+  for (; i < count; i++)
+  {
+    TransformAndLightVertex(positions[i], normals[i], colors[i], modelTransform,
+                            modelTransformNormals, clipPositions[i], screenPositions[i],
+                            varyings + i * varyingCount);
+    clipCodes[i] = (unsigned short)GetClipCode(clipPositions[i], guardX, guardY);
+  }
+
+  // The texture coordinates are interpolated as they are.
+  if (textureVarying >= 0)
+  {
+    for (i = 0; i < count; i++)
+    {
+      vec2 coords = (textureCoords != NULL ? textureCoords[i] : vec2(0.0f, 0.0f));
+      varyings[i * varyingCount + textureVarying] = coords.x;
+      varyings[i * varyingCount + textureVarying + 1] = coords.y;
+    }
+  }
+}
+
+int SimpleRasterizer::ClipTriangle(const unsigned int index[3], unsigned int firstVertex,
+                                   int planes, size_t newVertex, ScreenTriangle *triangles)
+{
+  const float guardX = GuardBand / image->GetWidth();
+  const float guardY = GuardBand / image->GetHeight();
+  ClipVertex polygon[2][MaxClipVertices];
+  int count = 3;
+
+  for (int v = 0; v < 3; v++)
+  {
+    polygon[0][v].position = clipPositions[index[v]];
+    std::copy_n(&varyings[(firstVertex + index[v]) * varyingCount], varyingCount,
+                polygon[0][v].varyings);
+  }
+
+  int current = 0;
+  for (int plane = 1; plane <= planes && count >= 3; plane <<= 1)
+  {
+    if (planes & plane)
+    {
+      count = ClipPolygon(polygon[current], count, varyingCount, plane, guardX, guardY,
+                          polygon[1 - current]);
+      current = 1 - current;
+    }
+  }
+
+  if (count < 3)
+    return 0;
+
+  if (triangles != NULL)
+  {
+    // Project the vertices the same way TransformAndLightVertex() does and split the
+    // polygon into a fan of triangles.
+    for (int v = 0; v < count; v++)
+    {
+      const ClipVertex &vertex = polygon[current][v];
+      vec4 p = vertex.position;
+
+      transformedPositions[newVertex + v] = vec4(
+          (p.x / p.w + 1.0f) * (image->GetWidth() * 0.5f),
+          (1.0f - p.y / p.w) * (image->GetHeight() * 0.5f), p.z / p.w, 1.0f / p.w);
+      std::copy_n(vertex.varyings, varyingCount, &varyings[(newVertex + v) * varyingCount]);
+    }
+
+    for (int v = 1; v + 1 < count; v++)
+    {
+      ScreenTriangle &t = triangles[v - 1];
+      t.vertex[0] = (unsigned int)newVertex;
+      t.vertex[1] = (unsigned int)(newVertex + v);
+      t.vertex[2] = (unsigned int)(newVertex + v + 1);
+    }
+  }
+
+  return count;
+}
+
+void SimpleRasterizer::RenderMesh(const Mesh *mesh, int level)
+{
+  if (mesh == NULL)
+    return;
+
+  // Exercise 8.1 a)
+
+  Clock::time_point stageStart = Clock::now();
+
+  const mat4 modelTransform = mesh->GetGlobalTransformation();
+  const mat4 modelTransformNormals = inverseTranspose(modelTransform);
+
+  // Invisible meshes are skipped entirely, translucent ones go into the fragment lists.
+  Material *material = mesh->GetMaterial();
+  const float opacity = (material != NULL ? std::min(material->GetOpacity(), 1.0f) : 1.0f);
+  if (!(opacity > 0.0f))
+    return;
+
+  // Skip the mesh if its bounding box lies completely outside one of the planes of the view
+  // frustum.
+  vec3 boundsMin, boundsMax;
+  if (!mesh->GetBoundingBox(boundsMin, boundsMax))
+    return;
+
+  const mat4 modelViewProjection = viewProjectionTransform * modelTransform;
+  int outside = FrustumPlanes;
+  for (int i = 0; i < 8; i++)
+  {
+    vec3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y,
+                (i & 4) ? boundsMax.z : boundsMin.z);
+    outside &= GetClipCode(modelViewProjection * vec4(corner, 1.0f), 1.0f, 1.0f);
+  }
+
+  if (outside != 0)
+  {
+    statistics.culledMeshes++;
+    return;
+  }
+
+  const Texture *texture = GetMeshTexture(mesh);
+  const vec3 *positions, *normals, *colors;
+  const vec2 *textureCoords = NULL;
+  const unsigned int *indices = NULL;
+  size_t vertexCount, triangleCount;
+
+  if (mesh->IsIndexed())
+  {
+    // Transform and light every unique vertex exactly once. Coarser levels of detail only
+    // use the first vertices.
+    vertexCount = mesh->GetLodVertexCount(level);
+    triangleCount = mesh->GetLodIndices(level).size() / 3;
+    if (vertexCount == 0 || triangleCount == 0)
+      return;
+
+    positions = &mesh->GetPositions()[0];
+    normals = &mesh->GetNormals()[0];
+    colors = &mesh->GetColors()[0];
+    indices = &mesh->GetLodIndices(level)[0];
+    if (texture != NULL)
+      textureCoords = &mesh->GetTextureCoords()[0];
+  }
+  else
+  {
+    // Gather the vertices of the triangles into arrays, so that they can be processed in
+    // batches, too.
+    const vector<Triangle> &triangles = mesh->GetTriangles();
+    triangleCount = triangles.size();
+    vertexCount = 3 * triangleCount;
+    if (vertexCount == 0)
+      return;
+
+    vertexPositions.resize(vertexCount);
+    vertexNormals.resize(vertexCount);
+    vertexColors.resize(vertexCount);
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+      for (int v = 0; v < 3; v++)
+      {
+        vertexPositions[3 * i + v] = triangles[i].position[v];
+        vertexNormals[3 * i + v] = triangles[i].normal[v];
+        vertexColors[3 * i + v] = triangles[i].color[v];
+      }
+    }
+
+    positions = &vertexPositions[0];
+    normals = &vertexNormals[0];
+    colors = &vertexColors[0];
+  }
+
+  // Run the vertex stage on all threads, writing into the post-transform buffer behind the
+  // vertices of the meshes before.
+  const unsigned int firstVertex = (unsigned int)transformedPositions.size();
+  transformedPositions.resize(firstVertex + vertexCount);
+  varyings.resize((firstVertex + vertexCount) * varyingCount);
+  clipPositions.resize(vertexCount);
+  clipCodes.resize(vertexCount);
+
+  ParallelFor(0, (int)vertexCount, VertexBatchSize, [&](int begin, int end)
+  {
+    TransformAndLightVertices(positions + begin, normals + begin, colors + begin,
+                              (textureCoords != NULL ? textureCoords + begin : NULL), end - begin,
+                              modelTransform, modelTransformNormals, &clipPositions[begin],
+                              &clipCodes[begin], &transformedPositions[firstVertex + begin],
+                              &varyings[(firstVertex + begin) * varyingCount]);
+  });
+
+  stageTimes.vertexTime += TakeMilliseconds(stageStart);
+
+  // Assemble the triangles from the post-transform vertices. Culling and clipping change
+  // the number of triangles and add vertices, so every batch counts them first, and then
+  // writes them to their place behind the ones of the batches before it.
+  int batchCount = (int)((triangleCount + VertexBatchSize - 1) / VertexBatchSize);
+  assembledTriangles.assign(batchCount, 0);
+  assembledVertices.assign(batchCount, 0);
+  rangeStatistics.assign(batchCount, Statistics());
+
+  ParallelFor(0, (int)triangleCount, VertexBatchSize, [&](int begin, int end)
+  {
+    int batch = begin / VertexBatchSize;
+    size_t triangles = 0, vertices = 0;
 
-void SimpleRasterizer::DrawSpan(int x1, int x2, int y, float z1, float z2, vec3 &color1,
-                                vec3 &color2, vec3 &color3, const Triangle &tri, int indices[])
-{ 
-  // Barycentric coordinates
-  float u = 0.0;
-  float v = 0.0;
-  float w = 0.0;
+    for (int i = begin; i < end; i++)
+    {
+      unsigned int index[3];
+      for (int v = 0; v < 3; v++)
+        index[v] = (indices != NULL ? indices[3 * i + v] : 3 * i + v);
+
+      int codes[3] = {clipCodes[index[0]], clipCodes[index[1]], clipCodes[index[2]]};
+
+      // Skip triangles that lie completely outside one of the planes of the view frustum.
+      if (codes[0] & codes[1] & codes[2] & FrustumPlanes)
+      {
+        rangeStatistics[batch].culledOutsideTriangles++;
+        continue;
+      }
 
-  // Convenience variables
-  double t;
-  double z;
-  vec3 c;
+      int planes = (codes[0] | codes[1] | codes[2]) & ClipPlanes;
+      if (planes != 0)
+      {
+        rangeStatistics[batch].clippedTriangles++;
+
+        int count = ClipTriangle(index, firstVertex, planes, 0, NULL);
+        if (count > 0)
+        {
+          triangles += count - 2;
+          vertices += count;
+        }
+      }
+      else
+        triangles++;
+    }
 
-  // Needs copy because of C++ reasons...
-  vec3 c1 = color1;
-  vec3 c2 = color2;
-  vec3 c3 = color3;
+    assembledTriangles[batch] = triangles;
+    assembledVertices[batch] = vertices;
+  });
+
+  size_t triangleEnd = screenTriangles.size();
+  size_t vertexEnd = transformedPositions.size();
+  for (int batch = 0; batch < batchCount; batch++)
+  {
+    size_t triangles = assembledTriangles[batch];
+    size_t vertices = assembledVertices[batch];
+    assembledTriangles[batch] = triangleEnd;
+    assembledVertices[batch] = vertexEnd;
+    triangleEnd += triangles;
+    vertexEnd += vertices;
+
+    statistics.culledOutsideTriangles += rangeStatistics[batch].culledOutsideTriangles;
+    statistics.clippedTriangles += rangeStatistics[batch].clippedTriangles;
+  }
 
-  // Check if from left to right or from right to left
-  if (x1 > x2)
+  if (triangleEnd == screenTriangles.size())
   {
-    std::swap(x1, x2);
-    std::swap(z1, z2);
+    stageTimes.setupTime += TakeMilliseconds(stageStart);
+    return;
   }
 
-  // Calculate center of mass of triangle
-  vec3 meanPoint = (tri.position[indices[0]] + tri.position[indices[1]] + tri.position[indices[2]])/3.0f;
-  vec3 currentPoint;
+  screenTriangles.resize(triangleEnd);
+  transformedPositions.resize(vertexEnd);
+  if (opacity < 1.0f)
+    translucent = true;
+  varyings.resize(vertexEnd * varyingCount);
 
-  // Save first value
-  int x1_start = x1;
+  ParallelFor(0, (int)triangleCount, VertexBatchSize, [&](int begin, int end)
+  {
+    int batch = begin / VertexBatchSize;
+    ScreenTriangle *t = &screenTriangles[0] + assembledTriangles[batch];
+    size_t newVertex = assembledVertices[batch];
 
-  // Loop from left to right and draw pixels accordingly
-  for (x1; x1 < x2; x1++)
-  { 
-    // Perfrom range checks, only draw pixel if inside canvas
-    if ((x1 > 0) && (x1 < image->GetWidth()) && (y > 0) && (y < image->GetHeight()))
+    for (int i = begin; i < end; i++)
     {
-      // Calculate interpolation parameter t
-      t = (x1 == x2) ? 1.0f : (double)(x1 - x1_start) / (double)(x2 - x1_start);
+      unsigned int index[3];
+      for (int v = 0; v < 3; v++)
+        index[v] = (indices != NULL ? indices[3 * i + v] : 3 * i + v);
+
+      int codes[3] = {clipCodes[index[0]], clipCodes[index[1]], clipCodes[index[2]]};
+      if (codes[0] & codes[1] & codes[2] & FrustumPlanes)
+        continue;
+
+      // Most triangles need no clipping and can use the projected vertices as they are.
+      int planes = (codes[0] | codes[1] | codes[2]) & ClipPlanes;
+      if (planes != 0)
+      {
+        int count = ClipTriangle(index, firstVertex, planes, newVertex, t);
+        for (int j = 0; j < count - 2; j++, t++)
+        {
+          t->opacity = opacity;
+          t->texture = texture;
+        }
+
+        newVertex += count;
+        continue;
+      }
 
-      // Interpolate depth perspectively correct
-      z = 1.0f / glm::mix(1.0f / z1, 1.0f / z2, t);
+      for (int v = 0; v < 3; v++)
+        t->vertex[v] = firstVertex + index[v];
+      t->opacity = opacity;
+      t->texture = texture;
+      t++;
+    }
+  });
+
+  stageTimes.setupTime += TakeMilliseconds(stageStart);
+}
 
-      // Check if corresponding zBuffer value is below the current z value
-      if (zBuffer[x1 * image->GetHeight() + y] > z)
-      { 
-        // Set new zBuffer value
-        zBuffer[x1 * image->GetHeight() + y] = z;
+void SimpleRasterizer::ClearTile(Tile &tile, unsigned char &pixelsCleared)
+{
+  const int width = image->GetWidth();
+  const int columns = tile.maxX - tile.minX + 1;
+  const int quadColumns = (width + 3) / 4;
+  vec3 *pixels = image->GetPixels();
 
-        // Save current pixel as point for Barycentric interpolation
-        currentPoint = vec3(x1, y, z);
+  if (!pixelsCleared)
+  {
+    for (int y = tile.minY; y <= tile.maxY; y++)
+      std::fill_n(pixels + y * width + tile.minX, columns, vec3(0));
+    pixelsCleared = 1;
+  }
 
-        // Shift a little into the center of mass, prevents edge to be misclassified
-        currentPoint = currentPoint + 0.1f * (meanPoint - currentPoint);
+  if (tile.cleared)
+    return;
 
-        // Compute barycentric coordinates
-        Barycentric(currentPoint, tri.position[indices[0]], tri.position[indices[1]], tri.position[indices[2]], u, v, w);
-        
-        // Compute barycentric interpolation
-        c = u * c1 + v * c2 + w *c3;
+  for (int y = tile.minY; y <= tile.maxY; y++)
+  {
+    std::fill_n(&zBuffer[0] + y * width + tile.minX, columns, 1.0f);
 
-        // Finally set pixel
-        image->SetPixel(x1, y, c);
-      }
+    if (samples > 1)
+    {
+      std::fill_n(&sampleDepths[((size_t)y * quadColumns + tile.minX / 4) * samples * 4],
+                  (tile.maxX / 4 - tile.minX / 4 + 1) * samples * 4, 1.0f);
     }
   }
+
+  // Nothing has been drawn yet, so the hierarchical z buffer starts out at the far plane.
+  // Tiles are made of whole blocks, so the blocks belong to this tile alone.
+  HiZBlock clearBlock = {1.0f, 1.0f, false};
+  for (int by = tile.minY / BlockSize; by <= tile.maxY / BlockSize; by++)
+  {
+    for (int bx = tile.minX / BlockSize; bx <= tile.maxX / BlockSize; bx++)
+      hiZ[by * blockColumns + bx] = clearBlock;
+  }
+
+  tile.minZ = 1.0f;
+  tile.maxZ = 1.0f;
+  tile.staleMaxZ = false;
+  tile.cleared = true;
 }
 
-std::vector<vec2> SimpleRasterizer::DrawLine(vec3 pos0, vec3 pos1)
+void SimpleRasterizer::AddFragment(Tile &tile, int pixel, const vec3 &color, float depth,
+                                   float opacity)
 {
-  // Bresenham Line Rasterization Algorithm
-  int x0 = pos0.x;
-  int y0 = pos0.y;
-  int x1 = pos1.x;
-  int y1 = pos1.y;
-  int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
-  int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
-  int err = dx + dy, e2;
-  std::vector<vec2> line;
-  while (1)
+  // The lists of the tile's pixels are started when its first fragment arrives.
+  if (!tile.translucent)
   {
-    line.push_back(vec2(x0, y0));
-    if (x0 == x1 && y0 == y1)
-      break;
-    e2 = 2 * err;
-    if (e2 > dy)
+    const int width = image->GetWidth();
+    for (int y = tile.minY; y <= tile.maxY; y++)
     {
-      err += dy;
-      x0 += sx;
+      std::fill(&fragmentHeads[y * width + tile.minX], &fragmentHeads[y * width + tile.maxX] + 1,
+                (unsigned int)NoFragment);
     }
-    if (e2 < dx)
+    tile.translucent = true;
+  }
+
+  if (tile.fragmentNext == tile.fragmentEnd)
+  {
+    size_t begin = fragmentCount.fetch_add(FragmentChunkSize);
+    if (begin >= fragments.size())
     {
-      err += dx;
-      y0 += sy;
+      tile.statistics.droppedFragments++;
+      return;
     }
+
+    tile.fragmentNext = begin;
+    tile.fragmentEnd = std::min(begin + FragmentChunkSize, fragments.size());
   }
-  return line;
+
+  Fragment &fragment = fragments[tile.fragmentNext];
+  fragment.color = color;
+  fragment.depth = depth;
+  fragment.opacity = opacity;
+  fragment.next = fragmentHeads[pixel];
+  fragmentHeads[pixel] = (unsigned int)tile.fragmentNext++;
+
+  tile.statistics.translucentFragments++;
 }
 
-void SimpleRasterizer::DrawTriangle(const Triangle &t)
+void SimpleRasterizer::ResolveTile(Tile &tile)
 {
-  int indices[3] = {0, 1, 2}; // Set of indices so the triangle object does not need to be modified
+  const int width = image->GetWidth();
+  vec3 *pixels = image->GetPixels();
 
-  // Sort vertices by y-value. Could also do std::sort but for three elements this is faster.
-  if (t.position[indices[0]].y > t.position[indices[1]].y)
-    std::swap(indices[0], indices[1]);
-  if (t.position[indices[1]].y > t.position[indices[2]].y)
-    std::swap(indices[1], indices[2]);
-  if (t.position[indices[0]].y > t.position[indices[1]].y)
-    std::swap(indices[0], indices[1]);
+  for (int y = tile.minY; y <= tile.maxY; y++)
+  {
+    for (int x = tile.minX; x <= tile.maxX; x++)
+    {
+      const int pixel = y * width + x;
+      if (fragmentHeads[pixel] == NoFragment)
+        continue;
+
+      // Sort the nearest layers in front of the opaque surface by depth, front to back.
+      // Layers with the same depth stay in the order they were drawn in.
+      const Fragment *layers[MaxFragmentLayers];
+      int layerCount = 0;
+
+      for (unsigned int i = fragmentHeads[pixel]; i != NoFragment; i = fragments[i].next)
+      {
+        const Fragment *fragment = &fragments[i];
+        if (!(fragment->depth < zBuffer[pixel]))
+          continue;
+
+        if (layerCount == MaxFragmentLayers)
+        {
+          tile.statistics.droppedFragments++;
+          if (!(fragment->depth < layers[layerCount - 1]->depth))
+            continue;
+          layerCount--;
+        }
+
+        // The list holds the latest fragment first, so earlier ones go behind equal ones.
+        int j = layerCount++;
+        while (j > 0 && fragment->depth < layers[j - 1]->depth)
+        {
+          layers[j] = layers[j - 1];
+          j--;
+        }
+        layers[j] = fragment;
+      }
 
-  // Apply line algorithm to draw lines between the vertices
-  std::vector<vec2> p01 = DrawLine(t.position[indices[0]], t.position[indices[1]]);
-  std::vector<vec2> p02 = DrawLine(t.position[indices[0]], t.position[indices[2]]);
-  std::vector<vec2> p12 = DrawLine(t.position[indices[1]], t.position[indices[2]]);
+      vec3 color = pixels[pixel];
+      for (int j = layerCount - 1; j >= 0; j--)
+        color = color * (1.0f - layers[j]->opacity) + layers[j]->color * layers[j]->opacity;
 
-  // Some convenience variables
-  int y = t.position[indices[0]].y;
-  int y_end = t.position[indices[2]].y;
+      pixels[pixel] = color;
+    }
+  }
+}
 
-  vec3 color0 = t.color[indices[0]];
-  vec3 color1 = t.color[indices[1]];
-  vec3 color2 = t.color[indices[2]];
+void SimpleRasterizer::ResolveSamples(Tile &tile)
+{
+  const int width = image->GetWidth();
+  const int quadColumns = (width + 3) / 4;
+  vec3 *pixels = image->GetPixels();
+  const float scale = 1.0f / samples;
 
-  float z0 = t.position[0].z;
-  float z1 = t.position[1].z;
-  float z2 = t.position[2].z;
+  for (size_t i = 0; i < tile.splitPixels.size(); i++)
+  {
+    // Skip the entries of pixels that were covered completely or split again later.
+    const unsigned int pixel = tile.splitPixels[i];
+    if (sampleSlots[pixel] != i)
+      continue;
+
+    const int x = pixel % width;
+    const int y = pixel / width;
+    const vec3 *colors = &tile.sampleColors[i * samples];
+    const float *depth = &sampleDepths[((size_t)y * quadColumns + x / 4) * samples * 4 + x % 4];
+    vec3 color(0.0f);
+    float nearestZ = 1.0f;
+
+    for (int s = 0; s < samples; s++)
+    {
+      color += colors[s];
+      nearestZ = std::min(nearestZ, depth[4 * s]);
+    }
 
-  vec3 c1;
-  vec3 c2;
+    pixels[pixel] = color * scale;
+    zBuffer[pixel] = nearestZ;
+    sampleSlots[pixel] = NoSamples;
+    tile.statistics.splitPixels++;
+  }
 
-  double t1;
-  double t2;
+  tile.splitPixels.clear();
+  tile.sampleColors.clear();
+}
 
-  float z01;
-  float z02;
-  float z12;
+void SimpleRasterizer::ShadeTile(Tile &tile)
+{
+  const int width = image->GetWidth();
+  vec3 *pixels = image->GetPixels();
+  Statistics &statistics = tile.statistics;
+
+  // Find the range of depths of the visible pixels. Pixels that are still at the clear
+  // value show the background and stay black.
+  float minZ = 1.0f, maxZ = -1.0f;
+  for (int y = tile.minY; y <= tile.maxY; y++)
+  {
+    const float *depth = &zBuffer[0] + y * width;
+    for (int x = tile.minX; x <= tile.maxX; x++)
+    {
+      if (depth[x] < 1.0f)
+      {
+        minZ = std::min(minZ, depth[x]);
+        maxZ = std::max(maxZ, depth[x]);
+      }
+    }
+  }
 
-  // To iteration variables, one for the left and one for the right line
-  int index_left = 0;
-  int index_right = 0;
+  if (maxZ < minZ)
+    return;
 
-  // Main loop goign from top to bottom
-  while (true)
+  // Only keep the lights whose bounds overlap the tile and the depths within it.
+  tile.lights.clear();
+  for (size_t i = 0; i < lightBounds.size(); i++)
   {
-    // Find current interpolation parameter t for left and right
-    t1 = (double)index_left / (double)(p01.size() - 1);
-    t2 = (double)index_right / (double)(p02.size() - 1);
+    const LightBounds &bounds = lightBounds[i];
+    if (bounds.minX <= tile.maxX && bounds.maxX >= tile.minX && bounds.minY <= tile.maxY &&
+        bounds.maxY >= tile.minY && bounds.minZ <= maxZ && bounds.maxZ >= minZ)
+    {
+      tile.lights.push_back((unsigned int)i);
+    }
+  }
 
-    // Interpolate depth for perspective correct interpolation
-    z01 = 1.0f / glm::mix(1.0f / z0, 1.0f / z1, t1);
-    z02 = 1.0f / glm::mix(1.0f / z0, 1.0f / z2, t2);
+  statistics.tileLights += tile.lights.size();
 
-    DrawSpan(p01[index_left].x,
-             p02[index_right].x,
-             y,
-             z01,
-             z02,
-             color0,
-             color1,
-             color2,
-             t, 
-             indices);
-    
-    // Increment current line
-    y++;
+#ifdef RAYTRACER_SSE2
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+#endif
 
-    // If the middle vertex is reached, break
-    if (y >= t.position[indices[1]].y)
-      break;
+  for (int by = tile.minY; by <= tile.maxY; by += BlockSize)
+  {
+    for (int bx = tile.minX; bx <= tile.maxX; bx += BlockSize)
+    {
+      int endX = std::min(bx + BlockSize - 1, tile.maxX);
+      int endY = std::min(by + BlockSize - 1, tile.maxY);
+
+      // The visible pixels of a block usually lie close together in world space, so most
+      // lights of the tile can be ruled out for the whole block by the box around them.
+      vec3 minPosition(FLT_MAX), maxPosition(-FLT_MAX);
+      for (int y = by; y <= endY; y++)
+      {
+        for (int x = bx; x <= endX; x++)
+        {
+          if (zBuffer[y * width + x] < 1.0f)
+          {
+            minPosition = glm::min(minPosition, gBufferPositions[y * width + x]);
+            maxPosition = glm::max(maxPosition, gBufferPositions[y * width + x]);
+          }
+        }
+      }
+
+      if (maxPosition.x < minPosition.x)
+        continue;
+
+      tile.blockLights.clear();
+      for (size_t i = 0; i < tile.lights.size(); i++)
+      {
+        vec3 position = lights[tile.lights[i]].position;
+        vec3 distance = position - glm::clamp(position, minPosition, maxPosition);
+        if (dot(distance, distance) < lightBounds[tile.lights[i]].squaredRadius)
+          tile.blockLights.push_back(tile.lights[i]);
+      }
+
+      const unsigned int *lightIndices = tile.blockLights.empty() ? NULL : &tile.blockLights[0];
+      const size_t lightCount = tile.blockLights.size();
+
+      for (int y = by; y <= endY; y++)
+      {
+        for (int x = bx; x <= endX; x += 4)
+        {
+          const int offset = y * width + x;
+          const float *depth = &zBuffer[0] + offset;
+          vec3 *target = pixels + offset;
+          int lanes = std::min(4, endX - x + 1);
+
+#ifdef RAYTRACER_SSE2
+          int mask = 0;
+          for (int lane = 0; lane < lanes; lane++)
+          {
+            if (depth[lane] < 1.0f)
+              mask |= 1 << lane;
+          }
+
+          if (mask == 0)
+            continue;
+
+          statistics.shadedPixels += LaneCounts[mask];
+
+          __m128 c[3], n[3], p[3];
+          vec3 color[4], normal[4], position[4];
+
+          if (mask == 0xf)
+          {
+            LoadVec3x4(target, c[0], c[1], c[2]);
+            LoadVec3x4(&gBufferNormals[offset], n[0], n[1], n[2]);
+            LoadVec3x4(&gBufferPositions[offset], p[0], p[1], p[2]);
+          }
+          else
+          {
+            // Empty lanes are filled with copies of the first visible pixel.
+            int first = 0;
+            while (!(mask & (1 << first)))
+              first++;
+
+            for (int lane = 0; lane < 4; lane++)
+            {
+              int source = (mask & (1 << lane)) ? lane : first;
+              color[lane] = target[source];
+              normal[lane] = gBufferNormals[offset + source];
+              position[lane] = gBufferPositions[offset + source];
+            }
+
+            LoadVec3x4(color, c[0], c[1], c[2]);
+            LoadVec3x4(normal, n[0], n[1], n[2]);
+            LoadVec3x4(position, p[0], p[1], p[2]);
+          }
+
+          __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+              _mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1])), _mm_mul_ps(n[2], n[2]))));
+          for (int k = 0; k < 3; k++)
+            n[k] = _mm_mul_ps(n[k], inverseLength);
+
+          // Every operation is done in the same order as in LightPixel().
+          __m128 result[3];
+          for (int k = 0; k < 3; k++)
+            result[k] = _mm_mul_ps(c[k], _mm_set1_ps(ambientLight[k]));
+
+          for (size_t i = 0; i < lightCount; i++)
+          {
+            const VertexLight &light = lights[lightIndices[i]];
+            const LightBounds &bounds = lightBounds[lightIndices[i]];
+
+            __m128 distance[3];
+            for (int k = 0; k < 3; k++)
+              distance[k] = _mm_sub_ps(_mm_set1_ps(light.position[k]), p[k]);
+
+            __m128 squaredDistance = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(distance[0], distance[0]), _mm_mul_ps(distance[1], distance[1])),
+                _mm_mul_ps(distance[2], distance[2]));
+
+            // Most lights of a tile only reach some of its pixels.
+            __m128 reached = _mm_cmplt_ps(squaredDistance, _mm_set1_ps(bounds.squaredRadius));
+            if (_mm_movemask_ps(reached) == 0)
+              continue;
+
+            __m128 attenuation = _mm_max_ps(_mm_sub_ps(
+                _mm_div_ps(one, _mm_add_ps(_mm_set1_ps(0.001f), squaredDistance)),
+                _mm_set1_ps(bounds.cutoff)), zero);
+            __m128 inverseDistance = _mm_div_ps(one, _mm_sqrt_ps(squaredDistance));
+
+            __m128 lambert = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(n[0], _mm_mul_ps(distance[0], inverseDistance)),
+                _mm_mul_ps(n[1], _mm_mul_ps(distance[1], inverseDistance))),
+                _mm_mul_ps(n[2], _mm_mul_ps(distance[2], inverseDistance)));
+            lambert = _mm_max_ps(zero, lambert);
+
+            __m128 lit = _mm_and_ps(_mm_cmpgt_ps(lambert, zero), reached);
+
+            bool shadowed = (lightIndices[i] < shadowMaps.size());
+            __m128 visibility = one;
+            if (shadowed)
+              visibility = GetShadowQuad(lightIndices[i], p, n, _mm_movemask_ps(lit) & mask);
+
+            for (int k = 0; k < 3; k++)
+            {
+              __m128 term = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(c[k], lambert), attenuation),
+                                       _mm_set1_ps(light.intensity[k]));
+              if (shadowed)
+                term = _mm_mul_ps(term, visibility);
+              result[k] = _mm_add_ps(result[k], _mm_and_ps(term, lit));
+            }
+          }
+
+          if (mask == 0xf)
+          {
+            StoreVec3x4(target, result[0], result[1], result[2]);
+            continue;
+          }
+
+          StoreVec3x4(color, result[0], result[1], result[2]);
+          for (int lane = 0; lane < lanes; lane++)
+          {
+            if (mask & (1 << lane))
+              target[lane] = color[lane];
+          }
+#else
+          for (int lane = 0; lane < lanes; lane++)
+          {
+            if (!(depth[lane] < 1.0f))
+              continue;
+
+            statistics.shadedPixels++;
+            target[lane] = LightPixel(gBufferPositions[offset + lane],
+                                      normalize(gBufferNormals[offset + lane]), target[lane],
+                                      lightIndices, lightCount);
+          }
+#endif
+        }
+      }
+    }
+  }
+}
+
+void SimpleRasterizer::RenderTiles()
+{
+  const int tileCount = (int)tiles.size();
+  const int rangeCount = ((int)screenTriangles.size() + binRangeSize - 1) / binRangeSize;
 
-    // Iterate both lines till the next y value is reached
-    while (p01[index_left].y != y)
+  // Each tile is drawn by a single thread, which owns its part of the image and the z
+  // buffer.
+  ParallelFor(0, tileCount, 1, [&](int begin, int end)
+  {
+    for (int i = begin; i < end; i++)
     {
-      index_left++;
+      Tile &tile = tiles[i];
+      tile.statistics = Statistics();
+      tile.translucent = false;
+      tile.fragmentNext = tile.fragmentEnd = 0;
+
+      // Clear the tile once per frame, unless it is still clear from an earlier frame.
+      unsigned char &pixelsCleared = (*imageClearedPixels)[i];
+      ClearTile(tile, pixelsCleared);
+
+      // The depth pre-pass lays down the nearest depths of the opaque triangles, so that the
+      // shading pass below only shades the visible fragments.
+      if (visibility == Visibility_DepthPrepass && samples == 1)
+      {
+        for (int range = 0; range < rangeCount; range++)
+        {
+          const vector<unsigned int> &bin = bins[(size_t)range * tileCount + i];
+          for (size_t j = 0; j < bin.size(); j++)
+          {
+            const ScreenTriangle &t = screenTriangles[bin[j]];
+            if (!(t.opacity < 1.0f))
+              DrawTriangle<true>(t, tile);
+          }
+        }
+
+        const int width = image->GetWidth();
+        for (int y = tile.minY; y <= tile.maxY; y++)
+          std::fill_n(&shadedPixels[0] + y * width + tile.minX, tile.maxX - tile.minX + 1, 0);
+      }
+
+      for (int range = 0; range < rangeCount; range++)
+      {
+        const vector<unsigned int> &bin = bins[(size_t)range * tileCount + i];
+        for (size_t j = 0; j < bin.size(); j++)
+          DrawTriangle<false>(screenTriangles[bin[j]], tile);
+      }
+
+      if (tile.statistics.fragmentsWritten > 0)
+      {
+        tile.cleared = false;
+        pixelsCleared = 0;
+
+        if (overdrawStatistics)
+        {
+          const int width = image->GetWidth();
+          for (int y = tile.minY; y <= tile.maxY; y++)
+          {
+            const float *depth = &zBuffer[0] + y * width;
+            for (int x = tile.minX; x <= tile.maxX; x++)
+            {
+              if (depth[x] < 1.0f)
+                tile.statistics.coveredPixels++;
+            }
+          }
+        }
+
+        // Deferred shading lights the averaged diffuse colors of the split pixels with the
+        // surface drawn last into them.
+        if (samples > 1)
+          ResolveSamples(tile);
+
+        if (shading == Shading_Deferred)
+          ShadeTile(tile);
+      }
+
+      // The translucent layers are blended over the lit opaque pixels.
+      if (tile.translucent)
+      {
+        pixelsCleared = 0;
+        ResolveTile(tile);
+      }
     }
-    while (p02[index_right].y != y)
+  });
+
+  for (int i = 0; i < tileCount; i++)
+  {
+    statistics.blocks += tiles[i].statistics.blocks;
+    statistics.fragments += tiles[i].statistics.fragments;
+    statistics.fragmentsWritten += tiles[i].statistics.fragmentsWritten;
+    statistics.fragmentsAccepted += tiles[i].statistics.fragmentsAccepted;
+    statistics.prepassFragments += tiles[i].statistics.prepassFragments;
+    statistics.coveredPixels += tiles[i].statistics.coveredPixels;
+    statistics.culledTriangles += tiles[i].statistics.culledTriangles;
+    statistics.culledBlocks += tiles[i].statistics.culledBlocks;
+    statistics.culledPixels += tiles[i].statistics.culledPixels;
+    statistics.shadedPixels += tiles[i].statistics.shadedPixels;
+    statistics.tileLights += tiles[i].statistics.tileLights;
+    statistics.translucentFragments += tiles[i].statistics.translucentFragments;
+    statistics.droppedFragments += tiles[i].statistics.droppedFragments;
+    statistics.splitPixels += tiles[i].statistics.splitPixels;
+  }
+}
+
+void SimpleRasterizer::UpdateLights(const Scene &scene)
+{
+  const vector<Light *> &sceneLights = scene.GetLights();
+
+  if (lightScene != &scene || lightGeneration != scene.GetGeneration(SceneRegistry_Lights))
+  {
+    lights.resize(sceneLights.size());
+    for (size_t i = 0; i < sceneLights.size(); i++)
     {
-      index_right++;
+      lights[i].intensity = vec3(1.0f);
+      if (sceneLights[i]->HasType(SceneObjectType_PointLight))
+        lights[i].intensity = ((const PointLight *)sceneLights[i])->GetIntensity();
     }
+
+    lightScene = &scene;
+    lightGeneration = scene.GetGeneration(SceneRegistry_Lights);
   }
 
-  // Reinitialize the left iterator, since we now use the bottom line
-  index_left = 0;
-  // Decrement line such that the last drawspan is actually called
-  y--;
+  // Lights may move every frame.
+  for (size_t i = 0; i < sceneLights.size(); i++)
+    lights[i].position = sceneLights[i]->GetGlobalPosition();
+}
+
+void SimpleRasterizer::UpdateLightBounds(const mat4 &viewTransform,
+                                         const mat4 &projectionTransform, float nearClip)
+{
+  const int width = image->GetWidth();
+  const int height = image->GetHeight();
 
-  // Second loop, from middle vertex to bottom vertex
-  while (y < y_end)
+  lightBounds.resize(lights.size());
+  for (size_t i = 0; i < lights.size(); i++)
   {
-    // Find current interpolation parameter t for left and right
-    t1 = (double)index_left / (double)(p12.size() - 1);
-    t2 = (double)index_right / (double)(p02.size() - 1);
+    LightBounds &bounds = lightBounds[i];
+    const VertexLight &light = lights[i];
+
+    bounds.minX = 0;
+    bounds.minY = 0;
+    bounds.maxX = width - 1;
+    bounds.maxY = height - 1;
+    bounds.minZ = -1.0f;
+    bounds.maxZ = 1.0f;
+    bounds.squaredRadius = FLT_MAX;
+    bounds.cutoff = 0.0f;
+
+    // Without a threshold, every light reaches every pixel.
+    if (lightThreshold <= 0.0f)
+      continue;
+
+    // The contribution of a light is at most its intensity times the attenuation, which
+    // falls to the threshold at this radius.
+    float maxIntensity = std::max(std::max(light.intensity.r, light.intensity.g),
+                                  light.intensity.b);
+    float squaredRadius = maxIntensity / lightThreshold - 0.001f;
+    if (!(squaredRadius > 0.0f))
+    {
+      bounds.maxX = -1;
+      continue;
+    }
 
-    // Interpolate depth for perspective correct interpolation
-    z02 = 1.0f / glm::mix(1.0f / z0, 1.0f / z2, t2);
-    z12 = 1.0f / glm::mix(1.0f / z1, 1.0f / z2, t1);
+    float radius = sqrtf(squaredRadius);
+    bounds.squaredRadius = squaredRadius;
+    bounds.cutoff = lightThreshold / maxIntensity;
 
-    // Call the DrawSpan() function
-    DrawSpan(p12[index_left].x,
-             p02[index_right].x,
-             y,
-             z12,
-             z02,
-             color0,
-             color1,
-             color2,
-             t, 
-             indices);
+    vec3 center = vec3(viewTransform * vec4(light.position, 1.0f));
+    float nearDistance = -center.z - radius;
+    float farDistance = -center.z + radius;
 
-    // Increment current line
-    y++;
+    if (farDistance <= nearClip)
+    {
+      bounds.maxX = -1;
+      continue;
+    }
 
-    // Iterate both lines till the next y value is reached
-    while (p12[index_left].y != y)
+    // Map the range of distances from the camera to screen space depths.
+    float distances[2] = {std::max(nearDistance, nearClip), farDistance};
+    float depths[2];
+    for (int j = 0; j < 2; j++)
     {
-      index_left++;
+      vec4 clip = projectionTransform * vec4(0.0f, 0.0f, -distances[j], 1.0f);
+      depths[j] = clip.z / clip.w;
     }
-    while (p02[index_right].y != y)
+
+    bounds.minZ = depths[0] - DepthMargin;
+    bounds.maxZ = depths[1] + DepthMargin;
+
+    // Spheres reaching through the near plane may cover any pixel. Otherwise, the corners
+    // of the box around the sphere, which all lie in front of the camera, bound its
+    // projection.
+    if (nearDistance <= nearClip)
+      continue;
+
+    vec2 minCorner(FLT_MAX);
+    vec2 maxCorner(-FLT_MAX);
+    for (int corner = 0; corner < 8; corner++)
     {
-      index_right++;
+      vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius,
+                  (corner & 4) ? radius : -radius);
+      vec4 clip = projectionTransform * vec4(center + offset, 1.0f);
+      vec2 screen((clip.x / clip.w + 1.0f) * (width * 0.5f),
+                  (1.0f - clip.y / clip.w) * (height * 0.5f));
+
+      minCorner = glm::min(minCorner, screen);
+      maxCorner = glm::max(maxCorner, screen);
     }
+
+    // Include every pixel whose center may lie within the projection.
+    bounds.minX = std::max((int)std::max(floorf(minCorner.x - 0.5f), -1.0f), 0);
+    bounds.minY = std::max((int)std::max(floorf(minCorner.y - 0.5f), -1.0f), 0);
+    bounds.maxX = std::min((int)std::min(ceilf(maxCorner.x - 0.5f), (float)width), width - 1);
+    bounds.maxY = std::min((int)std::min(ceilf(maxCorner.y - 0.5f), (float)height), height - 1);
   }
 }
 
-vec3 SimpleRasterizer::LightVertex(vec4 position, vec3 normal, vec3 color)
+void SimpleRasterizer::UpdateShadowMaps(const Scene &scene)
 {
-  vec3 result = color * ambientLight;
+  const size_t mapCount = (shadowMapSize > 0 ? std::min(lights.size(), (size_t)shadowLightLimit) : 0);
+  const size_t faceSize = (size_t)shadowMapSize * shadowMapSize;
+  shadowMaps.resize(mapCount);
 
-  foreach (const Light *, light, lights)
+  vector<int> faces;
+  for (size_t i = 0; i < mapCount; i++)
   {
-    vec3 intensity = vec3(1.0f);
-    if ((*light)->IsInstanceOf(SceneObjectType_PointLight))
-      intensity = ((PointLight *)*light)->GetIntensity();
+    ShadowMap &map = shadowMaps[i];
+    const VertexLight &light = lights[i];
 
-    vec3 distance = (*light)->GetPosition() - vec3(position);
-    float attenuation = 1.0f / (0.001f + dot(distance, distance));
-    vec3 direction = normalize(distance);
+    // The light reaches as far as with deferred shading, see UpdateLightBounds().
+    float squaredRadius = FLT_MAX;
+    if (lightThreshold > 0.0f)
+    {
+      float maxIntensity = std::max(std::max(light.intensity.r, light.intensity.g),
+                                    light.intensity.b);
+      squaredRadius = std::max(maxIntensity / lightThreshold - 0.001f, 0.0f);
+    }
 
-    float lambert = glm::max(0.0f, dot(normal, direction));
+    // Gather the opaque meshes that may lie within the radius. Translucent and invisible
+    // ones cast no shadows.
+    float radius = sqrtf(squaredRadius);
+    float farClip = 2.0f * ShadowNearClip;
+    shadowCasters.clear();
+    foreach_c (Mesh *, mesh, scene.GetMeshes())
+    {
+      Material *material = (*mesh)->GetMaterial();
+      if (material != NULL && !(material->GetOpacity() >= 1.0f))
+        continue;
+
+      vec3 center;
+      float meshRadius;
+      (*mesh)->GetBoundingSphere(center, meshRadius);
+      if (meshRadius < 0.0f)
+        continue;
+
+      const mat4 &transform = (*mesh)->GetGlobalTransformation();
+      meshRadius *= std::max(std::max(length(vec3(transform[0])), length(vec3(transform[1]))),
+                             length(vec3(transform[2])));
+      float distance = length(vec3(transform * vec4(center, 1.0f)) - light.position);
+      if (!(distance - meshRadius < radius))
+        continue;
+
+      ShadowCaster caster = {*mesh, transform, lodLevels[*mesh], (*mesh)->GetGeneration()};
+      shadowCasters.push_back(caster);
+      farClip = std::max(farClip, std::min(distance + meshRadius, radius));
+    }
 
-    if (lambert > 0)
-      result += color * lambert * attenuation * intensity;
+    // Keep the map if nothing it depends on has changed.
+    bool changed = (map.depths.size() != 6 * faceSize || map.position != light.position ||
+                    map.squaredRadius != squaredRadius ||
+                    map.casters.size() != shadowCasters.size());
+    for (size_t j = 0; !changed && j < shadowCasters.size(); j++)
+    {
+      const ShadowCaster &a = map.casters[j];
+      const ShadowCaster &b = shadowCasters[j];
+      changed = (a.mesh != b.mesh || a.transform != b.transform || a.level != b.level ||
+                 a.generation != b.generation);
+    }
+
+    if (!changed)
+      continue;
+
+    map.depths.resize(6 * faceSize);
+    map.position = light.position;
+    map.squaredRadius = squaredRadius;
+    map.farClip = farClip * 1.01f;
+    map.casters.swap(shadowCasters);
+    statistics.renderedShadowMaps++;
+
+    for (int face = 0; face < 6; face++)
+      faces.push_back((int)i * 6 + face);
   }
 
-  return result;
+  // Every face is rendered by a single thread.
+  ParallelFor(0, (int)faces.size(), 1, [&](int begin, int end)
+  {
+    for (int i = begin; i < end; i++)
+      RenderShadowFace(shadowMaps[faces[i] / 6], faces[i] % 6);
+  });
 }
 
-void SimpleRasterizer::SortTriangles(vector<Triangle> &triangles)
+void SimpleRasterizer::RenderShadowFace(ShadowMap &map, int face)
 {
-  sort(triangles.begin(), triangles.end(), CompareTriangle);
-}
+  const int size = shadowMapSize;
+  const float guard = GuardBand / size;
+  float *depths = &map.depths[(size_t)face * size * size];
+  std::fill_n(depths, (size_t)size * size, 0.0f);
 
-void SimpleRasterizer::TransformAndLightTriangle(Triangle &t,
-                                                 const mat4 &modelTransform,
-                                                 const mat4 &modelTransformNormals)
-{
-  // Exercise 8.1 c)
+  const mat4 faceTransform = GetShadowFaceTransform(map.position, face, map.farClip);
+  vector<vec4> clip, screen;
+  vector<int> codes;
 
-  for (int i = 0; i < 3; i++)
+  foreach_c (ShadowCaster, caster, map.casters)
   {
-    // Apply model transform to go from model coordiantes to world coordinates
-    vec4 worldCoords = modelTransform * vec4(t.position[i], 1.0f);
-    vec3 worldNormal = normalize(vec3(modelTransformNormals * vec4(t.normal[i], 0.0f)));
-
-    // Light vertex in world coordinates
-    t.color[i] = LightVertex(worldCoords, worldNormal, t.color[i]);
+    const Mesh *mesh = caster->mesh;
+    const mat4 transform = faceTransform * caster->transform;
 
-    // Get clip coordinates by ViewProjectionTransformation
-    vec4 clipCoords = this->viewProjectionTransform * worldCoords;
-
-    // Get normalized device coordinates (i.e. x,y in [-1,1])
-    clipCoords.x /= clipCoords.w;
-    clipCoords.y /= clipCoords.w;
-    clipCoords.z /= clipCoords.w;
+    // Use the same vertices and triangles as RenderMesh().
+    const unsigned int *indices = NULL;
+    size_t vertexCount, triangleCount;
+    if (mesh->IsIndexed())
+    {
+      vertexCount = mesh->GetLodVertexCount(caster->level);
+      triangleCount = mesh->GetLodIndices(caster->level).size() / 3;
+      if (vertexCount == 0 || triangleCount == 0)
+        continue;
+      indices = &mesh->GetLodIndices(caster->level)[0];
+    }
+    else
+    {
+      triangleCount = mesh->GetTriangles().size();
+      vertexCount = 3 * triangleCount;
+    }
 
-    // Apply viewport transform to get windows coordinates and set new positions
-    t.position[i].x = (clipCoords.x + 1.0) * (image->GetWidth() / 2.0);
-    t.position[i].y = (-1.0f * clipCoords.y + 1.0) * (image->GetHeight() / 2.0);
-    t.position[i].z = clipCoords.z;
-  }
-}
+    clip.resize(vertexCount);
+    screen.resize(vertexCount);
+    codes.resize(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+      vec3 position = (indices != NULL ? mesh->GetPositions()[v] :
+                       mesh->GetTriangles()[v / 3].position[v % 3]);
+      vec4 p = transform * vec4(position, 1.0f);
+      clip[v] = p;
+      codes[v] = GetClipCode(p, guard, guard);
+      screen[v] = vec4((p.x / p.w + 1.0f) * (size * 0.5f), (1.0f - p.y / p.w) * (size * 0.5f),
+                       0.0f, 1.0f / p.w);
+    }
 
-void SimpleRasterizer::RenderMesh(const Mesh *mesh)
-{
-  if (mesh == NULL)
-    return;
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+      unsigned int index[3];
+      for (int v = 0; v < 3; v++)
+        index[v] = (indices != NULL ? indices[3 * i + v] : (unsigned int)(3 * i + v));
+
+      int code[3] = {codes[index[0]], codes[index[1]], codes[index[2]]};
+      if (code[0] & code[1] & code[2] & FrustumPlanes)
+        continue;
+
+      int planes = (code[0] | code[1] | code[2]) & ClipPlanes;
+      if (planes == 0)
+      {
+        vec4 position[3] = {screen[index[0]], screen[index[1]], screen[index[2]]};
+        DrawShadowTriangle(position, depths, size);
+        continue;
+      }
 
-  // Exercise 8.1 a)
+      // Clip the triangle like ClipTriangle() does, without varyings.
+      ClipVertex polygon[2][MaxClipVertices];
+      int count = 3;
+      for (int v = 0; v < 3; v++)
+        polygon[0][v].position = clip[index[v]];
+
+      int current = 0;
+      for (int plane = 1; plane <= planes && count >= 3; plane <<= 1)
+      {
+        if (planes & plane)
+        {
+          count = ClipPolygon(polygon[current], count, 0, plane, guard, guard,
+                              polygon[1 - current]);
+          current = 1 - current;
+        }
+      }
 
-  const mat4 modelTransform = mesh->GetGlobalTransformation();
-  const mat4 modelTransformNormals = inverseTranspose(modelTransform);
+      vec4 position[MaxClipVertices];
+      for (int v = 0; v < count; v++)
+      {
+        const vec4 &p = polygon[current][v].position;
+        position[v] = vec4((p.x / p.w + 1.0f) * (size * 0.5f),
+                           (1.0f - p.y / p.w) * (size * 0.5f), 0.0f, 1.0f / p.w);
+      }
 
-  for (Triangle t : mesh->GetTriangles())
-  {
-    this->TransformAndLightTriangle(t, modelTransform, modelTransformNormals);
-    this->DrawTriangle(t);
+      for (int v = 1; v + 1 < count; v++)
+      {
+        vec4 fan[3] = {position[0], position[v], position[v + 1]};
+        DrawShadowTriangle(fan, depths, size);
+      }
+    }
   }
 }
 
-void SimpleRasterizer::ScanObject(const Raytracer::Scenes::SceneObject *object)
+bool SimpleRasterizer::Render(Image &image, Scene &scene)
 {
-  if (object == NULL)
-    return;
-
-  if (object->IsInstanceOf(SceneObjectType_Light))
-    lights.push_back((const Light *)object);
-  if (object->IsInstanceOf(SceneObjectType_Mesh))
-    meshes.push_back((const Mesh *)object);
+  // The render targets of the previous frame are reused. The pixels of the tiles are
+  // tracked for each image, so images that are used in turn are not cleared completely.
+  Clock::time_point stageStart = Clock::now();
+  this->image = &image;
 
-  foreach_c(SceneObject *, child, object->GetChildren())
-      ScanObject(*child);
-}
+  UpdateTiles();
+  if (clearedPixels.size() >= MaxTrackedImages && clearedPixels.count(&image) == 0)
+    clearedPixels.clear();
 
-bool SimpleRasterizer::Render(Image &image, const Scene &scene)
-{
-  image.Clear(vec3(0));
+  imageClearedPixels = &clearedPixels[&image];
+  if (imageClearedPixels->size() != tiles.size())
+    imageClearedPixels->assign(tiles.size(), 0);
 
   Camera *camera = scene.GetActiveCamera();
   if (camera == NULL)
+  {
+    for (size_t i = 0; i < tiles.size(); i++)
+      ClearTile(tiles[i], (*imageClearedPixels)[i]);
     return false;
+  }
+
+  statistics = Statistics();
+  stageTimes = StageTimes();
 
-  zBuffer = new float[image.GetWidth() * image.GetHeight()];
-  for (int i = 0; i < image.GetWidth() * image.GetHeight(); i++)
-    zBuffer[i] = 1.0f;
+  // Bring the global transformations up to date before anything reads them.
+  scene.GetSceneGraph()->Update();
 
-  // Build lists of all lights and meshes in the scene.
-  lights.clear();
-  meshes.clear();
-  ScanObject(&scene);
+  // Get all lights from the scene's registry.
+  UpdateLights(scene);
 
   // Exercise 8.1 b)
 
@@ -396,12 +3346,239 @@ bool SimpleRasterizer::Render(Image &image, const Scene &scene)
 
   this->viewProjectionTransform = projectionMatrix * viewTransformation;
 
-  // Render all meshes we found.
-  this->image = &image;
-  foreach (const Mesh *, mesh, meshes)
-    RenderMesh(*mesh);
+  if (shading == Shading_Deferred)
+  {
+    gBufferNormals.resize((size_t)image.GetWidth() * image.GetHeight());
+    gBufferPositions.resize((size_t)image.GetWidth() * image.GetHeight());
+    UpdateLightBounds(viewTransformation, projectionMatrix, camera->GetNearClip());
+  }
+
+  // Forget the previous levels of detail if meshes were added or removed.
+  if (lodScene != &scene || lodGeneration != scene.GetGeneration(SceneRegistry_Meshes))
+  {
+    lodLevels.clear();
+    lodScene = &scene;
+    lodGeneration = scene.GetGeneration(SceneRegistry_Meshes);
+  }
+
+  // Transform all meshes we found, each at the level of detail that fits its size on screen.
+  varyingCount = (shading == Shading_Gouraud ? 3 : 9);
+  textureVarying = -1;
+  foreach_c (Mesh *, mesh, scene.GetMeshes())
+  {
+    if (GetMeshTexture(*mesh) != NULL)
+    {
+      textureVarying = varyingCount;
+      varyingCount += 2;
+      break;
+    }
+  }
+
+  translucent = false;
+  screenTriangles.clear();
+  transformedPositions.clear();
+  varyings.clear();
+  foreach_c (Mesh *, mesh, scene.GetMeshes())
+  {
+    int &level = lodLevels[*mesh];
+    level = (*mesh)->SelectLod(*camera, (float)image.GetHeight(), lodTriangleDensity, level);
+  }
+
+  stageTimes.sceneTime = TakeMilliseconds(stageStart);
+
+  // The shadows are cast by the same levels of detail, and are needed to light the
+  // vertices.
+  UpdateShadowMaps(scene);
+  stageTimes.shadowTime = TakeMilliseconds(stageStart);
+
+  // The meshes measure their own vertex and setup stages.
+  foreach_c (Mesh *, mesh, scene.GetMeshes())
+    RenderMesh(*mesh, lodLevels[*mesh]);
+  stageStart = Clock::now();
 
-  delete[] zBuffer;
+  // The fragment lists are only needed for translucent meshes.
+  if (translucent)
+  {
+    fragmentHeads.resize((size_t)image.GetWidth() * image.GetHeight());
+    fragments.resize(fragmentBudget);
+    fragmentCount = 0;
+  }
+
+  // The painter's algorithm draws the triangles from back to front, and the tiles draw them
+  // in the order of the triangle list.
+  if (visibility == Visibility_Painter)
+  {
+    stageTimes.setupTime += TakeMilliseconds(stageStart);
+    SortTriangles();
+    stageTimes.sortTime = TakeMilliseconds(stageStart);
+  }
+
+  // Sort the triangles into screen tiles and draw the tiles in parallel.
+  BinTriangles();
+  stageTimes.setupTime += TakeMilliseconds(stageStart);
+  RenderTiles();
+  stageTimes.rasterTime = TakeMilliseconds(stageStart);
 
   return true;
 }
+
+void SimpleRasterizer::UpdateTiles()
+{
+  int width = image->GetWidth();
+  int height = image->GetHeight();
+
+  tileColumns = (width + TileSize - 1) / TileSize;
+  int tileRows = (height + TileSize - 1) / TileSize;
+
+  const size_t sampleCount = (samples > 1 ? (size_t)(width + 3) / 4 * 4 * height * samples : 0);
+
+  if (tiles.size() == (size_t)(tileColumns * tileRows) &&
+      zBuffer.size() == (size_t)width * height && sampleDepths.size() == sampleCount &&
+      (tiles.empty() || (tiles.back().maxX == width - 1 && tiles.back().maxY == height - 1)))
+  {
+    return;
+  }
+
+  zBuffer.resize((size_t)width * height);
+  shadedPixels.resize((size_t)width * height);
+
+  // The samples are only allocated with multisampling. No pixel is split between frames.
+  if (samples > 1)
+  {
+    sampleDepths.resize(sampleCount);
+    sampleSlots.assign((size_t)width * height, (unsigned int)NoSamples);
+  }
+  else
+  {
+    vector<float>().swap(sampleDepths);
+    vector<unsigned int>().swap(sampleSlots);
+  }
+
+  blockColumns = (width + BlockSize - 1) / BlockSize;
+  hiZ.resize(blockColumns * ((height + BlockSize - 1) / BlockSize));
+
+  tiles.resize(tileColumns * tileRows);
+  for (int y = 0; y < tileRows; y++)
+  {
+    for (int x = 0; x < tileColumns; x++)
+    {
+      Tile &tile = tiles[y * tileColumns + x];
+      tile.minX = x * TileSize;
+      tile.minY = y * TileSize;
+      tile.maxX = std::min(tile.minX + TileSize, width) - 1;
+      tile.maxY = std::min(tile.minY + TileSize, height) - 1;
+      tile.cleared = false;
+    }
+  }
+
+  // The bins of the old tile layout are meaningless now, and so are the flags of the images.
+  bins.clear();
+  clearedPixels.clear();
+}
+
+void SimpleRasterizer::SetBackfaceCulling(bool enable)
+{
+  backfaceCulling = enable;
+}
+
+void SimpleRasterizer::SetOverdrawStatistics(bool enable)
+{
+  overdrawStatistics = enable;
+}
+
+void SimpleRasterizer::SetVisibility(Visibility visibility)
+{
+  this->visibility = visibility;
+}
+
+void SimpleRasterizer::SetShading(Shading shading)
+{
+  this->shading = shading;
+}
+
+void SimpleRasterizer::SetLightThreshold(float threshold)
+{
+  lightThreshold = threshold;
+}
+
+void SimpleRasterizer::SetFragmentBudget(size_t fragments)
+{
+  // The fragments are addressed with 32 bit indices.
+  fragmentBudget = std::min(fragments, (size_t)NoFragment);
+}
+
+void SimpleRasterizer::SetMultisampling(int samples)
+{
+  if (samples >= 8)
+  {
+    this->samples = 8;
+    samplePositions = SamplePositions8;
+  }
+  else if (samples >= 4)
+  {
+    this->samples = 4;
+    samplePositions = SamplePositions4;
+  }
+  else
+  {
+    this->samples = 1;
+    samplePositions = NULL;
+  }
+
+  // A single sample lies at the pixel center.
+  sampleExtent = 0;
+  if (samplePositions != NULL)
+  {
+    for (int s = 0; s < this->samples; s++)
+    {
+      sampleExtent = std::max(sampleExtent, std::abs(samplePositions[s][0]));
+      sampleExtent = std::max(sampleExtent, std::abs(samplePositions[s][1]));
+    }
+  }
+}
+
+void SimpleRasterizer::SetShadows(int mapSize, int lightLimit)
+{
+  shadowMapSize = std::min(std::max(mapSize, 0), (int)MaxShadowMapSize);
+  shadowLightLimit = std::max(lightLimit, 0);
+
+  // The maps are rendered again in the next frame.
+  shadowMaps.clear();
+}
+
+size_t SimpleRasterizer::GetRenderTargetSize() const
+{
+  size_t size = zBuffer.capacity() * sizeof(float) + hiZ.capacity() * sizeof(HiZBlock) +
+                shadedPixels.capacity() +
+                sampleDepths.capacity() * sizeof(float) +
+                sampleSlots.capacity() * sizeof(unsigned int) +
+                (gBufferNormals.capacity() + gBufferPositions.capacity()) * sizeof(vec3) +
+                fragmentHeads.capacity() * sizeof(unsigned int) +
+                fragments.capacity() * sizeof(Fragment);
+
+  for (size_t i = 0; i < tiles.size(); i++)
+  {
+    size += tiles[i].sampleColors.capacity() * sizeof(vec3) +
+            tiles[i].splitPixels.capacity() * sizeof(unsigned int);
+  }
+
+  for (size_t i = 0; i < shadowMaps.size(); i++)
+    size += shadowMaps[i].depths.capacity() * sizeof(float);
+
+  return size;
+}
+
+void SimpleRasterizer::SetLodTriangleDensity(float trianglesPerPixel)
+{
+  lodTriangleDensity = trianglesPerPixel;
+}
+
+const SimpleRasterizer::Statistics &SimpleRasterizer::GetStatistics() const
+{
+  return statistics;
+}
+
+const SimpleRasterizer::StageTimes &SimpleRasterizer::GetStageTimes() const
+{
+  return stageTimes;
+}
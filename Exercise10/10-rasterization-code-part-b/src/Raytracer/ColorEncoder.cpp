@@ -0,0 +1,590 @@
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <glm.hpp>
+
+#include <Raytracer/ColorEncoder.h>
+#include <Raytracer/Image.h>
+#include <Raytracer/Internal/Parallel.h>
+#include <Raytracer/Internal/Simd.h>
+
+using namespace glm;
+using namespace Raytracer;
+using namespace Raytracer::Internal;
+
+namespace
+{
+	/**
+	 * The number of rows encoded by one task of ParallelFor()
+	 */
+	const int RowsPerTask = 16;
+
+	/**
+	 * The float representations of 1 and of the smallest normalized float
+	 */
+	const unsigned int OneBits = 0x3f800000;
+	const unsigned int MinNormalBits = 0x00800000;
+
+	/**
+	 * The float representation of the largest value that is looked up in a table before
+	 * trying smaller ones, 2^-20
+	 */
+	const unsigned int MinTableBits = 0x35800000;
+
+	/**
+	 * The parameters of the sRGB curve
+	 */
+	const float SrgbGamma = 2.4f;
+	const float SrgbLinearLimit = 0.0031308f;
+	const float SrgbLinearSlope = 12.92f;
+	const float SrgbScale = 1.055f;
+	const float SrgbOffset = 0.055f;
+
+	/**
+	 * The coefficients of the series log2((1 + t) / (1 - t)) = c1 t + c3 t^3 + c5 t^5 + ...,
+	 * which is accurate to about 1e-5 up to t^5 for |t| <= 1/5. That is well below the
+	 * 0.4% of a step of eight bits.
+	 */
+	const float Log2C1 = 2.8853900818f;
+	const float Log2C3 = 0.9617966939f;
+	const float Log2C5 = 0.5770780164f;
+
+	/**
+	 * The coefficients of the Taylor series of 2^f, which is accurate to about 3e-6 up to
+	 * f^5 for |f| <= 1/2
+	 */
+	const float Exp2C1 = 0.6931471806f;
+	const float Exp2C2 = 0.2402265070f;
+	const float Exp2C3 = 0.0555041087f;
+	const float Exp2C4 = 0.0096181291f;
+	const float Exp2C5 = 0.0013333558f;
+
+	/**
+	 * 2^-1/2, which undoes the shift of the exponent's fraction into [-1/2, 1/2]
+	 */
+	const float Exp2Shift = 0.7071067812f;
+
+	/**
+	 * The offsets added before truncating for ordered dithering, a 4 x 4 Bayer matrix
+	 * scaled to the range from 0 to 1
+	 */
+	const float BayerOffsets[4][4] = {
+		{ 0.5f / 16, 8.5f / 16, 2.5f / 16, 10.5f / 16 },
+		{ 12.5f / 16, 4.5f / 16, 14.5f / 16, 6.5f / 16 },
+		{ 3.5f / 16, 11.5f / 16, 1.5f / 16, 9.5f / 16 },
+		{ 15.5f / 16, 7.5f / 16, 13.5f / 16, 5.5f / 16 }
+	};
+
+	const float NoOffsets[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	float BitsToFloat(unsigned int bits)
+	{
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	unsigned int FloatToBits(float value)
+	{
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	/**
+	 * What the encoding functions need to know about a table, held in registers while a row
+	 * is encoded. See ColorEncoder::Table.
+	 */
+	struct TableView
+	{
+		const unsigned int *slots;
+		unsigned int minBits;
+		int shift;
+	};
+
+	/**
+	 * What the polynomial encoding functions need to know about the curve
+	 */
+	struct CurveView
+	{
+		bool srgb;
+
+		/**
+		 * The exponent of the power curve
+		 */
+		float exponent;
+	};
+
+	/**
+	 * Encodes a value with a table.
+	 *
+	 * @param table The table
+	 * @param value The linear value
+	 * @return The encoded value, from 0 to 255
+	 */
+	int EncodeTable(TableView table, float value)
+	{
+		unsigned int bits = FloatToBits(value);
+
+		// Negative values are above all positive ones when their bits are read as an integer,
+		// like NaN.
+		if (bits < table.minBits || bits > 0x7f800000)
+			return 0;
+		if (bits >= OneBits)
+			return 255;
+
+		unsigned int slot = table.slots[(bits >> table.shift) - (table.minBits >> table.shift)];
+		unsigned int low = bits & ((1u << table.shift) - 1);
+		return (int)(slot & 0xff) + (low >= (slot >> 8) ? 1 : 0);
+	}
+
+	/**
+	 * Encodes a value with the polynomial approximation of a curve.
+	 *
+	 * @param curve The curve
+	 * @param value The linear value
+	 * @param offset The dithering offset from 0 to 1 added before truncating
+	 * @return The encoded value, from 0 to 255
+	 */
+	int EncodePolynomial(CurveView curve, float value, float offset)
+	{
+		// This follows the SIMD version operation by operation, so both give the same results.
+		float x = std::min(std::max(value, BitsToFloat(MinNormalBits)), 1.0f);
+
+		// log2(x) = e + log2(m) with m from 3/4 to 3/2
+		unsigned int bits = FloatToBits(x);
+		int e = (int)(bits >> 23) - 127;
+		float m = BitsToFloat((bits & 0x007fffff) | OneBits);
+		if (m > 1.5f)
+		{
+			m *= 0.5f;
+			e++;
+		}
+
+		float t = (m - 1.0f) / (m + 1.0f);
+		float t2 = t * t;
+		float log2x = (float)e + t * (Log2C1 + t2 * (Log2C3 + t2 * Log2C5));
+
+		// 2^y = 2^n 2^f with n = y rounded towards 0. y is not positive, so f + 1/2 is from
+		// -1/2 to 1/2.
+		float y = std::max(log2x * curve.exponent, -126.0f);
+		int n = (int)y;
+		float f = y - (float)n + 0.5f;
+		float power = 1.0f + f * (Exp2C1 + f * (Exp2C2 + f * (Exp2C3 + f * (Exp2C4 +
+			f * Exp2C5))));
+		power = power * Exp2Shift * BitsToFloat((unsigned int)(n + 127) << 23);
+
+		float encoded = power;
+		if (curve.srgb)
+			encoded = (x <= SrgbLinearLimit ? x * SrgbLinearSlope : SrgbScale * power - SrgbOffset);
+
+		int result = std::min((int)(encoded * 255.0f + offset), 255);
+		return (x >= 1.0f ? 255 : std::max(result, 0));
+	}
+
+#ifdef RAYTRACER_SSE2
+	/**
+	 * Encodes four values the same way as the scalar EncodeTable().
+	 */
+	__m128i EncodeTable(TableView table, __m128 values)
+	{
+		// _mm_max_ps() returns its second operand for NaN, so NaN becomes the smallest value
+		// looked up, which gives 0 like negative values.
+		values = _mm_max_ps(values, _mm_castsi128_ps(_mm_set1_epi32(table.minBits)));
+		values = _mm_min_ps(values, _mm_set1_ps(1.0f));
+		__m128i bits = _mm_castps_si128(values);
+
+		__m128i index = _mm_sub_epi32(_mm_srl_epi32(bits, _mm_cvtsi32_si128(table.shift)),
+			_mm_set1_epi32(table.minBits >> table.shift));
+
+		int indices[4];
+		_mm_storeu_si128((__m128i *)indices, index);
+		__m128i slot = _mm_setr_epi32(table.slots[indices[0]], table.slots[indices[1]],
+			table.slots[indices[2]], table.slots[indices[3]]);
+
+		// The comparison gives -1 where the lower bits stay below those of the next step.
+		__m128i low = _mm_and_si128(bits, _mm_set1_epi32((1 << table.shift) - 1));
+		__m128i step = _mm_cmpgt_epi32(_mm_srli_epi32(slot, 8), low);
+		return _mm_add_epi32(_mm_and_si128(slot, _mm_set1_epi32(0xff)),
+			_mm_add_epi32(step, _mm_set1_epi32(1)));
+	}
+
+	/**
+	 * Encodes the red, green and blue values of four pixels the same way as the scalar
+	 * EncodePolynomial(). The channels are encoded together, so that their long chains of
+	 * dependent operations can overlap.
+	 */
+	void EncodePolynomial(CurveView curve, const __m128 values[3], __m128 offsets,
+		__m128i results[3])
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+
+		for (int c = 0; c < 3; c++)
+		{
+			// _mm_max_ps() returns its second operand for NaN.
+			__m128 x = _mm_max_ps(values[c], _mm_castsi128_ps(_mm_set1_epi32(MinNormalBits)));
+			x = _mm_min_ps(x, one);
+
+			__m128i bits = _mm_castps_si128(x);
+			__m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+			__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits,
+				_mm_set1_epi32(0x007fffff)), _mm_set1_epi32(OneBits)));
+
+			__m128 large = _mm_cmpgt_ps(m, _mm_set1_ps(1.5f));
+			m = _mm_mul_ps(m, _mm_or_ps(_mm_and_ps(large, half), _mm_andnot_ps(large, one)));
+			e = _mm_sub_epi32(e, _mm_castps_si128(large));
+
+			__m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+			__m128 t2 = _mm_mul_ps(t, t);
+			__m128 series = _mm_add_ps(_mm_set1_ps(Log2C3), _mm_mul_ps(t2, _mm_set1_ps(Log2C5)));
+			series = _mm_add_ps(_mm_set1_ps(Log2C1), _mm_mul_ps(t2, series));
+			__m128 log2x = _mm_add_ps(_mm_cvtepi32_ps(e), _mm_mul_ps(t, series));
+
+			__m128 y = _mm_max_ps(_mm_mul_ps(log2x, _mm_set1_ps(curve.exponent)),
+				_mm_set1_ps(-126.0f));
+			__m128i n = _mm_cvttps_epi32(y);
+			__m128 f = _mm_add_ps(_mm_sub_ps(y, _mm_cvtepi32_ps(n)), half);
+
+			__m128 power = _mm_add_ps(_mm_set1_ps(Exp2C4), _mm_mul_ps(f, _mm_set1_ps(Exp2C5)));
+			power = _mm_add_ps(_mm_set1_ps(Exp2C3), _mm_mul_ps(f, power));
+			power = _mm_add_ps(_mm_set1_ps(Exp2C2), _mm_mul_ps(f, power));
+			power = _mm_add_ps(_mm_set1_ps(Exp2C1), _mm_mul_ps(f, power));
+			power = _mm_add_ps(one, _mm_mul_ps(f, power));
+			power = _mm_mul_ps(_mm_mul_ps(power, _mm_set1_ps(Exp2Shift)),
+				_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23)));
+
+			__m128 encoded = power;
+			if (curve.srgb)
+			{
+				__m128 linear = _mm_cmple_ps(x, _mm_set1_ps(SrgbLinearLimit));
+				__m128 curved = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(SrgbScale), power),
+					_mm_set1_ps(SrgbOffset));
+				encoded = _mm_or_ps(_mm_and_ps(linear,
+					_mm_mul_ps(x, _mm_set1_ps(SrgbLinearSlope))), _mm_andnot_ps(linear, curved));
+			}
+
+			__m128i result = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(encoded,
+				_mm_set1_ps(255.0f)), offsets));
+
+			// Clamp to [0, 255] and make 1 give 255.
+			__m128i maximum = _mm_set1_epi32(255);
+			__m128i above = _mm_or_si128(_mm_cmpgt_epi32(result, maximum),
+				_mm_castps_si128(_mm_cmpge_ps(x, one)));
+			result = _mm_or_si128(_mm_and_si128(above, maximum), _mm_andnot_si128(above, result));
+			results[c] = _mm_andnot_si128(_mm_cmplt_epi32(result, _mm_setzero_si128()), result);
+		}
+	}
+#endif
+
+	/**
+	 * Packs the channels of a pixel into an integer whose bytes, from the lowest, are in the
+	 * order of the layout.
+	 */
+	unsigned int PackPixel(int red, int green, int blue, ColorEncoder::Layout layout)
+	{
+		if (layout == ColorEncoder::Layout_RGB)
+			return red | (green << 8) | (blue << 16);
+		else if (layout == ColorEncoder::Layout_BGR)
+			return blue | (green << 8) | (red << 16);
+		else
+			return blue | (green << 8) | (red << 16) | 0xff000000;
+	}
+
+	/**
+	 * Stores a pixel packed by PackPixel().
+	 */
+	void StorePixel(unsigned int pixel, int pixelSize, unsigned char *target)
+	{
+		target[0] = (unsigned char)pixel;
+		target[1] = (unsigned char)(pixel >> 8);
+		target[2] = (unsigned char)(pixel >> 16);
+		if (pixelSize == 4)
+			target[3] = (unsigned char)(pixel >> 24);
+	}
+}
+
+/**
+ * A table of the results of a curve. The values from minBits to 1 are divided into slots by
+ * the upper bits of their float representation, from bit shift on. Each slot stores the result
+ * for its smallest value in its lowest eight bits, and the lower bits of the smallest value in
+ * it whose result is one higher in the bits above, or 1 << shift if there is none. shift is
+ * chosen so that the result rises by at most one within a slot, and minBits so that smaller
+ * values give 0.
+ */
+struct ColorEncoder::Table
+{
+	Curve curve;
+	float gamma;
+	unsigned int minBits;
+	int shift;
+	std::vector<unsigned int> slots;
+};
+
+const float ColorEncoder::MinGamma = 0.1f;
+
+ColorEncoder::ColorEncoder()
+{
+	method = Method_Table;
+	dithering = false;
+	SetCurve(Curve_Gamma, 2.2f);
+}
+
+ColorEncoder::ColorEncoder(Curve curve, float gamma)
+{
+	method = Method_Table;
+	dithering = false;
+	SetCurve(curve, gamma);
+}
+
+unsigned char ColorEncoder::Encode(float value) const
+{
+	if (method == Method_Table)
+	{
+		TableView tableView = { &table->slots[0], table->minBits, table->shift };
+		return (unsigned char)EncodeTable(tableView, value);
+	}
+
+	CurveView curveView = { curve == Curve_sRGB, GetExponent() };
+	return (unsigned char)EncodePolynomial(curveView, value, 0.0f);
+}
+
+unsigned char ColorEncoder::EncodeExactly(Curve curve, float gamma, float value)
+{
+	// Negative values and NaN give 0 instead of whatever pow() makes of them.
+	if (!(value > 0.0f))
+		return 0;
+
+	float encoded;
+	if (curve == Curve_sRGB)
+	{
+		if (value <= SrgbLinearLimit)
+			encoded = value * SrgbLinearSlope;
+		else
+			encoded = SrgbScale * powf(value, 1.0f / SrgbGamma) - SrgbOffset;
+	}
+	else
+		encoded = powf(value, 1.0f / gamma);
+
+	return (unsigned char)std::min(std::max(encoded * 255.0f, 0.0f), 255.0f);
+}
+
+void ColorEncoder::EncodeImage(const Image &image, Layout layout, unsigned char *target,
+	int stride) const
+{
+	int width = image.GetWidth();
+	const vec3 *pixels = image.GetPixels();
+
+	ParallelFor(0, image.GetHeight(), RowsPerTask, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			EncodeRow(pixels + (size_t)y * width, width, y, layout,
+				target + (ptrdiff_t)y * stride);
+		}
+	});
+}
+
+void ColorEncoder::EncodeRow(const vec3 *pixels, int count, int y, Layout layout,
+	unsigned char *target) const
+{
+	TableView tableView = { &table->slots[0], table->minBits, table->shift };
+	CurveView curveView = { curve == Curve_sRGB, GetExponent() };
+
+	const float *offsets = (dithering ? BayerOffsets[y & 3] : NoOffsets);
+	bool useTable = (method == Method_Table && !dithering);
+	int pixelSize = (layout == Layout_BGRA ? 4 : 3);
+	int x = 0;
+
+#ifdef RAYTRACER_SSE2
+	__m128 offset = _mm_loadu_ps(offsets);
+	__m128i alpha = _mm_set1_epi32(layout == Layout_BGRA ? 0xff000000 : 0);
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128 colors[3];
+		Internal::LoadVec3x4(pixels + x, colors[0], colors[1], colors[2]);
+
+		__m128i channels[3];
+		if (useTable)
+		{
+			for (int c = 0; c < 3; c++)
+				channels[c] = EncodeTable(tableView, colors[c]);
+		}
+		else
+			EncodePolynomial(curveView, colors, offset, channels);
+
+		__m128i red = channels[0], green = channels[1], blue = channels[2];
+
+		// Pack the pixels like PackPixel().
+		if (layout == Layout_RGB)
+			std::swap(red, blue);
+		__m128i packed = _mm_or_si128(_mm_slli_epi32(red, 16), _mm_slli_epi32(green, 8));
+		packed = _mm_or_si128(packed, _mm_or_si128(blue, alpha));
+
+		unsigned char *pixel = target + x * pixelSize;
+		if (pixelSize == 4)
+			_mm_storeu_si128((__m128i *)pixel, packed);
+		else
+		{
+			// Each pixel is stored with four bytes, whose last one is overwritten by the next
+			// pixel. The last pixel must not write past its own bytes.
+			unsigned int words[4];
+			_mm_storeu_si128((__m128i *)words, packed);
+			memcpy(pixel, &words[0], 4);
+			memcpy(pixel + 3, &words[1], 4);
+			memcpy(pixel + 6, &words[2], 4);
+			memcpy(pixel + 9, &words[3], 3);
+		}
+	}
+#endif
+
+	for (; x < count; x++)
+	{
+		const vec3 &color = pixels[x];
+		int red, green, blue;
+		if (useTable)
+		{
+			red = EncodeTable(tableView, color.x);
+			green = EncodeTable(tableView, color.y);
+			blue = EncodeTable(tableView, color.z);
+		}
+		else
+		{
+			float offset = offsets[x & 3];
+			red = EncodePolynomial(curveView, color.x, offset);
+			green = EncodePolynomial(curveView, color.y, offset);
+			blue = EncodePolynomial(curveView, color.z, offset);
+		}
+
+		StorePixel(PackPixel(red, green, blue, layout), pixelSize, target + x * pixelSize);
+	}
+}
+
+ColorEncoder::Curve ColorEncoder::GetCurve() const
+{
+	return curve;
+}
+
+float ColorEncoder::GetExponent() const
+{
+	return (curve == Curve_sRGB ? 1.0f / SrgbGamma : 1.0f / gamma);
+}
+
+float ColorEncoder::GetGamma() const
+{
+	return gamma;
+}
+
+ColorEncoder::Method ColorEncoder::GetMethod() const
+{
+	return method;
+}
+
+std::shared_ptr<const ColorEncoder::Table> ColorEncoder::GetTable(Curve curve, float gamma)
+{
+	// The encoders own the tables, the cache only refers to the ones still in use.
+	static std::mutex tableMutex;
+	static std::vector<std::weak_ptr<const Table> > tables;
+
+	std::lock_guard<std::mutex> lock(tableMutex);
+	for (size_t i = 0; i < tables.size(); )
+	{
+		std::shared_ptr<const Table> cached = tables[i].lock();
+		if (!cached)
+		{
+			tables[i] = tables.back();
+			tables.pop_back();
+			continue;
+		}
+
+		if (cached->curve == curve && (curve == Curve_sRGB || cached->gamma == gamma))
+			return cached;
+		i++;
+	}
+
+	std::shared_ptr<Table> table = std::make_shared<Table>();
+	table->curve = curve;
+	table->gamma = gamma;
+
+	// Find the smallest value that gives each result by bisecting the float representations,
+	// which are ordered like the values they stand for.
+	unsigned int thresholds[256];
+	thresholds[0] = 0;
+	for (int result = 1; result < 256; result++)
+	{
+		unsigned int low = thresholds[result - 1], high = OneBits;
+		while (low < high)
+		{
+			unsigned int middle = low + (high - low) / 2;
+			if (EncodeExactly(curve, gamma, BitsToFloat(middle)) >= result)
+				high = middle;
+			else
+				low = middle + 1;
+		}
+
+		thresholds[result] = low;
+	}
+
+	// Values below the first slot must give 0.
+	table->minBits = MinTableBits;
+	while (table->minBits > MinNormalBits && thresholds[1] <= table->minBits)
+		table->minBits -= MinNormalBits;
+
+	// Start with 128 slots per power of two and split them further while the result rises by
+	// more than one within a slot. Steep curves, with gammas below 1, need the most.
+	for (table->shift = 16; table->shift > 8; table->shift--)
+	{
+		unsigned int lowMask = (1u << table->shift) - 1;
+		bool valid = true;
+
+		table->slots.clear();
+		for (unsigned int slot = table->minBits >> table->shift;
+			slot <= OneBits >> table->shift && valid; slot++)
+		{
+			unsigned int first = slot << table->shift;
+			unsigned int value = EncodeExactly(curve, gamma, BitsToFloat(first));
+
+			unsigned int step = lowMask + 1;
+			if (value < 255 && thresholds[value + 1] <= (first | lowMask))
+			{
+				step = thresholds[value + 1] & lowMask;
+				valid = (value + 2 > 255 || thresholds[value + 2] > (first | lowMask));
+			}
+
+			table->slots.push_back(value | (step << 8));
+		}
+
+		if (valid)
+			break;
+	}
+
+	tables.push_back(table);
+	return table;
+}
+
+bool ColorEncoder::IsDithering() const
+{
+	return dithering;
+}
+
+void ColorEncoder::SetCurve(Curve curve, float gamma)
+{
+	this->curve = curve;
+	this->gamma = std::max(gamma, MinGamma);
+	table = GetTable(curve, this->gamma);
+}
+
+void ColorEncoder::SetDithering(bool enable)
+{
+	dithering = enable;
+}
+
+void ColorEncoder::SetMethod(Method method)
+{
+	this->method = method;
+}
@@ -1,11 +1,14 @@
 #include <stdio.h>
 
+#include <vector>
+
 #include <glm.hpp>
 
 #include <Raytracer/Raytracer.h>
 
 using namespace glm;
 using namespace Raytracer;
+using namespace std;
 
 Image::Image()
 {
@@ -36,14 +39,11 @@ const void Image::GetBGRPixel(int x, int y, float gamma, unsigned char *color) c
 	if (color == NULL || gamma == 0)
 		return;
 
-	float invGamma = 1.0f / gamma;
-
-	vec3 value = GetPixel(x, y);
-	value = vec3(pow(value.x, invGamma), pow(value.y, invGamma), pow(value.z, invGamma));
+	const vec3 &value = GetPixel(x, y);
 
-	*color++ = (unsigned char)clamp(value.z * 255.0f, 0.0f, 255.0f);
-	*color++ = (unsigned char)clamp(value.y * 255.0f, 0.0f, 255.0f);
-	*color++ = (unsigned char)clamp(value.x * 255.0f, 0.0f, 255.0f);
+	*color++ = ColorEncoder::EncodeExactly(ColorEncoder::Curve_Gamma, gamma, value.z);
+	*color++ = ColorEncoder::EncodeExactly(ColorEncoder::Curve_Gamma, gamma, value.y);
+	*color++ = ColorEncoder::EncodeExactly(ColorEncoder::Curve_Gamma, gamma, value.x);
 }
 
 int Image::GetHeight() const
@@ -61,6 +61,11 @@ const vec3 *Image::GetPixels() const
 	return pixels;
 }
 
+vec3 *Image::GetPixels()
+{
+	return pixels;
+}
+
 int Image::GetWidth() const
 {
 	return width;
@@ -93,15 +98,12 @@ void Image::SaveBMP(const char *fileName, float gamma) const
 	if (fileName == NULL || gamma == 0)
 		return;
 
-	float invGamma = 1.0f / gamma;
 	int stride = (width * 3 + 3) / 4 * 4;
-	int padding = stride - (width * 3);
 
 	Header header = {
 		{ 'B', 'M' }, sizeof(Header) + stride * height, 0, 0, sizeof(Header),
 		40, width, height, 1, 24, 0, stride * height, 2835, 2835, 0, 0
 	};
-	const unsigned char padValues[3] = { 0, 0, 0};
 
 #ifdef __STDC_WANT_SECURE_LIB__
 	FILE *file = NULL;
@@ -113,22 +115,18 @@ void Image::SaveBMP(const char *fileName, float gamma) const
 	if (file == NULL)
 		return;
 
-	if (fwrite(&header, sizeof(Header), 1, file) != 1)
-		return;
-
-	for (int y = height - 1; y >= 0; y--)
+	// The rows are stored from the bottom up and padded with zeros to whole words.
+	vector<unsigned char> data((size_t)stride * height, 0);
+	if (!data.empty())
 	{
-		for (int x = 0; x < width; x++)
-		{
-			// Apply gamma correction
-			unsigned char buffer[3];
-			GetBGRPixel(x, y, gamma, buffer);
-			fwrite(buffer, sizeof(buffer), 1, file);
-		}
-
-		fwrite(padValues, 1, padding, file);
+		ColorEncoder encoder(ColorEncoder::Curve_Gamma, gamma);
+		encoder.EncodeImage(*this, ColorEncoder::Layout_BGR, &data[(size_t)(height - 1) * stride],
+			-stride);
 	}
 
+	if (fwrite(&header, sizeof(Header), 1, file) == 1 && !data.empty())
+		fwrite(&data[0], data.size(), 1, file);
+
 	fclose(file);
 }
 
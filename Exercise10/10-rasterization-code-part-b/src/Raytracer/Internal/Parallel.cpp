@@ -0,0 +1,231 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Raytracer/Internal/Parallel.h>
+
+using namespace std;
+
+namespace
+{
+	/**
+	 * A set of persistent worker threads that execute ParallelFor() jobs. Jobs started from
+	 * several threads at once are queued side by side and the workers spread across them.
+	 */
+	class ThreadPool
+	{
+	private:
+		/**
+		 * A running ParallelFor() call. It lives on the stack of the calling thread.
+		 */
+		struct Job
+		{
+			const function<void(int, int)> *body;
+			int begin;
+			int end;
+			int grainSize;
+			int chunkCount;
+
+			atomic<int> nextChunk;
+
+			/**
+			 * The number of workers currently running chunks of the job, guarded by
+			 * stateMutex
+			 */
+			int activeWorkers;
+		};
+
+		vector<thread> workers;
+
+		mutex stateMutex;
+		condition_variable wakeCondition;
+		condition_variable doneCondition;
+
+		/**
+		 * The jobs that may still have chunks left, guarded by stateMutex
+		 */
+		vector<Job *> jobs;
+		bool stopping;
+
+		static void RunChunks(Job &job)
+		{
+			for (;;)
+			{
+				int chunk = job.nextChunk.fetch_add(1);
+				if (chunk >= job.chunkCount)
+					break;
+
+				int chunkBegin = job.begin + chunk * job.grainSize;
+				int chunkEnd = (job.end - chunkBegin > job.grainSize) ?
+					chunkBegin + job.grainSize : job.end;
+				(*job.body)(chunkBegin, chunkEnd);
+			}
+		}
+
+		void RemoveJob(Job *job)
+		{
+			for (size_t i = 0; i < jobs.size(); i++)
+			{
+				if (jobs[i] == job)
+				{
+					jobs.erase(jobs.begin() + i);
+					return;
+				}
+			}
+		}
+
+		void WorkerMain()
+		{
+			insideJob = true;
+
+			for (;;)
+			{
+				Job *job;
+				{
+					unique_lock<mutex> lock(stateMutex);
+					wakeCondition.wait(lock, [&] { return stopping || !jobs.empty(); });
+					if (stopping)
+						return;
+
+					// Take the oldest job and move it to the back, so that the next worker
+					// picks another one if there are several.
+					job = jobs.front();
+					jobs.erase(jobs.begin());
+					jobs.push_back(job);
+					job->activeWorkers++;
+				}
+
+				RunChunks(*job);
+
+				// All chunks have been taken, so no other worker needs to pick the job up.
+				lock_guard<mutex> lock(stateMutex);
+				RemoveJob(job);
+				if (--job->activeWorkers == 0)
+					doneCondition.notify_all();
+			}
+		}
+
+	public:
+		static thread_local bool insideJob;
+
+		ThreadPool()
+		{
+			stopping = false;
+		}
+
+		~ThreadPool()
+		{
+			Resize(1);
+		}
+
+		int GetThreadCount() const
+		{
+			return (int)workers.size() + 1;
+		}
+
+		void Resize(int count)
+		{
+			{
+				lock_guard<mutex> lock(stateMutex);
+				stopping = true;
+			}
+			wakeCondition.notify_all();
+			for (size_t i = 0; i < workers.size(); i++)
+				workers[i].join();
+			workers.clear();
+			stopping = false;
+
+			for (int i = 1; i < count; i++)
+				workers.push_back(thread(&ThreadPool::WorkerMain, this));
+		}
+
+		void Run(int begin, int end, int grainSize, const function<void(int, int)> &body)
+		{
+			if (insideJob || workers.empty())
+			{
+				// This is a nested call; do the work right here.
+				for (int i = begin; i < end; i += grainSize)
+					body(i, (end - i > grainSize) ? i + grainSize : end);
+				return;
+			}
+
+			Job job;
+			job.body = &body;
+			job.begin = begin;
+			job.end = end;
+			job.grainSize = grainSize;
+			job.chunkCount = (end - begin + grainSize - 1) / grainSize;
+			job.nextChunk = 0;
+			job.activeWorkers = 0;
+
+			{
+				lock_guard<mutex> lock(stateMutex);
+				jobs.push_back(&job);
+			}
+			wakeCondition.notify_all();
+
+			insideJob = true;
+			RunChunks(job);
+			insideJob = false;
+
+			// Workers that still run chunks of the job must be done before it goes away.
+			unique_lock<mutex> lock(stateMutex);
+			RemoveJob(&job);
+			doneCondition.wait(lock, [&] { return job.activeWorkers == 0; });
+		}
+	};
+
+	thread_local bool ThreadPool::insideJob = false;
+
+	ThreadPool *CreatePool()
+	{
+		ThreadPool *pool = new ThreadPool();
+		unsigned int cores = thread::hardware_concurrency();
+		pool->Resize(cores > 0 ? (int)cores : 1);
+		return pool;
+	}
+
+	ThreadPool &GetPool()
+	{
+		// The pool is intentionally never destroyed so that it outlives any static objects
+		// that might still use it during shutdown.
+		static ThreadPool *pool = CreatePool();
+		return *pool;
+	}
+}
+
+int Raytracer::Internal::GetThreadCount()
+{
+	return GetPool().GetThreadCount();
+}
+
+void Raytracer::Internal::SetThreadCount(int count)
+{
+	if (count <= 0)
+	{
+		unsigned int cores = thread::hardware_concurrency();
+		count = (cores > 0) ? (int)cores : 1;
+	}
+
+	GetPool().Resize(count);
+}
+
+void Raytracer::Internal::ParallelFor(int begin, int end, int grainSize,
+									  const function<void(int, int)> &body)
+{
+	if (end <= begin)
+		return;
+
+	if (grainSize < 1)
+		grainSize = 1;
+
+	if (end - begin <= grainSize)
+	{
+		body(begin, end);
+		return;
+	}
+
+	GetPool().Run(begin, end, grainSize, body);
+}
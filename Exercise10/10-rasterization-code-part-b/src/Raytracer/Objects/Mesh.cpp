@@ -1,4 +1,10 @@
+#include <float.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
 
 #include <Raytracer/Raytracer.h>
 
@@ -8,14 +14,406 @@ using namespace Raytracer;
 using namespace Raytracer::Scenes;
 using namespace Raytracer::Objects;
 
-Mesh::Mesh()
+namespace
+{
+	/**
+	 * Merges identical vertices while an indexed mesh is being built. Vertices are compared
+	 * bit by bit and looked up in an open addressing hash table.
+	 */
+	class VertexWelder
+	{
+	private:
+		vector<vec3> &positions;
+		vector<vec3> &normals;
+		vector<vec3> &colors;
+
+		/**
+		 * The hash table, holding a vertex index or -1 for each bucket
+		 */
+		vector<int> table;
+
+		static unsigned int Hash(const vec3 &position, const vec3 &normal, const vec3 &color)
+		{
+			unsigned int words[9];
+			memcpy(words, &position, sizeof(vec3));
+			memcpy(words + 3, &normal, sizeof(vec3));
+			memcpy(words + 6, &color, sizeof(vec3));
+
+			unsigned int hash = 2166136261u;
+			for (int i = 0; i < 9; i++)
+			{
+				hash ^= words[i];
+				hash *= 16777619u;
+				hash ^= hash >> 15;
+			}
+
+			return hash;
+		}
+
+		void Rehash(size_t capacity)
+		{
+			table.assign(capacity, -1);
+			unsigned int mask = (unsigned int)capacity - 1;
+
+			for (size_t i = 0; i < positions.size(); i++)
+			{
+				unsigned int bucket = Hash(positions[i], normals[i], colors[i]) & mask;
+				while (table[bucket] >= 0)
+					bucket = (bucket + 1) & mask;
+				table[bucket] = (int)i;
+			}
+		}
+
+	public:
+		VertexWelder(vector<vec3> &positions, vector<vec3> &normals, vector<vec3> &colors,
+			size_t expectedVertices)
+			: positions(positions), normals(normals), colors(colors)
+		{
+			size_t capacity = 16;
+			while (capacity < 2 * expectedVertices)
+				capacity *= 2;
+
+			Rehash(capacity);
+		}
+
+		unsigned int Add(const vec3 &position, const vec3 &normal, const vec3 &color)
+		{
+			unsigned int mask = (unsigned int)table.size() - 1;
+			unsigned int bucket = Hash(position, normal, color) & mask;
+
+			for (; table[bucket] >= 0; bucket = (bucket + 1) & mask)
+			{
+				int i = table[bucket];
+				if (memcmp(&positions[i], &position, sizeof(vec3)) == 0 &&
+					memcmp(&normals[i], &normal, sizeof(vec3)) == 0 &&
+					memcmp(&colors[i], &color, sizeof(vec3)) == 0)
+				{
+					return (unsigned int)i;
+				}
+			}
+
+			unsigned int index = (unsigned int)positions.size();
+			positions.push_back(position);
+			normals.push_back(normal);
+			colors.push_back(color);
+			table[bucket] = (int)index;
+
+			// Keep the load factor at or below one half.
+			if (2 * positions.size() > table.size())
+				Rehash(2 * table.size());
+
+			return index;
+		}
+	};
+}
+
+namespace
 {
+	/**
+	 * A level of detail is only changed if the triangle count of the current level is off by
+	 * more than this fraction.
+	 */
+	const float LodHysteresis = 0.25f;
+
+	/**
+	 * The material of meshes without a material of their own
+	 */
+	Material defaultMaterial;
+}
+
+const float Mesh::DefaultLodTriangleDensity = 0.1f;
 
+Mesh::Mesh()
+{
+	activeLod = 0;
+	boundsMin = vec3(FLT_MAX);
+	boundsMax = vec3(-FLT_MAX);
+	material = NULL;
+	indexed = false;
+	generation = 0;
 }
 
 void Mesh::AddTriangle(Triangle &t)
 {
-	triangles.push_back(t);
+	AddTriangles(&t, 1);
+}
+
+void Mesh::AddTriangles(const Triangle *t, size_t count)
+{
+	if (t == NULL)
+		return;
+
+	ClearLods();
+	generation++;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		for (int v = 0; v < 3; v++)
+		{
+			boundsMin = glm::min(boundsMin, t[i].position[v]);
+			boundsMax = glm::max(boundsMax, t[i].position[v]);
+		}
+	}
+
+	if (!indexed)
+	{
+		triangles.insert(triangles.end(), t, t + count);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		for (int v = 0; v < 3; v++)
+		{
+			indices.push_back((unsigned int)positions.size());
+			positions.push_back(t[i].position[v]);
+			normals.push_back(t[i].normal[v]);
+			colors.push_back(t[i].color[v]);
+		}
+	}
+
+	// Triangles carry no texture coordinates; the new vertices get zeros.
+	if (!textureCoords.empty())
+		textureCoords.resize(positions.size(), vec2(0, 0));
+}
+
+void Mesh::ClearLods()
+{
+	lodIndices.clear();
+	lodVertexCounts.clear();
+	activeLod = 0;
+}
+
+void Mesh::GenerateLods(int maxLevels, float reduction, size_t minTriangleCount)
+{
+	if (!indexed)
+		MakeIndexed();
+
+	ClearLods();
+	generation++;
+
+	size_t previousCount = GetTriangleCount();
+	if (maxLevels <= 1 || previousCount == 0 || reduction <= 0.0f || reduction >= 1.0f)
+		return;
+
+	// Simplify step by step, taking a snapshot of the index buffer at every level.
+	MeshSimplifier simplifier(positions, indices);
+	vector<size_t> collapseCounts;
+
+	for (int level = 1; level < maxLevels; level++)
+	{
+		size_t targetCount = (size_t)(previousCount * reduction);
+		if (targetCount < minTriangleCount)
+			break;
+
+		simplifier.Simplify(targetCount);
+
+		// Stop if the mesh could not even be reduced by half the requested amount.
+		if (simplifier.GetTriangleCount() > previousCount - (previousCount - targetCount) / 2)
+			break;
+
+		lodIndices.push_back(vector<unsigned int>());
+		simplifier.GetIndices(lodIndices.back());
+		collapseCounts.push_back(simplifier.GetCollapseOrder().size());
+		previousCount = simplifier.GetTriangleCount();
+	}
+
+	if (lodIndices.empty())
+		return;
+
+	// Put the vertices that are never removed first, followed by the removed ones from the
+	// last to the first removed. Every level then only uses a prefix of the vertex arrays.
+	const vector<unsigned int> &collapseOrder = simplifier.GetCollapseOrder();
+	size_t vertexCount = positions.size();
+
+	vector<unsigned char> removed(vertexCount, 0);
+	for (size_t i = 0; i < collapseOrder.size(); i++)
+		removed[collapseOrder[i]] = 1;
+
+	vector<unsigned int> newIndices(vertexCount);
+	unsigned int next = 0;
+
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		if (!removed[i])
+			newIndices[i] = next++;
+	}
+	for (size_t i = collapseOrder.size(); i > 0; i--)
+		newIndices[collapseOrder[i - 1]] = next++;
+
+	vector<vec3> newPositions(vertexCount);
+	vector<vec3> newNormals(vertexCount);
+	vector<vec3> newColors(vertexCount);
+	vector<vec2> newTextureCoords(textureCoords.size());
+
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		newPositions[newIndices[i]] = positions[i];
+		newNormals[newIndices[i]] = normals[i];
+		newColors[newIndices[i]] = colors[i];
+	}
+	for (size_t i = 0; i < textureCoords.size(); i++)
+		newTextureCoords[newIndices[i]] = textureCoords[i];
+
+	positions.swap(newPositions);
+	normals.swap(newNormals);
+	colors.swap(newColors);
+	textureCoords.swap(newTextureCoords);
+
+	for (size_t i = 0; i < indices.size(); i++)
+		indices[i] = newIndices[indices[i]];
+
+	for (size_t level = 0; level < lodIndices.size(); level++)
+	{
+		vector<unsigned int> &levelIndices = lodIndices[level];
+		for (size_t i = 0; i < levelIndices.size(); i++)
+			levelIndices[i] = newIndices[levelIndices[i]];
+
+		lodVertexCounts.push_back(vertexCount - collapseCounts[level]);
+	}
+}
+
+int Mesh::GetActiveLod() const
+{
+	return activeLod;
+}
+
+bool Mesh::GetBoundingBox(vec3 &min, vec3 &max) const
+{
+	min = boundsMin;
+	max = boundsMax;
+	return (boundsMin.x <= boundsMax.x);
+}
+
+void Mesh::GetBoundingSphere(vec3 &center, float &radius) const
+{
+	if (boundsMin.x > boundsMax.x)
+	{
+		center = vec3(0.0f);
+		radius = -1.0f;
+		return;
+	}
+
+	center = 0.5f * (boundsMin + boundsMax);
+	radius = 0.5f * length(boundsMax - boundsMin);
+}
+
+const vector<vec3> &Mesh::GetColors() const
+{
+	return colors;
+}
+
+unsigned int Mesh::GetGeneration() const
+{
+	return generation;
+}
+
+const vector<unsigned int> &Mesh::GetIndices() const
+{
+	return indices;
+}
+
+void Mesh::GetIntersection(const RayHit &hit, Intersection &intersection) const
+{
+	const Ray &ray = hit.GetRay();
+
+	intersection.position = hit.GetPosition();
+	intersection.viewDirection = -ray.GetDirection();
+	intersection.material = (material != NULL) ? material : &defaultMaterial;
+	intersection.normal = -ray.GetDirection();
+	intersection.color = vec3(1.0f);
+
+	// HitTest() stored the triangle to interpolate its vertex attributes.
+	size_t triangle;
+	float u, v;
+	hit.GetPrimitive(triangle, u, v);
+
+	float w = 1.0f - u - v;
+
+	if (indexed)
+	{
+		const unsigned int *index = &GetLodIndices(activeLod)[3 * triangle];
+		intersection.normal = w * normals[index[0]] + u * normals[index[1]] +
+			v * normals[index[2]];
+		intersection.color = w * colors[index[0]] + u * colors[index[1]] + v * colors[index[2]];
+	}
+	else
+	{
+		const Triangle &t = triangles[triangle];
+		intersection.normal = w * t.normal[0] + u * t.normal[1] + v * t.normal[2];
+		intersection.color = w * t.color[0] + u * t.color[1] + v * t.color[2];
+	}
+
+	intersection.normal = normalize(intersection.normal);
+}
+
+int Mesh::GetLodCount() const
+{
+	return 1 + (int)lodIndices.size();
+}
+
+const vector<unsigned int> &Mesh::GetLodIndices(int level) const
+{
+	if (level <= 0 || level > (int)lodIndices.size())
+		return indices;
+
+	return lodIndices[level - 1];
+}
+
+size_t Mesh::GetLodTriangleCount(int level) const
+{
+	if (level <= 0 || level > (int)lodIndices.size())
+		return GetTriangleCount();
+
+	return lodIndices[level - 1].size() / 3;
+}
+
+size_t Mesh::GetLodVertexCount(int level) const
+{
+	if (level <= 0 || level > (int)lodVertexCounts.size())
+		return positions.size();
+
+	return lodVertexCounts[level - 1];
+}
+
+Material *Mesh::GetMaterial() const
+{
+	return material;
+}
+
+const vector<vec3> &Mesh::GetNormals() const
+{
+	return normals;
+}
+
+const vector<vec3> &Mesh::GetPositions() const
+{
+	return positions;
+}
+
+const vector<vec2> &Mesh::GetTextureCoords() const
+{
+	return textureCoords;
+}
+
+Triangle Mesh::GetTriangle(size_t i) const
+{
+	if (!indexed)
+		return triangles[i];
+
+	Triangle t;
+	for (int v = 0; v < 3; v++)
+	{
+		unsigned int index = indices[3 * i + v];
+		t.SetVertex(v, positions[index], normals[index], colors[index]);
+	}
+
+	return t;
+}
+
+size_t Mesh::GetTriangleCount() const
+{
+	return indexed ? indices.size() / 3 : triangles.size();
 }
 
 const vector<Triangle> &Mesh::GetTriangles() const
@@ -23,62 +421,335 @@ const vector<Triangle> &Mesh::GetTriangles() const
 	return triangles;
 }
 
-bool Mesh::IsInstanceOf(Scenes::SceneObjectType type) const
+size_t Mesh::GetVertexCount() const
 {
-	return (type == SceneObjectType_Mesh);
+	return positions.size();
 }
 
-bool Mesh::Load(const char *fileName)
+bool Mesh::HitTest(const Ray &ray, RayHit *hit) const
 {
-	if (fileName == NULL)
+	if (hit != NULL)
+		hit->Set(ray, 0, NULL);
+
+	size_t triangle;
+	float distance, u, v;
+	if (!Intersect(ray, hit == NULL, triangle, distance, u, v))
 		return false;
 
-#ifdef __STDC_WANT_SECURE_LIB__
-	FILE *file = NULL;
-	fopen_s(&file, fileName, "rb");
-#else
-	FILE *file = fopen(fileName, "rb");
-#endif
+	if (hit != NULL)
+	{
+		hit->Set(distance, this);
+		hit->SetPrimitive(triangle, u, v);
+	}
 
-	if (file == NULL)
+	return true;
+}
+
+bool Mesh::Intersect(const Ray &ray, bool anyHit, size_t &triangle, float &distance, float &u,
+					 float &v) const
+{
+	vec3 origin = ray.GetOrigin();
+	vec3 direction = ray.GetDirection();
+	float closest = ray.GetLength();
+
+	// Test the bounding box first.
+	vec3 inverseDirection = 1.0f / direction;
+	vec3 t0 = (boundsMin - origin) * inverseDirection;
+	vec3 t1 = (boundsMax - origin) * inverseDirection;
+	vec3 tNear = glm::min(t0, t1);
+	vec3 tFar = glm::max(t0, t1);
+
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float leave = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, closest));
+	if (!(enter <= leave))
 		return false;
 
-	int triangleCount;
+	// SetActiveLod() and ClearLods() keep the level within the levels of the mesh, so
+	// GetIntersection() finds the triangle in the same index buffer.
+	int level = activeLod;
+	size_t count = GetLodTriangleCount(level);
+	const unsigned int *index = indexed ? GetLodIndices(level).data() : NULL;
+	bool found = false;
 
-	if (fread(&triangleCount, 4, 1, file) != 1 || triangleCount < 0)
+	for (size_t i = 0; i < count; i++)
 	{
-		fclose(file);
-		return false;
+		vec3 p0, p1, p2;
+		if (indexed)
+		{
+			p0 = positions[index[3 * i]];
+			p1 = positions[index[3 * i + 1]];
+			p2 = positions[index[3 * i + 2]];
+		}
+		else
+		{
+			p0 = triangles[i].position[0];
+			p1 = triangles[i].position[1];
+			p2 = triangles[i].position[2];
+		}
+
+		// Moeller-Trumbore intersection test, hitting both sides of the triangle
+		vec3 e1 = p1 - p0;
+		vec3 e2 = p2 - p0;
+		vec3 p = cross(direction, e2);
+		float determinant = dot(e1, p);
+		if (fabsf(determinant) < 1e-12f)
+			continue;
+
+		float inverseDeterminant = 1.0f / determinant;
+		vec3 s = origin - p0;
+		float hitU = dot(s, p) * inverseDeterminant;
+		if (hitU < 0.0f || hitU > 1.0f)
+			continue;
+
+		vec3 q = cross(s, e1);
+		float hitV = dot(direction, q) * inverseDeterminant;
+		if (hitV < 0.0f || hitU + hitV > 1.0f)
+			continue;
+
+		float t = dot(e2, q) * inverseDeterminant;
+		if (t <= 0.0f || t >= closest)
+			continue;
+
+		closest = t;
+		triangle = i;
+		distance = t;
+		u = hitU;
+		v = hitV;
+		found = true;
+
+		if (anyHit)
+			break;
 	}
 
-	fseek(file, 0, SEEK_END);
+	return found;
+}
 
-	if (ftell(file) != triangleCount * sizeof(Triangle) + 4)
-	{
-		fclose(file);
+bool Mesh::IsIndexed() const
+{
+	return indexed;
+}
+
+bool Mesh::IsInstanceOf(Scenes::SceneObjectType type) const
+{
+	return (type == SceneObjectType_Mesh || PhysicalObject::IsInstanceOf(type));
+}
+
+bool Mesh::Load(const char *fileName, bool indexed)
+{
+	MeshFile file;
+	if (!file.Open(fileName))
 		return false;
-	}
 
-	fseek(file, 4, SEEK_SET);
+	if (file.IsCompressed())
+		return MeshCodec::Decode(file.GetData(), file.GetSize(), *this);
+
+	const RawTriangle *raw = file.GetTriangles();
+	size_t count = file.GetTriangleCount();
 
-	for (int i = 0; i < triangleCount; i++)
+	triangles.clear();
+	positions.clear();
+	normals.clear();
+	colors.clear();
+	textureCoords.clear();
+	indices.clear();
+	ClearLods();
+	generation++;
+	this->indexed = indexed;
+
+	if (indexed)
 	{
-		Triangle t;
+		// Build the vertex arrays straight from the file, merging identical vertices.
+		indices.reserve(3 * count);
+		VertexWelder welder(positions, normals, colors, count);
 
-		for (int v = 0; v < 3; v++)
+		for (size_t i = 0; i < count; i++)
 		{
-			if (fread(&t.position[v], sizeof(vec3), 1, file) != 1 ||
-				fread(&t.normal[v], sizeof(vec3), 1, file) != 1 ||
-				fread(&t.color[v], sizeof(vec3), 1, file) != 1)
+			for (int v = 0; v < 3; v++)
 			{
-				fclose(file);
-				return false;
+				const RawVertex &vertex = raw[i].vertex[v];
+				indices.push_back(welder.Add(vertex.position, vertex.normal, vertex.color));
 			}
 		}
 
+		UpdateBounds();
+		return true;
+	}
+
+	// The file interleaves the attributes per vertex, so convert while copying.
+	triangles.reserve(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Triangle t;
+		for (int v = 0; v < 3; v++)
+		{
+			t.position[v] = raw[i].vertex[v].position;
+			t.normal[v] = raw[i].vertex[v].normal;
+			t.color[v] = raw[i].vertex[v].color;
+		}
+
 		triangles.push_back(t);
 	}
 
-	fclose(file);
+	UpdateBounds();
 	return true;
 }
+
+void Mesh::MakeIndexed()
+{
+	vector<Triangle> source;
+	if (indexed)
+	{
+		// Merge the vertices of an already indexed mesh again.
+		source.reserve(GetTriangleCount());
+		for (size_t i = 0; i < GetTriangleCount(); i++)
+			source.push_back(GetTriangle(i));
+	}
+	else
+		source.swap(triangles);
+
+	positions.clear();
+	normals.clear();
+	colors.clear();
+	textureCoords.clear();
+	indices.clear();
+	indices.reserve(3 * source.size());
+	ClearLods();
+	generation++;
+
+	VertexWelder welder(positions, normals, colors, source.size());
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		for (int v = 0; v < 3; v++)
+			indices.push_back(welder.Add(source[i].position[v], source[i].normal[v],
+				source[i].color[v]));
+	}
+
+	indexed = true;
+}
+
+void Mesh::Reserve(size_t count)
+{
+	if (indexed)
+		indices.reserve(3 * count);
+	else
+		triangles.reserve(count);
+}
+
+bool Mesh::Save(const char *fileName) const
+{
+	vector<unsigned char> data;
+	if (fileName == NULL || !MeshCodec::Encode(*this, data))
+		return false;
+
+	FILE *file = fopen(fileName, "wb");
+	if (file == NULL)
+		return false;
+
+	bool success = (fwrite(data.data(), 1, data.size(), file) == data.size());
+	return (fclose(file) == 0 && success);
+}
+
+int Mesh::SelectLod(const Camera &camera, float imageHeight, float trianglesPerPixel,
+					int previousLevel) const
+{
+	int levelCount = GetLodCount();
+	if (levelCount <= 1 || trianglesPerPixel <= 0.0f)
+		return 0;
+
+	int level = std::min(std::max(previousLevel, 0), levelCount - 1);
+
+	vec3 center;
+	float radius;
+	GetBoundingSphere(center, radius);
+	if (radius <= 0.0f)
+		return level;
+
+	// Bring the bounding sphere into world space.
+	const mat4x4 &transformation = GetGlobalTransformation();
+	float scale = std::max(std::max(length(vec3(transformation[0])),
+		length(vec3(transformation[1]))), length(vec3(transformation[2])));
+
+	radius *= scale;
+	vec3 offset = vec3(transformation * vec4(center, 1.0f)) - camera.GetEye();
+	float distance2 = dot(offset, offset);
+	if (distance2 <= radius * radius)
+		return 0;
+
+	// The radius of the projected sphere in pixels, and the number of triangles to cover it
+	float tangent = tanf(0.5f * camera.GetFov() * 3.14159265358979323846f / 180.0f);
+	float pixels = radius / sqrtf(distance2 - radius * radius) / tangent * 0.5f * imageHeight;
+	float targetCount = trianglesPerPixel * 3.14159265358979323846f * pixels * pixels;
+
+	bool tooCoarse = GetLodTriangleCount(level) < targetCount * (1.0f - LodHysteresis);
+	bool tooFine = level + 1 < levelCount &&
+		GetLodTriangleCount(level + 1) >= targetCount * (1.0f + LodHysteresis);
+
+	if (!tooCoarse && !tooFine)
+		return level;
+
+	// Use the coarsest level that still has enough triangles.
+	level = 0;
+	while (level + 1 < levelCount && GetLodTriangleCount(level + 1) >= targetCount)
+		level++;
+
+	return level;
+}
+
+void Mesh::SetActiveLod(int level)
+{
+	activeLod = std::min(std::max(level, 0), GetLodCount() - 1);
+}
+
+void Mesh::SetMaterial(Material *material)
+{
+	this->material = material;
+}
+
+bool Mesh::SetTextureCoords(vector<vec2> &&coords)
+{
+	if (!indexed || (!coords.empty() && coords.size() != positions.size()))
+		return false;
+
+	textureCoords = std::move(coords);
+	coords.clear();
+	return true;
+}
+
+void Mesh::SetTriangles(vector<Triangle> &&triangles)
+{
+	this->triangles = std::move(triangles);
+	triangles.clear();
+
+	positions.clear();
+	normals.clear();
+	colors.clear();
+	textureCoords.clear();
+	indices.clear();
+	ClearLods();
+	generation++;
+	indexed = false;
+
+	UpdateBounds();
+}
+
+void Mesh::UpdateBounds()
+{
+	boundsMin = vec3(FLT_MAX);
+	boundsMax = vec3(-FLT_MAX);
+
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		boundsMin = glm::min(boundsMin, positions[i]);
+		boundsMax = glm::max(boundsMax, positions[i]);
+	}
+
+	for (size_t i = 0; i < triangles.size(); i++)
+	{
+		for (int v = 0; v < 3; v++)
+		{
+			boundsMin = glm::min(boundsMin, triangles[i].position[v]);
+			boundsMax = glm::max(boundsMax, triangles[i].position[v]);
+		}
+	}
+}
@@ -0,0 +1,434 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <Raytracer/Raytracer.h>
+#include <Raytracer/Internal/Parallel.h>
+#include <Raytracer/Internal/Simd.h>
+
+using namespace glm;
+using namespace std;
+using namespace Raytracer::Internal;
+using namespace Raytracer::Objects;
+
+// The decoder stores four vertices at a time as twelve consecutive floats.
+static_assert(sizeof(vec3) == 3 * sizeof(float), "vec3 must not contain padding");
+
+namespace
+{
+	const unsigned int FormatVersion = 1;
+
+	/**
+	 * The size of the fixed part of the header and of the header entry of each level of detail
+	 */
+	const size_t HeaderSize = 40;
+	const size_t LevelHeaderSize = 12;
+
+	/**
+	 * The number of bytes per vertex: three 16 bit coordinates, two 16 bit octahedral normal
+	 * components and three 8 bit color components
+	 */
+	const size_t VertexSize = 13;
+
+	/**
+	 * The number of vertices decoded in one parallel chunk
+	 */
+	const int DecodeChunkSize = 16384;
+
+	void Append32(vector<unsigned char> &data, const void *value)
+	{
+		const unsigned char *bytes = (const unsigned char *)value;
+		data.insert(data.end(), bytes, bytes + 4);
+	}
+
+	unsigned int Read32(const unsigned char *data)
+	{
+		unsigned int value;
+		memcpy(&value, data, 4);
+		return value;
+	}
+
+	vec3 ReadVec3(const unsigned char *data)
+	{
+		float values[3];
+		memcpy(values, data, sizeof(values));
+		return vec3(values[0], values[1], values[2]);
+	}
+
+	/**
+	 * Encodes a unit vector in octahedral coordinates, each in the -1 to 1 range.
+	 */
+	void EncodeOctahedral(const vec3 &normal, float &u, float &v)
+	{
+		float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+		if (sum == 0.0f)
+		{
+			u = v = 0.0f;
+			return;
+		}
+
+		u = normal.x / sum;
+		v = normal.y / sum;
+
+		// Fold the lower hemisphere over the diagonals.
+		if (normal.z < 0.0f)
+		{
+			float foldedU = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+			float foldedV = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+			u = foldedU;
+			v = foldedV;
+		}
+	}
+
+	/**
+	 * Delta-codes an index buffer. Each index is stored as the zigzag-coded difference to the
+	 * previous index, seven bits per byte with the high bit marking that more bytes follow.
+	 */
+	void EncodeIndices(const vector<unsigned int> &indices, vector<unsigned char> &data)
+	{
+		unsigned int previous = 0;
+
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			int delta = (int)(indices[i] - previous);
+			unsigned int value = ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31);
+			previous = indices[i];
+
+			while (value >= 0x80)
+			{
+				data.push_back((unsigned char)(value | 0x80));
+				value >>= 7;
+			}
+			data.push_back((unsigned char)value);
+		}
+	}
+
+	bool DecodeIndices(const unsigned char *data, size_t size, unsigned int vertexCount,
+		vector<unsigned int> &indices)
+	{
+		const unsigned char *end = data + size;
+		unsigned int previous = 0;
+
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int value = 0;
+			for (int shift = 0;; shift += 7)
+			{
+				if (data == end || shift > 28)
+					return false;
+
+				unsigned char byte = *data++;
+				value |= (unsigned int)(byte & 0x7f) << shift;
+				if (byte < 0x80)
+					break;
+			}
+
+			previous += (value >> 1) ^ (0u - (value & 1));
+			if (previous >= vertexCount)
+				return false;
+
+			indices[i] = previous;
+		}
+
+		return (data == end);
+	}
+
+	/**
+	 * Pointers to the attribute arrays of an encoded mesh
+	 */
+	struct VertexStreams
+	{
+		const unsigned short *position[3];
+		const short *normal[2];
+		const unsigned char *color[3];
+	};
+
+#ifdef RAYTRACER_SSE2
+	inline __m128 LoadUnsigned16(const unsigned short *p)
+	{
+		__m128i v = _mm_loadl_epi64((const __m128i *)p);
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, _mm_setzero_si128()));
+	}
+
+	inline __m128 LoadSigned16(const short *p)
+	{
+		__m128i v = _mm_loadl_epi64((const __m128i *)p);
+		return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+	}
+
+	inline __m128 LoadUnsigned8(const unsigned char *p)
+	{
+		int bytes;
+		memcpy(&bytes, p, 4);
+
+		__m128i zero = _mm_setzero_si128();
+		__m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+	}
+#endif // RAYTRACER_SSE2
+
+	/**
+	 * Expands the vertices in the range [begin, end) into float vectors.
+	 */
+	void DecodeVertices(const VertexStreams &streams, const vec3 &boundsMin, const vec3 &scale,
+		size_t begin, size_t end, vec3 *positions, vec3 *normals, vec3 *colors)
+	{
+		const float normalScale = 1.0f / 32767.0f;
+		const float colorScale = 1.0f / 255.0f;
+		size_t i = begin;
+
+#ifdef RAYTRACER_SSE2
+		const __m128 minX = _mm_set1_ps(boundsMin.x);
+		const __m128 minY = _mm_set1_ps(boundsMin.y);
+		const __m128 minZ = _mm_set1_ps(boundsMin.z);
+		const __m128 scaleX = _mm_set1_ps(scale.x);
+		const __m128 scaleY = _mm_set1_ps(scale.y);
+		const __m128 scaleZ = _mm_set1_ps(scale.z);
+		const __m128 normalFactor = _mm_set1_ps(normalScale);
+		const __m128 colorFactor = _mm_set1_ps(colorScale);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 minusOne = _mm_set1_ps(-1.0f);
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 x = _mm_add_ps(_mm_mul_ps(LoadUnsigned16(streams.position[0] + i), scaleX), minX);
+			__m128 y = _mm_add_ps(_mm_mul_ps(LoadUnsigned16(streams.position[1] + i), scaleY), minY);
+			__m128 z = _mm_add_ps(_mm_mul_ps(LoadUnsigned16(streams.position[2] + i), scaleZ), minZ);
+			StoreVec3x4(positions + i, x, y, z);
+
+			// Unfold the octahedron: z = 1 - |x| - |y|, and points with z < 0 are moved back
+			// across the diagonals.
+			x = _mm_max_ps(_mm_mul_ps(LoadSigned16(streams.normal[0] + i), normalFactor), minusOne);
+			y = _mm_max_ps(_mm_mul_ps(LoadSigned16(streams.normal[1] + i), normalFactor), minusOne);
+			z = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, x)), _mm_andnot_ps(signMask, y));
+
+			__m128 t = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), z), _mm_setzero_ps());
+			x = _mm_sub_ps(x, _mm_or_ps(t, _mm_and_ps(signMask, x)));
+			y = _mm_sub_ps(y, _mm_or_ps(t, _mm_and_ps(signMask, y)));
+
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+				_mm_mul_ps(z, z)));
+			__m128 inverseLength = _mm_div_ps(one, length);
+			StoreVec3x4(normals + i, _mm_mul_ps(x, inverseLength), _mm_mul_ps(y, inverseLength),
+				_mm_mul_ps(z, inverseLength));
+
+			StoreVec3x4(colors + i, _mm_mul_ps(LoadUnsigned8(streams.color[0] + i), colorFactor),
+				_mm_mul_ps(LoadUnsigned8(streams.color[1] + i), colorFactor),
+				_mm_mul_ps(LoadUnsigned8(streams.color[2] + i), colorFactor));
+		}
+#endif // RAYTRACER_SSE2
+
+		// The remaining vertices, or all of them without SSE2. This computes exactly the same
+		// values as the SIMD loop.
+		for (; i < end; i++)
+		{
+			positions[i] = vec3(streams.position[0][i] * scale.x + boundsMin.x,
+				streams.position[1][i] * scale.y + boundsMin.y,
+				streams.position[2][i] * scale.z + boundsMin.z);
+
+			float x = std::max(streams.normal[0][i] * normalScale, -1.0f);
+			float y = std::max(streams.normal[1][i] * normalScale, -1.0f);
+			float z = 1.0f - fabsf(x) - fabsf(y);
+
+			float t = std::max(-z, 0.0f);
+			x -= (x < 0.0f) ? -t : t;
+			y -= (y < 0.0f) ? -t : t;
+
+			float inverseLength = 1.0f / sqrtf(x * x + y * y + z * z);
+			normals[i] = vec3(x * inverseLength, y * inverseLength, z * inverseLength);
+
+			colors[i] = vec3(streams.color[0][i] * colorScale, streams.color[1][i] * colorScale,
+				streams.color[2][i] * colorScale);
+		}
+	}
+}
+
+bool MeshCodec::IsCompressed(const unsigned char *data, size_t size)
+{
+	return (data != NULL && size >= HeaderSize && memcmp(data, "QMSH", 4) == 0 &&
+		Read32(data + 4) == FormatVersion);
+}
+
+bool MeshCodec::Decode(const unsigned char *data, size_t size, Mesh &mesh)
+{
+	if (!IsCompressed(data, size))
+		return false;
+
+	unsigned int vertexCount = Read32(data + 8);
+	unsigned int levelCount = Read32(data + 12);
+
+	vec3 boundsMin = ReadVec3(data + 16);
+	vec3 scale = ReadVec3(data + 28);
+
+	// Validate the header before touching any of the arrays.
+	if (levelCount < 1 || levelCount > (size - HeaderSize) / LevelHeaderSize)
+		return false;
+
+	size_t offset = HeaderSize + levelCount * LevelHeaderSize;
+	if ((size - offset) / VertexSize < vertexCount)
+		return false;
+
+	const unsigned char *vertexData = data + offset;
+	offset += vertexCount * VertexSize;
+
+	vector<size_t> triangleCounts(levelCount), vertexCounts(levelCount);
+	vector<size_t> indexOffsets(levelCount), indexSizes(levelCount);
+
+	for (unsigned int level = 0; level < levelCount; level++)
+	{
+		const unsigned char *entry = data + HeaderSize + level * LevelHeaderSize;
+		triangleCounts[level] = Read32(entry);
+		vertexCounts[level] = Read32(entry + 4);
+		indexSizes[level] = Read32(entry + 8);
+		indexOffsets[level] = offset;
+
+		// Every index takes at least one byte.
+		if (vertexCounts[level] > vertexCount || indexSizes[level] > size - offset ||
+			indexSizes[level] / 3 < triangleCounts[level])
+		{
+			return false;
+		}
+
+		offset += indexSizes[level];
+	}
+
+	if (offset != size || vertexCounts[0] != vertexCount)
+		return false;
+
+	VertexStreams streams;
+	for (int c = 0; c < 3; c++)
+		streams.position[c] = (const unsigned short *)(vertexData + c * vertexCount * 2);
+	for (int c = 0; c < 2; c++)
+		streams.normal[c] = (const short *)(vertexData + (3 + c) * vertexCount * 2);
+	for (int c = 0; c < 3; c++)
+		streams.color[c] = vertexData + vertexCount * 10 + c * vertexCount;
+
+	// Decode into new arrays first so that the mesh stays intact if the data is invalid.
+	vector<vec3> positions(vertexCount), normals(vertexCount), colors(vertexCount);
+	vector<vector<unsigned int> > levelIndices(levelCount);
+	for (unsigned int level = 0; level < levelCount; level++)
+		levelIndices[level].resize(3 * triangleCounts[level]);
+
+	ParallelFor(0, (int)((vertexCount + DecodeChunkSize - 1) / DecodeChunkSize), 1,
+		[&](int begin, int end)
+	{
+		for (int chunk = begin; chunk < end; chunk++)
+		{
+			size_t first = (size_t)chunk * DecodeChunkSize;
+			size_t last = std::min(first + DecodeChunkSize, (size_t)vertexCount);
+			DecodeVertices(streams, boundsMin, scale, first, last, positions.data(),
+				normals.data(), colors.data());
+		}
+	});
+
+	vector<unsigned char> valid(levelCount, 0);
+	ParallelFor(0, (int)levelCount, 1, [&](int begin, int end)
+	{
+		for (int level = begin; level < end; level++)
+			valid[level] = DecodeIndices(data + indexOffsets[level], indexSizes[level],
+				(unsigned int)vertexCounts[level], levelIndices[level]) ? 1 : 0;
+	});
+
+	if (find(valid.begin(), valid.end(), 0) != valid.end())
+		return false;
+
+	mesh.triangles.clear();
+	mesh.positions.swap(positions);
+	mesh.normals.swap(normals);
+	mesh.colors.swap(colors);
+	mesh.textureCoords.clear();
+	mesh.indices.swap(levelIndices[0]);
+	mesh.lodIndices.assign(levelIndices.size() - 1, vector<unsigned int>());
+	mesh.lodVertexCounts.assign(vertexCounts.begin() + 1, vertexCounts.end());
+	for (unsigned int level = 1; level < levelCount; level++)
+		mesh.lodIndices[level - 1].swap(levelIndices[level]);
+
+	mesh.indexed = true;
+	mesh.generation++;
+	mesh.UpdateBounds();
+
+	return true;
+}
+
+bool MeshCodec::Encode(const Mesh &mesh, vector<unsigned char> &data)
+{
+	data.clear();
+
+	if (!mesh.IsIndexed())
+		return false;
+
+	const vector<vec3> &positions = mesh.GetPositions();
+	const vector<vec3> &normals = mesh.GetNormals();
+	const vector<vec3> &colors = mesh.GetColors();
+	unsigned int vertexCount = (unsigned int)positions.size();
+	unsigned int levelCount = (unsigned int)mesh.GetLodCount();
+
+	vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		boundsMin = glm::min(boundsMin, positions[i]);
+		boundsMax = glm::max(boundsMax, positions[i]);
+	}
+	if (positions.empty())
+		boundsMin = boundsMax = vec3(0.0f);
+
+	vec3 scale = (boundsMax - boundsMin) / 65535.0f;
+
+	vector<vector<unsigned char> > indexData(levelCount);
+	for (unsigned int level = 0; level < levelCount; level++)
+		EncodeIndices(mesh.GetLodIndices(level), indexData[level]);
+
+	unsigned int version = FormatVersion;
+	data.insert(data.end(), "QMSH", "QMSH" + 4);
+	Append32(data, &version);
+	Append32(data, &vertexCount);
+	Append32(data, &levelCount);
+	for (int c = 0; c < 3; c++)
+		Append32(data, &boundsMin[c]);
+	for (int c = 0; c < 3; c++)
+		Append32(data, &scale[c]);
+
+	for (unsigned int level = 0; level < levelCount; level++)
+	{
+		unsigned int triangleCount = (unsigned int)mesh.GetLodTriangleCount(level);
+		unsigned int levelVertexCount = (unsigned int)mesh.GetLodVertexCount(level);
+		unsigned int indexSize = (unsigned int)indexData[level].size();
+
+		Append32(data, &triangleCount);
+		Append32(data, &levelVertexCount);
+		Append32(data, &indexSize);
+	}
+
+	size_t vertexData = data.size();
+	data.resize(vertexData + vertexCount * VertexSize);
+
+	unsigned short *position = (unsigned short *)&data[vertexData];
+	short *normal = (short *)&data[vertexData + vertexCount * 6];
+	unsigned char *color = &data[vertexData + vertexCount * 10];
+
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			float q = (scale[c] > 0.0f) ? (positions[i][c] - boundsMin[c]) / scale[c] : 0.0f;
+			position[c * vertexCount + i] = (unsigned short)std::min(std::max(q + 0.5f, 0.0f),
+				65535.0f);
+
+			float channel = std::min(std::max(colors[i][c], 0.0f), 1.0f);
+			color[c * vertexCount + i] = (unsigned char)(channel * 255.0f + 0.5f);
+		}
+
+		float u, v;
+		EncodeOctahedral(normals[i], u, v);
+		normal[i] = (short)floorf(u * 32767.0f + 0.5f);
+		normal[vertexCount + i] = (short)floorf(v * 32767.0f + 0.5f);
+	}
+
+	for (unsigned int level = 0; level < levelCount; level++)
+		data.insert(data.end(), indexData[level].begin(), indexData[level].end());
+
+	return true;
+}
@@ -0,0 +1,160 @@
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <Raytracer/Raytracer.h>
+
+using namespace Raytracer::Objects;
+
+// The triangles are accessed directly in the mapped file.
+static_assert(sizeof(RawTriangle) == 27 * sizeof(float), "RawTriangle must not contain padding");
+
+MeshFile::MeshFile()
+{
+	data = NULL;
+	size = 0;
+	triangleCount = 0;
+	compressed = false;
+
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#endif
+}
+
+MeshFile::~MeshFile()
+{
+	Close();
+}
+
+void MeshFile::Close()
+{
+#ifdef _WIN32
+	if (data != NULL)
+		UnmapViewOfFile(data);
+	if (mappingHandle != NULL)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	if (data != NULL)
+		munmap((void *)data, size);
+#endif
+
+	data = NULL;
+	size = 0;
+	triangleCount = 0;
+	compressed = false;
+}
+
+const unsigned char *MeshFile::GetData() const
+{
+	return data;
+}
+
+size_t MeshFile::GetSize() const
+{
+	return size;
+}
+
+size_t MeshFile::GetTriangleCount() const
+{
+	return triangleCount;
+}
+
+const RawTriangle *MeshFile::GetTriangles() const
+{
+	if (data == NULL || compressed)
+		return NULL;
+
+	return (const RawTriangle *)(data + 4);
+}
+
+bool MeshFile::IsCompressed() const
+{
+	return compressed;
+}
+
+bool MeshFile::Open(const char *fileName)
+{
+	Close();
+
+	if (fileName == NULL)
+		return false;
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < 4)
+	{
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+
+	mappingHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle != NULL)
+		data = (const unsigned char *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+	int file = open(fileName, O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size < 4)
+	{
+		close(file);
+		return false;
+	}
+	size = (size_t)info.st_size;
+
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (mapping != MAP_FAILED)
+	{
+		data = (const unsigned char *)mapping;
+
+		// The triangles are usually read front to back exactly once.
+		madvise(mapping, size, MADV_SEQUENTIAL);
+	}
+#endif
+
+	if (data == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	if (MeshCodec::IsCompressed(data, size))
+	{
+		compressed = true;
+		return true;
+	}
+
+	int count;
+	memcpy(&count, data, 4);
+
+	if (count < 0 || size != (size_t)count * sizeof(RawTriangle) + 4)
+	{
+		Close();
+		return false;
+	}
+
+	triangleCount = (size_t)count;
+	return true;
+}
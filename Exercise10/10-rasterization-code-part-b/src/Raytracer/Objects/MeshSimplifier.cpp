@@ -0,0 +1,339 @@
+#include <algorithm>
+
+#include <Raytracer/Raytracer.h>
+
+using namespace glm;
+using namespace std;
+using namespace Raytracer::Objects;
+
+MeshSimplifier::Quadric::Quadric()
+{
+	a2 = ab = ac = ad = b2 = bc = bd = c2 = cd = d2 = 0.0;
+}
+
+MeshSimplifier::Quadric::Quadric(const vec3 &normal, float d, float weight)
+{
+	double a = normal.x, b = normal.y, c = normal.z;
+
+	a2 = weight * a * a;
+	ab = weight * a * b;
+	ac = weight * a * c;
+	ad = weight * a * d;
+	b2 = weight * b * b;
+	bc = weight * b * c;
+	bd = weight * b * d;
+	c2 = weight * c * c;
+	cd = weight * c * d;
+	d2 = weight * (double)d * d;
+}
+
+void MeshSimplifier::Quadric::Add(const Quadric &q)
+{
+	a2 += q.a2;
+	ab += q.ab;
+	ac += q.ac;
+	ad += q.ad;
+	b2 += q.b2;
+	bc += q.bc;
+	bd += q.bd;
+	c2 += q.c2;
+	cd += q.cd;
+	d2 += q.d2;
+}
+
+double MeshSimplifier::Quadric::Evaluate(const vec3 &p) const
+{
+	double x = p.x, y = p.y, z = p.z;
+
+	return a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x +
+		b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y +
+		c2 * z * z + 2.0 * cd * z + d2;
+}
+
+bool MeshSimplifier::Collapse::operator<(const Collapse &c) const
+{
+	// The priority queue returns its largest element first, but we want the cheapest.
+	return cost > c.cost;
+}
+
+MeshSimplifier::MeshSimplifier(const vector<vec3> &positions, const vector<unsigned int> &indices)
+	: positions(positions)
+{
+	size_t vertexCount = positions.size();
+
+	triangles = indices;
+	triangleAlive.assign(triangles.size() / 3, 1);
+	vertexTriangles.resize(vertexCount);
+	quadrics.resize(vertexCount);
+	locked.assign(vertexCount, 0);
+	removed.assign(vertexCount, 0);
+	versions.assign(vertexCount, 0);
+	marks.assign(vertexCount, 0);
+	mark = 0;
+	triangleCount = 0;
+
+	vector<unsigned long long> edges;
+	edges.reserve(triangles.size());
+
+	for (size_t t = 0; t < triangleAlive.size(); t++)
+	{
+		unsigned int *v = &triangles[3 * t];
+
+		if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0])
+		{
+			// Degenerate triangles are dropped right away.
+			triangleAlive[t] = 0;
+			continue;
+		}
+
+		triangleCount++;
+
+		vec3 normal = cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]);
+		float area = length(normal);
+
+		// Each triangle contributes its plane, weighted by its area, to its vertices.
+		if (area > 0.0f)
+		{
+			normal /= area;
+			Quadric q(normal, -dot(normal, positions[v[0]]), 0.5f * area);
+			for (int i = 0; i < 3; i++)
+				quadrics[v[i]].Add(q);
+		}
+
+		for (int i = 0; i < 3; i++)
+		{
+			vertexTriangles[v[i]].push_back((unsigned int)t);
+
+			unsigned long long a = std::min(v[i], v[(i + 1) % 3]);
+			unsigned long long b = std::max(v[i], v[(i + 1) % 3]);
+			edges.push_back((a << 32) | b);
+		}
+	}
+
+	// Edges used by exactly two triangles are interior edges. Lock the vertices of all other
+	// edges, which lie on open borders or where the mesh is not a manifold.
+	sort(edges.begin(), edges.end());
+
+	for (size_t i = 0; i < edges.size();)
+	{
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j] == edges[i])
+			j++;
+
+		if (j - i != 2)
+		{
+			locked[(unsigned int)(edges[i] >> 32)] = 1;
+			locked[(unsigned int)edges[i]] = 1;
+		}
+
+		i = j;
+	}
+
+	for (size_t t = 0; t < triangleAlive.size(); t++)
+	{
+		if (!triangleAlive[t])
+			continue;
+
+		for (int i = 0; i < 3; i++)
+		{
+			unsigned int a = triangles[3 * t + i];
+			unsigned int b = triangles[3 * t + (i + 1) % 3];
+
+			Push(a, b);
+			Push(b, a);
+		}
+	}
+}
+
+bool MeshSimplifier::CanCollapse(unsigned int from, unsigned int to)
+{
+	if (removed[from] || removed[to] || locked[from])
+		return false;
+
+	if (mark >= 0xfffffff0u)
+	{
+		marks.assign(marks.size(), 0);
+		mark = 0;
+	}
+
+	unsigned int toNeighbor = ++mark;
+	unsigned int commonNeighbor = ++mark;
+
+	const vector<unsigned int> &toTriangles = vertexTriangles[to];
+	for (size_t i = 0; i < toTriangles.size(); i++)
+	{
+		unsigned int t = toTriangles[i];
+		if (triangleAlive[t])
+		{
+			for (int k = 0; k < 3; k++)
+				marks[triangles[3 * t + k]] = toNeighbor;
+		}
+	}
+
+	size_t shared = 0;
+	size_t common = 0;
+
+	const vector<unsigned int> &fromTriangles = vertexTriangles[from];
+	for (size_t i = 0; i < fromTriangles.size(); i++)
+	{
+		unsigned int t = fromTriangles[i];
+		if (!triangleAlive[t])
+			continue;
+
+		const unsigned int *v = &triangles[3 * t];
+		if (v[0] == to || v[1] == to || v[2] == to)
+		{
+			// This triangle disappears with the edge.
+			shared++;
+			continue;
+		}
+
+		vec3 p[3];
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = positions[v[k]];
+
+			if (v[k] != from && marks[v[k]] == toNeighbor)
+			{
+				marks[v[k]] = commonNeighbor;
+				common++;
+			}
+		}
+
+		// Reject collapses that would flip the triangle over.
+		vec3 oldNormal = cross(p[1] - p[0], p[2] - p[0]);
+		for (int k = 0; k < 3; k++)
+		{
+			if (v[k] == from)
+				p[k] = positions[to];
+		}
+		vec3 newNormal = cross(p[1] - p[0], p[2] - p[0]);
+
+		if (dot(oldNormal, newNormal) <= 0.0f)
+			return false;
+	}
+
+	// The vertices adjacent to both ends must be exactly the opposite corners of the triangles
+	// along the edge. Otherwise, the collapse would pinch the surface.
+	return (shared > 0 && common == shared);
+}
+
+void MeshSimplifier::Push(unsigned int from, unsigned int to)
+{
+	if (locked[from])
+		return;
+
+	Quadric q = quadrics[from];
+	q.Add(quadrics[to]);
+
+	Collapse c;
+	c.cost = (float)std::max(0.0, q.Evaluate(positions[to]));
+	c.from = from;
+	c.to = to;
+	c.fromVersion = versions[from];
+	c.toVersion = versions[to];
+
+	collapses.push(c);
+}
+
+void MeshSimplifier::Remove(unsigned int from, unsigned int to)
+{
+	removed[from] = 1;
+	collapseOrder.push_back(from);
+
+	vector<unsigned int> &fromTriangles = vertexTriangles[from];
+	vector<unsigned int> &toTriangles = vertexTriangles[to];
+
+	for (size_t i = 0; i < fromTriangles.size(); i++)
+	{
+		unsigned int t = fromTriangles[i];
+		if (!triangleAlive[t])
+			continue;
+
+		unsigned int *v = &triangles[3 * t];
+		if (v[0] == to || v[1] == to || v[2] == to)
+		{
+			triangleAlive[t] = 0;
+			triangleCount--;
+			continue;
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			if (v[k] == from)
+				v[k] = to;
+		}
+
+		toTriangles.push_back(t);
+	}
+
+	vector<unsigned int>().swap(fromTriangles);
+
+	size_t count = 0;
+	for (size_t i = 0; i < toTriangles.size(); i++)
+	{
+		if (triangleAlive[toTriangles[i]])
+			toTriangles[count++] = toTriangles[i];
+	}
+	toTriangles.resize(count);
+
+	quadrics[to].Add(quadrics[from]);
+	versions[to]++;
+
+	// All collapses involving the remaining vertex have a new cost now.
+	for (size_t i = 0; i < toTriangles.size(); i++)
+	{
+		const unsigned int *v = &triangles[3 * toTriangles[i]];
+		for (int k = 0; k < 3; k++)
+		{
+			if (v[k] != to)
+			{
+				Push(v[k], to);
+				Push(to, v[k]);
+			}
+		}
+	}
+}
+
+const vector<unsigned int> &MeshSimplifier::GetCollapseOrder() const
+{
+	return collapseOrder;
+}
+
+void MeshSimplifier::GetIndices(vector<unsigned int> &indices) const
+{
+	indices.clear();
+	indices.reserve(3 * triangleCount);
+
+	for (size_t t = 0; t < triangleAlive.size(); t++)
+	{
+		if (triangleAlive[t])
+			indices.insert(indices.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+	}
+}
+
+size_t MeshSimplifier::GetTriangleCount() const
+{
+	return triangleCount;
+}
+
+bool MeshSimplifier::Simplify(size_t targetTriangleCount)
+{
+	while (triangleCount > targetTriangleCount && !collapses.empty())
+	{
+		Collapse c = collapses.top();
+		collapses.pop();
+
+		// Skip collapses whose vertices have changed since they were queued.
+		if (removed[c.from] || removed[c.to] || versions[c.from] != c.fromVersion ||
+			versions[c.to] != c.toVersion)
+		{
+			continue;
+		}
+
+		if (CanCollapse(c.from, c.to))
+			Remove(c.from, c.to);
+	}
+
+	return (triangleCount <= targetTriangleCount);
+}
@@ -25,6 +25,7 @@ void Sphere::GetIntersection(const RayHit &hit, Intersection &intersection) cons
 	intersection.viewDirection = -hit.GetRay().GetDirection();
 	intersection.normal = normalize(intersection.position);
 	intersection.material = material;
+	intersection.color = vec3(1.0f);
 }
 
 bool Sphere::HitTest(const Ray &ray, RayHit *hit) const
@@ -44,6 +44,13 @@ const Scenes::PhysicalObject *RayHit::GetObject() const
 	return object;
 }
 
+void RayHit::GetPrimitive(size_t &primitive, float &u, float &v) const
+{
+	primitive = this->primitive;
+	u = this->u;
+	v = this->v;
+}
+
 const Ray &RayHit::GetRay() const
 {
 	return ray;
@@ -52,6 +59,7 @@ const Ray &RayHit::GetRay() const
 void RayHit::Set(float distance, const Scenes::PhysicalObject *object)
 {
 	this->object = object;
+	SetPrimitive(0, 0.0f, 0.0f);
 	if (object != NULL)
 		this->distance = distance;
 	else
@@ -64,6 +72,13 @@ void RayHit::Set(const Ray &ray, float distance, const Scenes::PhysicalObject *o
 	Set(distance, object);
 }
 
+void RayHit::SetPrimitive(size_t primitive, float u, float v)
+{
+	this->primitive = primitive;
+	this->u = u;
+	this->v = v;
+}
+
 void RayHit::SetRay(const Ray &ray)
 {
 	this->ray = ray;
@@ -1,13 +1,16 @@
+#define RAYTRACER_USE_FOREACH
 #include <Raytracer/Raytracer.h>
 
 using namespace glm;
 using namespace Raytracer;
 using namespace Raytracer::Scenes;
+using namespace Raytracer::Objects;
 
 Renderer::Renderer()
 {
 	accelerator = NULL;
 	integrator = NULL;
+	lodTriangleDensity = Mesh::DefaultLodTriangleDensity;
 }
 
 Renderer::~Renderer()
@@ -45,7 +48,12 @@ void Raytracer::Renderer::SetAccelerator(Accelerator *accelerator)
 	this->accelerator = accelerator;
 }
 
-Image *Renderer::Render(const Scenes::Scene &scene, int width, int height)
+void Renderer::SetLodTriangleDensity(float trianglesPerPixel)
+{
+	lodTriangleDensity = trianglesPerPixel;
+}
+
+Image *Renderer::Render(Scenes::Scene &scene, int width, int height)
 {
 	Camera *camera = scene.GetActiveCamera();
 
@@ -56,6 +64,15 @@ Image *Renderer::Render(const Scenes::Scene &scene, int width, int height)
 	if (image == NULL)
 		return NULL;
 
+	scene.GetSceneGraph()->Update();
+
+	// The active level of detail of a mesh is kept from one frame to the next.
+	foreach_c (Mesh *, mesh, scene.GetMeshes())
+	{
+		(*mesh)->SetActiveLod((*mesh)->SelectLod(*camera, (float)height, lodTriangleDensity,
+			(*mesh)->GetActiveLod()));
+	}
+
 	accelerator->SetScene(&scene);
 
 	RenderImage(*camera, image);
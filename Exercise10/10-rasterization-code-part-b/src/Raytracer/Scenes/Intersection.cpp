@@ -11,6 +11,7 @@ Intersection Intersection::Transform(mat4x4 transformation) const
 	i.normal = vec3(transformation * vec4(normal, 0.0f));
 	i.viewDirection = vec3(transformation * vec4(viewDirection, 0.0f));
 	i.material = material;
+	i.color = color;
 
 	return i;
 }
@@ -10,6 +10,8 @@ Material::Material()
 	specular = vec3(1, 1, 1);
 	emissive = vec3(0, 0, 0);
 	shininess = 4.0f;
+	opacity = 1.0f;
+	texture = NULL;
 }
 
 vec3 Material::GetAmbient()
@@ -27,6 +29,11 @@ vec3 Material::GetEmissive()
 	return emissive;
 }
 
+float Material::GetOpacity()
+{
+	return opacity;
+}
+
 float Material::GetShininess()
 {
 	return shininess;
@@ -37,6 +44,11 @@ vec3 Material::GetSpecular()
 	return specular;
 }
 
+Texture *Material::GetTexture()
+{
+	return texture;
+}
+
 void Material::SetAmbient(vec3 &color)
 {
 	ambient = color;
@@ -52,6 +64,11 @@ void Material::SetEmissive(vec3 &color)
 	emissive = color;
 }
 
+void Material::SetOpacity(float opacity)
+{
+	this->opacity = opacity;
+}
+
 void Material::SetSpecular(vec3 &color)
 {
 	specular = color;
@@ -61,3 +78,8 @@ void Material::SetShininess(float shininess)
 {
 	this->shininess = shininess;
 }
+
+void Material::SetTexture(Texture *texture)
+{
+	this->texture = texture;
+}
@@ -31,7 +31,7 @@ vec3 PointLight::ComputeDirectContribution(const Accelerator *accelerator,
 				return c;
 		}
 
-		c = intersection.material->GetDiffuse() * lambert * attenuation * intensity;
+		c = intersection.material->GetDiffuse() * intersection.color * lambert * attenuation * intensity;
 
 		if (all(greaterThan(intersection.material->GetSpecular(), vec3(0.0f))))
 		{
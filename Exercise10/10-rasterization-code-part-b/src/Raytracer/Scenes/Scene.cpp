@@ -1,12 +1,39 @@
 #define RAYTRACER_USE_FOREACH
 #include <Raytracer/Raytracer.h>
 
+using namespace std;
 using namespace Raytracer;
+using namespace Raytracer::Objects;
 using namespace Raytracer::Scenes;
 
+namespace
+{
+	/**
+	 * Appends an object to a registry and remembers its position.
+	 */
+	template <class T>
+	void AddToRegistry(vector<T *> &registry, T *object, int &index)
+	{
+		index = (int)registry.size();
+		registry.push_back(object);
+	}
+}
+
 Scene::Scene()
 {
 	activeCamera = NULL;
+
+	for (int i = 0; i < SceneRegistry_Count; i++)
+		generations[i] = 0;
+
+	CreateGraph();
+}
+
+Scene::~Scene()
+{
+	// The children unregister themselves while being deleted, which needs the registries to
+	// still be alive.
+	DeleteChildren();
 }
 
 Camera *Scene::GetActiveCamera() const
@@ -14,12 +41,113 @@ Camera *Scene::GetActiveCamera() const
 	return activeCamera;
 }
 
+const vector<Camera *> &Scene::GetCameras() const
+{
+	return cameras;
+}
+
+unsigned int Scene::GetGeneration(SceneRegistry registry) const
+{
+	return generations[registry];
+}
+
+const vector<Light *> &Scene::GetLights() const
+{
+	return lights;
+}
+
+const vector<Mesh *> &Scene::GetMeshes() const
+{
+	return meshes;
+}
+
+const vector<PhysicalObject *> &Scene::GetPhysicalObjects() const
+{
+	return physicalObjects;
+}
+
 bool Scene::IsInstanceOf(SceneObjectType type) const
 {
 	return (type == SceneObjectType_Scene);
 }
 
+void Scene::Register(SceneObject *object)
+{
+	int *indices = object->registryIndices;
+
+	// The type tag has been computed when the object was attached, so no virtual calls are
+	// needed here.
+	if (object->HasType(SceneObjectType_Light) && indices[SceneRegistry_Lights] < 0)
+	{
+		AddToRegistry(lights, (Light *)object, indices[SceneRegistry_Lights]);
+		generations[SceneRegistry_Lights]++;
+	}
+	if (object->HasType(SceneObjectType_Mesh) && indices[SceneRegistry_Meshes] < 0)
+	{
+		AddToRegistry(meshes, (Mesh *)object, indices[SceneRegistry_Meshes]);
+		generations[SceneRegistry_Meshes]++;
+	}
+	if (object->HasType(SceneObjectType_PhysicalObject) &&
+		indices[SceneRegistry_PhysicalObjects] < 0)
+	{
+		AddToRegistry(physicalObjects, (PhysicalObject *)object,
+			indices[SceneRegistry_PhysicalObjects]);
+		generations[SceneRegistry_PhysicalObjects]++;
+	}
+	if (object->HasType(SceneObjectType_Camera) && indices[SceneRegistry_Cameras] < 0)
+	{
+		AddToRegistry(cameras, (Camera *)object, indices[SceneRegistry_Cameras]);
+		generations[SceneRegistry_Cameras]++;
+	}
+}
+
 void Scene::SetActiveCamera(Camera *camera)
 {
 	this->activeCamera = camera;
 }
+
+void Scene::Unregister(SceneObject *object)
+{
+	int *indices = object->registryIndices;
+
+	// Remove the object by moving the last entry of each registry into its place.
+	if (indices[SceneRegistry_Lights] >= 0)
+	{
+		Light *last = lights.back();
+		last->registryIndices[SceneRegistry_Lights] = indices[SceneRegistry_Lights];
+		lights[indices[SceneRegistry_Lights]] = last;
+		lights.pop_back();
+		generations[SceneRegistry_Lights]++;
+	}
+	if (indices[SceneRegistry_Meshes] >= 0)
+	{
+		Mesh *last = meshes.back();
+		last->registryIndices[SceneRegistry_Meshes] = indices[SceneRegistry_Meshes];
+		meshes[indices[SceneRegistry_Meshes]] = last;
+		meshes.pop_back();
+		generations[SceneRegistry_Meshes]++;
+	}
+	if (indices[SceneRegistry_PhysicalObjects] >= 0)
+	{
+		PhysicalObject *last = physicalObjects.back();
+		last->registryIndices[SceneRegistry_PhysicalObjects] =
+			indices[SceneRegistry_PhysicalObjects];
+		physicalObjects[indices[SceneRegistry_PhysicalObjects]] = last;
+		physicalObjects.pop_back();
+		generations[SceneRegistry_PhysicalObjects]++;
+	}
+	if (indices[SceneRegistry_Cameras] >= 0)
+	{
+		Camera *last = cameras.back();
+		last->registryIndices[SceneRegistry_Cameras] = indices[SceneRegistry_Cameras];
+		cameras[indices[SceneRegistry_Cameras]] = last;
+		cameras.pop_back();
+		generations[SceneRegistry_Cameras]++;
+	}
+
+	for (int i = 0; i < SceneRegistry_Count; i++)
+		indices[i] = -1;
+
+	if (object == activeCamera)
+		activeCamera = NULL;
+}
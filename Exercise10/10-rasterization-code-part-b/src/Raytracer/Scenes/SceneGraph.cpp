@@ -0,0 +1,260 @@
+#include <Raytracer/Raytracer.h>
+#include <Raytracer/Internal/Parallel.h>
+
+using namespace glm;
+using namespace Raytracer::Internal;
+using namespace Raytracer::Scenes;
+
+SceneGraph::SceneGraph(SceneObject *owner)
+{
+	this->owner = owner;
+	firstDirtyLevel = -1;
+	updateStamp = 0;
+}
+
+SceneGraph *SceneGraph::GetDefault()
+{
+	// Never destroyed, since scene objects may still be released during static destruction.
+	static SceneGraph *graph = new SceneGraph(NULL);
+	return graph;
+}
+
+int SceneGraph::Insert(int level, Node node, Node parent, unsigned int type,
+					   SceneObject *object, const mat4x4 &transformation)
+{
+	if ((int)levels.size() <= level)
+		levels.resize(level + 1);
+
+	Level &l = levels[level];
+	int slot = (int)l.nodes.size();
+
+	l.nodes.push_back(node);
+	l.parents.push_back(parent);
+	l.types.push_back(type);
+	l.objects.push_back(object);
+	l.transformations.push_back(transformation);
+	l.globalTransformations.push_back(transformation);
+	l.globalToLocals.push_back(mat4x4(1.0f));
+	l.updateStamps.push_back(0);
+	l.flags.push_back(NodeFlags_Dirty);
+
+	nodeLevels[node] = level;
+	nodeSlots[node] = slot;
+
+	if (firstDirtyLevel < 0 || level < firstDirtyLevel)
+		firstDirtyLevel = level;
+
+	return slot;
+}
+
+void SceneGraph::Erase(Node node)
+{
+	Level &l = levels[nodeLevels[node]];
+	int slot = nodeSlots[node];
+	int last = (int)l.nodes.size() - 1;
+
+	if (slot != last)
+	{
+		l.nodes[slot] = l.nodes[last];
+		l.parents[slot] = l.parents[last];
+		l.types[slot] = l.types[last];
+		l.objects[slot] = l.objects[last];
+		l.transformations[slot] = l.transformations[last];
+		l.globalTransformations[slot] = l.globalTransformations[last];
+		l.globalToLocals[slot] = l.globalToLocals[last];
+		l.updateStamps[slot] = l.updateStamps[last];
+		l.flags[slot] = l.flags[last];
+
+		nodeSlots[l.nodes[slot]] = slot;
+	}
+
+	l.nodes.pop_back();
+	l.parents.pop_back();
+	l.types.pop_back();
+	l.objects.pop_back();
+	l.transformations.pop_back();
+	l.globalTransformations.pop_back();
+	l.globalToLocals.pop_back();
+	l.updateStamps.pop_back();
+	l.flags.pop_back();
+
+	while (!levels.empty() && levels.back().nodes.empty())
+		levels.pop_back();
+
+	nodeLevels[node] = -1;
+}
+
+void SceneGraph::Invalidate(Node node)
+{
+	int level = nodeLevels[node];
+	levels[level].flags[nodeSlots[node]] = NodeFlags_Dirty;
+
+	if (firstDirtyLevel < 0 || level < firstDirtyLevel)
+		firstDirtyLevel = level;
+}
+
+SceneGraph::Node SceneGraph::Create(SceneObject *object)
+{
+	Node node;
+	if (freeNodes.empty())
+	{
+		node = (Node)nodeLevels.size();
+		nodeLevels.push_back(-1);
+		nodeSlots.push_back(-1);
+	}
+	else
+	{
+		node = freeNodes.back();
+		freeNodes.pop_back();
+	}
+
+	Insert(0, node, InvalidNode, 0, object, mat4x4(1.0f));
+	return node;
+}
+
+void SceneGraph::Destroy(Node node)
+{
+	if (node < 0 || node >= (Node)nodeLevels.size() || nodeLevels[node] < 0)
+		return;
+
+	Erase(node);
+	freeNodes.push_back(node);
+}
+
+int SceneGraph::GetDepth(Node node) const
+{
+	return nodeLevels[node];
+}
+
+const mat4x4 &SceneGraph::GetGlobalTransformation(Node node) const
+{
+	return levels[nodeLevels[node]].globalTransformations[nodeSlots[node]];
+}
+
+const mat4x4 &SceneGraph::GetGlobalToLocal(Node node) const
+{
+	return levels[nodeLevels[node]].globalToLocals[nodeSlots[node]];
+}
+
+SceneObject *SceneGraph::GetOwner() const
+{
+	return owner;
+}
+
+SceneGraph::Node SceneGraph::GetParent(Node node) const
+{
+	return levels[nodeLevels[node]].parents[nodeSlots[node]];
+}
+
+const mat4x4 &SceneGraph::GetTransformation(Node node) const
+{
+	return levels[nodeLevels[node]].transformations[nodeSlots[node]];
+}
+
+unsigned int SceneGraph::GetTypeMask(Node node) const
+{
+	return levels[nodeLevels[node]].types[nodeSlots[node]];
+}
+
+void SceneGraph::SetParent(Node node, Node parent)
+{
+	int oldLevel = nodeLevels[node];
+	int newLevel = (parent == InvalidNode) ? 0 : nodeLevels[parent] + 1;
+
+	if (oldLevel == newLevel)
+	{
+		levels[oldLevel].parents[nodeSlots[node]] = parent;
+		Invalidate(node);
+		return;
+	}
+
+	Level &l = levels[oldLevel];
+	int slot = nodeSlots[node];
+	unsigned int type = l.types[slot];
+	SceneObject *object = l.objects[slot];
+	mat4x4 transformation = l.transformations[slot];
+
+	Erase(node);
+	Insert(newLevel, node, parent, type, object, transformation);
+}
+
+void SceneGraph::SetTransformation(Node node, const mat4x4 &transformation)
+{
+	levels[nodeLevels[node]].transformations[nodeSlots[node]] = transformation;
+	Invalidate(node);
+}
+
+void SceneGraph::SetTypeMask(Node node, unsigned int typeMask)
+{
+	levels[nodeLevels[node]].types[nodeSlots[node]] = typeMask;
+}
+
+void SceneGraph::Update()
+{
+	if (firstDirtyLevel < 0)
+		return;
+
+	unsigned int stamp = ++updateStamp;
+
+	for (int level = firstDirtyLevel; level < (int)levels.size(); level++)
+	{
+		Level &l = levels[level];
+		const Level *up = (level > 0) ? &levels[level - 1] : NULL;
+
+		// Nodes of the same level never depend on each other.
+		ParallelFor(0, (int)l.nodes.size(), 4096, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				bool changed = (l.flags[i] & NodeFlags_Dirty) != 0;
+				int parentSlot = -1;
+
+				if (up != NULL)
+				{
+					parentSlot = nodeSlots[l.parents[i]];
+					changed = changed || (up->updateStamps[parentSlot] == stamp);
+				}
+
+				if (!changed)
+					continue;
+
+				if (up == NULL)
+					l.globalTransformations[i] = l.transformations[i];
+				else
+					l.globalTransformations[i] = up->globalTransformations[parentSlot] *
+						l.transformations[i];
+
+				l.globalToLocals[i] = inverse(l.globalTransformations[i]);
+				l.updateStamps[i] = stamp;
+				l.flags[i] = 0;
+			}
+		});
+	}
+
+	firstDirtyLevel = -1;
+}
+
+int SceneGraph::GetLevelCount() const
+{
+	return (int)levels.size();
+}
+
+int SceneGraph::GetLevelSize(int level) const
+{
+	return (int)levels[level].nodes.size();
+}
+
+SceneObject *const *SceneGraph::GetLevelObjects(int level) const
+{
+	return levels[level].objects.data();
+}
+
+const unsigned int *SceneGraph::GetLevelTypeMasks(int level) const
+{
+	return levels[level].types.data();
+}
+
+const mat4x4 *SceneGraph::GetLevelGlobalTransformations(int level) const
+{
+	return levels[level].globalTransformations.data();
+}
@@ -4,16 +4,46 @@
 using namespace glm;
 using namespace Raytracer::Scenes;
 
+namespace
+{
+	/**
+	 * Retrieves the scene a graph belongs to or NULL.
+	 */
+	Scene *GetScene(SceneGraph *graph)
+	{
+		SceneObject *owner = graph->GetOwner();
+		if (owner == NULL || !owner->HasType(SceneObjectType_Scene))
+			return NULL;
+
+		return (Scene *)owner;
+	}
+}
+
 SceneObject::SceneObject()
 {
 	parent = NULL;
-	SetTransformation(mat4x4(1.0f));
+	childIndex = -1;
+	for (int i = 0; i < SceneRegistry_Count; i++)
+		registryIndices[i] = -1;
+	ownedGraph = NULL;
+	graph = SceneGraph::GetDefault();
+	node = graph->Create(this);
 }
 
 SceneObject::~SceneObject()
 {
-	foreach (SceneObject *, child, children)
-		delete *child;
+	DeleteChildren();
+
+	if (parent != NULL)
+		parent->UnlinkChild(this);
+
+	// A scene does not need to unregister from its own registries.
+	Scene *scene = (graph != ownedGraph) ? GetScene(graph) : NULL;
+	if (scene != NULL)
+		scene->Unregister(this);
+
+	graph->Destroy(node);
+	delete ownedGraph;
 }
 
 bool SceneObject::AddChild(SceneObject *child)
@@ -25,29 +55,98 @@ bool SceneObject::AddChild(SceneObject *child)
 		return true;
 
 	if (child->parent != NULL)
-		child->parent->RemoveChild(child);
+		child->parent->UnlinkChild(child);
 
 	child->parent = this;
+	child->childIndex = (int)children.size();
 	children.push_back(child);
-	
-	child->UpdateTransformations();
+
+	child->Attach(graph, node);
 
 	return true;
 }
 
+void SceneObject::Attach(SceneGraph *target, SceneGraph::Node parentNode)
+{
+	if (target == graph)
+	{
+		graph->SetParent(node, parentNode);
+	}
+	else
+	{
+		Scene *scene = GetScene(graph);
+		if (scene != NULL)
+			scene->Unregister(this);
+
+		mat4x4 transformation = graph->GetTransformation(node);
+		graph->Destroy(node);
+
+		graph = target;
+		node = graph->Create(this);
+		graph->SetParent(node, parentNode);
+		graph->SetTransformation(node, transformation);
+	}
+
+	graph->SetTypeMask(node, GetTypeMask());
+
+	Scene *scene = GetScene(graph);
+	if (scene != NULL)
+		scene->Register(this);
+
+	// The children follow their parent into its new level or graph.
+	foreach (SceneObject *, child, children)
+		(*child)->Attach(graph, node);
+}
+
+void SceneObject::CreateGraph()
+{
+	if (ownedGraph != NULL)
+		return;
+
+	ownedGraph = new SceneGraph(this);
+	Attach(ownedGraph, SceneGraph::InvalidNode);
+}
+
+void SceneObject::DeleteChildren()
+{
+	foreach (SceneObject *, child, children)
+	{
+		// Keep the child from unlinking itself from the list we are iterating.
+		(*child)->parent = NULL;
+		delete *child;
+	}
+
+	children.clear();
+}
+
 const std::vector<SceneObject *> &SceneObject::GetChildren() const
 {
 	return children;
 }
 
+const vec3 SceneObject::GetGlobalPosition() const
+{
+	return vec3(graph->GetGlobalTransformation(node)[3]);
+}
+
 const mat4x4 &SceneObject::GetGlobalToLocal() const
 {
-	return globalToLocal;
+	return graph->GetGlobalToLocal(node);
 }
 
 const mat4x4 &SceneObject::GetGlobalTransformation() const
 {
-	return globalTransformation;
+	return graph->GetGlobalTransformation(node);
+}
+
+SceneGraph::Node SceneObject::GetNode() const
+{
+	return node;
+}
+
+bool SceneObject::HasType(SceneObjectType type) const
+{
+	return (graph->GetTypeMask(node) & (1u << type)) != 0;
 }
 
 SceneObject *SceneObject::GetParent() const
@@ -57,12 +156,34 @@ SceneObject *SceneObject::GetParent() const
 
 const vec3 SceneObject::GetPosition() const
 {
-	return vec3(transformation[3]);
+	return vec3(graph->GetTransformation(node)[3]);
+}
+
+SceneGraph *SceneObject::GetSceneGraph()
+{
+	return graph;
+}
+
+const SceneGraph *SceneObject::GetSceneGraph() const
+{
+	return graph;
 }
 
 const mat4x4 &SceneObject::GetTransformation() const
 {
-	return transformation;
+	return graph->GetTransformation(node);
+}
+
+unsigned int SceneObject::GetTypeMask() const
+{
+	unsigned int mask = 0;
+	for (int type = 0; type < SceneObjectType_Count; type++)
+	{
+		if (IsInstanceOf((SceneObjectType)type))
+			mask |= 1u << type;
+	}
+
+	return mask;
 }
 
 void SceneObject::RemoveChild(SceneObject *child)
@@ -70,56 +191,45 @@ void SceneObject::RemoveChild(SceneObject *child)
 	if (child == NULL || child->parent != this)
 		return;
 
+	UnlinkChild(child);
 	child->parent = NULL;
 
-	foreach (SceneObject *, it, children)
-	{
-		if (*it == child)
-		{
-			children.erase(it);
-			return;
-		}
-	}
+	// A detached object no longer belongs to the scene.
+	child->Attach(SceneGraph::GetDefault(), SceneGraph::InvalidNode);
 }
 
 void SceneObject::SetGlobalTransformation(const mat4x4 &transformation)
 {
 	if (parent == NULL)
-		this->transformation = transformation;
+		graph->SetTransformation(node, transformation);
 	else
-		this->transformation = inverse(parent->globalTransformation) * transformation;
-
-	UpdateTransformations();
+	{
+		// The parent's global transformation may have changed since the last update.
+		graph->Update();
+		graph->SetTransformation(node, parent->GetGlobalToLocal() * transformation);
+	}
 }
 
 void SceneObject::SetPosition(const vec3 &position)
 {
+	mat4x4 transformation = graph->GetTransformation(node);
 	transformation[3] = vec4(position, 1.0f);
-	UpdateTransformations();
+	graph->SetTransformation(node, transformation);
 }
 
 void SceneObject::SetTransformation(const mat4x4 &transformation)
 {
-	this->transformation = transformation;
-	UpdateTransformations();
+	graph->SetTransformation(node, transformation);
 }
 
-void SceneObject::UpdateTransformations()
+void SceneObject::UnlinkChild(SceneObject *child)
 {
-	if (parent == NULL)
-	{
-		// This is a top-level object.
-		globalTransformation = transformation;
-	}
-	else
-	{
-		// This object is embedded in a parent coordinate system.
-		globalTransformation = parent->globalTransformation * transformation;
-	}
+	int index = child->childIndex;
+	SceneObject *last = children.back();
 
-	globalToLocal = inverse(globalTransformation);
+	children[index] = last;
+	last->childIndex = index;
+	children.pop_back();
 
-	// Update child transformations
-	foreach (SceneObject *, child, children)
-		(*child)->UpdateTransformations();
+	child->childIndex = -1;
 }
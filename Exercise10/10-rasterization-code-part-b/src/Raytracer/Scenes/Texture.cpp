@@ -0,0 +1,526 @@
+#include <math.h>
+#include <stdio.h>
+
+#include <Raytracer/Raytracer.h>
+
+using namespace glm;
+using namespace Raytracer;
+using namespace Raytracer::Scenes;
+
+namespace
+{
+	/**
+	 * The position of a texel within its tile, indexed by (y % 4) * 4 + x % 4. The bits of x
+	 * and y are interleaved, so every 2 x 2 block of the tile is stored in four consecutive
+	 * texels.
+	 */
+	const unsigned char MortonOrder[16] = {
+		0, 1, 4, 5,
+		2, 3, 6, 7,
+		8, 9, 12, 13,
+		10, 11, 14, 15
+	};
+
+	/**
+	 * Beyond this magnitude, floats have no fractional part
+	 */
+	const float IntegralLimit = 8388608.0f;
+
+	/**
+	 * Wraps a texture coordinate into the range from 0 to 1. Coordinates that are not finite
+	 * become 0.
+	 */
+	inline float Repeat(float x)
+	{
+		if (!(fabsf(x) < IntegralLimit))
+			return 0.0f;
+
+		float floor = (float)(int)x;
+		if (floor > x)
+			floor -= 1.0f;
+		return x - floor;
+	}
+
+	/**
+	 * Interpolates linearly between two values. The SIMD sampling performs the same
+	 * operations in the same order.
+	 */
+	inline float Lerp(float a, float b, float weight)
+	{
+		return a + (b - a) * weight;
+	}
+
+	/**
+	 * Extracts a channel of a texel and decodes it to a linear value from 0 to 1.
+	 */
+	inline float GetChannel(unsigned int texel, const float *decode, int channel)
+	{
+		return decode[(texel >> (channel * 8)) & 0xff];
+	}
+
+	/**
+	 * Interpolates a channel of the four texels of a bilinear lookup in linear space.
+	 */
+	inline float Bilinear(const unsigned int *texels, const float *decode, int channel,
+		float weightX, float weightY)
+	{
+		float top = Lerp(GetChannel(texels[0], decode, channel),
+			GetChannel(texels[1], decode, channel), weightX);
+		float bottom = Lerp(GetChannel(texels[2], decode, channel),
+			GetChannel(texels[3], decode, channel), weightX);
+		return Lerp(top, bottom, weightY);
+	}
+
+#ifdef RAYTRACER_SSE2
+	/**
+	 * Wraps four texture coordinates into the range from 0 to 1 like Repeat().
+	 */
+	inline __m128 Repeat(__m128 x)
+	{
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128 valid = _mm_cmplt_ps(_mm_and_ps(x, absMask), _mm_set1_ps(IntegralLimit));
+
+		__m128 floor = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_and_ps(x, valid)));
+		floor = _mm_sub_ps(floor, _mm_and_ps(_mm_cmpgt_ps(floor, x), _mm_set1_ps(1.0f)));
+		return _mm_and_ps(_mm_sub_ps(x, floor), valid);
+	}
+
+	/**
+	 * Multiplies four integers by the same integer, keeping the lower 32 bits of the products.
+	 */
+	inline __m128i MultiplyLow(__m128i a, __m128i b)
+	{
+		__m128i even = _mm_mul_epu32(a, b);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+
+	/**
+	 * Interpolates linearly between four pairs of values like Lerp().
+	 */
+	inline __m128 Lerp(__m128 a, __m128 b, __m128 weight)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), weight));
+	}
+
+	/**
+	 * Decodes the channels of four texels to linear values from 0 to 1. SSE2 cannot gather,
+	 * so the values are looked up in the table one by one.
+	 */
+	inline void Decode(__m128i texels, const float *decode, __m128 channels[3])
+	{
+		unsigned int lanes[4];
+		_mm_storeu_si128((__m128i *)lanes, texels);
+
+		for (int channel = 0; channel < 3; channel++)
+		{
+			int shift = channel * 8;
+			channels[channel] = _mm_setr_ps(decode[(lanes[0] >> shift) & 0xff],
+				decode[(lanes[1] >> shift) & 0xff], decode[(lanes[2] >> shift) & 0xff],
+				decode[(lanes[3] >> shift) & 0xff]);
+		}
+	}
+
+	/**
+	 * Interpolates the channels of the bilinear lookups of four positions in linear space.
+	 * The texels of the lookups are given as the top left, top right, bottom left and bottom
+	 * right texels of all four positions.
+	 */
+	inline void Bilinear(const __m128i texels[4], const float *decode, __m128 weightX,
+		__m128 weightY, __m128 color[3])
+	{
+		__m128 values[4][3];
+		for (int i = 0; i < 4; i++)
+			Decode(texels[i], decode, values[i]);
+
+		for (int channel = 0; channel < 3; channel++)
+		{
+			__m128 top = Lerp(values[0][channel], values[1][channel], weightX);
+			__m128 bottom = Lerp(values[2][channel], values[3][channel], weightX);
+			color[channel] = Lerp(top, bottom, weightY);
+		}
+	}
+#endif
+}
+
+Texture::Texture()
+{
+	for (int i = 0; i < 256; i++)
+		decode[i] = (float)i / 255.0f;
+}
+
+void Texture::AddLevel(int width, int height, const std::vector<vec3> &pixels, float gamma)
+{
+	levels.push_back(Level());
+	Level &level = levels.back();
+
+	level.width = width;
+	level.height = height;
+	level.tileColumns = (width + TileSize - 1) / TileSize;
+
+	int tileRows = (height + TileSize - 1) / TileSize;
+	level.texels.assign((size_t)level.tileColumns * tileRows * TileSize * TileSize, 0);
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			vec3 color = pow(clamp(pixels[(size_t)y * width + x], 0.0f, 1.0f), vec3(1.0f / gamma));
+			color = color * 255.0f + 0.5f;
+			unsigned int texel = (unsigned int)color.r | ((unsigned int)color.g << 8) |
+				((unsigned int)color.b << 16) | (0xffu << 24);
+
+			size_t tile = (size_t)(y / TileSize) * level.tileColumns + x / TileSize;
+			level.texels[tile * TileSize * TileSize +
+				MortonOrder[(y % TileSize) * TileSize + x % TileSize]] = texel;
+		}
+	}
+}
+
+bool Texture::Create(const Image &image, float gamma)
+{
+	levels.clear();
+
+	int width = image.GetWidth();
+	int height = image.GetHeight();
+	if (width <= 0 || height <= 0 || image.GetPixels() == NULL || !(gamma > 0))
+		return false;
+
+	for (int i = 0; i < 256; i++)
+		decode[i] = powf((float)i / 255.0f, gamma);
+
+	std::vector<vec3> pixels(image.GetPixels(), image.GetPixels() + (size_t)width * height);
+	AddLevel(width, height, pixels, gamma);
+
+	// Every level averages 2 x 2 texels of the one before. For odd sizes, the last row or
+	// column of the larger level only contributes to the texels next to it.
+	std::vector<vec3> nextPixels;
+	while (width > 1 || height > 1)
+	{
+		int nextWidth = std::max(width / 2, 1);
+		int nextHeight = std::max(height / 2, 1);
+		nextPixels.resize((size_t)nextWidth * nextHeight);
+
+		for (int y = 0; y < nextHeight; y++)
+		{
+			const vec3 *row0 = &pixels[(size_t)std::min(y * 2, height - 1) * width];
+			const vec3 *row1 = &pixels[(size_t)std::min(y * 2 + 1, height - 1) * width];
+
+			for (int x = 0; x < nextWidth; x++)
+			{
+				int x0 = std::min(x * 2, width - 1);
+				int x1 = std::min(x * 2 + 1, width - 1);
+				nextPixels[(size_t)y * nextWidth + x] =
+					(row0[x0] + row0[x1] + row1[x0] + row1[x1]) * 0.25f;
+			}
+		}
+
+		pixels.swap(nextPixels);
+		width = nextWidth;
+		height = nextHeight;
+		AddLevel(width, height, pixels, gamma);
+	}
+
+	return true;
+}
+
+void Texture::GetFootprint(const Level &level, float s, float t, unsigned int texels[4],
+	float &weightX, float &weightY) const
+{
+	// Texel centers are at half-integer positions
+	float x = s * (float)level.width - 0.5f;
+	float y = t * (float)level.height - 0.5f;
+
+	int x0 = (int)x;
+	int y0 = (int)y;
+	float floorX = (float)x0;
+	float floorY = (float)y0;
+	if (floorX > x)
+	{
+		x0--;
+		floorX -= 1.0f;
+	}
+	if (floorY > y)
+	{
+		y0--;
+		floorY -= 1.0f;
+	}
+
+	weightX = x - floorX;
+	weightY = y - floorY;
+
+	// The texels beyond the edges come from the opposite edge.
+	int x1 = (x0 + 1 < level.width ? x0 + 1 : 0);
+	int y1 = (y0 + 1 < level.height ? y0 + 1 : 0);
+	if (x0 < 0)
+		x0 = level.width - 1;
+	if (y0 < 0)
+		y0 = level.height - 1;
+
+	const int tileTexels = TileSize * TileSize;
+	size_t row0 = (size_t)(y0 / TileSize) * level.tileColumns * tileTexels;
+	size_t row1 = (size_t)(y1 / TileSize) * level.tileColumns * tileTexels;
+	int offset0 = (y0 % TileSize) * TileSize;
+	int offset1 = (y1 % TileSize) * TileSize;
+
+	size_t column0 = (size_t)(x0 / TileSize) * tileTexels;
+	size_t column1 = (size_t)(x1 / TileSize) * tileTexels;
+
+	texels[0] = level.texels[row0 + column0 + MortonOrder[offset0 + x0 % TileSize]];
+	texels[1] = level.texels[row0 + column1 + MortonOrder[offset0 + x1 % TileSize]];
+	texels[2] = level.texels[row1 + column0 + MortonOrder[offset1 + x0 % TileSize]];
+	texels[3] = level.texels[row1 + column1 + MortonOrder[offset1 + x1 % TileSize]];
+}
+
+#ifdef RAYTRACER_SSE2
+void Texture::GetFootprint(const Level &level, __m128 s, __m128 t, __m128i texels[4],
+	__m128 &weightX, __m128 &weightY) const
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128i oneBit = _mm_set1_epi32(1);
+	const __m128i twoBit = _mm_set1_epi32(2);
+
+	__m128 x = _mm_sub_ps(_mm_mul_ps(s, _mm_set1_ps((float)level.width)), _mm_set1_ps(0.5f));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps((float)level.height)), _mm_set1_ps(0.5f));
+
+	__m128i x0 = _mm_cvttps_epi32(x);
+	__m128i y0 = _mm_cvttps_epi32(y);
+	__m128 floorX = _mm_cvtepi32_ps(x0);
+	__m128 floorY = _mm_cvtepi32_ps(y0);
+	__m128 aboveX = _mm_cmpgt_ps(floorX, x);
+	__m128 aboveY = _mm_cmpgt_ps(floorY, y);
+	x0 = _mm_add_epi32(x0, _mm_castps_si128(aboveX));
+	y0 = _mm_add_epi32(y0, _mm_castps_si128(aboveY));
+	floorX = _mm_sub_ps(floorX, _mm_and_ps(aboveX, one));
+	floorY = _mm_sub_ps(floorY, _mm_and_ps(aboveY, one));
+
+	weightX = _mm_sub_ps(x, floorX);
+	weightY = _mm_sub_ps(y, floorY);
+
+	// The texels beyond the edges come from the opposite edge.
+	__m128i lastX = _mm_set1_epi32(level.width - 1);
+	__m128i lastY = _mm_set1_epi32(level.height - 1);
+	__m128i x1 = _mm_add_epi32(x0, oneBit);
+	__m128i y1 = _mm_add_epi32(y0, oneBit);
+	x1 = _mm_andnot_si128(_mm_cmpgt_epi32(x1, lastX), x1);
+	y1 = _mm_andnot_si128(_mm_cmpgt_epi32(y1, lastY), y1);
+
+	__m128i negativeX = _mm_cmplt_epi32(x0, _mm_setzero_si128());
+	__m128i negativeY = _mm_cmplt_epi32(y0, _mm_setzero_si128());
+	x0 = _mm_or_si128(_mm_andnot_si128(negativeX, x0), _mm_and_si128(negativeX, lastX));
+	y0 = _mm_or_si128(_mm_andnot_si128(negativeY, y0), _mm_and_si128(negativeY, lastY));
+
+	// The offsets of the columns and rows, with the bits within the tile interleaved as in
+	// MortonOrder
+	__m128i rowSize = _mm_set1_epi32(level.tileColumns * TileSize * TileSize);
+	__m128i columns[2], rows[2];
+	__m128i xs[2] = {x0, x1};
+	__m128i ys[2] = {y0, y1};
+
+	for (int i = 0; i < 2; i++)
+	{
+		columns[i] = _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(xs[i], 2), 4), _mm_or_si128(
+			_mm_and_si128(xs[i], oneBit), _mm_slli_epi32(_mm_and_si128(xs[i], twoBit), 1)));
+		rows[i] = _mm_add_epi32(MultiplyLow(_mm_srli_epi32(ys[i], 2), rowSize), _mm_or_si128(
+			_mm_slli_epi32(_mm_and_si128(ys[i], oneBit), 1),
+			_mm_slli_epi32(_mm_and_si128(ys[i], twoBit), 2)));
+	}
+
+	// SSE2 cannot gather, so the texels are loaded one by one.
+	const unsigned int *data = &level.texels[0];
+	for (int i = 0; i < 4; i++)
+	{
+		int indices[4];
+		_mm_storeu_si128((__m128i *)indices, _mm_add_epi32(rows[i / 2], columns[i % 2]));
+		texels[i] = _mm_setr_epi32(data[indices[0]], data[indices[1]], data[indices[2]],
+			data[indices[3]]);
+	}
+}
+#endif
+
+int Texture::GetHeight() const
+{
+	return levels.empty() ? 0 : levels[0].height;
+}
+
+int Texture::GetLevelCount() const
+{
+	return (int)levels.size();
+}
+
+float Texture::GetLod(float dudx, float dvdx, float dudy, float dvdy) const
+{
+	if (levels.empty())
+		return 0;
+
+	float width = (float)levels[0].width;
+	float height = (float)levels[0].height;
+
+	float stepX = dudx * dudx * width * width + dvdx * dvdx * height * height;
+	float stepY = dudy * dudy * width * width + dvdy * dvdy * height * height;
+
+	return 0.5f * log2f(std::max(stepX, stepY));
+}
+
+int Texture::GetWidth() const
+{
+	return levels.empty() ? 0 : levels[0].width;
+}
+
+bool Texture::LoadBMP(const char *fileName, float gamma)
+{
+#pragma pack(push,1)
+	struct Header
+	{
+		unsigned char bfType[2];
+		unsigned int bfSize;
+		unsigned short bfReserved1;
+		unsigned short bfReserved2;
+		unsigned int bfOffBits;
+		unsigned int biSize;
+		int biWidth;
+		int biHeight;
+		unsigned short biPlanes;
+		unsigned short biBitCount;
+		unsigned int biCompression;
+		unsigned int biSizeImage;
+		int biXPelsPerMeter;
+		int biYPelsPerMeter;
+		unsigned int biClrUsed;
+		unsigned int biClrImportant;
+	};
+#pragma pack(pop)
+
+	if (fileName == NULL || !(gamma > 0))
+		return false;
+
+#ifdef __STDC_WANT_SECURE_LIB__
+	FILE *file = NULL;
+	fopen_s(&file, fileName, "rb");
+#else
+	FILE *file = fopen(fileName, "rb");
+#endif
+
+	if (file == NULL)
+		return false;
+
+	Header header;
+	if (fread(&header, sizeof(Header), 1, file) != 1 || header.bfType[0] != 'B' ||
+		header.bfType[1] != 'M' || header.biBitCount != 24 || header.biCompression != 0 ||
+		header.biWidth <= 0 || header.biHeight == 0 || fseek(file, header.bfOffBits, SEEK_SET) != 0)
+	{
+		fclose(file);
+		return false;
+	}
+
+	// Rows are stored from the bottom up unless the height is negative
+	int width = header.biWidth;
+	int height = header.biHeight < 0 ? -header.biHeight : header.biHeight;
+	int stride = (width * 3 + 3) / 4 * 4;
+
+	Image image(width, height);
+	std::vector<unsigned char> row(stride);
+
+	for (int i = 0; i < height; i++)
+	{
+		if (fread(&row[0], 1, stride, file) != (size_t)stride)
+		{
+			fclose(file);
+			return false;
+		}
+
+		int y = header.biHeight < 0 ? i : height - 1 - i;
+		for (int x = 0; x < width; x++)
+		{
+			vec3 color(row[x * 3 + 2], row[x * 3 + 1], row[x * 3]);
+			image.SetPixel(x, y, pow(color / 255.0f, vec3(gamma)));
+		}
+	}
+
+	// The first level is encoded with the same gamma again and keeps the values of the file.
+	fclose(file);
+	return Create(image, gamma);
+}
+
+vec3 Texture::Sample(float u, float v, float lod) const
+{
+	if (levels.empty())
+		return vec3(0, 0, 0);
+
+	float blend;
+	int index = SelectLevels(lod, blend);
+	float s = Repeat(u);
+	float t = Repeat(v);
+
+	unsigned int texels[4];
+	float weightX, weightY;
+	GetFootprint(levels[index], s, t, texels, weightX, weightY);
+
+	vec3 color;
+	for (int channel = 0; channel < 3; channel++)
+		color[channel] = Bilinear(texels, decode, channel, weightX, weightY);
+
+	if (blend != 0)
+	{
+		GetFootprint(levels[index + 1], s, t, texels, weightX, weightY);
+
+		for (int channel = 0; channel < 3; channel++)
+		{
+			float next = Bilinear(texels, decode, channel, weightX, weightY);
+			color[channel] = Lerp(color[channel], next, blend);
+		}
+	}
+
+	return color;
+}
+
+#ifdef RAYTRACER_SSE2
+void Texture::SampleQuad(__m128 u, __m128 v, float lod, __m128 color[3]) const
+{
+	if (levels.empty())
+	{
+		color[0] = color[1] = color[2] = _mm_setzero_ps();
+		return;
+	}
+
+	float blend;
+	int index = SelectLevels(lod, blend);
+	__m128 s = Repeat(u);
+	__m128 t = Repeat(v);
+
+	__m128i texels[4];
+	__m128 weightX, weightY;
+	GetFootprint(levels[index], s, t, texels, weightX, weightY);
+
+	Bilinear(texels, decode, weightX, weightY, color);
+
+	if (blend != 0)
+	{
+		GetFootprint(levels[index + 1], s, t, texels, weightX, weightY);
+
+		__m128 next[3];
+		Bilinear(texels, decode, weightX, weightY, next);
+
+		__m128 blends = _mm_set1_ps(blend);
+		for (int channel = 0; channel < 3; channel++)
+			color[channel] = Lerp(color[channel], next[channel], blends);
+	}
+}
+#endif
+
+int Texture::SelectLevels(float lod, float &blend) const
+{
+	blend = 0;
+
+	// Magnified texels and levels of detail that are not finite use the first level
+	int last = (int)levels.size() - 1;
+	if (!(lod > 0))
+		return 0;
+	if (lod >= (float)last)
+		return last;
+
+	int index = (int)lod;
+	blend = lod - (float)index;
+	return index;
+}
@@ -8,6 +8,11 @@ using namespace Raytracer::Scenes;
 
 bool SimpleAccelerator::HitTest(const Ray &ray, RayHit *hit) const
 {
+	if (scene == NULL)
+		return false;
+
+	const std::vector<PhysicalObject *> &physicalObjects = scene->GetPhysicalObjects();
+
 	if (hit == NULL)
 	{
 		// Search for any intersection.
@@ -40,31 +45,12 @@ bool SimpleAccelerator::HitTest(const Ray &ray, RayHit *hit) const
 	}
 }
 
-void Raytracer::SimpleAccelerator::SetScene(const Scenes::Scene *scene)
+const std::vector<Light *> &SimpleAccelerator::GetLights() const
 {
-	this->scene = scene;
-	physicalObjects.clear();
-	lights.clear();
+	static const std::vector<Light *> noLights;
 
 	if (scene == NULL)
-		return;
-
-	AddObject(scene);
-}
+		return noLights;
 
-void Raytracer::SimpleAccelerator::AddObject(const SceneObject *object)
-{
-	if (object->IsInstanceOf(SceneObjectType_PhysicalObject))
-		physicalObjects.push_back((PhysicalObject *)object);
-
-	if (object->IsInstanceOf(SceneObjectType_Light))
-		lights.push_back((Light *)object);
-
-	foreach_c (SceneObject *, child, object->GetChildren())
-		AddObject(*child);
-}
-
-const std::vector<Light *> &SimpleAccelerator::GetLights() const
-{
-	return lights;
+	return scene->GetLights();
 }
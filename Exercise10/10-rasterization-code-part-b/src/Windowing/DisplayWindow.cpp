@@ -1,3 +1,7 @@
+#include <string.h>
+
+#include <chrono>
+
 #include <Raytracer/Raytracer.h>
 #include <Windowing/DisplayWindow.h>
 
@@ -6,12 +10,35 @@
 #else
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 
-#include <sys/time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #endif
 
+using namespace Raytracer;
 using namespace Windowing;
 
+#ifndef _WIN32
+namespace
+{
+	/**
+	 * Whether attaching shared memory failed, set by HandleAttachError()
+	 */
+	bool attachFailed;
+
+	/**
+	 * Receives the error of XShmAttach() if the X server cannot attach the shared memory,
+	 * typically because it runs on another machine.
+	 */
+	int HandleAttachError(Display *, XErrorEvent *)
+	{
+		attachFailed = true;
+		return 0;
+	}
+}
+#endif
+
 #ifdef _WIN32
 const TCHAR *DisplayWindow::className = TEXT("DisplayWindowClass");
 #endif
@@ -35,6 +62,12 @@ DisplayWindow::DisplayWindow(int width, int height)
 		CW_USEDEFAULT, CW_USEDEFAULT, windowRect.right - windowRect.left,
 		windowRect.bottom - windowRect.top, NULL, NULL, GetModuleHandle(NULL), this);
 #else
+	frame = NULL;
+	frameShared = false;
+	framePending = false;
+	frameOutdated = true;
+	sharedMemory = true;
+
 	display = XOpenDisplay(NULL);
 	if (display != NULL)
 	{
@@ -58,6 +91,8 @@ DisplayWindow::~DisplayWindow()
 #ifdef _WIN32
 	if (handle != NULL)
 		DestroyWindow(handle);
+#else
+	DestroyFrame();
 #endif
 }
 
@@ -106,17 +141,9 @@ LRESULT DisplayWindow::WndProc(HWND handle, UINT message, WPARAM wParam, LPARAM
 					(void **)&bits, NULL, 0);
 				if (bitmap != NULL)
 				{
-					for (int y = height - 1; y >= 0; y--)
-					{
-						BYTE *ptr = bits;
-						for (int x = 0; x < width; x++)
-						{
-							window->image->GetBGRPixel(x, y, 2.2f, ptr);
-							ptr += 3;
-						}
-
-						bits += stride;
-					}
+					// The rows of the bitmap are stored from the bottom up.
+					window->encoder.EncodeImage(*window->image, ColorEncoder::Layout_BGR,
+						bits + (ptrdiff_t)(height - 1) * stride, -stride);
 
 					HDC bitmapDC = CreateCompatibleDC(paintStruct.hdc);
 					SelectObject(bitmapDC, bitmap);
@@ -134,69 +161,163 @@ LRESULT DisplayWindow::WndProc(HWND handle, UINT message, WPARAM wParam, LPARAM
 	return DefWindowProc(handle, message, wParam, lParam);
 }
 #else
-void DisplayWindow::HandleEvent(XEvent &event)
+bool DisplayWindow::CreateFrame(int width, int height)
 {
-	switch (event.type)
+	Visual *visual = DefaultVisual(display, DefaultScreen(display));
+
+	if (sharedMemory && XShmQueryExtension(display))
 	{
-		case Expose:
+		frame = XShmCreateImage(display, visual, 24, ZPixmap, NULL, &sharedSegment, width,
+			height);
+		if (frame != NULL)
 		{
-			if (image == NULL)
-				break;
-			
-			int width = image->GetWidth();
-			int height = image->GetHeight();
-			
-			int stride = (width * 3 + 3) / 4 * 4;
-			stride = width * 4;
-			
-			unsigned char *buffer = (unsigned char *)malloc(width * height * 4);
-			if (buffer == NULL)
-				break;
-			
-			unsigned char *bits = buffer;
-			for (int y = 0; y < height; y++)
+			sharedSegment.shmid = shmget(IPC_PRIVATE, (size_t)frame->bytes_per_line * height,
+				IPC_CREAT | 0600);
+			sharedSegment.shmaddr = (char *)-1;
+			if (sharedSegment.shmid != -1)
+				sharedSegment.shmaddr = (char *)shmat(sharedSegment.shmid, NULL, 0);
+
+			bool attached = false;
+			if (sharedSegment.shmaddr != (char *)-1)
 			{
-				unsigned char *ptr = bits;
-				for (int x = 0; x < width; x++)
-				{
-					image->GetBGRPixel(x, y, 2.2f, ptr);
-					ptr += 4;
-				}
-
-				bits += stride;
+				frame->data = sharedSegment.shmaddr;
+				sharedSegment.readOnly = False;
+
+				// A server that cannot attach the segment reports an error instead of
+				// failing XShmAttach(), so the error is caught until the request was handled.
+				XSync(display, False);
+				attachFailed = false;
+				XErrorHandler previousHandler = XSetErrorHandler(HandleAttachError);
+				attached = (XShmAttach(display, &sharedSegment) != False);
+				XSync(display, False);
+				XSetErrorHandler(previousHandler);
+				attached = attached && !attachFailed;
+
+				if (!attached)
+					shmdt(sharedSegment.shmaddr);
 			}
-			
-			XImage *image = XCreateImage(display, DefaultVisual(display, 0), 24, ZPixmap, 0,
-				(char *)buffer, width, height, 32, 0);
-			if (image != NULL)
+
+			// The segment is freed once both the server and this process have detached it.
+			if (sharedSegment.shmid != -1)
+				shmctl(sharedSegment.shmid, IPC_RMID, NULL);
+
+			if (attached)
 			{
-				XPutImage(display, window, DefaultGC(display, 0), image, 0, 0, 0, 0, width, height);
-				XDestroyImage(image);
+				frameShared = true;
+				return true;
 			}
-			else
-				free(buffer);
-			
-			break;
+
+			frame->data = NULL;
+			XDestroyImage(frame);
 		}
 	}
+
+	// Fall back to an image in ordinary memory, which is sent to the server with every update.
+	frame = XCreateImage(display, visual, 24, ZPixmap, 0, NULL, width, height, 32, 0);
+	if (frame == NULL)
+		return false;
+
+	frame->data = (char *)malloc((size_t)frame->bytes_per_line * height);
+	if (frame->data == NULL)
+	{
+		XDestroyImage(frame);
+		frame = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+void DisplayWindow::DestroyFrame()
+{
+	if (frame == NULL)
+		return;
+
+	if (frameShared)
+	{
+		if (display != NULL)
+		{
+			XShmDetach(display, &sharedSegment);
+			XSync(display, False);
+		}
+
+		frame->data = NULL;
+		XDestroyImage(frame);
+		shmdt(sharedSegment.shmaddr);
+	}
+	else
+		XDestroyImage(frame);
+
+	frame = NULL;
+	frameShared = false;
+	framePending = false;
+}
+
+void DisplayWindow::DrawFrame()
+{
+	if (image == NULL || display == NULL)
+		return;
+
+	int width = image->GetWidth();
+	int height = image->GetHeight();
+
+	if (frame == NULL || frame->width != width || frame->height != height)
+	{
+		DestroyFrame();
+		if (!CreateFrame(width, height))
+			return;
+
+		frameOutdated = true;
+	}
+
+	if (frameOutdated)
+	{
+		// The server reads the shared memory when it handles the request, so it must be done
+		// with the last one before the pixels are overwritten.
+		if (framePending)
+			XSync(display, False);
+
+		encoder.EncodeImage(*image, ColorEncoder::Layout_BGRA, (unsigned char *)frame->data,
+			frame->bytes_per_line);
+		frameOutdated = false;
+		framePending = false;
+	}
+
+	GC gc = DefaultGC(display, DefaultScreen(display));
+	if (frameShared)
+	{
+		XShmPutImage(display, window, gc, frame, 0, 0, 0, 0, width, height, False);
+		framePending = true;
+	}
+	else
+		XPutImage(display, window, gc, frame, 0, 0, 0, 0, width, height);
+}
+
+void DisplayWindow::HandleEvent(XEvent &event)
+{
+	switch (event.type)
+	{
+		case Expose:
+			// The whole frame is drawn once for a series of exposed rectangles.
+			if (event.xexpose.count == 0)
+				DrawFrame();
+			break;
+	}
 }
 #endif
 
+ColorEncoder &DisplayWindow::GetEncoder()
+{
+	return encoder;
+}
+
 float DisplayWindow::GetTime()
 {
-#ifdef _WIN32
-	static DWORD firstTick = GetTickCount();
-	return (GetTickCount() - firstTick) / 1000.0f;
-#else
-	static time_t startSec = 0;
-	timeval t;
-	gettimeofday(&t, NULL);
-	
-	if (startSec == 0)
-		startSec = t.tv_sec;
-
-	return ((t.tv_sec - startSec) + (t.tv_usec / 1000) / 1000.0f);
-#endif
+	// The steady clock has at least microsecond resolution and does not jump when the system
+	// time is changed.
+	typedef std::chrono::steady_clock Clock;
+	static const Clock::time_point start = Clock::now();
+	return std::chrono::duration<float>(Clock::now() - start).count();
 }
 
 bool DisplayWindow::ProcessMessages()
@@ -240,9 +361,34 @@ bool DisplayWindow::ProcessMessages()
 #endif
 }
 
+bool DisplayWindow::IsSharedMemoryUsed() const
+{
+#ifdef _WIN32
+	return false;
+#else
+	return frameShared;
+#endif
+}
+
 void DisplayWindow::SetImage(Raytracer::Image *image)
 {
 	this->image = image;
+
+#ifndef _WIN32
+	frameOutdated = true;
+#endif
+}
+
+void DisplayWindow::SetSharedMemory(bool enable)
+{
+#ifndef _WIN32
+	if (enable != sharedMemory)
+	{
+		// The frame is created again when it is drawn the next time.
+		sharedMemory = enable;
+		DestroyFrame();
+	}
+#endif
 }
 
 void DisplayWindow::Update()
@@ -250,8 +396,12 @@ void DisplayWindow::Update()
 #ifdef _WIN32
 	InvalidateRect(handle, NULL, FALSE);
 #else
-	XEvent event;
-	event.type = Expose;
-	XSendEvent(display, window, True, ExposureMask, &event);
+	// The frame is drawn right away instead of sending an Expose event through the server,
+	// which would delay it by a round trip.
+	frameOutdated = true;
+	DrawFrame();
+
+	if (display != NULL)
+		XFlush(display);
 #endif
 }
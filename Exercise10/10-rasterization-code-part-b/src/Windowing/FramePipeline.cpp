@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <thread>
+
+#include <Raytracer/Raytracer.h>
+#include <Windowing/FramePipeline.h>
+#include <Windowing/IPresenter.h>
+
+using namespace std;
+using namespace Windowing;
+using Raytracer::Image;
+
+namespace
+{
+	typedef chrono::duration<double, milli> Milliseconds;
+
+	/**
+	 * The longest time the window thread waits for a frame before it handles the window
+	 * messages again
+	 */
+	const chrono::milliseconds MessageInterval(10);
+}
+
+FramePipeline::FramePipeline(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	latency = 1;
+	frameInterval = 0.0;
+	timeStep = 0.0;
+	stopping = false;
+	finished = false;
+}
+
+FramePipeline::~FramePipeline()
+{
+	for (size_t i = 0; i < slots.size(); i++)
+		delete slots[i].image;
+}
+
+const vector<FramePipeline::FrameTiming> &FramePipeline::GetTimings() const
+{
+	return timings;
+}
+
+void FramePipeline::RenderLoop(const RenderFunction &render, Clock::time_point start)
+{
+	const Clock::duration interval =
+		chrono::duration_cast<Clock::duration>(chrono::duration<double>(frameInterval));
+	Clock::time_point scheduled = start;
+
+	for (unsigned int frame = 0; ; frame++)
+	{
+		Clock::time_point now = Clock::now();
+		double time = chrono::duration<double>(now - start).count();
+
+		// Start the frame at its scheduled time. After falling behind by a whole interval,
+		// the schedule starts over instead of rendering the missed frames in a burst.
+		if (frameInterval > 0.0)
+		{
+			if (now < scheduled)
+				this_thread::sleep_until(scheduled);
+			else if (now - scheduled > interval)
+				scheduled = now;
+
+			time = chrono::duration<double>(scheduled - start).count();
+			scheduled += interval;
+		}
+
+		if (timeStep > 0.0)
+			time = frame * timeStep;
+
+		// Wait until fewer than latency frames wait for presentation. One of the images is
+		// free then.
+		Slot *slot = NULL;
+		{
+			unique_lock<mutex> lock(slotMutex);
+			while (!stopping)
+			{
+				int ready = 0;
+				Slot *free = NULL;
+				for (size_t i = 0; i < slots.size(); i++)
+				{
+					if (slots[i].state == Slot_Ready)
+						ready++;
+					else if (slots[i].state == Slot_Free && free == NULL)
+						free = &slots[i];
+				}
+
+				if (ready < latency && free != NULL)
+				{
+					slot = free;
+					break;
+				}
+
+				freeCondition.wait(lock);
+			}
+
+			if (slot == NULL)
+				return;
+
+			slot->state = Slot_Rendering;
+			timings.push_back(FrameTiming());
+		}
+
+		Clock::time_point begin = Clock::now();
+		bool proceed = render(*slot->image, frame, time);
+		Clock::time_point end = Clock::now();
+
+		{
+			lock_guard<mutex> lock(slotMutex);
+			slot->state = Slot_Ready;
+			slot->frame = frame;
+			slot->finished = end;
+			timings[frame].renderTime = Milliseconds(end - begin).count();
+			if (!proceed)
+				finished = true;
+		}
+
+		readyCondition.notify_all();
+		if (!proceed)
+			return;
+	}
+}
+
+bool FramePipeline::Run(IPresenter &presenter, const RenderFunction &render)
+{
+	UpdateSlots();
+	for (size_t i = 0; i < slots.size(); i++)
+		slots[i].state = Slot_Free;
+
+	timings.clear();
+	stopping = false;
+	finished = false;
+
+	Clock::time_point start = Clock::now();
+	thread renderThread(&FramePipeline::RenderLoop, this, cref(render), start);
+
+	Slot *shown = NULL;
+	bool open = true;
+
+	// The frames whose timings became final, passed to the timing function outside the lock
+	vector<unsigned int> finalFrames;
+	vector<FrameTiming> finalTimings;
+
+	for (;;)
+	{
+		if (timingFunction)
+		{
+			for (size_t i = 0; i < finalFrames.size(); i++)
+				timingFunction(finalFrames[i], finalTimings[i]);
+		}
+
+		finalFrames.clear();
+		finalTimings.clear();
+
+		// Handle the presenter's messages, which includes drawing the frame shown.
+		Clock::time_point begin = Clock::now();
+		open = presenter.ProcessMessages();
+		if (shown != NULL)
+		{
+			lock_guard<mutex> lock(slotMutex);
+			timings[shown->frame].presentTime += Milliseconds(Clock::now() - begin).count();
+		}
+
+		if (!open)
+			break;
+
+		// Take the newest finished frame and skip the older ones.
+		Slot *next = NULL;
+		{
+			unique_lock<mutex> lock(slotMutex);
+			for (;;)
+			{
+				for (size_t i = 0; i < slots.size(); i++)
+				{
+					if (slots[i].state == Slot_Ready && (next == NULL || slots[i].frame > next->frame))
+						next = &slots[i];
+				}
+
+				if (next != NULL || finished ||
+					readyCondition.wait_for(lock, MessageInterval) == cv_status::timeout)
+					break;
+			}
+
+			if (next == NULL)
+			{
+				if (finished)
+					break;
+				continue;
+			}
+
+			for (size_t i = 0; i < slots.size(); i++)
+			{
+				if (slots[i].state == Slot_Ready && &slots[i] != next)
+				{
+					timings[slots[i].frame].dropped = true;
+					slots[i].state = Slot_Free;
+					finalFrames.push_back(slots[i].frame);
+					finalTimings.push_back(timings[slots[i].frame]);
+				}
+			}
+
+			timings[next->frame].queueTime = Milliseconds(Clock::now() - next->finished).count();
+			if (shown != NULL)
+			{
+				shown->state = Slot_Free;
+				finalFrames.push_back(shown->frame);
+				finalTimings.push_back(timings[shown->frame]);
+			}
+			next->state = Slot_Presented;
+			shown = next;
+		}
+
+		freeCondition.notify_all();
+
+		begin = Clock::now();
+		presenter.SetImage(shown->image);
+		presenter.Update();
+
+		lock_guard<mutex> lock(slotMutex);
+		timings[shown->frame].presentTime += Milliseconds(Clock::now() - begin).count();
+	}
+
+	{
+		lock_guard<mutex> lock(slotMutex);
+		stopping = true;
+	}
+
+	freeCondition.notify_all();
+	renderThread.join();
+
+	// The frame shown last is final now, the ones before were passed on in the loop.
+	if (timingFunction && shown != NULL)
+		timingFunction(shown->frame, timings[shown->frame]);
+
+	return open;
+}
+
+void FramePipeline::SetFrameRate(double framesPerSecond)
+{
+	frameInterval = (framesPerSecond > 0.0 ? 1.0 / framesPerSecond : 0.0);
+}
+
+void FramePipeline::SetLatency(int frames)
+{
+	latency = min(max(frames, 1), (int)MaxLatency);
+}
+
+void FramePipeline::SetTimeStep(double seconds)
+{
+	timeStep = max(seconds, 0.0);
+}
+
+void FramePipeline::SetTimingFunction(const TimingFunction &function)
+{
+	timingFunction = function;
+}
+
+void FramePipeline::UpdateSlots()
+{
+	if (slots.size() == (size_t)latency + 2)
+		return;
+
+	for (size_t i = 0; i < slots.size(); i++)
+		delete slots[i].image;
+
+	slots.resize(latency + 2);
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		slots[i].image = new Image(width, height);
+		slots[i].state = Slot_Free;
+		slots[i].frame = 0;
+	}
+}
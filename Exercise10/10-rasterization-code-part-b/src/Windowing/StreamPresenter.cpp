@@ -0,0 +1,269 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include <Raytracer/Raytracer.h>
+#include <Windowing/StreamPresenter.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+using namespace Windowing;
+using Raytracer::ColorEncoder;
+using Raytracer::Image;
+
+StreamPresenter::StreamPresenter(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	format = Format_Y4M;
+	file = NULL;
+	standardOutput = false;
+	image = NULL;
+	frameCount = 0;
+	framesQueued = 0;
+	framesWritten = 0;
+	queueLength = DefaultQueueLength;
+	closing = false;
+	failed = false;
+}
+
+StreamPresenter::~StreamPresenter()
+{
+	Close();
+}
+
+bool StreamPresenter::Close()
+{
+	if (file == NULL)
+		return !failed;
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		closing = true;
+	}
+
+	queuedCondition.notify_all();
+	writer.join();
+
+	if (fflush(file) != 0)
+		failed = true;
+	if (!standardOutput && fclose(file) != 0)
+		failed = true;
+
+	file = NULL;
+	return !failed;
+}
+
+void StreamPresenter::ConvertToYuv(const vector<unsigned char> &pixels,
+	vector<unsigned char> &planes) const
+{
+	size_t count = (size_t)width * height;
+	planes.resize(count * 3);
+
+	unsigned char *y = &planes[0];
+	unsigned char *u = y + count;
+	unsigned char *v = u + count;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		int r = pixels[i * 3];
+		int g = pixels[i * 3 + 1];
+		int b = pixels[i * 3 + 2];
+
+		// The usual 8 bit integer approximation of BT.601, which maps black to 16 and white
+		// to 235 in Y and gray to 128 in U and V.
+		y[i] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		u[i] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		v[i] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+}
+
+ColorEncoder &StreamPresenter::GetEncoder()
+{
+	return encoder;
+}
+
+unsigned int StreamPresenter::GetFramesWritten()
+{
+	lock_guard<mutex> lock(queueMutex);
+	return framesWritten;
+}
+
+bool StreamPresenter::Open(const char *fileName, Format format, double framesPerSecond)
+{
+	Close();
+
+	if (fileName == NULL || width <= 0 || height <= 0)
+		return false;
+
+	standardOutput = (strcmp(fileName, "-") == 0);
+	if (standardOutput)
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		file = stdout;
+	}
+	else
+		file = fopen(fileName, "wb");
+
+	if (file == NULL)
+		return false;
+
+	this->format = format;
+	framesQueued = 0;
+	framesWritten = 0;
+	closing = false;
+	failed = false;
+	queue.clear();
+
+	if (format == Format_Y4M)
+	{
+		// The frame rate is stored as a fraction, here in thousandths of frames per second.
+		unsigned int numerator = (unsigned int)(max(framesPerSecond, 0.001) * 1000.0 + 0.5);
+		unsigned int denominator = 1000;
+		for (unsigned int a = numerator, b = denominator; ; )
+		{
+			if (b == 0)
+			{
+				numerator /= a;
+				denominator /= a;
+				break;
+			}
+
+			unsigned int remainder = a % b;
+			a = b;
+			b = remainder;
+		}
+
+		if (fprintf(file, "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 C444\n", width, height, numerator,
+			denominator) < 0)
+		{
+			if (!standardOutput)
+				fclose(file);
+			file = NULL;
+			return false;
+		}
+	}
+
+	writer = thread(&StreamPresenter::WriteLoop, this);
+	return true;
+}
+
+bool StreamPresenter::ProcessMessages()
+{
+	if (file == NULL || (frameCount > 0 && framesQueued >= frameCount))
+		return false;
+
+	lock_guard<mutex> lock(queueMutex);
+	return !failed;
+}
+
+void StreamPresenter::SetFrameCount(unsigned int frames)
+{
+	frameCount = frames;
+}
+
+void StreamPresenter::SetImage(Image *image)
+{
+	this->image = image;
+}
+
+void StreamPresenter::SetQueueLength(int frames)
+{
+	queueLength = max(frames, 1);
+}
+
+void StreamPresenter::Update()
+{
+	if (image == NULL || !ProcessMessages())
+		return;
+
+	vector<unsigned char> pixels;
+	{
+		unique_lock<mutex> lock(queueMutex);
+
+		// A frame of another size cannot be stored in the stream.
+		if (image->GetWidth() != width || image->GetHeight() != height)
+			failed = true;
+
+		while (!failed && (int)queue.size() >= queueLength)
+			writtenCondition.wait(lock);
+
+		if (failed)
+			return;
+
+		if (!spareBuffers.empty())
+		{
+			pixels.swap(spareBuffers.back());
+			spareBuffers.pop_back();
+		}
+	}
+
+	pixels.resize((size_t)width * height * 3);
+	encoder.EncodeImage(*image, ColorEncoder::Layout_RGB, &pixels[0], width * 3);
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		queue.push_back(vector<unsigned char>());
+		queue.back().swap(pixels);
+	}
+
+	framesQueued++;
+	queuedCondition.notify_one();
+}
+
+void StreamPresenter::WriteLoop()
+{
+	vector<unsigned char> pixels, planes;
+
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(queueMutex);
+			if (!pixels.empty())
+			{
+				spareBuffers.push_back(vector<unsigned char>());
+				spareBuffers.back().swap(pixels);
+			}
+
+			while (queue.empty() && !closing)
+				queuedCondition.wait(lock);
+
+			if (queue.empty())
+				return;
+
+			pixels.swap(queue.front());
+			queue.pop_front();
+		}
+
+		// There is room in the queue again.
+		writtenCondition.notify_one();
+
+		bool written;
+		if (format == Format_Y4M)
+		{
+			ConvertToYuv(pixels, planes);
+			written = (fputs("FRAME\n", file) >= 0 &&
+				fwrite(&planes[0], planes.size(), 1, file) == 1);
+		}
+		else
+			written = (fwrite(&pixels[0], pixels.size(), 1, file) == 1);
+
+		lock_guard<mutex> lock(queueMutex);
+		if (!written)
+		{
+			// Wake up Update(), which would wait for room in the queue forever.
+			failed = true;
+			queue.clear();
+			writtenCondition.notify_all();
+			return;
+		}
+
+		framesWritten++;
+	}
+}
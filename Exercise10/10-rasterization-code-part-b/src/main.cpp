@@ -1,16 +1,23 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <vector>
 
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp> 
 
 #include <Raytracer/Raytracer.h>
+#include <Rasterizer/FrameProfiler.h>
 #include <Rasterizer/SimpleRasterizer.h>
 
 #include <Windowing/DisplayWindow.h>
+#include <Windowing/FramePipeline.h>
+#include <Windowing/StreamPresenter.h>
 
 using namespace glm;
 using namespace Rasterizer;
@@ -85,13 +92,16 @@ Scene *BuildScene(const char *fileName, float aspect, Mesh *&mesh)
 	}
 	else
 	{
-		// Load the mesh from this file.
-		if (!mesh->Load(fileName))
+		// Load the mesh from this file, sharing identical vertices between triangles.
+		if (!mesh->Load(fileName, true))
 		{
 			delete scene;
 			mesh = NULL;
 			return NULL;
 		}
+
+		// Simplified versions are drawn when the mesh covers only a few pixels.
+		mesh->GenerateLods();
 	}
 
 	scene->AddChild(mesh);
@@ -135,21 +145,218 @@ Scene *BuildScene(const char *fileName, float aspect, Mesh *&mesh)
 }
 
 /**
- * Renders the scene continuously into a window.
+ * Adds small colored point lights at random positions around the mesh to a scene.
+ *
+ * @param scene The scene
+ * @param count The number of lights
+ * @return true if the lights were added, false if we ran out of memory
+ */
+bool AddLights(Scene *scene, int count)
+{
+	srand(2);
+
+	for (int i = 0; i < count; i++)
+	{
+		vec3 color(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+		Light *light = new PointLight(color * 0.01f);
+		if (light == NULL)
+			return false;
+
+		// Place the lights on a sphere enclosing the mesh.
+		vec3 direction;
+		do
+		{
+			direction = vec3(rand(), rand(), rand()) / (float)RAND_MAX * 2.0f - 1.0f;
+		}
+		while (dot(direction, direction) > 1.0f || dot(direction, direction) < 0.01f);
+
+		light->SetPosition(normalize(direction) * 1.6f);
+		scene->AddChild(light);
+	}
+
+	return true;
+}
+
+/**
+ * Creates a checkerboard texture with 16 x 16 squares, blending between four colors across
+ * the texture.
+ *
+ * @param texture The texture
+ * @param size The width and height in texels
+ * @return true if the texture was created, false otherwise
+ */
+bool CreateCheckerTexture(Texture &texture, int size)
+{
+	if (size < 16)
+		return false;
+
+	Image image(size, size);
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			float s = (float)x / size, t = (float)y / size;
+			vec3 color = ((x * 16 / size + y * 16 / size) & 1) ? vec3(1.0f, 0.9f, 0.3f) :
+				vec3(0.2f + 0.7f * s, 0.3f, 1.0f - 0.7f * t);
+			image.SetPixel(x, y, color);
+		}
+	}
+
+	return texture.Create(image, 2.2f);
+}
+
+/**
+ * Assigns texture coordinates to a mesh by projecting its vertices onto a sphere around the
+ * center of its bounding box. u follows the longitude around the y axis, v the latitude.
+ *
+ * @param mesh The mesh, which must be indexed
+ * @param repeat The number of times the texture repeats in each direction
+ * @return true if the texture coordinates were set, false otherwise
+ */
+bool MapSpherically(Mesh *mesh, float repeat)
+{
+	vec3 boundsMin, boundsMax;
+	if (!mesh->IsIndexed() || !mesh->GetBoundingBox(boundsMin, boundsMax))
+		return false;
+
+	const float pi = 3.14159265358979323846f;
+	vec3 center = (boundsMin + boundsMax) * 0.5f;
+	const std::vector<vec3> &positions = mesh->GetPositions();
+	std::vector<vec2> coords(positions.size());
+
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		vec3 direction = positions[i] - center;
+		float distance = length(direction);
+		float latitude = acosf(distance > 0.0f ? clamp(direction.y / distance, -1.0f, 1.0f) : 0.0f);
+
+		coords[i] = vec2(atan2f(direction.z, direction.x) / (2.0f * pi) + 0.5f, latitude / pi) * repeat;
+	}
+
+	return mesh->SetTextureCoords(std::move(coords));
+}
+
+/**
+ * The settings of the scene, the rasterizer and the frame loop, taken from the command line
+ */
+struct RenderOptions
+{
+	/**
+	 * Whether to rotate the geometry
+	 */
+	bool rotate;
+
+	/**
+	 * The file name of the geometry, or NULL to use just a single triangle
+	 */
+	const char *filename;
+
+	/**
+	 * The number of triangles per pixel covered by the mesh, 0 to always draw all triangles
+	 */
+	float lodDensity;
+
+	/**
+	 * Whether to skip triangles facing away from the camera
+	 */
+	bool backfaceCulling;
+
+	/**
+	 * How the pixel colors are computed. Shading_Phong lights every pixel instead of every
+	 * vertex, Shading_Deferred lights every visible pixel once.
+	 */
+	SimpleRasterizer::Shading shading;
+
+	/**
+	 * How the hidden surfaces are removed. Visibility_Painter draws the triangles from back
+	 * to front instead of testing the depth of every pixel, Visibility_DepthPrepass draws the
+	 * depths first and shades every visible pixel once.
+	 */
+	SimpleRasterizer::Visibility visibility;
+
+	/**
+	 * The number of small lights added to the scene
+	 */
+	int lightCount;
+
+	/**
+	 * The opacity of the mesh, below 1 to make it translucent
+	 */
+	float opacity;
+
+	/**
+	 * The number of samples per pixel, 4 or 8 to antialias the edges of the triangles
+	 */
+	int samples;
+
+	/**
+	 * The texture of the mesh or NULL
+	 */
+	Texture *texture;
+
+	/**
+	 * The size of the shadow map faces of the two main lights, 0 for no shadows
+	 */
+	int shadowMapSize;
+
+	/**
+	 * The number of rendered frames that may wait for presentation
+	 */
+	int latency;
+
+	/**
+	 * The number of frames started per second, 0 to render as fast as possible
+	 */
+	double frameRate;
+
+	/**
+	 * The time from one frame to the next in seconds, or 0 to animate in real time
+	 */
+	double timeStep;
+
+	/**
+	 * Whether to draw the percentiles of the profiler into the frames
+	 */
+	bool overlay;
+
+	RenderOptions()
+	{
+		rotate = true;
+		filename = "data/kopf_subdivided.raw";
+		lodDensity = Mesh::DefaultLodTriangleDensity;
+		backfaceCulling = false;
+		shading = SimpleRasterizer::Shading_Gouraud;
+		visibility = SimpleRasterizer::Visibility_DepthBuffer;
+		lightCount = 0;
+		opacity = 1.0f;
+		samples = 1;
+		texture = NULL;
+		shadowMapSize = 0;
+		latency = 1;
+		frameRate = 0.0;
+		timeStep = 0.0;
+		overlay = false;
+	}
+};
+
+/**
+ * Renders the scene continuously and presents it in a window or a video stream.
  *
  * @param width The image width
  * @param height The image height
- * @param rotate whether to rotate the geometry
- * @param filename the filename of a geometry to load.
+ * @param options The settings of the scene, the rasterizer and the frame loop
+ * @param presenter the window or stream that presents the frames until it is closed
+ * @param profiler receives the time spent on each stage of the frames, or NULL
  */
-void Render(int width, int height, bool rotate, const char *filename)
+void Render(int width, int height, const RenderOptions &options, IPresenter &presenter,
+	FrameProfiler *profiler)
 {
 	if (width <= 0 || height <= 0)
 		return;
 
 	Mesh *mesh;
 
-	Scene *scene = BuildScene(filename, (float)width / height, mesh);
+	Scene *scene = BuildScene(options.filename, (float)width / height, mesh);
 
 	if (scene == NULL)
 	{
@@ -158,56 +365,857 @@ void Render(int width, int height, bool rotate, const char *filename)
 		return;
 	}
 
+	if (!AddLights(scene, options.lightCount))
+	{
+		puts("Die Lichter konnten nicht erstellt werden.");
+		delete scene;
+		return;
+	}
+
+	// Translucent meshes are blended in depth order.
+	Material material;
+	material.SetOpacity(options.opacity);
+	if (options.opacity < 1.0f)
+		mesh->SetMaterial(&material);
+
+	if (options.texture != NULL)
+	{
+		if (!MapSpherically(mesh, 4.0f))
+		{
+			puts("Die Texturkoordinaten konnten nicht erstellt werden.");
+			delete scene;
+			return;
+		}
+
+		material.SetTexture(options.texture);
+		mesh->SetMaterial(&material);
+	}
+
 	SimpleRasterizer rasterizer;
+	rasterizer.SetLodTriangleDensity(options.lodDensity);
+	rasterizer.SetBackfaceCulling(options.backfaceCulling);
+	rasterizer.SetShading(options.shading);
+	rasterizer.SetVisibility(options.visibility);
+	rasterizer.SetMultisampling(options.samples);
 
-	Image image(width, height);
-	DisplayWindow window(width, height);
-	window.SetImage(&image);
+	// Only the first two lights of the scene are strong enough to cast visible shadows.
+	rasterizer.SetShadows(options.shadowMapSize, 2);
+
+	FramePipeline pipeline(width, height);
+	pipeline.SetLatency(options.latency);
+	pipeline.SetFrameRate(options.frameRate);
+	pipeline.SetTimeStep(options.timeStep);
 
-	// Keep rendering the scene into the window until the window is closed.
-	while (window.ProcessMessages())
+	// Skipped frames were never presented, so they have no presentation time.
+	if (profiler != NULL)
 	{
+		pipeline.SetTimingFunction([=](unsigned int frame,
+			const FramePipeline::FrameTiming &timing)
+		{
+			if (!timing.dropped)
+				profiler->Record(frame, FrameProfiler::Stage_Present, timing.presentTime);
+		});
+	}
+
+	// Keep rendering the scene until the window is closed. The frames are rendered on their
+	// own thread while the window shows the previous one.
+	pipeline.Run(presenter, [&](Image &image, unsigned int frame, double time)
+	{
+		if (profiler != NULL)
+			profiler->BeginFrame(frame);
+
 		// Rotate the mesh over time.
-		float t = 0.0f;
-		if (rotate)
-			t = window.GetTime();
+		float t = (options.rotate ? (float)time : 0.0f);
 		mesh->SetTransformation(RotationY(t * 36.0f) * RotationX(-90.0f));
 
 		rasterizer.Render(image, *scene);
-		window.Update();
+
+		if (profiler != NULL)
+		{
+			profiler->Record(frame, rasterizer.GetStageTimes());
+			if (options.overlay)
+				profiler->DrawOverlay(image);
+		}
+
+		return true;
+	});
+
+	// Report the average time of each stage.
+	const std::vector<FramePipeline::FrameTiming> &timings = pipeline.GetTimings();
+	if (!timings.empty())
+	{
+		double renderTime = 0.0, queueTime = 0.0, presentTime = 0.0;
+		unsigned int dropped = 0;
+		for (size_t i = 0; i < timings.size(); i++)
+		{
+			renderTime += timings[i].renderTime;
+			queueTime += timings[i].queueTime;
+			presentTime += timings[i].presentTime;
+			dropped += (timings[i].dropped ? 1 : 0);
+		}
+
+		double shown = std::max((double)(timings.size() - dropped), 1.0);
+		// This goes to the error output, which stays apart from a stream on the standard output.
+		fprintf(stderr, "%u Bilder: rendern %.2f ms, warten %.2f ms, anzeigen %.2f ms, %u uebersprungen\n",
+			(unsigned int)timings.size(), renderTime / timings.size(), queueTime / shown,
+			presentTime / shown, dropped);
 	}
 
 	delete scene;
 }
 
+/**
+ * Prints the 50th and 99th percentiles of the recent frames of a profiler and writes the
+ * times of all frames to a CSV file.
+ *
+ * @param profiler The profiler
+ * @param fileName The CSV file, or NULL to write none
+ * @return true if the file was written or none was requested, false otherwise
+ */
+bool ReportProfile(const FrameProfiler &profiler, const char *fileName)
+{
+	// This goes to the error output, which stays apart from a stream on the standard output.
+	fprintf(stderr, "%u Bilder, Perzentile der letzten %d:\n  %-10s %8s %8s\n",
+		(unsigned int)profiler.GetFrameCount(), FrameProfiler::DefaultWindowSize, "ms", "p50",
+		"p99");
+	for (int i = 0; i < FrameProfiler::StageCount; i++)
+	{
+		FrameProfiler::Stage stage = (FrameProfiler::Stage)i;
+		fprintf(stderr, "  %-10s %8.2f %8.2f\n", FrameProfiler::GetStageName(stage),
+			profiler.GetPercentile(stage, 50.0), profiler.GetPercentile(stage, 99.0));
+	}
+
+	return (fileName == NULL || profiler.SaveCSV(fileName));
+}
+
+/**
+ * Writes a .raw mesh file with a given number of random triangles.
+ *
+ * @param fileName The file name
+ * @param triangleCount The number of triangles
+ * @return true if the file was written, false otherwise
+ */
+bool WriteSyntheticMesh(const char *fileName, int triangleCount)
+{
+	FILE *file = fopen(fileName, "wb");
+	if (file == NULL)
+		return false;
+
+	bool success = (fwrite(&triangleCount, 4, 1, file) == 1);
+
+	// Write in blocks to keep the memory use bounded for very large files.
+	std::vector<RawTriangle> block(65536);
+	srand(1);
+
+	for (int written = 0; success && written < triangleCount; written += (int)block.size())
+	{
+		int count = std::min((int)block.size(), triangleCount - written);
+		for (int i = 0; i < count; i++)
+		{
+			vec3 center = vec3(rand(), rand(), rand()) / (float)RAND_MAX - 0.5f;
+			for (int v = 0; v < 3; v++)
+			{
+				vec3 offset = vec3(rand(), rand(), rand()) / (float)RAND_MAX * 0.01f;
+				block[i].vertex[v].position = center + offset;
+				block[i].vertex[v].normal = normalize(center);
+				block[i].vertex[v].color = vec3(0.8f);
+			}
+		}
+
+		success = (fwrite(&block[0], sizeof(RawTriangle), count, file) == (size_t)count);
+	}
+
+	fclose(file);
+	return success;
+}
+
+/**
+ * Loads a .raw file the way Mesh::Load() did before it used memory mapping, with separate
+ * reads for every vertex attribute. Used as the reference in BenchmarkLoad().
+ */
+bool LoadStreamed(const char *fileName, std::vector<Triangle> &triangles)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL)
+		return false;
+
+	int triangleCount;
+	if (fread(&triangleCount, 4, 1, file) != 1 || triangleCount < 0)
+	{
+		fclose(file);
+		return false;
+	}
+
+	for (int i = 0; i < triangleCount; i++)
+	{
+		Triangle t;
+		for (int v = 0; v < 3; v++)
+		{
+			if (fread(&t.position[v], sizeof(vec3), 1, file) != 1 ||
+				fread(&t.normal[v], sizeof(vec3), 1, file) != 1 ||
+				fread(&t.color[v], sizeof(vec3), 1, file) != 1)
+			{
+				fclose(file);
+				return false;
+			}
+		}
+
+		triangles.push_back(t);
+	}
+
+	fclose(file);
+	return true;
+}
+
+/**
+ * Reads a whole file into memory with a single fread(). Used as the reference for the disk
+ * read speed in BenchmarkLoad().
+ */
+bool ReadWholeFile(const char *fileName, std::vector<unsigned char> &data)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data.resize(size > 0 ? (size_t)size : 0);
+	bool success = (size >= 0 && fread(data.data(), 1, data.size(), file) == data.size());
+
+	fclose(file);
+	return success;
+}
+
+/**
+ * Measures how long it takes to load a mesh file with a reference loader, to map it without
+ * copying and to load it into a Mesh. The reference for .raw files is the streamed loader;
+ * compressed files are read into memory in one go.
+ *
+ * @param fileName The file name
+ * @param runs The number of times each variant is run; the fastest run is reported
+ */
+void BenchmarkLoad(const char *fileName, int runs)
+{
+	typedef std::chrono::steady_clock Clock;
+	typedef std::chrono::duration<double, std::milli> Milliseconds;
+	double streamed = 1e30, mapped = 1e30, loaded = 1e30;
+	size_t triangleCount = 0;
+
+	MeshFile probe;
+	if (!probe.Open(fileName))
+	{
+		printf("Die Datei %s konnte nicht gelesen werden.\n", fileName);
+		return;
+	}
+	bool compressed = probe.IsCompressed();
+	probe.Close();
+
+	for (int run = 0; run < runs; run++)
+	{
+		Clock::time_point start = Clock::now();
+		{
+			std::vector<Triangle> triangles;
+			std::vector<unsigned char> data;
+			if (compressed ? !ReadWholeFile(fileName, data) : !LoadStreamed(fileName, triangles))
+			{
+				printf("Die Datei %s konnte nicht gelesen werden.\n", fileName);
+				return;
+			}
+		}
+		Clock::time_point end = Clock::now();
+		streamed = std::min(streamed, Milliseconds(end - start).count());
+
+		// Mapping alone does not read anything, so touch every page once.
+		start = Clock::now();
+		{
+			MeshFile file;
+			file.Open(fileName);
+			unsigned int sum = 0;
+			for (size_t i = 0; i < file.GetSize(); i += 4096)
+				sum += file.GetData()[i];
+			triangleCount = file.GetTriangleCount() + (sum == 12345 ? 1 : 0);
+		}
+		end = Clock::now();
+		mapped = std::min(mapped, Milliseconds(end - start).count());
+
+		start = Clock::now();
+		{
+			Mesh mesh;
+			mesh.Load(fileName);
+			triangleCount = mesh.GetTriangleCount();
+		}
+		end = Clock::now();
+		loaded = std::min(loaded, Milliseconds(end - start).count());
+	}
+
+	printf("%s: %u Dreiecke, schnellster von %d Durchlaeufen\n", fileName,
+		(unsigned int)triangleCount, runs);
+	printf("  %-22s %10.2f ms\n", compressed ? "ganze Datei gelesen:" : "stueckweise mit fread:",
+		streamed);
+	printf("  %-22s %10.2f ms\n", "gemappt, ohne Kopie:", mapped);
+	printf("  %-22s %10.2f ms\n", "Mesh::Load:", loaded);
+}
+
+/**
+ * The width and height of the images rendered by the benchmarks
+ */
+const int BenchmarkSize = 512;
+
+/**
+ * Creates the scene of a benchmark with BuildScene() and AddLights(), and textures its mesh.
+ *
+ * @param fileName The file name of the mesh
+ * @param lightCount The number of small lights to add to the scene
+ * @param texture The texture of the mesh or NULL
+ * @param material The material of the mesh if it is textured, which must outlive the scene
+ * @param mesh Receives a pointer to the mesh
+ * @return The created scene or NULL if an error occurred
+ */
+Scene *BuildBenchmarkScene(const char *fileName, int lightCount, Texture *texture,
+	Material &material, Mesh *&mesh)
+{
+	Scene *scene = BuildScene(fileName, 1.0f, mesh);
+	if (scene == NULL || !AddLights(scene, lightCount))
+	{
+		puts("Die Szene konnte nicht erstellt werden.");
+		delete scene;
+		return NULL;
+	}
+
+	if (texture != NULL && MapSpherically(mesh, 4.0f))
+	{
+		material.SetTexture(texture);
+		mesh->SetMaterial(&material);
+	}
+
+	return scene;
+}
+
+/**
+ * Renders the scene of a benchmark without a window and measures the time it takes.
+ *
+ * @param rasterizer The rasterizer, configured for the run
+ * @param scene The scene
+ * @param mesh The mesh of the scene
+ * @param frames The number of frames
+ * @param rotate true to turn the mesh around once over all frames, false to keep it still
+ * @param frameDone Called with the statistics of each frame, or empty
+ * @return The average time per frame in milliseconds
+ */
+double RunBenchmark(SimpleRasterizer &rasterizer, Scene &scene, Mesh *mesh, int frames,
+	bool rotate, const std::function<void(const SimpleRasterizer::Statistics &)> &frameDone)
+{
+	typedef std::chrono::steady_clock Clock;
+	typedef std::chrono::duration<double, std::milli> Milliseconds;
+
+	Image image(BenchmarkSize, BenchmarkSize);
+	double time = 0.0;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		float angle = (rotate ? frame * 360.0f / frames : 0.0f);
+		mesh->SetTransformation(RotationY(angle) * RotationX(-90.0f));
+
+		Clock::time_point start = Clock::now();
+		rasterizer.Render(image, scene);
+		time += Milliseconds(Clock::now() - start).count();
+
+		if (frameDone)
+			frameDone(rasterizer.GetStatistics());
+	}
+
+	return time / frames;
+}
+
+/**
+ * Measures the cost of multisampling by rendering the rotating mesh without a window, once
+ * with one sample per pixel and once with every supported sample count.
+ *
+ * @param fileName The file name of the mesh
+ * @param shading How the pixel colors are computed
+ * @param lightCount The number of small lights to add to the scene
+ * @param frames The number of frames rendered per sample count
+ * @param texture The texture of the mesh or NULL
+ */
+void BenchmarkMultisampling(const char *fileName, SimpleRasterizer::Shading shading,
+	int lightCount, int frames, Texture *texture)
+{
+	Material material;
+	Mesh *mesh;
+	Scene *scene = BuildBenchmarkScene(fileName, lightCount, texture, material, mesh);
+	if (scene == NULL)
+		return;
+
+	double singleSample = 0.0;
+
+	printf("%dx%d, %d frames\n", BenchmarkSize, BenchmarkSize, frames);
+
+	for (int samples = 1; samples <= SimpleRasterizer::MaxSamples; samples *= 2)
+	{
+		if (samples == 2)
+			continue;
+
+		SimpleRasterizer rasterizer;
+		rasterizer.SetShading(shading);
+		rasterizer.SetMultisampling(samples);
+
+		size_t splitPixels = 0;
+		double time = RunBenchmark(rasterizer, *scene, mesh, frames, true,
+			[&](const SimpleRasterizer::Statistics &statistics)
+		{
+			splitPixels += statistics.splitPixels;
+		});
+
+		if (samples == 1)
+			singleSample = time;
+
+		printf("  %dx: %8.2f ms/frame (%.2fx), %6.1f MB, %u geteilte Pixel/frame\n", samples,
+			time, time / singleSample, rasterizer.GetRenderTargetSize() / (1024.0 * 1024.0),
+			(unsigned int)(splitPixels / frames));
+	}
+
+	delete scene;
+}
+
+/**
+ * Measures the cost of the shadows of the two main lights by rendering the mesh without a
+ * window: without shadows, with shadows of the still mesh, whose shadow maps are kept across
+ * frames, and with shadows of the rotating mesh, which are rendered again every frame.
+ *
+ * @param fileName The file name of the mesh
+ * @param shading How the pixel colors are computed
+ * @param frames The number of frames rendered per run
+ * @param shadowMapSize The size of the shadow map faces
+ */
+void BenchmarkShadows(const char *fileName, SimpleRasterizer::Shading shading, int frames,
+	int shadowMapSize)
+{
+	const char *names[3] = {"ohne Schatten", "Schatten, fest", "Schatten, rotierend"};
+
+	Material material;
+	Mesh *mesh;
+	Scene *scene = BuildBenchmarkScene(fileName, 0, NULL, material, mesh);
+	if (scene == NULL)
+		return;
+
+	printf("%dx%d, %d frames, Schattentexturen %dx%d\n", BenchmarkSize, BenchmarkSize, frames,
+		shadowMapSize, shadowMapSize);
+
+	for (int run = 0; run < 3; run++)
+	{
+		SimpleRasterizer rasterizer;
+		rasterizer.SetShading(shading);
+		rasterizer.SetShadows(run > 0 ? shadowMapSize : 0, 2);
+
+		size_t shadowMaps = 0;
+		double time = RunBenchmark(rasterizer, *scene, mesh, frames, run == 2,
+			[&](const SimpleRasterizer::Statistics &statistics)
+		{
+			shadowMaps += statistics.renderedShadowMaps;
+		});
+
+		printf("  %-20s %8.2f ms/frame, %6.1f MB, %u Schattentexturen gerendert\n", names[run],
+			time, rasterizer.GetRenderTargetSize() / (1024.0 * 1024.0), (unsigned int)shadowMaps);
+	}
+
+	delete scene;
+}
+
+/**
+ * Measures the savings of the depth pre-pass by rendering the rotating mesh without a window,
+ * once testing every fragment against the z buffer and once with the pre-pass. The overdraw
+ * is the number of shaded fragments per covered pixel.
+ *
+ * @param fileName The file name of the mesh
+ * @param shading How the pixel colors are computed
+ * @param lightCount The number of small lights to add to the scene
+ * @param frames The number of frames rendered per run
+ * @param texture The texture of the mesh or NULL
+ */
+void BenchmarkOverdraw(const char *fileName, SimpleRasterizer::Shading shading, int lightCount,
+	int frames, Texture *texture)
+{
+	const char *names[2] = {"z-Buffer", "Tiefenvorlauf"};
+	const SimpleRasterizer::Visibility visibilities[2] = {
+		SimpleRasterizer::Visibility_DepthBuffer, SimpleRasterizer::Visibility_DepthPrepass
+	};
+
+	Material material;
+	Mesh *mesh;
+	Scene *scene = BuildBenchmarkScene(fileName, lightCount, texture, material, mesh);
+	if (scene == NULL)
+		return;
+
+	printf("%dx%d, %d frames\n", BenchmarkSize, BenchmarkSize, frames);
+
+	for (int run = 0; run < 2; run++)
+	{
+		SimpleRasterizer rasterizer;
+		rasterizer.SetShading(shading);
+		rasterizer.SetVisibility(visibilities[run]);
+		rasterizer.SetOverdrawStatistics(true);
+
+		size_t shaded = 0, covered = 0, prepass = 0;
+		double time = RunBenchmark(rasterizer, *scene, mesh, frames, true,
+			[&](const SimpleRasterizer::Statistics &statistics)
+		{
+			shaded += statistics.fragmentsWritten;
+			covered += statistics.coveredPixels;
+			prepass += statistics.prepassFragments;
+		});
+
+		printf("  %-14s %8.2f ms/frame, %8u schattiert/frame, Overdraw %.2f, %8u Tiefen/frame\n",
+			names[run], time, (unsigned int)(shaded / frames),
+			covered > 0 ? (double)shaded / covered : 0.0, (unsigned int)(prepass / frames));
+	}
+
+	delete scene;
+}
+
+/**
+ * Measures how long it takes to encode a 1920x1080 image with each method of the color
+ * encoder, and to present it in a window, with shared memory and with the pixels sent to the
+ * X server. The window needs a display, which may be a virtual one like Xvfb.
+ *
+ * @param frames The number of frames presented per run
+ */
+void BenchmarkPresentation(int frames)
+{
+	typedef std::chrono::steady_clock Clock;
+	typedef std::chrono::duration<double, std::milli> Milliseconds;
+	const int width = 1920, height = 1080;
+	const char *names[2] = {"gemeinsamer Speicher", "XPutImage"};
+
+	// A gradient covers all brightness levels of each channel.
+	Image image(width, height);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			image.SetPixel(x, y, vec3((float)x / width, (float)y / height,
+				(float)(x + y) / (width + height)));
+		}
+	}
+
+	printf("%dx%d, %d Bilder\n", width, height, frames);
+
+	const char *encoderNames[3] = {"Tabelle", "Polynom", "Dithering"};
+	std::vector<unsigned char> pixels((size_t)width * height * 4);
+	for (int run = 0; run < 3; run++)
+	{
+		ColorEncoder encoder;
+		encoder.SetMethod(run == 1 ? ColorEncoder::Method_Polynomial : ColorEncoder::Method_Table);
+		encoder.SetDithering(run == 2);
+
+		Clock::time_point start = Clock::now();
+		for (int frame = 0; frame < frames; frame++)
+			encoder.EncodeImage(image, ColorEncoder::Layout_BGRA, &pixels[0], width * 4);
+
+		double time = Milliseconds(Clock::now() - start).count();
+		printf("  %-22s %6.2f ms/Bild\n", encoderNames[run], time / frames);
+	}
+
+	for (int run = 0; run < 2; run++)
+	{
+		DisplayWindow window(width, height);
+		if (!window.ProcessMessages())
+		{
+			puts("Das Fenster konnte nicht geoeffnet werden.");
+			return;
+		}
+
+		window.SetSharedMemory(run == 0);
+		window.SetImage(&image);
+
+		// The first frame creates the buffers.
+		window.Update();
+
+		Clock::time_point start = Clock::now();
+		for (int frame = 0; frame < frames && window.ProcessMessages(); frame++)
+			window.Update();
+
+		double time = Milliseconds(Clock::now() - start).count();
+		printf("  %-22s %6.2f ms/Bild%s\n", names[run], time / frames,
+			(run == 0 && !window.IsSharedMemoryUsed() ? " (nicht verfuegbar)" : ""));
+	}
+}
+
+/**
+ * Converts a mesh file into the compressed format, including generated levels of detail.
+ *
+ * @param inputName The name of the .raw file
+ * @param outputName The name of the compressed file to write
+ * @return true if the file was converted, false otherwise
+ */
+bool CompressMesh(const char *inputName, const char *outputName)
+{
+	Mesh mesh;
+	if (inputName == NULL || !mesh.Load(inputName, true))
+		return false;
+
+	mesh.GenerateLods();
+	if (!mesh.Save(outputName))
+		return false;
+
+	MeshFile input, output;
+	input.Open(inputName);
+	output.Open(outputName);
+
+	printf("%s: %u Bytes -> %s: %u Bytes (%.1fx kleiner), %d Detailstufen\n", inputName,
+		(unsigned int)input.GetSize(), outputName, (unsigned int)output.GetSize(),
+		(double)input.GetSize() / output.GetSize(), mesh.GetLodCount());
+	return true;
+}
+
 /**
  * The main program
  */
 int main(int argc, char *argv[])
 {
-	// Set this to true to have the geometry rotate by default.
-	bool rotate = true;
+  // The defaults rotate the geometry loaded from data/kopf_subdivided.raw, see RenderOptions.
+  RenderOptions options;
+
+  // Set this to a file name to measure the mesh loading speed instead of rendering.
+  const char *benchmarkFile = NULL;
+
+  // Set this to a file name to write the mesh in the compressed format instead of rendering.
+  const char *compressFile = NULL;
+  int syntheticTriangles = 0;
+
+  // Set this to a number of frames to measure the cost of multisampling instead of rendering.
+  int benchmarkFrames = 0;
+
+  // Set this to a 24 bit BMP file, or checkerTexture to true, to texture the mesh.
+  const char *textureFile = NULL;
+  bool checkerTexture = false;
+
+  // Set this to a number of frames to measure the cost of the shadows instead of rendering.
+  int shadowBenchmarkFrames = 0;
+
+  // Set this to a number of frames to measure the overdraw with and without the depth
+  // pre-pass instead of rendering.
+  int overdrawBenchmarkFrames = 0;
 
-	// Set this to false to use just a single triangle by default, 
-  // or to true to load a more complex geometry.
-	bool loadFile = true;
+  // Set this to false to always send the frames to the X server instead of sharing memory.
+  bool sharedMemory = true;
 
-  // Set this to NULL to use just a single triangle to default,
-  // or to a filename to load a more complex geometry.
-  const char *filename = "data/kopf_subdivided.raw";
+  // Set this to a number of frames to measure the cost of presenting instead of rendering.
+  int presentBenchmarkFrames = 0;
 
-  for (int i = 1; ((i < argc) && (i < 3)); ++i)
+  // Set this to true to encode the frames with the sRGB curve instead of a gamma of 2.2, and
+  // dithering to true to hide the banding of dark gradients.
+  bool srgb = false;
+  bool dithering = false;
+
+  // Set this to a file name, or "-" for the standard output, to write the frames as a Y4M
+  // video, or as raw RGB with rawStream, instead of showing them in a window. The stream ends
+  // after streamFrames frames, 0 for no limit.
+  const char *streamFile = NULL;
+  bool rawStream = false;
+  unsigned int streamFrames = 0;
+
+  // Set profile to true to report the percentiles of the time spent on each stage of the
+  // frames, and profileFile to also write the times of all frames as CSV.
+  bool profile = false;
+  const char *profileFile = NULL;
+
+  for (int i = 1; i < argc; ++i)
   {
-    if (strcmp(argv[i], "-rotate") == 0)
-      rotate = true;
+    if (strcmp(argv[i], "-benchload") == 0 && i + 1 < argc)
+      benchmarkFile = argv[++i];
+    else if (strcmp(argv[i], "-compress") == 0 && i + 1 < argc)
+      compressFile = argv[++i];
+    else if (strcmp(argv[i], "-synthetic") == 0 && i + 1 < argc)
+      syntheticTriangles = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-lod") == 0 && i + 1 < argc)
+      options.lodDensity = (float)atof(argv[++i]);
+    else if (strcmp(argv[i], "-backface") == 0)
+      options.backfaceCulling = true;
+    else if (strcmp(argv[i], "-phong") == 0)
+      options.shading = SimpleRasterizer::Shading_Phong;
+    else if (strcmp(argv[i], "-deferred") == 0)
+      options.shading = SimpleRasterizer::Shading_Deferred;
+    else if (strcmp(argv[i], "-painter") == 0)
+      options.visibility = SimpleRasterizer::Visibility_Painter;
+    else if (strcmp(argv[i], "-prepass") == 0)
+      options.visibility = SimpleRasterizer::Visibility_DepthPrepass;
+    else if (strcmp(argv[i], "-lights") == 0 && i + 1 < argc)
+      options.lightCount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-opacity") == 0 && i + 1 < argc)
+      options.opacity = (float)atof(argv[++i]);
+    else if (strcmp(argv[i], "-msaa") == 0 && i + 1 < argc)
+      options.samples = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-benchmsaa") == 0 && i + 1 < argc)
+      benchmarkFrames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-texture") == 0 && i + 1 < argc)
+      textureFile = argv[++i];
+    else if (strcmp(argv[i], "-checker") == 0)
+      checkerTexture = true;
+    else if (strcmp(argv[i], "-shadows") == 0 && i + 1 < argc)
+      options.shadowMapSize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-benchshadows") == 0 && i + 1 < argc)
+      shadowBenchmarkFrames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-benchoverdraw") == 0 && i + 1 < argc)
+      overdrawBenchmarkFrames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc)
+      options.latency = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-fps") == 0 && i + 1 < argc)
+      options.frameRate = atof(argv[++i]);
+    else if (strcmp(argv[i], "-noshm") == 0)
+      sharedMemory = false;
+    else if (strcmp(argv[i], "-benchpresent") == 0 && i + 1 < argc)
+      presentBenchmarkFrames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-srgb") == 0)
+      srgb = true;
+    else if (strcmp(argv[i], "-dither") == 0)
+      dithering = true;
+    else if (strcmp(argv[i], "-stream") == 0 && i + 1 < argc)
+      streamFile = argv[++i];
+    else if (strcmp(argv[i], "-raw") == 0)
+      rawStream = true;
+    else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+      streamFrames = (unsigned int)atoi(argv[++i]);
+    else if (strcmp(argv[i], "-timestep") == 0 && i + 1 < argc)
+      options.timeStep = atof(argv[++i]);
+    else if (strcmp(argv[i], "-profile") == 0)
+      profile = true;
+    else if (strcmp(argv[i], "-profilecsv") == 0 && i + 1 < argc)
+    {
+      profile = true;
+      profileFile = argv[++i];
+    }
+    else if (strcmp(argv[i], "-overlay") == 0)
+      profile = options.overlay = true;
+    else if (strcmp(argv[i], "-rotate") == 0)
+      options.rotate = true;
     else if (strcmp(argv[i], "-norotate") == 0)
-      rotate = false;
+      options.rotate = false;
     else if (strcmp(argv[i], "-nogeometry") == 0)
-      filename = NULL;
+      options.filename = NULL;
     else
-      filename = argv[i];
+      options.filename = argv[i];
+  }
+
+  if (compressFile != NULL)
+  {
+    if (!CompressMesh(options.filename, compressFile))
+    {
+      printf("Die Datei %s konnte nicht geschrieben werden.\n", compressFile);
+      return 1;
+    }
+
+    return 0;
+  }
+
+  if (presentBenchmarkFrames > 0)
+  {
+    BenchmarkPresentation(presentBenchmarkFrames);
+    return 0;
+  }
+
+  if (benchmarkFile != NULL)
+  {
+    // With -synthetic, the benchmark file is created first.
+    if (syntheticTriangles > 0 && !WriteSyntheticMesh(benchmarkFile, syntheticTriangles))
+    {
+      printf("Die Datei %s konnte nicht geschrieben werden.\n", benchmarkFile);
+      return 1;
+    }
+
+    BenchmarkLoad(benchmarkFile, 3);
+    return 0;
+  }
+
+  // The texture is stored as it is in the file, assuming the usual gamma of 2.2.
+  Texture texture;
+  if (textureFile != NULL && !texture.LoadBMP(textureFile, 2.2f))
+  {
+    printf("Die Textur %s konnte nicht geladen werden.\n", textureFile);
+    return 1;
+  }
+
+  if (textureFile == NULL && checkerTexture)
+    CreateCheckerTexture(texture, 1024);
+
+  if (texture.GetLevelCount() > 0)
+    options.texture = &texture;
+
+  if (benchmarkFrames > 0)
+  {
+    BenchmarkMultisampling(options.filename, options.shading, options.lightCount,
+      benchmarkFrames, options.texture);
+    return 0;
+  }
+
+  if (shadowBenchmarkFrames > 0)
+  {
+    BenchmarkShadows(options.filename, options.shading, shadowBenchmarkFrames,
+      options.shadowMapSize > 0 ? options.shadowMapSize : 512);
+    return 0;
   }
 
-	Render(512, 512, rotate, filename);
+  if (overdrawBenchmarkFrames > 0)
+  {
+    BenchmarkOverdraw(options.filename, options.shading, options.lightCount,
+      overdrawBenchmarkFrames, options.texture);
+    return 0;
+  }
+
+  FrameProfiler profiler;
+  FrameProfiler *frameProfiler = (profile ? &profiler : NULL);
+
+  if (streamFile != NULL)
+  {
+    // Every frame is written, so the pipeline must not skip any, and streams animate at 30
+    // frames per second unless told otherwise.
+    if (options.timeStep <= 0.0)
+      options.timeStep = 1.0 / 30.0;
+    options.latency = 1;
+
+    StreamPresenter stream(512, 512);
+    stream.SetFrameCount(streamFrames);
+    if (srgb)
+      stream.GetEncoder().SetCurve(ColorEncoder::Curve_sRGB, 2.2f);
+    stream.GetEncoder().SetDithering(dithering);
+    if (!stream.Open(streamFile, rawStream ? StreamPresenter::Format_RGB :
+      StreamPresenter::Format_Y4M, 1.0 / options.timeStep))
+    {
+      fprintf(stderr, "Die Datei %s konnte nicht geoeffnet werden.\n", streamFile);
+      return 1;
+    }
+
+    Render(512, 512, options, stream, frameProfiler);
+
+    if (profile && !ReportProfile(profiler, profileFile))
+    {
+      fprintf(stderr, "Die Datei %s konnte nicht geschrieben werden.\n", profileFile);
+      return 1;
+    }
+
+    if (!stream.Close())
+    {
+      fprintf(stderr, "Die Datei %s konnte nicht geschrieben werden.\n", streamFile);
+      return 1;
+    }
+
+    return 0;
+  }
+
+	DisplayWindow window(512, 512);
+	window.SetSharedMemory(sharedMemory);
+	if (srgb)
+		window.GetEncoder().SetCurve(ColorEncoder::Curve_sRGB, 2.2f);
+	window.GetEncoder().SetDithering(dithering);
+
+	Render(512, 512, options, window, frameProfiler);
+
+	if (profile && !ReportProfile(profiler, profileFile))
+	{
+		fprintf(stderr, "Die Datei %s konnte nicht geschrieben werden.\n", profileFile);
+		return 1;
+	}
+
 	return 0;
 }